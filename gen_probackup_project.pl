@@ -160,15 +160,19 @@ sub build_pgprobackup
 		'data.c',
 		'delete.c',
 		'dir.c',
+		'export.c',
 		'fetch.c',
 		'help.c',
 		'init.c',
 		'merge.c',
 		'parsexlog.c',
 		'pg_probackup.c',
+		'progress.c',
 		'restore.c',
 		'show.c',
 		'stream.c',
+		'throttle.c',
+		'timing.c',
 		'util.c',
 		'validate.c',
 		'checkdb.c',
@@ -162,6 +162,9 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 
 	num_threads = n_threads;
 
+	progress_begin("push WAL files", parray_num(batch_files),
+				   (int64) parray_num(batch_files) * instance->xlog_seg_size);
+
 	/* Single-thread push
 	 * We don`t want to start multi-thread push, if number of threads in equal to 1,
 	 * or the number of files ready to push is small.
@@ -264,10 +267,14 @@ push_done:
 	pretty_time_interval(push_time, pretty_time_str, 20);
 
 	if (push_isok)
+	{
+		progress_finish();
+
 		/* report number of files pushed into archive */
 		elog(INFO, "pg_probackup archive-push completed successfully, "
 					"pushed: %u, skipped: %u, time elapsed: %s",
 					n_total_pushed, n_total_skipped, pretty_time_str);
+	}
 	else
 		elog(ERROR, "pg_probackup archive-push failed, "
 					"pushed: %i, skipped: %u, failed: %u, time elapsed: %s",
@@ -347,6 +354,10 @@ push_file(WALSegno *xlogfile, const char *archive_status_dir,
 								   archive_timeout);
 #endif
 
+	/* skipped file was already pushed, nothing was read */
+	progress_add_file(rc == 0 && IsXLogFileName(xlogfile->name) ?
+					  instance_config.xlog_seg_size : 0, 0);
+
 	/* take '--no-ready-rename' flag into account */
 	if (!no_ready_rename && archive_status_dir != NULL)
 	{
@@ -1730,3 +1741,81 @@ uint32 maintain_prefetch(const char *prefetch_dir, XLogSegNo first_segno, uint32
 
 	return n_files;
 }
+
+/*
+ * Summarize WAL segments in the archive of the instance, so that validation
+ * and restore to a recovery target later read only the segment which may
+ * contain the target. It's meant to be run regularly, e.g. by cron, and
+ * reads only segments archived since the previous run. See parsexlog.c for
+ * details about summaries.
+ */
+void
+do_index_wal(InstanceState *instanceState)
+{
+	parray	   *timelines;
+	size_t		i;
+	bool		failed = false;
+
+	timelines = catalog_get_timelines(instanceState, &instance_config);
+
+	if (parray_num(timelines) == 0)
+		elog(INFO, "WAL archive of instance '%s' is empty",
+			 instanceState->instance_name);
+
+	for (i = 0; i < parray_num(timelines); i++)
+	{
+		timelineInfo *tlinfo = (timelineInfo *) parray_get(timelines, i);
+		XLogSegNo	begin_segno = 0;
+		XLogSegNo	end_segno = 0;
+		uint32		n_summarized = 0;
+		uint32		n_skipped = 0;
+		size_t		j;
+
+		/*
+		 * Summarize each interval of consecutive segments, segments after
+		 * a lost one cannot be read.
+		 */
+		for (j = 0; j <= parray_num(tlinfo->xlog_filelist); j++)
+		{
+			xlogFile   *wal_file = NULL;
+
+			if (j < parray_num(tlinfo->xlog_filelist))
+			{
+				wal_file = (xlogFile *) parray_get(tlinfo->xlog_filelist, j);
+
+				if (wal_file->type != SEGMENT)
+					continue;
+
+				/* both compressed and uncompressed segment may exist */
+				if (end_segno != 0 &&
+					(wal_file->segno == end_segno ||
+					 wal_file->segno == end_segno + 1))
+				{
+					end_segno = wal_file->segno;
+					continue;
+				}
+			}
+
+			if (end_segno != 0 &&
+				!summarize_wal(instanceState->instance_wal_subdir_path,
+							   tlinfo->tli, begin_segno, end_segno,
+							   instance_config.xlog_seg_size,
+							   &n_summarized, &n_skipped))
+			{
+				elog(WARNING, "Failed to summarize WAL segments of timeline %u",
+					 tlinfo->tli);
+				failed = true;
+			}
+
+			if (wal_file)
+				begin_segno = end_segno = wal_file->segno;
+		}
+
+		elog(INFO, "Timeline %u: %u WAL segments are summarized, %u summaries are up to date",
+			 tlinfo->tli, n_summarized, n_skipped);
+	}
+
+	if (failed)
+		elog(ERROR, "Some WAL segments of instance '%s' are not summarized",
+			 instanceState->instance_name);
+}
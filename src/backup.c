@@ -20,6 +20,10 @@
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 #include "utils/thread.h"
 #include "utils/file.h"
@@ -38,12 +42,45 @@ bool exclusive_backup = false;
 /* Is pg_start_backup() was executed */
 bool backup_in_progress = false;
 
+/* PGDATA with less files is considered to be listed incorrectly */
+#define PGDATA_MIN_FILES	100
+
+/* Stream, which files are written to as they are copied, with --to-stdout */
+static ExportStream *backup_stream = NULL;
+
+/*
+ * Files to back up, which are found by directory listing running
+ * concurrently with backup_files() threads. Files are kept in binary
+ * heap by size, so the biggest known file is taken first.
+ */
+typedef struct backup_files_queue
+{
+	parray	   *files;
+	parray	   *listed;			/* all files and directories listed so far */
+	bool		started;		/* enough files are listed to start copying */
+	bool		finished;		/* listing is done, no more files will come */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	/* used by the listing callback */
+	const char *external_prefix;
+	parray	   *cfs_dirs;		/* tablespace directories with pg_compression */
+} backup_files_queue;
+
 /*
  * Backup routines
  */
 static void backup_cleanup(bool fatal, void *userdata);
 
 static void *backup_files(void *arg);
+static void backup_files_queue_put(backup_files_queue *queue, parray *files);
+static pgFile *backup_files_queue_get(backup_files_queue *queue);
+static parray *backup_files_queue_listed(backup_files_queue *queue);
+static void backup_files_enqueue_dir(pgFile *dir, parray *files, void *arg);
+static void make_backup_directories(parray *files, const char *external_prefix);
+static void backup_stream_file(pgFile *file, const char *to_fullpath);
+static void dedup_backup_file(pgFile *file, const char *to_fullpath,
+							  parray *dedup_filelist, const char *dedup_root);
 
 static void do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 						 PGNodeInfo *nodeInfo, bool no_sync, bool backup_logs);
@@ -104,10 +141,19 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 
 	pgBackup   *prev_backup = NULL;
 	parray	   *prev_backup_filelist = NULL;
+	pgBackup   *dedup_backup = NULL;
+	parray	   *dedup_filelist = NULL;
 	parray	   *backup_list = NULL;
 	parray	   *external_dirs = NULL;
 	parray	   *database_map = NULL;
 
+	/* list PGDATA concurrently with copying of files */
+	bool		concurrent_listing;
+	backup_files_queue files_queue;
+
+	/* files added to the list after transfer are streamed at the end */
+	size_t		n_transferred = 0;
+
 	/* used for multitimeline incremental backup */
 	parray       *tli_list = NULL;
 
@@ -204,6 +250,39 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		write_backup(&current, true);
 	}
 
+	/*
+	 * FULL backup with --dedup shares files, which didn`t changed since
+	 * the latest valid FULL backup, instead of storing its own copies.
+	 */
+	if (backup_dedup && current.backup_mode == BACKUP_MODE_FULL)
+	{
+		backup_list = catalog_get_backup_list(instanceState, INVALID_BACKUP_ID);
+
+		for (i = 0; i < parray_num(backup_list); i++)
+		{
+			pgBackup   *backup = (pgBackup *) parray_get(backup_list, i);
+
+			if (backup->backup_mode == BACKUP_MODE_FULL &&
+				(backup->status == BACKUP_STATUS_OK ||
+				 backup->status == BACKUP_STATUS_DONE) &&
+				parse_program_version(backup->program_version) >= 20400 &&
+				parse_program_version(backup->program_version) <= parse_program_version(PROGRAM_VERSION))
+			{
+				dedup_backup = backup;
+				break;
+			}
+		}
+
+		if (dedup_backup)
+		{
+			elog(INFO, "Deduplicate files with backup %s", base36enc(dedup_backup->start_time));
+			dedup_filelist = get_backup_filelist(dedup_backup, true);
+			parray_qsort(dedup_filelist, pgFileCompareRelPathWithExternal);
+		}
+		else
+			elog(WARNING, "Valid full backup to deduplicate files with is not found");
+	}
+
 	/*
 	 * It`s illegal to take PTRACK backup if LSN from ptrack_control() is not
 	 * equal to start_lsn of previous backup.
@@ -238,6 +317,16 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	/* Update running backup meta with START LSN */
 	write_backup(&current, true);
 
+	/*
+	 * Metadata goes first in the stream, it is replaced by the final one
+	 * at the end of backup.
+	 */
+	if (backup_to_stdout)
+	{
+		backup_stream = export_stream_open(stdout);
+		export_stream_control(backup_stream, current.root_dir);
+	}
+
 	/* In PAGE mode or in ARCHIVE wal-mode wait for current segment */
 	if (current.backup_mode == BACKUP_MODE_DIFF_PAGE || !current.stream)
 	{
@@ -276,9 +365,26 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	backup_files_list = parray_new();
 	join_path_components(external_prefix, current.root_dir, EXTERNAL_DIR);
 
+	/* PTRACK maps are fetched on a separate connection while PGDATA is listed */
+	if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
+		pg_ptrack_start_pagemapset_fetch(&instance_config.conn_opt,
+										 nodeInfo->ptrack_schema,
+										 nodeInfo->ptrack_version_num,
+										 prev_backup_start_lsn);
+
+	/*
+	 * FULL and DELTA backups don't need the whole list of files to start
+	 * copying, so local PGDATA is listed while files are being copied.
+	 * PAGE and PTRACK backups need the list to build pagemap first.
+	 */
+	concurrent_listing = !fio_is_remote(FIO_DB_HOST) &&
+		(current.backup_mode == BACKUP_MODE_FULL ||
+		 current.backup_mode == BACKUP_MODE_DIFF_DELTA);
+
 	/* list files with the logical path. omit $PGDATA */
-	fio_list_dir(backup_files_list, instance_config.pgdata,
-				 true, true, false, backup_logs, true, 0);
+	if (!concurrent_listing)
+		fio_list_dir(backup_files_list, instance_config.pgdata,
+					 true, true, false, backup_logs, true, 0);
 
 	/*
 	 * Get database_map (name to oid) for use in partial restore feature.
@@ -308,11 +414,15 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	/* close ssh session in main thread */
 	fio_disconnect();
 
+	/* PGDATA is not listed yet, its files are handled as they are found */
+	if (concurrent_listing)
+		goto start_transfer;
+
 	/* Sanity check for backup_files_list, thank you, Windows:
 	 * https://github.com/postgrespro/pg_probackup/issues/48
 	 */
 
-	if (parray_num(backup_files_list) < 100)
+	if (parray_num(backup_files_list) < PGDATA_MIN_FILES)
 		elog(ERROR, "PGDATA is almost empty. Either it was concurrently deleted or "
 			"pg_probackup do not possess sufficient permissions to list PGDATA content");
 
@@ -352,8 +462,10 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
 	{
 		bool pagemap_isok = true;
+		uint64 pagemap_start;
 
 		time(&start_time);
+		TIMING_START(pagemap_start);
 		elog(INFO, "Extracting pagemap of changed blocks");
 
 		if (current.backup_mode == BACKUP_MODE_DIFF_PAGE)
@@ -380,6 +492,7 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		}
 
 		time(&end_time);
+		TIMING_STOP(TIMING_PAGEMAP, pagemap_start);
 
 		/* TODO: add ms precision */
 		if (pagemap_isok)
@@ -393,36 +506,15 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	/*
 	 * Make directories before backup
 	 */
-	for (i = 0; i < parray_num(backup_files_list); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(backup_files_list, i);
-
-		/* if the entry was a directory, create it in the backup */
-		if (S_ISDIR(file->mode))
-		{
-			char		dirpath[MAXPGPATH];
-
-			if (file->external_dir_num)
-			{
-				char		temp[MAXPGPATH];
-				snprintf(temp, MAXPGPATH, "%s%d", external_prefix,
-						 file->external_dir_num);
-				join_path_components(dirpath, temp, file->rel_path);
-			}
-			else
-				join_path_components(dirpath, current.database_dir, file->rel_path);
-
-			elog(VERBOSE, "Create directory '%s'", dirpath);
-			fio_mkdir(dirpath, DIR_PERMISSION, FIO_BACKUP_HOST);
-		}
-
-	}
+	make_backup_directories(backup_files_list, external_prefix);
 
 	/* setup thread locks */
 	pfilearray_clear_locks(backup_files_list);
 
 	/* Sort by size for load balancing */
 	parray_qsort(backup_files_list, pgFileCompareSize);
+
+start_transfer:
 	/* Sort the array for binary search */
 	if (prev_backup_filelist)
 		parray_qsort(prev_backup_filelist, pgFileCompareRelPathWithExternal);
@@ -432,6 +524,28 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 						  instance_config.pgdata, external_dirs, true);
 	write_backup(&current, true);
 
+	/* in case of concurrent listing total is accounted by the queue */
+	if (concurrent_listing)
+		progress_begin("backup files", 0, 0);
+	else
+		progress_begin_files("backup files", backup_files_list);
+
+	/* external directories are already listed, they go first */
+	if (concurrent_listing)
+	{
+		files_queue.files = parray_new();
+		files_queue.listed = parray_new();
+		files_queue.started = false;
+		files_queue.finished = false;
+		pthread_mutex_init(&files_queue.lock, NULL);
+		pthread_cond_init(&files_queue.cond, NULL);
+		files_queue.external_prefix = external_prefix;
+		files_queue.cfs_dirs = parray_new();
+
+		make_backup_directories(backup_files_list, external_prefix);
+		backup_files_queue_put(&files_queue, backup_files_list);
+	}
+
 	/* Init backup page header map */
 	init_header_map(&current);
 
@@ -451,7 +565,10 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		arg->files_list = backup_files_list;
 		arg->prev_filelist = prev_backup_filelist;
 		arg->prev_start_lsn = prev_backup_start_lsn;
+		arg->dedup_filelist = dedup_filelist;
+		arg->dedup_root = dedup_backup ? dedup_backup->database_dir : NULL;
 		arg->hdr_map = &(current.hdr_map);
+		arg->files_queue = concurrent_listing ? &files_queue : NULL;
 		arg->thread_num = i+1;
 		/* By default there are some error */
 		arg->ret = 1;
@@ -469,6 +586,33 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		pthread_create(&threads[i], NULL, backup_files, arg);
 	}
 
+	/* Feed threads with files as they are found */
+	if (concurrent_listing)
+	{
+		parray	   *pgdata_files = parray_new();
+
+		dir_list_file_parallel(pgdata_files, instance_config.pgdata, true, true,
+							   false, backup_logs, true, 0, num_threads,
+							   backup_files_enqueue_dir, &files_queue);
+
+		/*
+		 * Sanity check, see above. Threads don't get any file until
+		 * PGDATA_MIN_FILES are listed, so nothing is copied yet, if
+		 * there are less of them.
+		 */
+		if (parray_num(files_queue.listed) < PGDATA_MIN_FILES)
+			elog(ERROR, "PGDATA is almost empty. Either it was concurrently deleted or "
+				"pg_probackup do not possess sufficient permissions to list PGDATA content");
+
+		pthread_lock(&files_queue.lock);
+		files_queue.finished = true;
+		pthread_cond_broadcast(&files_queue.cond);
+		pthread_mutex_unlock(&files_queue.lock);
+
+		parray_concat(backup_files_list, pgdata_files);
+		parray_free(pgdata_files);
+	}
+
 	/* Wait threads */
 	for (i = 0; i < num_threads; i++)
 	{
@@ -476,6 +620,21 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		if (threads_args[i].ret == 1)
 			backup_isok = false;
 	}
+	n_transferred = parray_num(backup_files_list);
+
+	if (concurrent_listing)
+	{
+		current.pgdata_bytes += calculate_datasize_of_filelist(backup_files_list);
+		pretty_size(current.pgdata_bytes, pretty_bytes, lengthof(pretty_bytes));
+		elog(INFO, "PGDATA size: %s", pretty_bytes);
+
+		parray_walk(files_queue.cfs_dirs, pfree);
+		parray_free(files_queue.cfs_dirs);
+		parray_free(files_queue.files);
+		parray_free(files_queue.listed);
+		pthread_mutex_destroy(&files_queue.lock);
+		pthread_cond_destroy(&files_queue.cond);
+	}
 
 	time(&end_time);
 	pretty_time_interval(difftime(end_time, start_time),
@@ -494,6 +653,12 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		parray_free(prev_backup_filelist);
 	}
 
+	if (dedup_filelist)
+	{
+		parray_walk(dedup_filelist, pgFileFree);
+		parray_free(dedup_filelist);
+	}
+
 	/* Notify end of backup */
 	pg_stop_backup(instanceState, &current, backup_conn, nodeInfo);
 
@@ -555,8 +720,32 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	/* update backup control file to update size info */
 	write_backup(&current, true);
 
+	/*
+	 * Files created after transfer of data files and pg_control, which
+	 * may be modified after copying, are written to the stream the last.
+	 * Files of the stream are not kept, so there is nothing to sync.
+	 */
+	if (backup_stream)
+	{
+		for (i = 0; i < parray_num(backup_files_list); i++)
+		{
+			char    to_fullpath[MAXPGPATH];
+			pgFile *file = (pgFile *) parray_get(backup_files_list, i);
+
+			if (S_ISDIR(file->mode))
+				continue;
+
+			if (i < n_transferred &&
+				!(file->external_dir_num == 0 &&
+				  strcmp(file->rel_path, XLOG_CONTROL_FILE) == 0))
+				continue;
+
+			join_path_components(to_fullpath, current.database_dir, file->rel_path);
+			export_stream_file(backup_stream, file, to_fullpath);
+		}
+	}
 	/* Sync all copied files unless '--no-sync' flag is used */
-	if (no_sync)
+	else if (no_sync)
 		elog(WARNING, "Backup files are not synced to disk");
 	else
 	{
@@ -704,6 +893,24 @@ do_backup(InstanceState *instanceState, pgSetBackupParams *set_backup_params,
 	/* Initialize PGInfonode */
 	pgNodeInit(&nodeInfo);
 
+	/* Backup written to stdout is not kept in the catalog */
+	if (backup_to_stdout)
+	{
+		if (current.backup_mode != BACKUP_MODE_FULL)
+			elog(ERROR, "Only FULL backup can be written to stdout");
+
+		if (backup_dedup)
+			elog(ERROR, "You cannot specify \"--dedup\" and \"--to-stdout\" options together");
+
+		if (delete_expired || merge_expired || delete_wal ||
+			(set_backup_params &&
+			 (set_backup_params->ttl > 0 || set_backup_params->expire_time > 0)))
+			elog(ERROR, "Retention and pinning options cannot be used with \"--to-stdout\" option");
+
+		if (isatty(fileno(stdout)))
+			elog(ERROR, "Refuse to write backup stream to terminal, redirect stdout");
+	}
+
 	/* Save list of external directories */
 	if (instance_config.external_dir_str &&
 		(pg_strcasecmp(instance_config.external_dir_str, "none") != 0))
@@ -819,6 +1026,7 @@ do_backup(InstanceState *instanceState, pgSetBackupParams *set_backup_params,
 	/* Backup is done. Update backup status */
 	current.end_time = time(NULL);
 	current.status = BACKUP_STATUS_DONE;
+	current.timing = timing_to_json();
 	write_backup(&current, true);
 
 	/* Pin backup if requested */
@@ -829,9 +1037,12 @@ do_backup(InstanceState *instanceState, pgSetBackupParams *set_backup_params,
 		pin_backup(&current, set_backup_params);
 	}
 
-	if (!no_validate)
+	/* files of the stream are already removed */
+	if (!no_validate && !backup_stream)
 		pgBackupValidate(&current, NULL);
 
+	progress_finish();
+
 	/* Notify user about backup size */
 	if (current.stream)
 		pretty_size(current.data_bytes + current.wal_bytes, pretty_bytes, lengthof(pretty_bytes));
@@ -845,6 +1056,22 @@ do_backup(InstanceState *instanceState, pgSetBackupParams *set_backup_params,
 	else
 		elog(ERROR, "Backup %s failed", base36enc(current.start_time));
 
+	/* finish the stream with final metadata and remove what is left of backup */
+	if (backup_stream)
+	{
+		uint64		stream_size;
+
+		export_stream_control(backup_stream, current.root_dir);
+		stream_size = export_stream_close(backup_stream);
+		backup_stream = NULL;
+
+		pretty_size(stream_size, pretty_bytes, lengthof(pretty_bytes));
+		elog(INFO, "Backup %s is written to stdout, stream size: %s",
+			 base36enc(current.start_time), pretty_bytes);
+
+		delete_backup_files(&current);
+	}
+
 	/*
 	 * After successful backup completion remove backups
 	 * which are expired according to retention policies
@@ -1206,6 +1433,43 @@ pg_is_superuser(PGconn *conn)
 	return false;
 }
 
+/*
+ * Sleep until WAL we are waiting for may have arrived: until the streaming
+ * thread receives 'target_lsn', until a file is written or moved into the
+ * watched archive directory, but no longer than --wal-poll-interval.
+ */
+static void
+wait_wal_arrival(int watch_fd, bool in_stream_dir, XLogRecPtr target_lsn)
+{
+	if (in_stream_dir)
+	{
+		wait_WAL_streamed(target_lsn, wal_poll_interval);
+		return;
+	}
+
+#ifdef __linux__
+	if (watch_fd >= 0)
+	{
+		struct pollfd pfd;
+
+		pfd.fd = watch_fd;
+		pfd.events = POLLIN;
+
+		if (poll(&pfd, 1, wal_poll_interval) > 0)
+		{
+			char		buf[4096];
+
+			/* events are used only to wake up, throw them away */
+			while (read(watch_fd, buf, sizeof(buf)) > 0)
+				;
+		}
+		return;
+	}
+#endif
+
+	pg_usleep(wal_poll_interval * 1000L);
+}
+
 /*
  * Wait for target LSN or WAL segment, containing target LSN.
  *
@@ -1231,17 +1495,22 @@ pg_is_superuser(PGconn *conn)
  * Returns target LSN if such is found, failing that returns LSN of record prior to target LSN.
  * Returns InvalidXLogRecPtr if 'segment_only' flag is used.
  */
-XLogRecPtr
-wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_lsn, TimeLineID tli,
-			 bool in_prev_segment, bool segment_only,
-			 int timeout_elevel, bool in_stream_dir)
+static XLogRecPtr
+wait_wal_lsn_internal(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_lsn,
+					  TimeLineID tli, bool in_prev_segment, bool segment_only,
+					  int timeout_elevel, bool in_stream_dir)
 {
 	XLogSegNo	targetSegNo;
 	char		wal_segment_path[MAXPGPATH],
 				wal_segment[MAXFNAMELEN];
 	bool		file_exists = false;
-	uint32		try_count = 0,
-				timeout;
+	uint32		timeout;
+	uint32		elapsed = 0;
+	uint64		wait_start = timing_now();
+	bool		wait_reported = false;
+	bool		archive_warned = false;
+	int			watch_fd = -1;
+	XLogRecPtr	result = InvalidXLogRecPtr;
 	char		*wal_delivery_str = in_stream_dir ? "streamed":"archived";
 
 #ifdef HAVE_LIBZ
@@ -1281,6 +1550,26 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 			 wal_segment_path);
 #endif
 
+#ifdef __linux__
+	/*
+	 * Watch local archive directory to notice new WAL files at once. Remote
+	 * directories and other platforms are polled.
+	 */
+	if (!in_stream_dir && !fio_is_remote(FIO_BACKUP_HOST))
+	{
+		watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (watch_fd >= 0 &&
+			inotify_add_watch(watch_fd, wal_segment_dir,
+							  IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+		{
+			elog(VERBOSE, "Cannot watch directory \"%s\": %s",
+				 wal_segment_dir, strerror(errno));
+			close(watch_fd);
+			watch_fd = -1;
+		}
+	}
+#endif
+
 	/* Wait until target LSN is archived or streamed */
 	while (true)
 	{
@@ -1305,7 +1594,7 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 		{
 			/* Do not check for target LSN */
 			if (segment_only)
-				return InvalidXLogRecPtr;
+				break;
 
 			/*
 			 * A WAL segment found. Look for target LSN in it.
@@ -1316,7 +1605,8 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 				/* Target LSN was found */
 			{
 				elog(LOG, "Found LSN: %X/%X", (uint32) (target_lsn >> 32), (uint32) target_lsn);
-				return target_lsn;
+				result = target_lsn;
+				break;
 			}
 
 			/*
@@ -1334,7 +1624,7 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 			 *  for previous record which endpoint points greater or equal LSN in previous WAL segment.
 			 */
 			if (current.from_replica &&
-				(XRecOffIsNull(target_lsn) || try_count > timeout / 2))
+				(XRecOffIsNull(target_lsn) || elapsed > timeout / 2))
 			{
 				XLogRecPtr	res;
 
@@ -1346,19 +1636,22 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 					/* LSN of the prior record was found */
 					elog(LOG, "Found prior LSN: %X/%X",
 						 (uint32) (res >> 32), (uint32) res);
-					return res;
+					result = res;
+					break;
 				}
 			}
 		}
 
-		sleep(1);
+		wait_wal_arrival(watch_fd, in_stream_dir, target_lsn);
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during waiting for WAL %s", in_stream_dir ? "streaming" : "archiving");
-		try_count++;
+		elapsed = (timing_now() - wait_start) / 1000000000;
 
 		/* Inform user if WAL segment is absent in first attempt */
-		if (try_count == 1)
+		if (!wait_reported)
 		{
+			wait_reported = true;
+
 			if (segment_only)
 				elog(INFO, "Wait for WAL segment %s to be %s",
 					 wal_segment_path, wal_delivery_str);
@@ -1368,12 +1661,15 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 					 wal_delivery_str, wal_segment_path);
 		}
 
-		if (!current.stream && is_start_lsn && try_count == 30)
+		if (!current.stream && is_start_lsn && elapsed >= 30 && !archive_warned)
+		{
+			archive_warned = true;
 			elog(WARNING, "By default pg_probackup assume WAL delivery method to be ARCHIVE. "
 				 "If continuous archiving is not set up, use '--stream' option to make autonomous backup. "
 				 "Otherwise check that continuous archiving works correctly.");
+		}
 
-		if (timeout > 0 && try_count > timeout)
+		if (timeout > 0 && elapsed >= timeout)
 		{
 			if (file_exists)
 				elog(timeout_elevel, "WAL segment %s was %s, "
@@ -1387,9 +1683,31 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 					 "WAL segment %s could not be %s in %d seconds",
 					 wal_segment, wal_delivery_str, timeout);
 
-			return InvalidXLogRecPtr;
+			break;
 		}
 	}
+
+	if (watch_fd >= 0)
+		close(watch_fd);
+
+	return result;
+}
+
+XLogRecPtr
+wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_lsn, TimeLineID tli,
+			 bool in_prev_segment, bool segment_only,
+			 int timeout_elevel, bool in_stream_dir)
+{
+	XLogRecPtr	result;
+	uint64		start;
+
+	TIMING_START(start);
+	result = wait_wal_lsn_internal(wal_segment_dir, target_lsn, is_start_lsn, tli,
+								   in_prev_segment, segment_only,
+								   timeout_elevel, in_stream_dir);
+	TIMING_STOP(TIMING_WAIT_WAL, start);
+
+	return result;
 }
 
 /*
@@ -1962,11 +2280,23 @@ backup_files(void *arg)
 	prev_time = current.start_time;
 
 	/* backup a file */
-	for (i = 0; i < n_backup_files_list; i++)
+	for (i = 0; ; i++)
 	{
-		pgFile	*file = (pgFile *) parray_get(arguments->files_list, i);
+		pgFile	*file;
 		pgFile	*prev_file = NULL;
 
+		/* take the next file from the queue, while it is being filled */
+		if (arguments->files_queue)
+		{
+			file = backup_files_queue_get(arguments->files_queue);
+			if (file == NULL)
+				break;
+		}
+		else if (i < n_backup_files_list)
+			file = (pgFile *) parray_get(arguments->files_list, i);
+		else
+			break;
+
 		/* We have already copied all directories */
 		if (S_ISDIR(file->mode))
 			continue;
@@ -1976,8 +2306,18 @@ backup_files(void *arg)
 			/* update backup_content.control every 60 seconds */
 			if ((difftime(time(NULL), prev_time)) > 60)
 			{
-				write_backup_filelist(&current, arguments->files_list, arguments->from_root,
-									  arguments->external_dirs, false);
+				/* in case of the queue write files listed so far */
+				if (arguments->files_queue)
+				{
+					parray	   *listed = backup_files_queue_listed(arguments->files_queue);
+
+					write_backup_filelist(&current, listed, arguments->from_root,
+										  arguments->external_dirs, false);
+					parray_free(listed);
+				}
+				else
+					write_backup_filelist(&current, arguments->files_list, arguments->from_root,
+										  arguments->external_dirs, false);
 				/* update backup control file to update size info */
 				write_backup(&current, true);
 
@@ -1985,7 +2325,7 @@ backup_files(void *arg)
 			}
 		}
 
-		if (!pg_atomic_test_set_flag(&file->lock))
+		if (!arguments->files_queue && !pg_atomic_test_set_flag(&file->lock))
 			continue;
 
 		/* check for interrupt */
@@ -1993,14 +2333,12 @@ backup_files(void *arg)
 			elog(ERROR, "interrupted during backup");
 
 		if (progress)
-			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
-				 i + 1, n_backup_files_list, file->rel_path);
-
-		/* Handle zero sized files */
-		if (file->size == 0)
 		{
-			file->write_size = 0;
-			continue;
+			if (arguments->files_queue)
+				elog(INFO, "Progress: Process file \"%s\"", file->rel_path);
+			else
+				elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
+					 i + 1, n_backup_files_list, file->rel_path);
 		}
 
 		/* construct destination filepath */
@@ -2023,6 +2361,16 @@ backup_files(void *arg)
 			join_path_components(from_fullpath, external_path, file->rel_path);
 		}
 
+		/* Handle zero sized files */
+		if (file->size == 0)
+		{
+			file->write_size = 0;
+			progress_file_done(file);
+			if (backup_stream)
+				backup_stream_file(file, to_fullpath);
+			continue;
+		}
+
 		/* Encountered some strange beast */
 		if (!S_ISREG(file->mode))
 			elog(WARNING, "Unexpected type %d of file \"%s\", skipping",
@@ -2059,6 +2407,8 @@ backup_files(void *arg)
 								 current.backup_mode, current.parent_backup, true);
 		}
 
+		progress_file_done(file);
+
 		if (file->write_size == FILE_NOT_FOUND)
 			continue;
 
@@ -2070,6 +2420,13 @@ backup_files(void *arg)
 
 		elog(VERBOSE, "File \"%s\". Copied "INT64_FORMAT " bytes",
 						from_fullpath, file->write_size);
+
+		if (arguments->dedup_filelist && file->write_size > 0)
+			dedup_backup_file(file, to_fullpath, arguments->dedup_filelist,
+							  arguments->dedup_root);
+
+		if (backup_stream)
+			backup_stream_file(file, to_fullpath);
 	}
 
 	/* ssh connection to longer needed */
@@ -2081,6 +2438,378 @@ backup_files(void *arg)
 	return NULL;
 }
 
+/*
+ * Replace just copied file with a hardlink to the same file in older backup,
+ * if their content is identical, so unchanged files are stored only once.
+ * Every backup owns its own link to the file, so deleting or merging one
+ * of them doesn`t affect others: merge never modifies files in place.
+ * CRC and sizes are used only to find candidates, the final decision is
+ * made by comparing content of the files.
+ */
+static void
+dedup_backup_file(pgFile *file, const char *to_fullpath,
+				  parray *dedup_filelist, const char *dedup_root)
+{
+	pgFile	  **res_file = NULL;
+	pgFile	   *dedup_file = NULL;
+	char		dedup_fullpath[MAXPGPATH];
+	char		to_fullpath_tmp[MAXPGPATH];
+	struct stat	st_dedup;
+	struct stat	st_link;
+	char	   *buf1 = NULL;
+	char	   *buf2 = NULL;
+	int			fd1 = -1;
+	int			fd2 = -1;
+	bool		identical = false;
+
+	/* external directories of two backups can be numbered differently */
+	if (file->external_dir_num != 0)
+		return;
+
+	if (strcmp(file->rel_path, XLOG_CONTROL_FILE) == 0)
+		return;
+
+	res_file = parray_bsearch(dedup_filelist, file, pgFileCompareRelPathWithExternal);
+	dedup_file = (res_file) ? *res_file : NULL;
+
+	if (!dedup_file ||
+		dedup_file->write_size != file->write_size ||
+		dedup_file->crc != file->crc)
+		return;
+
+	if (file->is_datafile && !file->is_cfs &&
+		(dedup_file->compress_alg != file->compress_alg ||
+		 dedup_file->n_headers != file->n_headers ||
+		 dedup_file->hdr_crc != file->hdr_crc))
+		return;
+
+	join_path_components(dedup_fullpath, dedup_root, file->rel_path);
+
+	fd1 = open(dedup_fullpath, O_RDONLY | PG_BINARY, 0);
+	fd2 = open(to_fullpath, O_RDONLY | PG_BINARY, 0);
+	if (fd1 < 0 || fd2 < 0 || fstat(fd1, &st_dedup) != 0)
+		goto cleanup;
+
+	buf1 = pgut_malloc(STDIO_BUFSIZE);
+	buf2 = pgut_malloc(STDIO_BUFSIZE);
+
+	for (;;)
+	{
+		ssize_t		rc1 = read(fd1, buf1, STDIO_BUFSIZE);
+		ssize_t		rc2 = read(fd2, buf2, STDIO_BUFSIZE);
+
+		if (rc1 < 0 || rc2 < 0 || rc1 != rc2 ||
+			memcmp(buf1, buf2, rc1) != 0)
+			goto cleanup;
+
+		if (rc1 == 0)
+			break;
+	}
+	identical = true;
+
+	snprintf(to_fullpath_tmp, MAXPGPATH, "%s_dedup", to_fullpath);
+
+	if (link(dedup_fullpath, to_fullpath_tmp) != 0)
+	{
+		elog(LOG, "Cannot create hard link \"%s\" to \"%s\": %s",
+			 to_fullpath_tmp, dedup_fullpath, strerror(errno));
+		goto cleanup;
+	}
+
+	/* file of old backup could be replaced by merge after comparison */
+	if (stat(to_fullpath_tmp, &st_link) != 0 ||
+		st_link.st_dev != st_dedup.st_dev ||
+		st_link.st_ino != st_dedup.st_ino)
+	{
+		unlink(to_fullpath_tmp);
+		goto cleanup;
+	}
+
+	if (rename(to_fullpath_tmp, to_fullpath) == -1)
+		elog(ERROR, "Could not rename file \"%s\" to \"%s\": %s",
+			 to_fullpath_tmp, to_fullpath, strerror(errno));
+
+	elog(VERBOSE, "File \"%s\" is deduplicated with \"%s\"",
+		 to_fullpath, dedup_fullpath);
+
+cleanup:
+	if (!identical)
+		elog(VERBOSE, "File \"%s\" differs from \"%s\", keep it",
+			 to_fullpath, dedup_fullpath);
+
+	if (fd1 >= 0)
+		close(fd1);
+	if (fd2 >= 0)
+		close(fd2);
+	pg_free(buf1);
+	pg_free(buf2);
+}
+
+/* Create directories from the list in the backup */
+static void
+make_backup_directories(parray *files, const char *external_prefix)
+{
+	int			i;
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		/* if the entry was a directory, create it in the backup */
+		if (S_ISDIR(file->mode))
+		{
+			char		dirpath[MAXPGPATH];
+
+			if (file->external_dir_num)
+			{
+				char		temp[MAXPGPATH];
+				snprintf(temp, MAXPGPATH, "%s%d", external_prefix,
+						 file->external_dir_num);
+				join_path_components(dirpath, temp, file->rel_path);
+			}
+			else
+				join_path_components(dirpath, current.database_dir, file->rel_path);
+
+			elog(VERBOSE, "Create directory '%s'", dirpath);
+			fio_mkdir(dirpath, DIR_PERMISSION, FIO_BACKUP_HOST);
+
+			/* directory must precede its files in the stream */
+			if (backup_stream)
+			{
+				char		parent_dir[MAXPGPATH];
+				char		linked[MAXPGPATH];
+				bool		is_link = false;
+
+				/* tablespace directory carries the target of its link */
+				strncpy(parent_dir, file->rel_path, MAXPGPATH);
+				get_parent_directory(parent_dir);
+
+				if (file->external_dir_num == 0 &&
+					strcmp(parent_dir, PG_TBLSPC_DIR) == 0)
+				{
+					char		from_fullpath[MAXPGPATH];
+
+					join_path_components(from_fullpath, instance_config.pgdata,
+										 file->rel_path);
+					is_link = fio_readlink(from_fullpath, linked, sizeof(linked) - 1,
+										   FIO_DB_HOST) > 0;
+				}
+
+				export_stream_dir(backup_stream, file, is_link ? linked : NULL);
+			}
+		}
+	}
+}
+
+/*
+ * Write just copied file into the backup stream and remove it from the
+ * backup directory. pg_control is kept until the end of backup, as it
+ * may be modified after copying, see set_min_recovery_point().
+ */
+static void
+backup_stream_file(pgFile *file, const char *to_fullpath)
+{
+	if (file->external_dir_num == 0 &&
+		strcmp(file->rel_path, XLOG_CONTROL_FILE) == 0)
+		return;
+
+	export_stream_file(backup_stream, file, to_fullpath);
+
+	if (unlink(to_fullpath) != 0 && errno != ENOENT)
+		elog(ERROR, "Cannot remove file \"%s\": %s", to_fullpath, strerror(errno));
+}
+
+/*
+ * Callback of concurrent PGDATA listing, called for the content of every
+ * directory before its subdirectories are listed. It does the same as
+ * done for the whole list otherwise: skips files of unlogged relations,
+ * marks files of cfs tablespaces, creates directories in the backup.
+ * Regular files are passed to backup_files() threads.
+ */
+static void
+backup_files_enqueue_dir(pgFile *dir, parray *files, void *arg)
+{
+	backup_files_queue *queue = (backup_files_queue *) arg;
+	bool		is_cfs = false;
+	int			i;
+
+	/* files of the same relation must be next to each other */
+	parray_qsort(files, pgFileCompareRelPathWithExternal);
+	parse_filelist_filenames(files, instance_config.pgdata);
+
+	pthread_lock(&queue->lock);
+
+	/*
+	 * pg_compression is located in the tablespace version directory,
+	 * which is always listed before directories of databases.
+	 */
+	for (i = 0; i < parray_num(queue->cfs_dirs); i++)
+	{
+		if (path_is_prefix_of_path((char *) parray_get(queue->cfs_dirs, i),
+								   dir->rel_path))
+		{
+			is_cfs = true;
+			break;
+		}
+	}
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (S_ISREG(file->mode) && strcmp(file->name, "pg_compression") == 0 &&
+			path_is_prefix_of_path(PG_TBLSPC_DIR, file->rel_path))
+		{
+			elog(VERBOSE, "CFS DIRECTORY %s", dir->rel_path);
+			parray_append(queue->cfs_dirs, pgut_strdup(dir->rel_path));
+		}
+
+		if (is_cfs && S_ISREG(file->mode) && file->is_datafile)
+			file->is_cfs = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	make_backup_directories(files, queue->external_prefix);
+	backup_files_queue_put(queue, files);
+}
+
+/*
+ * Add regular files from the array to the queue.
+ * Queue is a binary heap with the biggest file on top.
+ */
+static void
+backup_files_queue_put(backup_files_queue *queue, parray *files)
+{
+	int			i;
+
+	pthread_lock(&queue->lock);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		size_t		pos = parray_num(queue->files);
+
+		parray_append(queue->listed, file);
+
+		if (!S_ISREG(file->mode))
+			continue;
+
+		parray_append(queue->files, file);
+		progress_add_total(1, file->size);
+
+		/* sift up */
+		while (pos > 0)
+		{
+			size_t		parent = (pos - 1) / 2;
+			pgFile	   *parent_file = (pgFile *) parray_get(queue->files, parent);
+
+			if (parent_file->size >= file->size)
+				break;
+
+			parray_set(queue->files, pos, parent_file);
+			pos = parent;
+		}
+		parray_set(queue->files, pos, file);
+	}
+
+	progress_set_queue_depth(parray_num(queue->files));
+
+	if (parray_num(queue->listed) >= PGDATA_MIN_FILES)
+		queue->started = true;
+
+	pthread_cond_broadcast(&queue->cond);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * Take the biggest file from the queue, wait for it if the queue is empty.
+ * Files are not given out until enough of them are listed to pass the
+ * sanity check of PGDATA.
+ * Return NULL when listing is finished and all files are taken.
+ */
+static pgFile *
+backup_files_queue_get(backup_files_queue *queue)
+{
+	pgFile	   *result;
+	pgFile	   *last;
+	size_t		n;
+	size_t		pos = 0;
+
+	pthread_lock(&queue->lock);
+
+	while ((parray_num(queue->files) == 0 || !queue->started) && !queue->finished)
+	{
+		struct timespec	timeout;
+
+		/* listing may fail, don't wait for it forever */
+		if (interrupted || thread_interrupted)
+		{
+			pthread_mutex_unlock(&queue->lock);
+			elog(ERROR, "interrupted during backup");
+		}
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += 1;
+		pthread_cond_timedwait(&queue->cond, &queue->lock, &timeout);
+	}
+
+	if (parray_num(queue->files) == 0 || !queue->started)
+	{
+		pthread_mutex_unlock(&queue->lock);
+		return NULL;
+	}
+
+	result = (pgFile *) parray_get(queue->files, 0);
+	last = (pgFile *) parray_remove(queue->files, parray_num(queue->files) - 1);
+	n = parray_num(queue->files);
+
+	/* sift down the last element from the top */
+	while (n > 0)
+	{
+		size_t		child = 2 * pos + 1;
+		pgFile	   *child_file;
+
+		if (child >= n)
+			break;
+
+		child_file = (pgFile *) parray_get(queue->files, child);
+		if (child + 1 < n &&
+			((pgFile *) parray_get(queue->files, child + 1))->size > child_file->size)
+		{
+			child++;
+			child_file = (pgFile *) parray_get(queue->files, child);
+		}
+
+		if (last->size >= child_file->size)
+			break;
+
+		parray_set(queue->files, pos, child_file);
+		pos = child;
+	}
+	if (n > 0)
+		parray_set(queue->files, pos, last);
+
+	progress_set_queue_depth(n);
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return result;
+}
+
+/* Return a copy of the list of files and directories listed so far */
+static parray *
+backup_files_queue_listed(backup_files_queue *queue)
+{
+	parray	   *listed = parray_new();
+
+	pthread_lock(&queue->lock);
+	parray_concat(listed, queue->listed);
+	pthread_mutex_unlock(&queue->lock);
+
+	return listed;
+}
+
 /*
  * Extract information about files in backup_list parsing their names:
  * - remove temp tables from the list
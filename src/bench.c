@@ -0,0 +1,708 @@
+/*-------------------------------------------------------------------------
+ *
+ * bench.c: benchmark of data file routines
+ *
+ * Generates synthetic relation segment and measures throughput of the
+ * routines, which are on the hot path of backup and restore: send_pages(),
+ * restore_data_file_internal(), get_checksum_map(), page header map I/O
+ * and page compression. Every measurement is repeated several times and
+ * the best run is reported, so results are comparable between builds.
+ *
+ * It is built by "make bench" and is not installed.
+ *
+ * Copyright (c) 2021, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include "getopt_long.h"
+#include "instr_time.h"
+#include "storage/bufpage.h"
+#include "storage/checksum.h"
+#include "utils/json.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* LSN of "previous backup", pages above it are considered changed */
+#define BENCH_PREV_LSN		((XLogRecPtr) 0x10000000)
+
+/* number of files emulated by page header map benchmark */
+#define BENCH_HDR_FILES		100
+
+/* number of pages used by compression benchmark */
+#define BENCH_COMPRESS_PAGES	4096
+
+typedef struct
+{
+	const char *benchmark;
+	const char *variant;
+	const char *compress_alg;
+	int64		pages;
+	int64		bytes;			/* bytes processed */
+	int64		output_bytes;	/* bytes produced, if applicable */
+	double		seconds;		/* best run */
+} bench_result;
+
+/* options */
+static char	   *work_dir = NULL;
+static int		n_pages = 16384;
+static int		fill_percent = 70;
+static int		changed_percent = 10;
+static int		pagemap_percent = 10;
+static int		repeat = 3;
+static uint32	seed = 42;
+static bool		json_format = false;
+
+static char		segment_path[MAXPGPATH];
+static parray  *results = NULL;
+static uint32	random_state;
+
+static const CompressAlg bench_algs[] =
+{
+	NONE_COMPRESS, PGLZ_COMPRESS, ZLIB_COMPRESS
+};
+
+static uint32 bench_random(void);
+static void bench_make_segment(void);
+static pgFile *bench_make_file(BackupMode mode);
+static void bench_add_result(const char *benchmark, const char *variant,
+							 CompressAlg alg, int64 pages, int64 bytes,
+							 int64 output_bytes, double seconds);
+static void bench_send_pages(BackupMode mode, CompressAlg alg);
+static void bench_restore(CompressAlg alg, bool incremental);
+static void bench_checksum_map(void);
+static void bench_page_headers(void);
+static void bench_compress(CompressAlg alg, int level);
+static void bench_print(void);
+static void bench_usage(void);
+
+int
+main(int argc, char *argv[])
+{
+	static struct option long_options[] = {
+		{"dir", required_argument, NULL, 'd'},
+		{"pages", required_argument, NULL, 'n'},
+		{"fill", required_argument, NULL, 'f'},
+		{"changed", required_argument, NULL, 'c'},
+		{"pagemap", required_argument, NULL, 'p'},
+		{"repeat", required_argument, NULL, 'r'},
+		{"seed", required_argument, NULL, 's'},
+		{"json", no_argument, NULL, 'j'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int			c;
+	int			i;
+	bool		own_dir = false;
+
+	PROGRAM_NAME_FULL = argv[0];
+	PROGRAM_NAME = get_progname(argv[0]);
+	main_tid = pthread_self();
+	init_config(&instance_config, NULL);
+
+	while ((c = getopt_long(argc, argv, "d:n:f:c:p:r:s:jh", long_options, NULL)) != -1)
+	{
+		switch (c)
+		{
+			case 'd':
+				work_dir = pgut_strdup(optarg);
+				break;
+			case 'n':
+				n_pages = atoi(optarg);
+				break;
+			case 'f':
+				fill_percent = atoi(optarg);
+				break;
+			case 'c':
+				changed_percent = atoi(optarg);
+				break;
+			case 'p':
+				pagemap_percent = atoi(optarg);
+				break;
+			case 'r':
+				repeat = atoi(optarg);
+				break;
+			case 's':
+				seed = (uint32) strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				json_format = true;
+				break;
+			case 'h':
+				bench_usage();
+				exit(0);
+			default:
+				bench_usage();
+				exit(1);
+		}
+	}
+
+	if (n_pages <= 0 || n_pages > RELSEG_SIZE)
+		elog(ERROR, "--pages must be between 1 and %u", RELSEG_SIZE);
+	if (fill_percent < 0 || fill_percent > 100 ||
+		changed_percent < 0 || changed_percent > 100 ||
+		pagemap_percent < 0 || pagemap_percent > 100)
+		elog(ERROR, "percent values must be between 0 and 100");
+	if (repeat <= 0)
+		elog(ERROR, "--repeat must be positive");
+
+	init_logger(NULL, &instance_config.logger);
+
+	if (work_dir == NULL)
+	{
+		char		tmpl[] = "pg_probackup_bench.XXXXXX";
+
+		if (mkdtemp(tmpl) == NULL)
+			elog(ERROR, "Cannot create temporary directory: %s", strerror(errno));
+		work_dir = pgut_strdup(tmpl);
+		own_dir = true;
+	}
+	else if (mkdir(work_dir, DIR_PERMISSION) != 0 && errno != EEXIST)
+		elog(ERROR, "Cannot create directory \"%s\": %s", work_dir, strerror(errno));
+
+	results = parray_new();
+
+	random_state = seed ? seed : 1;
+	bench_make_segment();
+
+	for (i = 0; i < lengthof(bench_algs); i++)
+		bench_send_pages(BACKUP_MODE_FULL, bench_algs[i]);
+	bench_send_pages(BACKUP_MODE_DIFF_DELTA, NONE_COMPRESS);
+	bench_send_pages(BACKUP_MODE_DIFF_PAGE, NONE_COMPRESS);
+
+	for (i = 0; i < lengthof(bench_algs); i++)
+		bench_restore(bench_algs[i], false);
+	bench_restore(NONE_COMPRESS, true);
+
+	bench_checksum_map();
+	bench_page_headers();
+
+	bench_compress(PGLZ_COMPRESS, 1);
+	bench_compress(ZLIB_COMPRESS, 1);
+	bench_compress(ZLIB_COMPRESS, 6);
+
+	bench_print();
+
+	/* cleanup */
+	unlink(segment_path);
+	if (own_dir && rmdir(work_dir) != 0)
+		elog(WARNING, "Cannot remove directory \"%s\": %s", work_dir, strerror(errno));
+
+	parray_walk(results, pg_free);
+	parray_free(results);
+
+	return 0;
+}
+
+static void
+bench_usage(void)
+{
+	printf(_("%s benchmarks data file routines of pg_probackup.\n\n"), PROGRAM_NAME);
+	printf(_("Usage:\n  %s [OPTION]...\n\n"), PROGRAM_NAME);
+	printf(_("  -d, --dir=DIR          directory for temporary files (default: new directory in cwd)\n"));
+	printf(_("  -n, --pages=NUM        number of pages in synthetic segment (default: 16384)\n"));
+	printf(_("  -f, --fill=PERCENT     how much of page space is occupied by tuples (default: 70)\n"));
+	printf(_("  -c, --changed=PERCENT  pages changed since previous backup, for DELTA (default: 10)\n"));
+	printf(_("  -p, --pagemap=PERCENT  pages present in pagemap, for PAGE (default: 10)\n"));
+	printf(_("  -r, --repeat=NUM       number of runs of every benchmark, best is reported (default: 3)\n"));
+	printf(_("  -s, --seed=NUM         seed of pseudo-random generator (default: 42)\n"));
+	printf(_("  -j, --json             print results in JSON format\n"));
+	printf(_("  -h, --help             show this help, then exit\n"));
+}
+
+/* xorshift, we need speed and reproducibility, not quality */
+static uint32
+bench_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state;
+}
+
+/*
+ * Generate relation segment with valid pages and checksums.
+ * Tuple area is filled with symbols from small alphabet, so compression
+ * algorithms have something to do.
+ */
+static void
+bench_make_segment(void)
+{
+	FILE	   *out;
+	char		page[BLCKSZ];
+	PageHeader	phdr = (PageHeader) page;
+	int			data_len;
+	BlockNumber	blknum;
+
+	data_len = (BLCKSZ - SizeOfPageHeaderData) * fill_percent / 100;
+	data_len -= data_len % MAXIMUM_ALIGNOF;
+
+	join_path_components(segment_path, work_dir, "16384");
+
+	out = fopen(segment_path, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", segment_path, strerror(errno));
+
+	for (blknum = 0; blknum < n_pages; blknum++)
+	{
+		XLogRecPtr	lsn;
+		int			i;
+
+		if (bench_random() % 100 < changed_percent)
+			lsn = BENCH_PREV_LSN + 1 + bench_random() % BENCH_PREV_LSN;
+		else
+			lsn = 1 + bench_random() % (BENCH_PREV_LSN - 1);
+
+		MemSet(page, 0, BLCKSZ);
+		PageSetPageSizeAndVersion(page, BLCKSZ, PG_PAGE_LAYOUT_VERSION);
+		PageXLogRecPtrSet(phdr->pd_lsn, lsn);
+		phdr->pd_lower = SizeOfPageHeaderData;
+		phdr->pd_upper = BLCKSZ - data_len;
+		phdr->pd_special = BLCKSZ;
+
+		for (i = phdr->pd_upper; i < BLCKSZ; i++)
+			page[i] = 'a' + bench_random() % 16;
+
+		phdr->pd_checksum = pg_checksum_page(page, blknum);
+
+		if (fwrite(page, 1, BLCKSZ, out) != BLCKSZ)
+			elog(ERROR, "Cannot write file \"%s\": %s", segment_path, strerror(errno));
+	}
+
+	if (fclose(out) != 0)
+		elog(ERROR, "Cannot write file \"%s\": %s", segment_path, strerror(errno));
+}
+
+/* Describe synthetic segment as a file of backup */
+static pgFile *
+bench_make_file(BackupMode mode)
+{
+	pgFile	   *file = pgFileInit("base/1/16384");
+
+	file->is_datafile = true;
+	file->segno = 0;
+	file->n_blocks = n_pages;
+	file->size = (int64) n_pages * BLCKSZ;
+	file->exists_in_prev = true;
+
+	if (mode == BACKUP_MODE_DIFF_PAGE)
+	{
+		BlockNumber	blknum;
+		uint32		saved_state = random_state;
+
+		/* every run must use the same pagemap */
+		random_state = seed ? seed + 1 : 2;
+		for (blknum = 0; blknum < n_pages; blknum++)
+			if (bench_random() % 100 < pagemap_percent)
+				datapagemap_add(&file->pagemap, blknum);
+		random_state = saved_state;
+	}
+
+	return file;
+}
+
+static void
+bench_add_result(const char *benchmark, const char *variant, CompressAlg alg,
+				 int64 pages, int64 bytes, int64 output_bytes, double seconds)
+{
+	bench_result *result = pgut_new0(bench_result);
+
+	result->benchmark = benchmark;
+	result->variant = variant;
+	result->compress_alg = deparse_compress_alg(alg);
+	result->pages = pages;
+	result->bytes = bytes;
+	result->output_bytes = output_bytes;
+	result->seconds = seconds;
+
+	parray_append(results, result);
+}
+
+/* Backup synthetic segment with given mode and compression */
+static void
+bench_send_pages(BackupMode mode, CompressAlg alg)
+{
+	char		to_fullpath[MAXPGPATH];
+	double		best = 0;
+	int			n_read = 0;
+	int64		output_bytes = 0;
+	int			r;
+
+	join_path_components(to_fullpath, work_dir, "backup");
+
+	for (r = 0; r < repeat; r++)
+	{
+		pgFile	   *file = bench_make_file(mode);
+		BackupPageHeader2 *headers = NULL;
+		instr_time	start_time,
+					end_time;
+
+		INIT_FILE_CRC32(true, file->crc);
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		n_read = send_pages(to_fullpath, segment_path, file, BENCH_PREV_LSN,
+							alg, 1, 1, mode == BACKUP_MODE_DIFF_PAGE,
+							&headers, mode);
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best)
+			best = INSTR_TIME_GET_DOUBLE(end_time);
+		output_bytes = file->write_size;
+
+		pg_free(headers);
+		pgFileFree(file);
+		unlink(to_fullpath);
+	}
+
+	bench_add_result("send_pages",
+					 mode == BACKUP_MODE_FULL ? "FULL" :
+					 mode == BACKUP_MODE_DIFF_DELTA ? "DELTA" : "PAGE",
+					 alg, n_read, (int64) n_read * BLCKSZ, output_bytes, best);
+}
+
+/*
+ * Restore synthetic segment from FULL backup. In incremental mode
+ * destination already has the same content and checksum map is used
+ * to skip all pages.
+ */
+static void
+bench_restore(CompressAlg alg, bool incremental)
+{
+	char		backup_path[MAXPGPATH];
+	char		to_fullpath[MAXPGPATH];
+	pgFile	   *file = bench_make_file(BACKUP_MODE_FULL);
+	BackupPageHeader2 *headers = NULL;
+	uint32		backup_version = parse_program_version(PROGRAM_VERSION);
+	double		best = 0;
+	int			r;
+
+	join_path_components(backup_path, work_dir, "backup");
+	join_path_components(to_fullpath, work_dir, "restored");
+
+	INIT_FILE_CRC32(true, file->crc);
+	send_pages(backup_path, segment_path, file, InvalidXLogRecPtr,
+			   alg, 1, 1, false, &headers, BACKUP_MODE_FULL);
+
+	/*
+	 * Runs of incremental restore skip all pages and leave destination
+	 * intact, so it is enough to restore it once beforehand.
+	 */
+	unlink(to_fullpath);
+	for (r = incremental ? -1 : 0; r < repeat; r++)
+	{
+		FILE	   *in;
+		FILE	   *out;
+		PageState  *checksum_map = NULL;
+		bool		use_map = incremental && r >= 0;
+		instr_time	start_time,
+					end_time;
+
+		in = fopen(backup_path, PG_BINARY_R);
+		out = fopen(to_fullpath, use_map ? PG_BINARY_R "+" : PG_BINARY_W);
+		if (in == NULL || out == NULL)
+			elog(ERROR, "Cannot open files in \"%s\": %s", work_dir, strerror(errno));
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		if (use_map)
+			checksum_map = get_checksum_map(to_fullpath, 1, n_pages,
+											InvalidXLogRecPtr, 0);
+		restore_data_file_internal(in, out, file, backup_version,
+								   backup_path, to_fullpath, n_pages, NULL,
+								   checksum_map, 1, NULL, headers);
+		if (fflush(out) != 0)
+			elog(ERROR, "Cannot write file \"%s\": %s", to_fullpath, strerror(errno));
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || (r > 0 && INSTR_TIME_GET_DOUBLE(end_time) < best))
+			best = INSTR_TIME_GET_DOUBLE(end_time);
+
+		fclose(in);
+		fclose(out);
+		pg_free(checksum_map);
+	}
+
+	bench_add_result("restore_data_file_internal", incremental ? "CHECKSUM" : "FULL",
+					 alg, n_pages, (int64) n_pages * BLCKSZ, file->write_size, best);
+
+	pg_free(headers);
+	pgFileFree(file);
+	unlink(backup_path);
+	unlink(to_fullpath);
+}
+
+/* Build checksum map of synthetic segment, as incremental restore does */
+static void
+bench_checksum_map(void)
+{
+	double		best = 0;
+	int			r;
+
+	for (r = 0; r < repeat; r++)
+	{
+		PageState  *checksum_map;
+		instr_time	start_time,
+					end_time;
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		checksum_map = get_checksum_map(segment_path, 1, n_pages,
+										InvalidXLogRecPtr, 0);
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best)
+			best = INSTR_TIME_GET_DOUBLE(end_time);
+
+		pg_free(checksum_map);
+	}
+
+	bench_add_result("get_checksum_map", "", NONE_COMPRESS,
+					 n_pages, (int64) n_pages * BLCKSZ, 0, best);
+}
+
+/*
+ * Write headers of synthetic segment into page header map as if
+ * backup had BENCH_HDR_FILES such files, then read all of them back.
+ */
+static void
+bench_page_headers(void)
+{
+	char		backup_path[MAXPGPATH];
+	pgFile	   *file = bench_make_file(BACKUP_MODE_FULL);
+	pgFile	  **files;
+	BackupPageHeader2 *headers = NULL;
+	HeaderMap	hdr_map;
+	uint32		backup_version = parse_program_version(PROGRAM_VERSION);
+	double		best_write = 0;
+	double		best_read = 0;
+	int64		hdr_bytes;
+	int64		map_size = 0;
+	int			r;
+	int			i;
+
+	join_path_components(backup_path, work_dir, "backup");
+
+	INIT_FILE_CRC32(true, file->crc);
+	send_pages(backup_path, segment_path, file, InvalidXLogRecPtr,
+			   NONE_COMPRESS, 1, 1, false, &headers, BACKUP_MODE_FULL);
+	unlink(backup_path);
+
+	hdr_bytes = (int64) (file->n_headers + 1) * sizeof(BackupPageHeader2);
+
+	files = pgut_malloc(BENCH_HDR_FILES * sizeof(pgFile *));
+	for (i = 0; i < BENCH_HDR_FILES; i++)
+	{
+		files[i] = pgut_new0(pgFile);
+		files[i]->rel_path = file->rel_path;
+		files[i]->n_headers = file->n_headers;
+	}
+
+	MemSet(&hdr_map, 0, sizeof(hdr_map));
+	join_path_components(hdr_map.path, work_dir, HEADER_MAP);
+	join_path_components(hdr_map.path_tmp, work_dir, HEADER_MAP_TMP);
+	pthread_mutex_init(&hdr_map.mutex, NULL);
+
+	for (r = 0; r < repeat; r++)
+	{
+		instr_time	start_time,
+					end_time;
+
+		unlink(hdr_map.path);
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		for (i = 0; i < BENCH_HDR_FILES; i++)
+			write_page_headers(headers, files[i], &hdr_map, false);
+		map_size = hdr_map.offset;
+		cleanup_header_map(&hdr_map);
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best_write)
+			best_write = INSTR_TIME_GET_DOUBLE(end_time);
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		for (i = 0; i < BENCH_HDR_FILES; i++)
+			pg_free(get_data_file_headers(&hdr_map, files[i], backup_version, true));
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best_read)
+			best_read = INSTR_TIME_GET_DOUBLE(end_time);
+	}
+
+	bench_add_result("write_page_headers", "", ZLIB_COMPRESS,
+					 (int64) file->n_headers * BENCH_HDR_FILES,
+					 hdr_bytes * BENCH_HDR_FILES, map_size, best_write);
+	bench_add_result("get_data_file_headers", "", ZLIB_COMPRESS,
+					 (int64) file->n_headers * BENCH_HDR_FILES,
+					 hdr_bytes * BENCH_HDR_FILES, 0, best_read);
+
+	unlink(hdr_map.path);
+	pthread_mutex_destroy(&hdr_map.mutex);
+	for (i = 0; i < BENCH_HDR_FILES; i++)
+		pg_free(files[i]);
+	pg_free(files);
+	pg_free(headers);
+	pgFileFree(file);
+}
+
+/* Compress and decompress pages of synthetic segment in memory */
+static void
+bench_compress(CompressAlg alg, int level)
+{
+	int			n = Min(n_pages, BENCH_COMPRESS_PAGES);
+	char	   *pages = pgut_malloc((size_t) n * BLCKSZ);
+	char	   *compressed = pgut_malloc((size_t) n * 2 * BLCKSZ);
+	int32	   *sizes = pgut_malloc(n * sizeof(int32));
+	char		page[BLCKSZ];
+	char	   *variant = psprintf("level %d", level);
+	double		best_compress = 0;
+	double		best_decompress = 0;
+	int64		output_bytes = 0;
+	FILE	   *in;
+	int			r;
+	int			i;
+
+	in = fopen(segment_path, PG_BINARY_R);
+	if (in == NULL || fread(pages, BLCKSZ, n, in) != n)
+		elog(ERROR, "Cannot read file \"%s\": %s", segment_path, strerror(errno));
+	fclose(in);
+
+	for (r = 0; r < repeat; r++)
+	{
+		const char *errormsg = NULL;
+		instr_time	start_time,
+					end_time;
+
+		output_bytes = 0;
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		for (i = 0; i < n; i++)
+		{
+			sizes[i] = do_compress(compressed + (size_t) i * 2 * BLCKSZ, 2 * BLCKSZ,
+								   pages + (size_t) i * BLCKSZ, BLCKSZ,
+								   alg, level, &errormsg);
+			if (sizes[i] <= 0)
+				elog(ERROR, "Cannot compress page %d: %s", i,
+					 errormsg ? errormsg : "unknown error");
+			output_bytes += sizes[i];
+		}
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best_compress)
+			best_compress = INSTR_TIME_GET_DOUBLE(end_time);
+
+		INSTR_TIME_SET_CURRENT(start_time);
+		for (i = 0; i < n; i++)
+		{
+			if (do_decompress(page, BLCKSZ, compressed + (size_t) i * 2 * BLCKSZ,
+							  sizes[i], alg, &errormsg) != BLCKSZ)
+				elog(ERROR, "Cannot decompress page %d: %s", i,
+					 errormsg ? errormsg : "invalid page size");
+		}
+		INSTR_TIME_SET_CURRENT(end_time);
+		INSTR_TIME_SUBTRACT(end_time, start_time);
+
+		if (r == 0 || INSTR_TIME_GET_DOUBLE(end_time) < best_decompress)
+			best_decompress = INSTR_TIME_GET_DOUBLE(end_time);
+	}
+
+	bench_add_result("do_compress", variant, alg, n, (int64) n * BLCKSZ,
+					 output_bytes, best_compress);
+	bench_add_result("do_decompress", variant, alg, n, (int64) n * BLCKSZ,
+					 0, best_decompress);
+
+	pg_free(pages);
+	pg_free(compressed);
+	pg_free(sizes);
+}
+
+static void
+bench_print(void)
+{
+	int			i;
+
+	if (json_format)
+	{
+		PQExpBufferData buf;
+		int32		json_level = 0;
+		char		value[64];
+
+		initPQExpBuffer(&buf);
+
+		json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+		json_add_value(&buf, "program-version", PROGRAM_VERSION, json_level, true);
+		json_add_key(&buf, "block-size", json_level);
+		appendPQExpBuffer(&buf, "%u", BLCKSZ);
+		json_add_key(&buf, "pages", json_level);
+		appendPQExpBuffer(&buf, "%d", n_pages);
+		json_add_key(&buf, "fill", json_level);
+		appendPQExpBuffer(&buf, "%d", fill_percent);
+		json_add_key(&buf, "changed", json_level);
+		appendPQExpBuffer(&buf, "%d", changed_percent);
+		json_add_key(&buf, "pagemap", json_level);
+		appendPQExpBuffer(&buf, "%d", pagemap_percent);
+		json_add_key(&buf, "repeat", json_level);
+		appendPQExpBuffer(&buf, "%d", repeat);
+
+		json_add_key(&buf, "results", json_level);
+		json_add(&buf, JT_BEGIN_ARRAY, &json_level);
+
+		for (i = 0; i < parray_num(results); i++)
+		{
+			bench_result *result = (bench_result *) parray_get(results, i);
+
+			if (i != 0)
+				appendPQExpBufferChar(&buf, ',');
+
+			json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+			json_add_value(&buf, "benchmark", result->benchmark, json_level, true);
+			json_add_value(&buf, "variant", result->variant, json_level, true);
+			json_add_value(&buf, "compress-alg", result->compress_alg, json_level, true);
+			json_add_key(&buf, "pages", json_level);
+			appendPQExpBuffer(&buf, INT64_FORMAT, result->pages);
+			json_add_key(&buf, "bytes", json_level);
+			appendPQExpBuffer(&buf, INT64_FORMAT, result->bytes);
+			json_add_key(&buf, "output-bytes", json_level);
+			appendPQExpBuffer(&buf, INT64_FORMAT, result->output_bytes);
+			json_add_key(&buf, "seconds", json_level);
+			appendPQExpBuffer(&buf, "%.6f", result->seconds);
+			json_add_key(&buf, "mb-per-sec", json_level);
+			snprintf(value, lengthof(value), "%.2f",
+					 result->seconds > 0 ? result->bytes / result->seconds / (1024 * 1024) : 0);
+			appendPQExpBufferStr(&buf, value);
+			json_add_key(&buf, "pages-per-sec", json_level);
+			snprintf(value, lengthof(value), "%.0f",
+					 result->seconds > 0 ? result->pages / result->seconds : 0);
+			appendPQExpBufferStr(&buf, value);
+			json_add(&buf, JT_END_OBJECT, &json_level);
+		}
+
+		json_add(&buf, JT_END_ARRAY, &json_level);
+		json_add(&buf, JT_END_OBJECT, &json_level);
+
+		fputs(buf.data, stdout);
+		termPQExpBuffer(&buf);
+		return;
+	}
+
+	printf("%-28s %-10s %-6s %10s %12s %12s\n",
+		   "benchmark", "variant", "alg", "pages", "MB/s", "pages/s");
+
+	for (i = 0; i < parray_num(results); i++)
+	{
+		bench_result *result = (bench_result *) parray_get(results, i);
+
+		printf("%-28s %-10s %-6s %10" INT64_MODIFIER "d %12.2f %12.0f\n",
+			   result->benchmark, result->variant, result->compress_alg,
+			   result->pages,
+			   result->seconds > 0 ? result->bytes / result->seconds / (1024 * 1024) : 0,
+			   result->seconds > 0 ? result->pages / result->seconds : 0);
+	}
+}
@@ -1074,6 +1074,7 @@ get_backup_filelist(pgBackup *backup, bool strict)
 					external_dir_num,
 					crc,
 					segno,
+					compress_level,
 					n_blocks,
 					n_headers,
 					dbOid,		/* used for partial restore */
@@ -1116,6 +1117,9 @@ get_backup_filelist(pgBackup *backup, bool strict)
 		if (get_control_value_int64(buf, "segno", &segno, false))
 			file->segno = (int) segno;
 
+		if (get_control_value_int64(buf, "compress_level", &compress_level, false))
+			file->compress_level = (int) compress_level;
+
 		if (get_control_value_int64(buf, "n_blocks", &n_blocks, false))
 			file->n_blocks = (int) n_blocks;
 
@@ -1724,6 +1728,9 @@ catalog_get_timelines(InstanceState *instanceState, InstanceConfig *instance)
 			parray_walk(timelines, pfree);
 			parray_free(timelines);
 		}
+		/* summaries of validated WAL segments, not a part of WAL */
+		else if (IsWalSummaryFileName(file->name))
+			continue;
 		else
 			elog(WARNING, "unexpected WAL file name \"%s\"", file->name);
 	}
@@ -2412,6 +2419,9 @@ pgBackupWriteControl(FILE *out, pgBackup *backup, bool utc)
 	if (backup->note)
 		fio_fprintf(out, "note = '%s'\n", backup->note);
 
+	if (backup->timing)
+		fio_fprintf(out, "timing = '%s'\n", backup->timing);
+
 	if (backup->content_crc != 0)
 		fio_fprintf(out, "content-crc = %u\n", backup->content_crc);
 
@@ -2539,7 +2549,8 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 			 * Size of WAL files in 'pg_wal' is counted separately
 			 * TODO: in 3.0 add attribute is_walfile
 			 */
-			if (IsXLogFileName(file->name) && file->external_dir_num == 0)
+			if ((IsXLogFileName(file->name) || IsCompressedXLogFileName(file->name)) &&
+				file->external_dir_num == 0)
 				wal_size_on_disk += file->write_size;
 			else
 			{
@@ -2564,6 +2575,9 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 		if (file->is_datafile)
 			len += sprintf(line+len, ",\"segno\":\"%d\"", file->segno);
 
+		if (file->compress_level > 0)
+			len += sprintf(line+len, ",\"compress_level\":\"%d\"", file->compress_level);
+
 		if (file->linked)
 			len += sprintf(line+len, ",\"linked\":\"%s\"", file->linked);
 
@@ -2666,6 +2680,7 @@ readBackupControlFile(const char *path)
 		{'s', 0, "primary-conninfo",	&backup->primary_conninfo, SOURCE_FILE_STRICT},
 		{'s', 0, "external-dirs",		&backup->external_dir_str, SOURCE_FILE_STRICT},
 		{'s', 0, "note",				&backup->note, SOURCE_FILE_STRICT},
+		{'s', 0, "timing",				&backup->timing, SOURCE_FILE_STRICT},
 		{'u', 0, "content-crc",			&backup->content_crc, SOURCE_FILE_STRICT},
 		{0}
 	};
@@ -2935,6 +2950,7 @@ pgBackupInit(pgBackup *backup)
 	backup->database_dir = NULL;
 	backup->files = NULL;
 	backup->note = NULL;
+	backup->timing = NULL;
 	backup->content_crc = 0;
 }
 
@@ -2949,6 +2965,7 @@ pgBackupFree(void *backup)
 	pg_free(b->root_dir);
 	pg_free(b->database_dir);
 	pg_free(b->note);
+	pg_free(b->timing);
 	pg_free(backup);
 }
 
@@ -441,6 +441,8 @@ catchup_thread_runner(void *arg)
 								 arguments->backup_mode, current.parent_backup, true);
 		}
 
+		progress_file_done(file);
+
 		/* file went missing during catchup */
 		if (file->write_size == FILE_NOT_FOUND)
 			continue;
@@ -509,6 +511,8 @@ catchup_multithreaded_copy(int num_threads,
 	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	if (!dry_run)
 	{
+		progress_begin_files("catchup files", source_filelist);
+
 		for (i = 0; i < num_threads; i++)
 		{
 			elog(VERBOSE, "Start thread num: %i", i);
@@ -721,6 +725,13 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 
 	source_filelist = parray_new();
 
+	/* PTRACK maps are fetched on a separate connection while PGDATA is listed */
+	if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
+		pg_ptrack_start_pagemapset_fetch(&instance_config.conn_opt,
+										 source_node_info.ptrack_schema,
+										 source_node_info.ptrack_version_num,
+										 dest_redo.lsn);
+
 	/* list files with the logical path. omit $PGDATA */
 	if (fio_is_remote(FIO_DB_HOST))
 		fio_list_dir(source_filelist, source_pgdata,
@@ -783,7 +794,10 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 	/* Build page mapping in PTRACK mode */
 	if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
 	{
+		uint64 pagemap_start;
+
 		time(&start_time);
+		TIMING_START(pagemap_start);
 		elog(INFO, "Extracting pagemap of changed blocks");
 
 		/* Build the page map from ptrack information */
@@ -792,6 +806,7 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 									source_node_info.ptrack_version_num,
 									dest_redo.lsn);
 		time(&end_time);
+		TIMING_STOP(TIMING_PAGEMAP, pagemap_start);
 		elog(INFO, "Pagemap successfully extracted, time elapsed: %.0f sec",
 			 difftime(end_time, start_time));
 	}
@@ -1126,5 +1141,7 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 	parray_free(source_filelist);
 	pgFileFree(source_pg_control_file);
 
+	progress_finish();
+
 	return 0;
 }
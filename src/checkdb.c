@@ -51,10 +51,24 @@ typedef struct
 } check_files_arg;
 
 
+/* database to amcheck */
+typedef struct amcheck_database
+{
+	char	   *dbname;
+	/* idle connections to the database, protected by amcheck_pool_lock */
+	parray	   *idle_conns;
+	/* false if amcheck is not installed in the database */
+	bool		amchecked;
+	/* set by threads if amcheck of some index failed */
+	volatile bool failed;
+} amcheck_database;
+
 typedef struct
 {
-	/* list of indexes to amcheck */
+	/* list of indexes of all databases to amcheck, largest first */
 	parray	   *index_list;
+	/* position of the next index to check in index_list */
+	pg_atomic_uint32 *next_index;
 	/*
 	 * credentials to connect to postgres instance
 	 * used for compatibility checks of blocksize,
@@ -66,6 +80,8 @@ typedef struct
 	 * to use in threads to connect to databases
 	 */
 	ConnectionArgs conn_arg;
+	/* database of conn_arg.conn */
+	amcheck_database *conn_db;
 	/* number of thread for debugging */
 	int			thread_num;
 	/*
@@ -86,8 +102,12 @@ typedef struct pg_indexEntry
 	bool checkunique_is_supported;
 	/* schema where amcheck extension is located */
 	char *amcheck_nspname;
-	/* lock for synchronization of parallel threads  */
-	volatile pg_atomic_flag lock;
+	/* database of the index */
+	amcheck_database *db;
+	/* size of the index, used for scheduling */
+	int64 size;
+	/* time spent in amcheck, seconds */
+	double duration;
 } pg_indexEntry;
 
 static void
@@ -113,14 +133,71 @@ pg_indexEntry_free(void *index)
 
 static void *check_files(void *arg);
 static void do_block_validation(char *pgdata, uint32 checksum_version);
+static parray *filter_files_by_shard(parray *files_list);
 
 static void *check_indexes(void *arg);
-static parray* get_index_list(const char *dbname, bool first_db_with_amcheck,
+static parray* get_index_list(amcheck_database *db, bool first_db_with_amcheck,
 							  PGconn *db_conn);
 static bool amcheck_one_index(check_indexes_arg *arguments,
 				 pg_indexEntry *ind);
 static void do_amcheck(ConnectionOptions conn_opt, PGconn *conn);
 
+/*
+ * Pool of idle connections of amcheck threads. A thread keeps its connection
+ * while it checks indexes of the same database, and returns it to the pool
+ * when it moves to an index of another database. At most num_threads idle
+ * connections are kept in the pool, so the total number of connections is
+ * bounded by twice the number of threads.
+ */
+static pthread_mutex_t amcheck_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int	amcheck_pool_size = 0;
+
+/*
+ * Leave in the list only data files which belong to the shard given by
+ * --shard=N/M. A file belongs to the shard by the hash of its path, so
+ * that M processes, possibly running on different hosts of a cluster with
+ * the same file layout, split the check without any coordination, and
+ * segments of a big relation are spread over all shards.
+ */
+static parray *
+filter_files_by_shard(parray *files_list)
+{
+	parray	   *shard_files = parray_new();
+	size_t		n_datafiles = 0;
+	int			i;
+
+	for (i = 0; i < parray_num(files_list); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files_list, i);
+		pg_crc32	crc;
+
+		if (!S_ISREG(file->mode) || !file->is_datafile || file->is_cfs)
+		{
+			pgFileFree(file);
+			continue;
+		}
+
+		n_datafiles++;
+
+		INIT_FILE_CRC32(true, crc);
+		COMP_FILE_CRC32(true, crc, file->rel_path, strlen(file->rel_path));
+		FIN_FILE_CRC32(true, crc);
+
+		if (crc % checkdb_shard_count == checkdb_shard_num - 1)
+			parray_append(shard_files, file);
+		else
+			pgFileFree(file);
+	}
+
+	parray_free(files_list);
+
+	elog(INFO, "Checking shard %u of %u: %zu of %zu data files",
+		 checkdb_shard_num, checkdb_shard_count,
+		 parray_num(shard_files), n_datafiles);
+
+	return shard_files;
+}
+
 /*
  * Check files in PGDATA.
  * Read all files listed in files_list.
@@ -222,6 +299,9 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	/* Extract information about files in pgdata parsing their names:*/
 	parse_filelist_filenames(files_list, pgdata);
 
+	if (checkdb_shard_count > 0)
+		files_list = filter_files_by_shard(files_list);
+
 	/* setup threads */
 	for (i = 0; i < parray_num(files_list); i++)
 	{
@@ -286,11 +366,69 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 		elog(ERROR, "Checkdb failed");
 }
 
+/* Return connection of the thread to the pool of its database */
+static void
+amcheck_release_conn(check_indexes_arg *arguments)
+{
+	PGconn	   *conn = arguments->conn_arg.conn;
+
+	if (conn == NULL)
+		return;
+
+	PQfreeCancel(arguments->conn_arg.cancel_conn);
+	arguments->conn_arg.conn = NULL;
+	arguments->conn_arg.cancel_conn = NULL;
+
+	pthread_lock(&amcheck_pool_lock);
+	if (amcheck_pool_size < num_threads)
+	{
+		parray_append(arguments->conn_db->idle_conns, conn);
+		amcheck_pool_size++;
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&amcheck_pool_lock);
+
+	if (conn)
+		pgut_disconnect(conn);
+
+	arguments->conn_db = NULL;
+}
+
+/* Get connection to the database from the pool or open a new one */
+static void
+amcheck_acquire_conn(check_indexes_arg *arguments, amcheck_database *db)
+{
+	PGconn	   *conn = NULL;
+
+	if (arguments->conn_db == db)
+		return;
+
+	amcheck_release_conn(arguments);
+
+	pthread_lock(&amcheck_pool_lock);
+	if (parray_num(db->idle_conns) > 0)
+	{
+		conn = parray_remove(db->idle_conns, parray_num(db->idle_conns) - 1);
+		amcheck_pool_size--;
+	}
+	pthread_mutex_unlock(&amcheck_pool_lock);
+
+	if (conn == NULL)
+		conn = pgut_connect(arguments->conn_opt.pghost,
+							arguments->conn_opt.pgport,
+							db->dbname,
+							arguments->conn_opt.pguser);
+
+	arguments->conn_arg.conn = conn;
+	arguments->conn_arg.cancel_conn = PQgetCancel(conn);
+	arguments->conn_db = db;
+	arguments->conn_opt.pgdatabase = db->dbname;
+}
+
 /* Check indexes with amcheck */
 static void *
 check_indexes(void *arg)
 {
-	int			i;
 	check_indexes_arg *arguments = (check_indexes_arg *) arg;
 	int			n_indexes = 0;
 	my_thread_num = arguments->thread_num;
@@ -298,12 +436,15 @@ check_indexes(void *arg)
 	if (arguments->index_list)
 		n_indexes = parray_num(arguments->index_list);
 
-	for (i = 0; i < n_indexes; i++)
+	for (;;)
 	{
-		pg_indexEntry *ind = (pg_indexEntry *) parray_get(arguments->index_list, i);
+		uint32		i = pg_atomic_fetch_add_u32(arguments->next_index, 1);
+		pg_indexEntry *ind;
 
-		if (!pg_atomic_test_set_flag(&ind->lock))
-			continue;
+		if (i >= n_indexes)
+			break;
+
+		ind = (pg_indexEntry *) parray_get(arguments->index_list, i);
 
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
@@ -311,28 +452,21 @@ check_indexes(void *arg)
 				arguments->thread_num);
 
 		if (progress)
-			elog(INFO, "Thread [%d]. Progress: (%d/%d). Amchecking index '%s.%s'",
+			elog(INFO, "Thread [%d]. Progress: (%d/%d). Amchecking index '%s.%s' in database '%s'",
 				 arguments->thread_num, i + 1, n_indexes,
-				 ind->namespace, ind->name);
+				 ind->namespace, ind->name, ind->db->dbname);
 
-		if (arguments->conn_arg.conn == NULL)
-		{
-
-			arguments->conn_arg.conn = pgut_connect(arguments->conn_opt.pghost,
-												arguments->conn_opt.pgport,
-												arguments->conn_opt.pgdatabase,
-												arguments->conn_opt.pguser);
-			arguments->conn_arg.cancel_conn = PQgetCancel(arguments->conn_arg.conn);
-		}
+		amcheck_acquire_conn(arguments, ind->db);
 
 		/* remember that we have a failed check */
 		if (!amcheck_one_index(arguments, ind))
+		{
 			arguments->ret = 2; /* corruption found */
+			ind->db->failed = true;
+		}
 	}
 
-	/* Close connection. */
-	if (arguments->conn_arg.conn)
-		pgut_disconnect(arguments->conn_arg.conn);
+	amcheck_release_conn(arguments);
 
 	/* Ret values:
 	 * 0 everything is ok
@@ -347,9 +481,10 @@ check_indexes(void *arg)
 
 /* Get index list for given database */
 static parray*
-get_index_list(const char *dbname, bool first_db_with_amcheck,
+get_index_list(amcheck_database *db, bool first_db_with_amcheck,
 			   PGconn *db_conn)
 {
+	const char *dbname = db->dbname;
 	PGresult   *res;
 	char *amcheck_nspname = NULL;
 	char *amcheck_extname = NULL;
@@ -456,7 +591,8 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 	if (first_db_with_amcheck)
 	{
 
-		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, nmspc.nspname "
+		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, nmspc.nspname, "
+									"pg_catalog.pg_relation_size(cls.oid) "
 									"FROM pg_catalog.pg_index idx "
 									"LEFT JOIN pg_catalog.pg_class cls ON idx.indexrelid=cls.oid "
 									"LEFT JOIN pg_catalog.pg_namespace nmspc ON cls.relnamespace=nmspc.oid "
@@ -468,7 +604,8 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 	else
 	{
 
-		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, nmspc.nspname "
+		res = pgut_execute(db_conn, "SELECT cls.oid, cls.relname, nmspc.nspname, "
+									"pg_catalog.pg_relation_size(cls.oid) "
 									"FROM pg_catalog.pg_index idx "
 									"LEFT JOIN pg_catalog.pg_class cls ON idx.indexrelid=cls.oid "
 									"LEFT JOIN pg_catalog.pg_namespace nmspc ON cls.relnamespace=nmspc.oid "
@@ -505,7 +642,11 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 		ind->checkunique_is_supported = checkunique_is_supported;
 		ind->amcheck_nspname = pgut_malloc(strlen(amcheck_nspname) + 1);
 		strcpy(ind->amcheck_nspname, amcheck_nspname);
-		pg_atomic_clear_flag(&ind->lock);
+
+		/* index size */
+		ind->size = atoll(PQgetvalue(res, i, 3));
+		ind->db = db;
+		ind->duration = 0;
 
 		if (index_list == NULL)
 			index_list = parray_new();
@@ -535,6 +676,7 @@ amcheck_one_index(check_indexes_arg *arguments,
 	};
 	int			params_count;
 	char		*query = NULL;
+	uint64		start;
 
 	if (interrupted)
 		elog(ERROR, "Interrupted");
@@ -563,9 +705,11 @@ amcheck_one_index(check_indexes_arg *arguments,
 	query = palloc(strlen(ind->amcheck_nspname) + strlen(queries[params_count - 1]) + 1 - 2);
 	sprintf(query, queries[params_count - 1], ind->amcheck_nspname);
 
+	start = timing_now();
 	res = pgut_execute_parallel(arguments->conn_arg.conn,
 								arguments->conn_arg.cancel_conn,
 								query, params_count, (const char **)params, true, true, true);
+	ind->duration = (timing_now() - start) / 1000000000.0;
 
 	if (PQresultStatus(res) != PGRES_TUPLES_OK)
 	{
@@ -579,9 +723,10 @@ amcheck_one_index(check_indexes_arg *arguments,
 		return false;
 	}
 	else
-		elog(LOG, "Thread [%d]. Amcheck succeeded in database '%s' for index: '%s.%s'",
+		elog(LOG, "Thread [%d]. Amcheck succeeded in database '%s' for index: '%s.%s', time elapsed: %.3f sec",
 				arguments->thread_num,
-				arguments->conn_opt.pgdatabase, ind->namespace, ind->name);
+				arguments->conn_opt.pgdatabase, ind->namespace, ind->name,
+				ind->duration);
 
 	pfree(params[INDEXRELID]);
 #undef INDEXRELID
@@ -590,13 +735,45 @@ amcheck_one_index(check_indexes_arg *arguments,
 	return true;
 }
 
+/* Compare indexes by size, largest first */
+static int
+pg_indexEntry_cmp_size_desc(const void *a, const void *b)
+{
+	const pg_indexEntry *ind_a = *(pg_indexEntry * const *) a;
+	const pg_indexEntry *ind_b = *(pg_indexEntry * const *) b;
+
+	if (ind_a->size > ind_b->size)
+		return -1;
+	if (ind_a->size < ind_b->size)
+		return 1;
+	return 0;
+}
+
+/* Compare indexes by amcheck duration, slowest first */
+static int
+pg_indexEntry_cmp_duration_desc(const void *a, const void *b)
+{
+	const pg_indexEntry *ind_a = *(pg_indexEntry * const *) a;
+	const pg_indexEntry *ind_b = *(pg_indexEntry * const *) b;
+
+	if (ind_a->duration > ind_b->duration)
+		return -1;
+	if (ind_a->duration < ind_b->duration)
+		return 1;
+	return 0;
+}
+
+/* Number of the slowest indexes to report */
+#define AMCHECK_REPORT_SLOWEST	5
+
 /*
  * Entry point of checkdb --amcheck.
  *
  * Connect to all databases in the cluster
- * and get list of persistent indexes,
+ * and get list of persistent indexes with their sizes,
  * then run parallel threads to perform bt_index_check()
- * for all indexes from the list.
+ * for all indexes of all databases, largest indexes first,
+ * so that a big index doesn't end up alone at the end of the run.
  *
  * If amcheck extension is not installed in the database,
  * skip this database and report it via warning message.
@@ -613,6 +790,9 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 	int n_databases = 0;
 	bool first_db_with_amcheck = true;
 	bool db_skipped = false;
+	parray	   *databases = parray_new();
+	parray	   *index_list = parray_new();
+	pg_atomic_uint32 next_index;
 
 	elog(INFO, "Start amchecking PostgreSQL instance");
 
@@ -628,85 +808,151 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 
 	n_databases =  PQntuples(res_db);
 
-	/* For each database check indexes. In parallel. */
+	/* Collect indexes of all databases */
 	for(i = 0; i < n_databases; i++)
 	{
-		int j;
-		const char 	*dbname;
 		PGconn 		*db_conn = NULL;
-		parray 		*index_list = NULL;
+		parray 		*db_index_list = NULL;
+		amcheck_database *db;
+
+		if (interrupted)
+			elog(ERROR, "checkdb --amcheck is interrupted.");
+
+		db = pgut_new0(amcheck_database);
+		db->dbname = pgut_strdup(PQgetvalue(res_db, i, 0));
+		db->idle_conns = parray_new();
+		parray_append(databases, db);
 
-		dbname = PQgetvalue(res_db, i, 0);
 		db_conn = pgut_connect(conn_opt.pghost, conn_opt.pgport,
-								dbname, conn_opt.pguser);
+								db->dbname, conn_opt.pguser);
 
-		index_list = get_index_list(dbname, first_db_with_amcheck,
-									db_conn);
+		db_index_list = get_index_list(db, first_db_with_amcheck,
+									   db_conn);
 
-		/* we don't need this connection anymore */
-		if (db_conn)
+		/*
+		 * Keep the connection for the first thread checking this database,
+		 * but no more than one per thread: the rest will be opened on demand.
+		 */
+		if (db_index_list != NULL && db_conn != NULL &&
+			amcheck_pool_size < num_threads)
+		{
+			parray_append(db->idle_conns, db_conn);
+			amcheck_pool_size++;
+		}
+		else if (db_conn)
 			pgut_disconnect(db_conn);
 
-		if (index_list == NULL)
+		if (db_index_list == NULL)
 		{
 			db_skipped = true;
 			continue;
 		}
 
+		db->amchecked = true;
 		first_db_with_amcheck = false;
 
-		/* init thread args with own index lists */
-		threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
-		threads_args = (check_indexes_arg *) palloc(sizeof(check_indexes_arg)*num_threads);
+		parray_concat(index_list, db_index_list);
+		parray_free(db_index_list);
+	}
 
-		for (j = 0; j < num_threads; j++)
-		{
-			check_indexes_arg *arg = &(threads_args[j]);
+	/* cleanup */
+	PQclear(res_db);
 
-			arg->index_list = index_list;
-			arg->conn_arg.conn = NULL;
-			arg->conn_arg.cancel_conn = NULL;
+	parray_qsort(index_list, pg_indexEntry_cmp_size_desc);
+	pg_atomic_init_u32(&next_index, 0);
 
-			arg->conn_opt.pghost = conn_opt.pghost;
-			arg->conn_opt.pgport = conn_opt.pgport;
-			arg->conn_opt.pgdatabase = dbname;
-			arg->conn_opt.pguser = conn_opt.pguser;
+	/* init thread args with the common index list */
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	threads_args = (check_indexes_arg *) palloc(sizeof(check_indexes_arg)*num_threads);
 
-			arg->thread_num = j + 1;
-			/* By default there are some error */
-			arg->ret = 1;
-		}
+	for (i = 0; i < num_threads; i++)
+	{
+		check_indexes_arg *arg = &(threads_args[i]);
+
+		arg->index_list = index_list;
+		arg->next_index = &next_index;
+		arg->conn_arg.conn = NULL;
+		arg->conn_arg.cancel_conn = NULL;
+		arg->conn_db = NULL;
+
+		arg->conn_opt.pghost = conn_opt.pghost;
+		arg->conn_opt.pgport = conn_opt.pgport;
+		arg->conn_opt.pgdatabase = NULL;
+		arg->conn_opt.pguser = conn_opt.pguser;
+
+		arg->thread_num = i + 1;
+		/* By default there are some error */
+		arg->ret = 1;
+	}
+
+	/* Run threads */
+	for (i = 0; i < num_threads; i++)
+	{
+		check_indexes_arg *arg = &(threads_args[i]);
+		elog(VERBOSE, "Start thread num: %i", i);
+		pthread_create(&threads[i], NULL, check_indexes, arg);
+	}
+
+	/* Wait threads */
+	for (i = 0; i < num_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		if (threads_args[i].ret > 0)
+			check_isok = false;
+	}
+
+	/* Report results per database and close pooled connections */
+	for (i = 0; i < parray_num(databases); i++)
+	{
+		amcheck_database *db = (amcheck_database *) parray_get(databases, i);
+		int			j;
 
-		/* Run threads */
-		for (j = 0; j < num_threads; j++)
+		/* databases without amcheck were reported already */
+		if (db->amchecked && !interrupted)
 		{
-			check_indexes_arg *arg = &(threads_args[j]);
-			elog(VERBOSE, "Start thread num: %i", j);
-			pthread_create(&threads[j], NULL, check_indexes, arg);
+			if (!db->failed)
+				elog(INFO, "Amcheck succeeded for database '%s'", db->dbname);
+			else
+				elog(WARNING, "Amcheck failed for database '%s'", db->dbname);
 		}
 
-		/* Wait threads */
-		for (j = 0; j < num_threads; j++)
+		for (j = 0; j < parray_num(db->idle_conns); j++)
+			pgut_disconnect((PGconn *) parray_get(db->idle_conns, j));
+		parray_free(db->idle_conns);
+	}
+	amcheck_pool_size = 0;
+
+	/* Report the slowest indexes */
+	if (!interrupted && parray_num(index_list) > 0)
+	{
+		parray_qsort(index_list, pg_indexEntry_cmp_duration_desc);
+
+		for (i = 0; i < Min(parray_num(index_list), AMCHECK_REPORT_SLOWEST); i++)
 		{
-			pthread_join(threads[j], NULL);
-			if (threads_args[j].ret > 0)
-				check_isok = false;
+			pg_indexEntry *ind = (pg_indexEntry *) parray_get(index_list, i);
+			char		size_str[20];
+
+			pretty_size(ind->size, size_str, lengthof(size_str));
+			elog(INFO, "Slowest index %d: '%s.%s' in database '%s', size: %s, time elapsed: %.3f sec",
+				 i + 1, ind->namespace, ind->name, ind->db->dbname,
+				 size_str, ind->duration);
 		}
+	}
 
-		if (check_isok)
-			elog(INFO, "Amcheck succeeded for database '%s'", dbname);
-		else
-			elog(WARNING, "Amcheck failed for database '%s'", dbname);
+	parray_walk(index_list, pg_indexEntry_free);
+	parray_free(index_list);
 
-		parray_walk(index_list, pg_indexEntry_free);
-		parray_free(index_list);
+	for (i = 0; i < parray_num(databases); i++)
+	{
+		amcheck_database *db = (amcheck_database *) parray_get(databases, i);
 
-		if (interrupted)
-			break;
+		free(db->dbname);
+		free(db);
 	}
+	parray_free(databases);
 
-	/* cleanup */
-	PQclear(res_db);
+	pfree(threads);
+	pfree(threads_args);
 
 	/* Inform user about amcheck results */
 	if (interrupted)
@@ -17,6 +17,10 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
 #ifdef HAVE_LIBZ
 #include <zlib.h>
@@ -33,6 +37,50 @@ typedef struct DataPage
 
 static bool get_page_header(FILE *in, const char *fullpath, BackupPageHeader *bph,
 							pg_crc32 *crc, bool use_crc32c);
+static bool restore_data_file_planned(parray *parent_chain, pgFile *dest_file, FILE *out,
+									  const char *to_fullpath, PageState *checksum_map,
+									  XLogRecPtr shift_lsn, datapagemap_t *lsn_map,
+									  size_t *write_len);
+
+/* Block versions seen and restored by restore_data_file_planned() */
+static pthread_mutex_t restore_plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64 restore_plan_versions = 0;
+static uint64 restore_plan_blocks = 0;
+
+/*
+ * Adaptive compression (--compress-adaptive).
+ *
+ * Every thread measures the share of wall time spent in compression over
+ * windows of ADAPTIVE_WINDOW_PAGES pages. Wall time includes reading, writing
+ * and waiting for throttling, so a big share means that the thread is bound
+ * by CPU, and the zlib level is lowered, a small share means that it is bound
+ * by I/O, and heavier compression is used to write less. New level is applied
+ * to the next file, so each file is compressed with a single level, which is
+ * recorded in the file list.
+ *
+ * Also, if ADAPTIVE_POOR_PAGES pages in a row are not shrunk by at least
+ * 1/ADAPTIVE_POOR_RATIO, following pages without free space in the middle
+ * are stored uncompressed, with compression retried every
+ * ADAPTIVE_PROBE_PAGES pages.
+ */
+#define ADAPTIVE_WINDOW_PAGES	2048
+#define ADAPTIVE_CPU_HIGH		0.5
+#define ADAPTIVE_CPU_LOW		0.2
+#define ADAPTIVE_POOR_PAGES		8
+#define ADAPTIVE_POOR_RATIO		16
+#define ADAPTIVE_PROBE_PAGES	64
+
+typedef struct AdaptiveCompress
+{
+	int			level;			/* level for the next file, 0 if not set */
+	int			n_pages;		/* pages compressed in the current window */
+	uint64		window_start;
+	uint64		compress_time;	/* nanoseconds spent in do_compress() */
+	int			poor_pages;		/* pages in a row with poor ratio */
+	int			stored_pages;	/* pages stored uncompressed since last try */
+} AdaptiveCompress;
+
+static __thread AdaptiveCompress adaptive = {0};
 
 #ifdef HAVE_LIBZ
 /* Implementation of zlib compression method */
@@ -287,6 +335,7 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 	bool		page_is_valid = false;
 	BlockNumber absolute_blknum = file->segno * RELSEG_SIZE + blknum;
 	int rc = 0;
+	uint64		start;
 
 	/* check for interrupt */
 	if (interrupted || thread_interrupted)
@@ -300,7 +349,13 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 	while (!page_is_valid && try_again--)
 	{
 		/* read the block */
-		int read_len = fio_pread(in, page, blknum * BLCKSZ);
+		int read_len;
+
+		TIMING_START(start);
+		read_len = fio_pread(in, page, blknum * BLCKSZ);
+		TIMING_STOP(TIMING_READ, start);
+
+		throttle_read_pages(1);
 
 		/* The block could have been truncated. It is fine. */
 		if (read_len == 0)
@@ -319,9 +374,11 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 		else
 		{
 			/* We have BLCKSZ of raw data, validate it */
+			TIMING_START(start);
 			rc = validate_one_page(page, absolute_blknum,
 								   InvalidXLogRecPtr, page_st,
 								   checksum_version);
+			TIMING_STOP(TIMING_VALIDATE_PAGE, start);
 			switch (rc)
 			{
 				case PAGE_IS_ZEROED:
@@ -410,6 +467,88 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 	return PageIsOk;
 }
 
+/*
+ * Return compression level for the next data file of the thread.
+ */
+static int
+adaptive_compress_level(CompressAlg calg, int clevel)
+{
+	if (!compress_adaptive || calg != ZLIB_COMPRESS)
+		return clevel;
+
+	if (adaptive.level == 0)
+	{
+		adaptive.level = Max(clevel, 1);
+		adaptive.window_start = timing_now();
+	}
+
+	adaptive.poor_pages = 0;
+	adaptive.stored_pages = 0;
+
+	return adaptive.level;
+}
+
+/*
+ * Return true if compression of the page can be skipped, as it is
+ * unlikely to shrink.
+ */
+static bool
+adaptive_skip_compression(Page page)
+{
+	PageHeader	phdr = (PageHeader) page;
+
+	if (adaptive.poor_pages < ADAPTIVE_POOR_PAGES)
+		return false;
+
+	/* free space between line pointers and tuples is compressed well */
+	if (phdr->pd_upper > phdr->pd_lower &&
+		phdr->pd_upper - phdr->pd_lower >= BLCKSZ / ADAPTIVE_POOR_RATIO)
+		return false;
+
+	if (++adaptive.stored_pages >= ADAPTIVE_PROBE_PAGES)
+	{
+		adaptive.stored_pages = 0;
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Account compression of a page, adjust the level at the end of window.
+ */
+static void
+adaptive_account(int compressed_size, uint64 compress_time)
+{
+	uint64		now;
+	double		cpu_share;
+
+	if (compressed_size <= 0 ||
+		compressed_size > BLCKSZ - BLCKSZ / ADAPTIVE_POOR_RATIO)
+		adaptive.poor_pages++;
+	else
+		adaptive.poor_pages = 0;
+
+	adaptive.compress_time += compress_time;
+	if (++adaptive.n_pages < ADAPTIVE_WINDOW_PAGES)
+		return;
+
+	now = timing_now();
+	cpu_share = (double) adaptive.compress_time / Max(now - adaptive.window_start, 1);
+
+	if (cpu_share > ADAPTIVE_CPU_HIGH && adaptive.level > 1)
+		adaptive.level--;
+	else if (cpu_share < ADAPTIVE_CPU_LOW && adaptive.level < 9)
+		adaptive.level++;
+
+	elog(VERBOSE, "Compression took %.0f%% of time, zlib level for next files: %i",
+		 cpu_share * 100, adaptive.level);
+
+	adaptive.n_pages = 0;
+	adaptive.compress_time = 0;
+	adaptive.window_start = now;
+}
+
 /* split this function in two: compress() and backup() */
 static int
 compress_and_backup_page(pgFile *file, BlockNumber blknum,
@@ -423,12 +562,33 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 	char		write_buffer[BLCKSZ*2]; /* compressed page may require more space than uncompressed */
 	BackupPageHeader* bph = (BackupPageHeader*)write_buffer;
 	const char *errormsg = NULL;
+	uint64		start;
 
 	/* Compress the page */
-	compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
-								  sizeof(write_buffer) - sizeof(BackupPageHeader),
-								  page, BLCKSZ, calg, clevel,
-								  &errormsg);
+	if (compress_adaptive && calg == ZLIB_COMPRESS)
+	{
+		if (adaptive_skip_compression(page))
+			compressed_size = BLCKSZ;
+		else
+		{
+			start = timing_now();
+			compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
+										  sizeof(write_buffer) - sizeof(BackupPageHeader),
+										  page, BLCKSZ, calg, clevel,
+										  &errormsg);
+			adaptive_account(compressed_size, timing_now() - start);
+			TIMING_STOP(TIMING_COMPRESS, start);
+		}
+	}
+	else
+	{
+		TIMING_START(start);
+		compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
+									  sizeof(write_buffer) - sizeof(BackupPageHeader),
+									  page, BLCKSZ, calg, clevel,
+									  &errormsg);
+		TIMING_STOP(TIMING_COMPRESS, start);
+	}
 	/* Something went wrong and errormsg was assigned, throw a warning */
 	if (compressed_size < 0 && errormsg != NULL)
 		elog(WARNING, "An error occured during compressing block %u of file \"%s\": %s",
@@ -451,9 +611,13 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 	COMP_FILE_CRC32(true, *crc, write_buffer, write_buffer_size);
 
 	/* write data page */
+	TIMING_START(start);
 	if (fio_fwrite(out, write_buffer, write_buffer_size) != write_buffer_size)
 		elog(ERROR, "File: \"%s\", cannot write at block %u: %s",
 			 to_fullpath, blknum, strerror(errno));
+	TIMING_STOP(TIMING_WRITE, start);
+
+	throttle_write(write_buffer_size);
 
 	file->write_size += write_buffer_size;
 	file->uncompressed_size += BLCKSZ;
@@ -465,9 +629,15 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 static int
 write_page(pgFile *file, FILE *out, Page page)
 {
+	uint64		start;
+
 	/* write data page */
+	TIMING_START(start);
 	if (fio_fwrite(out, page, BLCKSZ) != BLCKSZ)
 		return -1;
+	TIMING_STOP(TIMING_WRITE, start);
+
+	throttle_write(BLCKSZ);
 
 	file->write_size += BLCKSZ;
 	file->uncompressed_size += BLCKSZ;
@@ -531,6 +701,10 @@ backup_data_file(pgFile *file, const char *from_fullpath, const char *to_fullpat
 	file->uncompressed_size = 0;
 	INIT_FILE_CRC32(true, file->crc);
 
+	clevel = adaptive_compress_level(calg, clevel);
+	if (calg == ZLIB_COMPRESS)
+		file->compress_level = clevel;
+
 	/*
 	 * Read each page, verify checksum and write it to backup.
 	 * If page map is empty or file is not present in previous backup
@@ -827,9 +1001,21 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 				  XLogRecPtr shift_lsn, datapagemap_t *lsn_map, bool use_headers)
 {
 	size_t total_write_len = 0;
-	char  *in_buf = pgut_malloc(STDIO_BUFSIZE);
+	char  *in_buf = NULL;
 	int    backup_seq = 0;
 
+	/*
+	 * If every backup of the chain has page headers, collapse the chain
+	 * into a single pass over the destination file.
+	 */
+	if (use_bitmap && use_headers && parray_num(parent_chain) > 1 &&
+		restore_data_file_planned(parent_chain, dest_file, out, to_fullpath,
+								  checksum_map, shift_lsn, lsn_map,
+								  &total_write_len))
+		return total_write_len;
+
+	in_buf = pgut_malloc(STDIO_BUFSIZE);
+
 	/*
 	 * FULL -> INCR -> DEST
 	 *  2       1       0
@@ -938,6 +1124,319 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 	return total_write_len;
 }
 
+/* Run of consecutive blocks to be written by restore at once */
+typedef struct RestoreStage
+{
+	char	   *buf;
+	int			capacity;	/* max number of blocks in buf */
+	BlockNumber	start;		/* first staged block */
+	int			count;		/* number of staged blocks */
+} RestoreStage;
+
+/*
+ * Write blocks staged by restore_data_file_internal() with a single write.
+ */
+static void
+restore_stage_flush(RestoreStage *stage, FILE *out, off_t *cur_pos_out,
+					const char *to_fullpath)
+{
+	off_t		write_pos = (off_t) stage->start * BLCKSZ;
+	size_t		len = (size_t) stage->count * BLCKSZ;
+	uint64		write_start;
+
+	if (stage->count == 0)
+		return;
+
+	if (*cur_pos_out != write_pos &&
+		fio_fseek(out, write_pos) < 0)
+		elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+			 stage->start, to_fullpath, strerror(errno));
+
+	TIMING_START(write_start);
+	if (fio_fwrite(out, stage->buf, len) != len)
+		elog(ERROR, "Cannot write blocks %u-%u of \"%s\": %s",
+			 stage->start, stage->start + stage->count - 1,
+			 to_fullpath, strerror(errno));
+	TIMING_STOP(TIMING_WRITE, write_start);
+
+	throttle_write(len);
+
+	*cur_pos_out = write_pos + len;
+	stage->count = 0;
+}
+
+/* Member of the backup chain, from which blocks of a file are restored */
+typedef struct RestoreSource
+{
+	pgBackup   *backup;
+	pgFile	   *file;
+	BackupPageHeader2 *headers;
+	FILE	   *in;
+	char	   *in_buf;
+	off_t		cur_pos_in;
+	char		fullpath[MAXPGPATH];
+} RestoreSource;
+
+/*
+ * Restore data file from the whole chain at once.
+ *
+ * Page headers of every chain member are loaded up front and collapsed into
+ * a plan, which tells for every block of the destination file the newest
+ * backup containing it. Then blocks are restored in ascending order, each
+ * of them is read from exactly one backup and written exactly once, so the
+ * destination file is written sequentially in large runs, and backups whose
+ * blocks are all superseded by newer ones are not even opened.
+ *
+ * Return false without restoring anything if the plan cannot be built,
+ * because some chain member was taken by version older than 2.4.0 and has
+ * no separate page headers, or the destination is remote, where compressed
+ * pages are sent as is. The caller falls back to restore backup by backup.
+ */
+static bool
+restore_data_file_planned(parray *parent_chain, pgFile *dest_file, FILE *out,
+						  const char *to_fullpath, PageState *checksum_map,
+						  XLogRecPtr shift_lsn, datapagemap_t *lsn_map,
+						  size_t *write_len)
+{
+	BlockNumber	nblocks = dest_file->n_blocks;
+	int			n_sources = 0;
+	RestoreSource *sources;
+	int16	   *plan_source;
+	int32	   *plan_header;
+	uint64		n_versions = 0;
+	uint64		n_planned = 0;
+	BlockNumber	blknum;
+	off_t		cur_pos_out = 0;
+	RestoreStage stage = {NULL, 0, 0, 0};
+	int			i;
+
+	if (fio_is_remote_file(out) || dest_file->n_blocks <= 0)
+		return false;
+
+	sources = pgut_malloc0(sizeof(RestoreSource) * parray_num(parent_chain));
+
+	/* collect chain members with something to restore, newest first */
+	for (i = 0; i < parray_num(parent_chain); i++)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+		pgFile	  **res_file;
+		pgFile	   *tmp_file;
+		RestoreSource *src;
+
+		res_file = parray_bsearch(backup->files, dest_file, pgFileCompareRelPathWithExternal);
+		tmp_file = (res_file) ? *res_file : NULL;
+
+		/* see restore_data_file() for the meaning of these cases */
+		if (tmp_file == NULL ||
+			tmp_file->write_size == BYTES_INVALID ||
+			tmp_file->write_size == 0)
+			continue;
+
+		/* blocks are known only after reading the whole file */
+		if (tmp_file->n_headers <= 0)
+		{
+			while (n_sources > 0)
+				pg_free(sources[--n_sources].headers);
+			pg_free(sources);
+			return false;
+		}
+
+		src = &sources[n_sources++];
+		src->backup = backup;
+		src->file = tmp_file;
+		join_path_components(src->fullpath, backup->root_dir, DATABASE_DIR);
+		join_path_components(src->fullpath, src->fullpath, tmp_file->rel_path);
+
+		src->headers = get_data_file_headers(&(backup->hdr_map), tmp_file,
+											 parse_program_version(backup->program_version),
+											 true);
+		if (!src->headers)
+			elog(ERROR, "Failed to get page headers for file \"%s\"", src->fullpath);
+	}
+
+	/* the newest backup containing a block wins */
+	plan_source = pgut_malloc(sizeof(int16) * nblocks);
+	plan_header = pgut_malloc(sizeof(int32) * nblocks);
+	memset(plan_source, -1, sizeof(int16) * nblocks);
+
+	for (i = 0; i < n_sources; i++)
+	{
+		int			n_hdr;
+
+		for (n_hdr = 0; n_hdr < sources[i].file->n_headers; n_hdr++)
+		{
+			blknum = sources[i].headers[n_hdr].block;
+
+			/* no point in writing redundant data */
+			if (blknum >= nblocks)
+				break;
+
+			n_versions++;
+			if (plan_source[blknum] < 0)
+			{
+				plan_source[blknum] = i;
+				plan_header[blknum] = n_hdr;
+				n_planned++;
+			}
+		}
+	}
+
+	stage.capacity = Min(nblocks, RESTORE_STAGE_PAGES);
+	stage.buf = pgut_malloc((size_t) stage.capacity * BLCKSZ);
+
+	if (fio_fseek(out, cur_pos_out) < 0)
+		elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+			 0, to_fullpath, strerror(errno));
+
+	for (blknum = 0; blknum < nblocks; blknum++)
+	{
+		RestoreSource *src;
+		BackupPageHeader2 *hdr;
+		DataPage	page;
+		int32		compressed_size;
+		size_t		read_len;
+		char	   *dst;
+
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during data file restore");
+
+		if (plan_source[blknum] < 0)
+			continue;
+
+		src = &sources[plan_source[blknum]];
+		hdr = &src->headers[plan_header[blknum]];
+
+		/* Incremental restore in LSN mode, shiftmap can be used only if backup precedes the shift */
+		if (lsn_map && src->backup->stop_lsn <= shift_lsn &&
+			datapagemap_is_set(lsn_map, blknum))
+			continue;
+
+		/* Incremental restore in CHECKSUM mode */
+		if (checksum_map && checksum_map[blknum].checksum != 0 &&
+			hdr->checksum == checksum_map[blknum].checksum &&
+			hdr->lsn == checksum_map[blknum].lsn)
+			continue;
+
+		if (src->in == NULL)
+		{
+			src->in = fopen(src->fullpath, PG_BINARY_R);
+			if (src->in == NULL)
+				elog(ERROR, "Cannot open backup file \"%s\": %s", src->fullpath,
+					 strerror(errno));
+
+			src->in_buf = pgut_malloc(STDIO_BUFSIZE);
+			setvbuf(src->in, src->in_buf, _IOFBF, STDIO_BUFSIZE);
+		}
+
+		/* payload size is the distance to the next page, without page header */
+		compressed_size = hdr[1].pos - hdr->pos - sizeof(BackupPageHeader);
+		if (compressed_size <= 0 || compressed_size > BLCKSZ)
+			elog(ERROR, "Size of a blknum %i exceed BLCKSZ: %i", blknum, compressed_size);
+
+		read_len = compressed_size + sizeof(BackupPageHeader);
+
+		if (src->cur_pos_in != hdr->pos)
+		{
+			if (fseek(src->in, hdr->pos, SEEK_SET) != 0)
+				elog(ERROR, "Cannot seek to offset %u of \"%s\": %s",
+					 hdr->pos, src->fullpath, strerror(errno));
+
+			src->cur_pos_in = hdr->pos;
+		}
+
+		if (fread(&page, 1, read_len, src->in) != read_len)
+			elog(ERROR, "Cannot read block %u file \"%s\": %s",
+				 blknum, src->fullpath, strerror(errno));
+
+		src->cur_pos_in += read_len;
+
+		/* add the page to the current run of blocks, flush it if the run ends */
+		if (stage.count > 0 &&
+			(blknum != stage.start + stage.count ||
+			 stage.count == stage.capacity))
+			restore_stage_flush(&stage, out, &cur_pos_out, to_fullpath);
+
+		if (stage.count == 0)
+			stage.start = blknum;
+
+		dst = stage.buf + (size_t) stage.count * BLCKSZ;
+
+		if (compressed_size != BLCKSZ ||
+			page_may_be_compressed(page.data, src->file->compress_alg,
+								   parse_program_version(src->backup->program_version)))
+		{
+			char	   *errormsg = NULL;
+			int32		decompressed_size;
+
+			decompressed_size = fio_decompress(dst, page.data, compressed_size,
+											   src->file->compress_alg, &errormsg);
+			if (decompressed_size < 0)
+				elog(ERROR, "%s", errormsg);
+			if (decompressed_size != BLCKSZ)
+				elog(ERROR, "Cannot write block %u of \"%s\": decompressed size %d, "
+					 "compressed size: %u", blknum, to_fullpath,
+					 decompressed_size, compressed_size);
+		}
+		else
+			memcpy(dst, page.data, BLCKSZ);
+
+		stage.count++;
+		*write_len += BLCKSZ;
+	}
+
+	restore_stage_flush(&stage, out, &cur_pos_out, to_fullpath);
+	pg_free(stage.buf);
+
+	for (i = 0; i < n_sources; i++)
+	{
+		if (sources[i].in && fclose(sources[i].in) != 0)
+			elog(ERROR, "Cannot close file \"%s\": %s", sources[i].fullpath,
+				 strerror(errno));
+
+		pg_free(sources[i].in_buf);
+		pg_free(sources[i].headers);
+	}
+
+	pg_free(sources);
+	pg_free(plan_source);
+	pg_free(plan_header);
+
+	elog(VERBOSE, "Restored file \"%s\" from %d backups: %lu bytes, "
+		 UINT64_FORMAT " of " UINT64_FORMAT " block versions in the chain are skipped",
+		 to_fullpath, n_sources, *write_len, n_versions - n_planned, n_versions);
+
+	pthread_lock(&restore_plan_lock);
+	restore_plan_versions += n_versions;
+	restore_plan_blocks += n_planned;
+	pthread_mutex_unlock(&restore_plan_lock);
+
+	return true;
+}
+
+/*
+ * Report how many reads and writes were saved by restore_data_file_planned()
+ * compared to restoring every backup of the chain in turn.
+ */
+void
+restore_plan_report(void)
+{
+	char		pretty_versions[20];
+	char		pretty_saved[20];
+
+	if (restore_plan_versions == 0)
+		return;
+
+	pretty_size(restore_plan_versions * BLCKSZ, pretty_versions, lengthof(pretty_versions));
+	pretty_size((restore_plan_versions - restore_plan_blocks) * BLCKSZ,
+				pretty_saved, lengthof(pretty_saved));
+
+	elog(INFO, "Restore of incremental chain: %s of block versions, "
+		 "%s (%.f%%) superseded by newer backups are neither read nor written",
+		 pretty_versions, pretty_saved,
+		 (double) (restore_plan_versions - restore_plan_blocks) * 100 / restore_plan_versions);
+}
+
 /* Restore block from "in" file to "out" file.
  * If "nblocks" is greater than zero, then skip restoring blocks,
  * whose position if greater than "nblocks".
@@ -946,6 +1445,11 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
  * backup. We restoring from newest to oldest and page, once restored, marked in map.
  * When the same page, but in older backup, encountered, we check the map, if it is
  * marked as already restored, then page is skipped.
+ *
+ * Locally, consecutive blocks are decompressed into a staging buffer and
+ * written with one write per run, so that restoring a block range costs
+ * one seek and one write instead of a write per block. In remote mode
+ * compressed blocks are sent to the agent as is, to save the network.
  */
 size_t
 restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_version,
@@ -958,10 +1462,19 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 	size_t write_len = 0;
 	off_t cur_pos_out = 0;
 	off_t cur_pos_in = 0;
+	uint64 write_start;
+	RestoreStage stage = {NULL, 0, 0, 0};
 
 	/* should not be possible */
 	Assert(!(backup_version >= 20400 && file->n_headers <= 0));
 
+	if (!fio_is_remote_file(out))
+	{
+		stage.capacity = nblocks > 0 ? Min(nblocks, RESTORE_STAGE_PAGES) :
+									   RESTORE_STAGE_PAGES;
+		stage.buf = pgut_malloc((size_t) stage.capacity * BLCKSZ);
+	}
+
 	/*
 	 * We rely on stdio buffering of input and output.
 	 * For buffering to be efficient, we try to minimize the
@@ -1064,6 +1577,9 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 
 			elog(VERBOSE, "Truncate file \"%s\" to block %u", to_fullpath, blknum);
 
+			if (stage.buf)
+				restore_stage_flush(&stage, out, &cur_pos_out, to_fullpath);
+
 			/* To correctly truncate file, we must first flush STDIO buffers */
 			if (fio_fflush(out) != 0)
 				elog(ERROR, "Cannot flush file \"%s\": %s", to_fullpath, strerror(errno));
@@ -1153,6 +1669,47 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 			is_compressed = true;
 		}
 
+		/* Add the page to the current run of blocks, flush it if the run ends */
+		if (stage.buf)
+		{
+			char	   *dst;
+
+			if (stage.count > 0 &&
+				(blknum != stage.start + stage.count ||
+				 stage.count == stage.capacity))
+				restore_stage_flush(&stage, out, &cur_pos_out, to_fullpath);
+
+			if (stage.count == 0)
+				stage.start = blknum;
+
+			dst = stage.buf + (size_t) stage.count * BLCKSZ;
+
+			if (is_compressed)
+			{
+				char	   *errormsg = NULL;
+				int32		decompressed_size;
+
+				decompressed_size = fio_decompress(dst, page.data, compressed_size,
+												   file->compress_alg, &errormsg);
+				if (decompressed_size < 0)
+					elog(ERROR, "%s", errormsg);
+				if (decompressed_size != BLCKSZ)
+					elog(ERROR, "Cannot write block %u of \"%s\": decompressed size %d, "
+						 "compressed size: %u", blknum, to_fullpath,
+						 decompressed_size, compressed_size);
+			}
+			else
+				memcpy(dst, page.data, BLCKSZ);
+
+			stage.count++;
+			write_len += BLCKSZ;
+
+			/* Mark page as restored to avoid reading this page when restoring parent backups */
+			if (map)
+				datapagemap_add(map, blknum);
+			continue;
+		}
+
 		/*
 		 * Seek and write the restored page.
 		 * When restoring file from FULL backup, pages are written sequentially,
@@ -1173,6 +1730,7 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 		 * If page is compressed and restore is in remote mode,
 		 * send compressed page to the remote side.
 		 */
+		TIMING_START(write_start);
 		if (is_compressed)
 		{
 			ssize_t rc;
@@ -1188,6 +1746,9 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 				elog(ERROR, "Cannot write block %u of \"%s\": %s",
 					 blknum, to_fullpath, strerror(errno));
 		}
+		TIMING_STOP(TIMING_WRITE, write_start);
+
+		throttle_write(BLCKSZ);
 
 		write_len += BLCKSZ;
 		cur_pos_out += BLCKSZ; /* update current write position */
@@ -1197,6 +1758,12 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 			datapagemap_add(map, blknum);
 	}
 
+	if (stage.buf)
+	{
+		restore_stage_flush(&stage, out, &cur_pos_out, to_fullpath);
+		pg_free(stage.buf);
+	}
+
 	elog(VERBOSE, "Copied file \"%s\": %lu bytes", from_fullpath, write_len);
 	return write_len;
 }
@@ -1206,6 +1773,65 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
  * We do not apply compression to these files, because
  * it is either small control file or already compressed cfs file.
  */
+#ifdef HAVE_LIBZ
+/*
+ * Decompress gzip-compressed WAL segment, stored in pg_wal of stream backup.
+ */
+static void
+restore_compressed_wal_file(FILE *in, FILE *out, char *buf,
+							const char *from_fullpath, const char *to_fullpath)
+{
+	char	   *in_buf = pgut_malloc(STDIO_BUFSIZE);
+	z_stream	z;
+	int			rc = Z_OK;
+
+	MemSet(&z, 0, sizeof(z));
+	/* add 16 to window bits to expect gzip header */
+	if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK)
+		elog(ERROR, "Cannot initialize decompression of \"%s\": %s",
+			 from_fullpath, z.msg ? z.msg : "unknown error");
+
+	while (rc != Z_STREAM_END)
+	{
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during nonedata file restore");
+
+		if (z.avail_in == 0)
+		{
+			z.avail_in = fread(in_buf, 1, STDIO_BUFSIZE, in);
+			z.next_in = (Bytef *) in_buf;
+
+			if (ferror(in))
+				elog(ERROR, "Cannot read backup file \"%s\": %s",
+					 from_fullpath, strerror(errno));
+
+			if (z.avail_in == 0)
+				elog(ERROR, "Cannot decompress backup file \"%s\": unexpected end of file",
+					 from_fullpath);
+		}
+
+		z.next_out = (Bytef *) buf;
+		z.avail_out = STDIO_BUFSIZE;
+
+		rc = inflate(&z, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END)
+			elog(ERROR, "Cannot decompress backup file \"%s\": %s",
+				 from_fullpath, z.msg ? z.msg : "unknown error");
+
+		if (z.avail_out < STDIO_BUFSIZE &&
+			fio_fwrite_async(out, buf, STDIO_BUFSIZE - z.avail_out) != STDIO_BUFSIZE - z.avail_out)
+			elog(ERROR, "Cannot write to \"%s\": %s", to_fullpath,
+				 strerror(errno));
+	}
+
+	inflateEnd(&z);
+	pg_free(in_buf);
+
+	elog(VERBOSE, "Decompressed file \"%s\": %lu bytes", from_fullpath, z.total_out);
+}
+#endif
+
 void
 restore_non_data_file_internal(FILE *in, FILE *out, pgFile *file,
 							   const char *from_fullpath, const char *to_fullpath)
@@ -1213,6 +1839,16 @@ restore_non_data_file_internal(FILE *in, FILE *out, pgFile *file,
 	size_t read_len = 0;
 	char  *buf = pgut_malloc(STDIO_BUFSIZE); /* 64kB buffer */
 
+#ifdef HAVE_LIBZ
+	/* streamed WAL segment compressed during backup */
+	if (file->compress_alg == ZLIB_COMPRESS)
+	{
+		restore_compressed_wal_file(in, out, buf, from_fullpath, to_fullpath);
+		pg_free(buf);
+		return;
+	}
+#endif
+
 	/* copy content */
 	for (;;)
 	{
@@ -1233,6 +1869,8 @@ restore_non_data_file_internal(FILE *in, FILE *out, pgFile *file,
 			if (fio_fwrite_async(out, buf, read_len) != read_len)
 				elog(ERROR, "Cannot write to \"%s\": %s", to_fullpath,
 					 strerror(errno));
+
+			throttle_write(read_len);
 		}
 
 		if (feof(in))
@@ -1388,6 +2026,7 @@ backup_non_data_file_internal(const char *from_fullpath,
 	FILE	*out = NULL;
 	ssize_t  read_len = 0;
 	char	*buf = NULL;
+	uint64	 write_start;
 
 	INIT_FILE_CRC32(true, file->crc);
 
@@ -1480,9 +2119,14 @@ backup_non_data_file_internal(const char *from_fullpath,
 
 			if (read_len > 0)
 			{
+				TIMING_START(write_start);
 				if (fwrite(buf, 1, read_len, out) != read_len)
 					elog(ERROR, "Cannot write to file \"%s\": %s", to_fullpath,
 						 strerror(errno));
+				TIMING_STOP(TIMING_WRITE, write_start);
+
+				throttle_read(read_len);
+				throttle_write(read_len);
 
 				/* update CRC */
 				COMP_FILE_CRC32(true, file->crc, buf, read_len);
@@ -1600,7 +2244,12 @@ validate_one_page(Page page, BlockNumber absolute_blkno,
 }
 
 /*
- * Validate pages of datafile in PGDATA one by one.
+ * Validate pages of datafile in PGDATA.
+ *
+ * Pages are read in chunks of CHECKDB_READ_CHUNK_PAGES and validated in
+ * memory. Only pages which look broken are read again one by one by
+ * prepare_page(), with retries, because a page could have been read
+ * in the middle of a concurrent write.
  *
  * returns true if the file is valid
  * also returns true if the file was not found
@@ -1613,8 +2262,10 @@ check_data_file(ConnectionArgs *arguments, pgFile *file,
 	BlockNumber	blknum = 0;
 	BlockNumber	nblocks = 0;
 	int			page_state;
-	char		curr_page[BLCKSZ];
+	char		*chunk;
 	bool		is_valid = true;
+	bool		is_truncated = false;
+	uint64		start;
 
 	in = fopen(from_fullpath, PG_BINARY_R);
 	if (in == NULL)
@@ -1644,61 +2295,129 @@ check_data_file(ConnectionArgs *arguments, pgFile *file,
 	 */
 	nblocks = file->size/BLCKSZ;
 
-	for (blknum = 0; blknum < nblocks; blknum++)
+	/* reads of this size go to the file directly, bypassing stdio buffer */
+	chunk = pgut_malloc((size_t) Max(Min(nblocks, CHECKDB_READ_CHUNK_PAGES), 1) * BLCKSZ);
+
+	while (blknum < nblocks && !is_truncated)
 	{
-		PageState page_st;
-		page_state = prepare_page(file, InvalidXLogRecPtr,
-								  blknum, in, BACKUP_MODE_FULL,
-								  curr_page, false, checksum_version,
-								  from_fullpath, &page_st);
+		BlockNumber	n_pages = Min(nblocks - blknum, CHECKDB_READ_CHUNK_PAGES);
+		size_t		read_len;
+		BlockNumber	n_read;
+		BlockNumber	i;
 
-		if (page_state == PageIsTruncated)
-			break;
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during page reading");
+
+		TIMING_START(start);
+		if (fseek(in, (off_t) blknum * BLCKSZ, SEEK_SET) != 0)
+			elog(ERROR, "Cannot seek to block %u of \"%s\": %s",
+				 blknum, from_fullpath, strerror(errno));
+
+		read_len = fread(chunk, 1, (size_t) n_pages * BLCKSZ, in);
+		if (ferror(in))
+			elog(ERROR, "Cannot read block %u of \"%s\": %s",
+				 blknum, from_fullpath, strerror(errno));
+		TIMING_STOP(TIMING_READ, start);
 
-		if (page_state == PageIsCorrupted)
+		n_read = read_len / BLCKSZ;
+		throttle_read_pages(n_read);
+
+		/*
+		 * The file was truncated or the last page was read partially,
+		 * let prepare_page() sort it out.
+		 */
+		if (n_read == 0)
 		{
-			/* Page is corrupted, no need to elog about it,
-			 * prepare_page() already done that
-			 */
-			is_valid = false;
+			PageState page_st;
+
+			page_state = prepare_page(file, InvalidXLogRecPtr,
+									  blknum, in, BACKUP_MODE_FULL,
+									  chunk, false, checksum_version,
+									  from_fullpath, &page_st);
+			if (page_state == PageIsTruncated)
+				break;
+			if (page_state == PageIsCorrupted)
+				is_valid = false;
+
+			blknum++;
 			continue;
 		}
+
+		for (i = 0; i < n_read; i++)
+		{
+			PageState page_st;
+			Page		page = chunk + (size_t) i * BLCKSZ;
+			int			rc;
+
+			TIMING_START(start);
+			rc = validate_one_page(page, file->segno * RELSEG_SIZE + blknum + i,
+								   InvalidXLogRecPtr, &page_st,
+								   checksum_version);
+			TIMING_STOP(TIMING_VALIDATE_PAGE, start);
+
+			if (rc == PAGE_IS_VALID || rc == PAGE_IS_ZEROED)
+				continue;
+
+			/* Suspect page, read it again one more time and retry */
+			page_state = prepare_page(file, InvalidXLogRecPtr,
+									  blknum + i, in, BACKUP_MODE_FULL,
+									  page, false, checksum_version,
+									  from_fullpath, &page_st);
+
+			if (page_state == PageIsTruncated)
+			{
+				is_truncated = true;
+				break;
+			}
+
+			if (page_state == PageIsCorrupted)
+			{
+				/* Page is corrupted, no need to elog about it,
+				 * prepare_page() already done that
+				 */
+				is_valid = false;
+			}
+		}
+
+		blknum += n_read;
 	}
 
+	pg_free(chunk);
 	fclose(in);
 	return is_valid;
 }
 
-/* Valiate pages of datafile in backup one by one */
+/*
+ * Valiate pages of datafile in backup one by one.
+ * File "in" is opened by the caller, who closes it afterwards and is
+ * expected to set large stdio buffer for it.
+ */
 bool
-validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
+validate_file_pages(pgFile *file, FILE *in, const char *fullpath, XLogRecPtr stop_lsn,
 					uint32 checksum_version, uint32 backup_version, HeaderMap *hdr_map)
 {
 	size_t		read_len = 0;
 	bool		is_valid = true;
-	FILE		*in;
 	pg_crc32	crc;
 	bool		use_crc32c = backup_version <= 20021 || backup_version >= 20025;
 	BackupPageHeader2 *headers = NULL;
 	int         n_hdr = -1;
 	off_t       cur_pos_in = 0;
+	off_t		prefetch_pos = 0;
+	uint64		validate_start;
 
 	elog(VERBOSE, "Validate relation blocks for file \"%s\"", fullpath);
 
 	/* should not be possible */
 	Assert(!(backup_version >= 20400 && file->n_headers <= 0));
 
-	in = fopen(fullpath, PG_BINARY_R);
-	if (in == NULL)
-		elog(ERROR, "Cannot open file \"%s\": %s",
-			 fullpath, strerror(errno));
-
 	headers = get_data_file_headers(hdr_map, file, backup_version, false);
 
 	if (!headers && file->n_headers > 0)
 	{
 		elog(WARNING, "Cannot get page headers for file \"%s\"", fullpath);
-		return false;
+		is_valid = false;
+		goto cleanup;
 	}
 
 	/* calc CRC of backup file */
@@ -1718,6 +2437,14 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during data file validation");
 
+		/* keep the kernel reading one chunk ahead of validation */
+		if (cur_pos_in + LARGE_CHUNK_SIZE > prefetch_pos &&
+			prefetch_pos < file->write_size)
+		{
+			prefetch_file_range(fileno(in), prefetch_pos, LARGE_CHUNK_SIZE);
+			prefetch_pos += LARGE_CHUNK_SIZE;
+		}
+
 		/* newer backups have page headers in separate storage */
 		if (headers)
 		{
@@ -1783,7 +2510,8 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 		{
 			elog(WARNING, "Cannot read block %u file \"%s\": %s",
 				blknum, fullpath, strerror(errno));
-			return false;
+			is_valid = false;
+			goto cleanup;
 		}
 
 		/* update current position */
@@ -1810,7 +2538,8 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 			{
 				elog(WARNING, "An error occured during decompressing block %u of file \"%s\": %s",
 					 blknum, fullpath, errormsg);
-				return false;
+				is_valid = false;
+				goto cleanup;
 			}
 
 			if (uncompressed_size != BLCKSZ)
@@ -1822,17 +2551,24 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 				}
 				elog(WARNING, "Page %u of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
 						blknum, fullpath, uncompressed_size);
-				return false;
+				is_valid = false;
+				goto cleanup;
 			}
 
+			TIMING_START(validate_start);
 			rc = validate_one_page(page.data,
 								   file->segno * RELSEG_SIZE + blknum,
 								   stop_lsn, &page_st, checksum_version);
+			TIMING_STOP(TIMING_VALIDATE_PAGE, validate_start);
 		}
 		else
+		{
+			TIMING_START(validate_start);
 			rc = validate_one_page(compressed_page.data,
 								   file->segno * RELSEG_SIZE + blknum,
 								   stop_lsn, &page_st, checksum_version);
+			TIMING_STOP(TIMING_VALIDATE_PAGE, validate_start);
+		}
 
 		switch (rc)
 		{
@@ -1862,7 +2598,6 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 	}
 
 	FIN_FILE_CRC32(use_crc32c, crc);
-	fclose(in);
 
 	if (crc != file->crc)
 	{
@@ -1871,11 +2606,25 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 		is_valid = false;
 	}
 
+cleanup:
 	pg_free(headers);
 
 	return is_valid;
 }
 
+/*
+ * Ask the kernel to read the range of the file ahead, so that I/O overlaps
+ * with processing of the data read before. No-op where posix_fadvise()
+ * is not available.
+ */
+void
+prefetch_file_range(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	(void) posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+}
+
 /* read local data file and construct map with block checksums */
 PageState*
 get_checksum_map(const char *fullpath, uint32 checksum_version,
@@ -2359,10 +3108,191 @@ copy_pages(const char *to_fullpath, const char *from_fullpath,
 }
 
 /*
- * Attempt to open header file, read content and return as
- * array of headers.
- * TODO: some access optimizations would be great here:
- * less fseeks, buffering, descriptor sharing, etc.
+ * Cache of decompressed header arrays, shared by all threads.
+ *
+ * The same headers are often requested more than once by a command,
+ * e.g. restore validates the chain and then restores it, so recently
+ * used arrays are kept up to HDR_CACHE_SIZE bytes and evicted in LRU order.
+ * Entries are matched by path of the map, offset, size and checksum of
+ * headers, and dropped when the map is closed, so rewritten map is never
+ * served from the cache. The path is used rather than the address of the
+ * map, as HeaderMap is freed together with its backup without closing it,
+ * and the address may be reused by the map of another backup.
+ */
+#define HDR_CACHE_SIZE		(16 * 1024 * 1024)
+#define HDR_CACHE_ENTRIES	256
+
+typedef struct HeaderCacheEntry
+{
+	char	   *path;			/* path of the map */
+	pg_off_t	hdr_off;
+	int			hdr_size;
+	pg_crc32	hdr_crc;
+	size_t		len;			/* size of decompressed headers */
+	uint64		last_used;
+	BackupPageHeader2 *headers;
+} HeaderCacheEntry;
+
+static HeaderCacheEntry hdr_cache[HDR_CACHE_ENTRIES];
+static size_t hdr_cache_used = 0;
+static uint64 hdr_cache_clock = 0;
+static pthread_mutex_t hdr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return a copy of cached headers of the file, or NULL if they are not cached */
+static BackupPageHeader2 *
+header_cache_lookup(HeaderMap *hdr_map, pgFile *file, size_t len)
+{
+	BackupPageHeader2 *headers = NULL;
+	int			i;
+
+	pthread_lock(&hdr_cache_lock);
+	for (i = 0; i < HDR_CACHE_ENTRIES; i++)
+	{
+		HeaderCacheEntry *entry = &hdr_cache[i];
+
+		if (entry->headers && strcmp(entry->path, hdr_map->path) == 0 &&
+			entry->hdr_off == file->hdr_off && entry->hdr_size == file->hdr_size &&
+			entry->hdr_crc == file->hdr_crc && entry->len == len)
+		{
+			entry->last_used = ++hdr_cache_clock;
+			headers = pgut_malloc(len);
+			memcpy(headers, entry->headers, len);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&hdr_cache_lock);
+
+	return headers;
+}
+
+static void
+header_cache_evict(HeaderCacheEntry *entry)
+{
+	hdr_cache_used -= entry->len;
+	pg_free(entry->headers);
+	entry->headers = NULL;
+	pg_free(entry->path);
+	entry->path = NULL;
+}
+
+/* Remember a copy of just read headers of the file */
+static void
+header_cache_add(HeaderMap *hdr_map, pgFile *file, BackupPageHeader2 *headers,
+				 size_t len)
+{
+	HeaderCacheEntry *entry;
+	int			i;
+
+	/* a single huge file would wipe out the whole cache */
+	if (len > HDR_CACHE_SIZE / 8)
+		return;
+
+	pthread_lock(&hdr_cache_lock);
+	for (;;)
+	{
+		HeaderCacheEntry *victim = NULL;
+
+		entry = NULL;
+		for (i = 0; i < HDR_CACHE_ENTRIES; i++)
+		{
+			if (!hdr_cache[i].headers)
+				entry = &hdr_cache[i];
+			else if (!victim || hdr_cache[i].last_used < victim->last_used)
+				victim = &hdr_cache[i];
+		}
+
+		if (entry && hdr_cache_used + len <= HDR_CACHE_SIZE)
+			break;
+
+		header_cache_evict(victim);
+	}
+
+	entry->path = pgut_strdup(hdr_map->path);
+	entry->hdr_off = file->hdr_off;
+	entry->hdr_size = file->hdr_size;
+	entry->hdr_crc = file->hdr_crc;
+	entry->len = len;
+	entry->last_used = ++hdr_cache_clock;
+	entry->headers = pgut_malloc(len);
+	memcpy(entry->headers, headers, len);
+	hdr_cache_used += len;
+	pthread_mutex_unlock(&hdr_cache_lock);
+}
+
+/* Drop cached headers of the map */
+static void
+header_cache_forget(HeaderMap *hdr_map)
+{
+	int			i;
+
+	pthread_lock(&hdr_cache_lock);
+	for (i = 0; i < HDR_CACHE_ENTRIES; i++)
+		if (hdr_cache[i].headers && strcmp(hdr_cache[i].path, hdr_map->path) == 0)
+			header_cache_evict(&hdr_cache[i]);
+	pthread_mutex_unlock(&hdr_cache_lock);
+}
+
+#ifndef WIN32
+/*
+ * Return pointer to compressed headers of the file in memory-mapped header
+ * map, or NULL if they are not mapped.
+ *
+ * The map is mapped once on the first use and shared by all threads until
+ * cleanup_header_map(). Kernel is asked to read the whole map ahead, as
+ * headers of the files are requested in an order different from the order
+ * they were written in. Headers appended to the map after it was mapped
+ * are not visible and are read by the caller from the file.
+ */
+static char *
+header_map_mapped(HeaderMap *hdr_map, pgFile *file)
+{
+	char	   *rmap;
+	size_t		rmap_size;
+
+	pthread_lock(&(hdr_map->mutex));
+	if (!hdr_map->rmap_tried)
+	{
+		int			fd;
+		struct stat st;
+
+		hdr_map->rmap_tried = true;
+
+		fd = open(hdr_map->path, O_RDONLY | PG_BINARY, 0);
+		if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			void	   *addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (addr != MAP_FAILED)
+			{
+				hdr_map->rmap = addr;
+				hdr_map->rmap_size = st.st_size;
+				posix_madvise(addr, st.st_size, POSIX_MADV_WILLNEED);
+			}
+			else
+				elog(LOG, "Cannot map page header map \"%s\": %s",
+					 hdr_map->path, strerror(errno));
+		}
+
+		if (fd >= 0)
+			close(fd);
+	}
+	rmap = hdr_map->rmap;
+	rmap_size = hdr_map->rmap_size;
+	pthread_mutex_unlock(&(hdr_map->mutex));
+
+	if (rmap == NULL || file->hdr_off + file->hdr_size > rmap_size)
+		return NULL;
+
+	return rmap + file->hdr_off;
+}
+#endif
+
+/*
+ * Read and decompress headers of the file from the page header map of
+ * its backup and return them as array of headers.
+ * Compressed headers are taken from memory-mapped map and decompressed
+ * headers are cached, so that restore, merge and validate of many files do
+ * not open the map and decompress the same headers for every file.
  */
 BackupPageHeader2*
 get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, bool strict)
@@ -2375,7 +3305,9 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 	/* header decompression */
 	int     z_len = 0;
 	char   *zheaders = NULL;
+	char   *zsrc = NULL;
 	const char *errormsg = NULL;
+	uint64  start;
 
 	if (backup_version < 20400)
 		return NULL;
@@ -2383,23 +3315,7 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 	if (file->n_headers <= 0)
 		return NULL;
 
-	/* TODO: consider to make this descriptor thread-specific */
-	in = fopen(hdr_map->path, PG_BINARY_R);
-
-	if (!in)
-	{
-		elog(strict ? ERROR : WARNING, "Cannot open header file \"%s\": %s", hdr_map->path, strerror(errno));
-		return NULL;
-	}
-	/* disable buffering for header file */
-	setvbuf(in, NULL, _IONBF, 0);
-
-	if (fseeko(in, file->hdr_off, SEEK_SET))
-	{
-		elog(strict ? ERROR : WARNING, "Cannot seek to position %llu in page header map \"%s\": %s",
-			file->hdr_off, hdr_map->path, strerror(errno));
-		goto cleanup;
-	}
+	TIMING_START(start);
 
 	/*
 	 * The actual number of headers in header file is n+1, last one is a dummy header,
@@ -2407,22 +3323,55 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 	 */
 	read_len = (file->n_headers+1) * sizeof(BackupPageHeader2);
 
-	/* allocate memory for compressed headers */
-	zheaders = pgut_malloc(file->hdr_size);
-	memset(zheaders, 0, file->hdr_size);
+	headers = header_cache_lookup(hdr_map, file, read_len);
+	if (headers)
+	{
+		TIMING_STOP(TIMING_HEADER_MAP, start);
+		return headers;
+	}
+
+#ifndef WIN32
+	zsrc = header_map_mapped(hdr_map, file);
+#endif
 
-	if (fread(zheaders, 1, file->hdr_size, in) != file->hdr_size)
+	if (!zsrc)
 	{
-		elog(strict ? ERROR : WARNING, "Cannot read header file at offset: %llu len: %i \"%s\": %s",
-			file->hdr_off, file->hdr_size, hdr_map->path, strerror(errno));
-		goto cleanup;
+		in = fopen(hdr_map->path, PG_BINARY_R);
+
+		if (!in)
+		{
+			elog(strict ? ERROR : WARNING, "Cannot open header file \"%s\": %s", hdr_map->path, strerror(errno));
+			goto cleanup;
+		}
+		/* disable buffering for header file */
+		setvbuf(in, NULL, _IONBF, 0);
+
+		if (fseeko(in, file->hdr_off, SEEK_SET))
+		{
+			elog(strict ? ERROR : WARNING, "Cannot seek to position %llu in page header map \"%s\": %s",
+				file->hdr_off, hdr_map->path, strerror(errno));
+			goto cleanup;
+		}
+
+		/* allocate memory for compressed headers */
+		zheaders = pgut_malloc(file->hdr_size);
+		memset(zheaders, 0, file->hdr_size);
+
+		if (fread(zheaders, 1, file->hdr_size, in) != file->hdr_size)
+		{
+			elog(strict ? ERROR : WARNING, "Cannot read header file at offset: %llu len: %i \"%s\": %s",
+				file->hdr_off, file->hdr_size, hdr_map->path, strerror(errno));
+			goto cleanup;
+		}
+
+		zsrc = zheaders;
 	}
 
 	/* allocate memory for uncompressed headers */
 	headers = pgut_malloc(read_len);
 	memset(headers, 0, read_len);
 
-	z_len = do_decompress(headers, read_len, zheaders, file->hdr_size,
+	z_len = do_decompress(headers, read_len, zsrc, file->hdr_size,
 						  ZLIB_COMPRESS, &errormsg);
 	if (z_len <= 0)
 	{
@@ -2449,6 +3398,8 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 		goto cleanup;
 	}
 
+	header_cache_add(hdr_map, file, headers, read_len);
+
 	success = true;
 
 cleanup:
@@ -2463,6 +3414,8 @@ cleanup:
 		headers = NULL;
 	}
 
+	TIMING_STOP(TIMING_HEADER_MAP, start);
+
 	return headers;
 }
 
@@ -2477,10 +3430,13 @@ write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map,
 	int     z_len = 0;
 	char   *zheaders = NULL;
 	const char *errormsg = NULL;
+	uint64  start;
 
 	if (file->n_headers <= 0)
 		return;
 
+	TIMING_START(start);
+
 	/* when running merge we must write headers into temp map */
 	map_path = (is_merge) ? hdr_map->path_tmp : hdr_map->path;
 	read_len = (file->n_headers + 1) * sizeof(BackupPageHeader2);
@@ -2546,6 +3502,8 @@ write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map,
 	pthread_mutex_unlock(&(hdr_map->mutex));
 
 	pg_free(zheaders);
+
+	TIMING_STOP(TIMING_HEADER_MAP, start);
 }
 
 void
@@ -2553,6 +3511,9 @@ init_header_map(pgBackup *backup)
 {
 	backup->hdr_map.fp = NULL;
 	backup->hdr_map.buf = NULL;
+	backup->hdr_map.rmap = NULL;
+	backup->hdr_map.rmap_size = 0;
+	backup->hdr_map.rmap_tried = false;
 	join_path_components(backup->hdr_map.path, backup->root_dir, HEADER_MAP);
 	join_path_components(backup->hdr_map.path_tmp, backup->root_dir, HEADER_MAP_TMP);
 	backup->hdr_map.mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
@@ -2568,4 +3529,14 @@ cleanup_header_map(HeaderMap *hdr_map)
 	hdr_map->offset = 0;
 	pg_free(hdr_map->buf);
 	hdr_map->buf = NULL;
+
+	/* map may be rewritten after closing, forget what was read from it */
+#ifndef WIN32
+	if (hdr_map->rmap && munmap(hdr_map->rmap, hdr_map->rmap_size) != 0)
+		elog(ERROR, "Cannot unmap file \"%s\": %s", hdr_map->path, strerror(errno));
+#endif
+	hdr_map->rmap = NULL;
+	hdr_map->rmap_size = 0;
+	hdr_map->rmap_tried = false;
+	header_cache_forget(hdr_map);
 }
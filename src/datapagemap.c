@@ -3,7 +3,8 @@
  * datapagemap.c
  *	  A data structure for keeping track of data pages that have changed.
  *
- * This is a fairly simple bitmap.
+ * This is a fairly simple bitmap. Iteration skips empty parts of the bitmap
+ * a word at a time, so sparse maps of big relations are cheap to scan.
  *
  * Copyright (c) 2013-2019, PostgreSQL Global Development Group
  *
@@ -20,6 +21,26 @@ struct datapagemap_iterator
 	BlockNumber nextblkno;
 };
 
+/*
+ * Position of the lowest set bit in a non-zero byte.
+ */
+static inline int
+rightmost_one_pos8(unsigned char byte)
+{
+#ifdef HAVE__BUILTIN_CTZ
+	return __builtin_ctz(byte);
+#else
+	int			pos = 0;
+
+	while ((byte & 1) == 0)
+	{
+		byte >>= 1;
+		pos++;
+	}
+	return pos;
+#endif
+}
+
 /*****
  * Public functions
  */
@@ -88,26 +109,66 @@ bool
 datapagemap_next(datapagemap_iterator_t *iter, BlockNumber *blkno)
 {
 	datapagemap_t *map = iter->map;
+	BlockNumber blk = iter->nextblkno;
+	int			offset = blk / 8;
+	unsigned char bits;
+
+	if (offset >= map->bitmapsize)
+		return false;
 
-	for (;;)
+	/* rest of the current byte */
+	bits = (unsigned char) map->bitmap[offset] >> (blk % 8);
+	if (bits != 0)
 	{
-		BlockNumber blk = iter->nextblkno;
-		int			nextoff = blk / 8;
-		int			bitno = blk % 8;
+		blk += rightmost_one_pos8(bits);
+		goto found;
+	}
+	offset++;
 
-		if (nextoff >= map->bitmapsize)
-			break;
+	/* skip empty words */
+	while (offset + (int) sizeof(uint64) <= map->bitmapsize)
+	{
+		uint64		word;
 
-		iter->nextblkno++;
+		memcpy(&word, map->bitmap + offset, sizeof(word));
+		if (word != 0)
+			break;
+		offset += sizeof(word);
+	}
 
-		if (map->bitmap[nextoff] & (1 << bitno))
+	/* find the first non-empty byte */
+	for (; offset < map->bitmapsize; offset++)
+	{
+		bits = (unsigned char) map->bitmap[offset];
+		if (bits != 0)
 		{
-			*blkno = blk;
-			return true;
+			blk = (BlockNumber) offset * 8 + rightmost_one_pos8(bits);
+			goto found;
 		}
 	}
 
 	/* no more set bits in this bitmap. */
+	iter->nextblkno = (BlockNumber) map->bitmapsize * 8;
 	return false;
+
+found:
+	*blkno = blk;
+	iter->nextblkno = blk + 1;
+	return true;
 }
 
+/*
+ * Number of bytes of the bitmap up to the last non-zero byte, at least
+ * one byte for a non-empty bitmap. Trailing zeroes carry no information,
+ * so only this part of the bitmap needs to be sent to a remote agent.
+ */
+int
+datapagemap_used_size(datapagemap_t *map)
+{
+	int			size = map->bitmapsize;
+
+	while (size > 1 && map->bitmap[size - 1] == 0)
+		size--;
+
+	return size;
+}
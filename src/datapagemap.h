@@ -25,5 +25,6 @@ typedef struct datapagemap_iterator datapagemap_iterator_t;
 extern void datapagemap_add(datapagemap_t *map, BlockNumber blkno);
 extern datapagemap_iterator_t *datapagemap_iterate(datapagemap_t *map);
 extern bool datapagemap_next(datapagemap_iterator_t *iter, BlockNumber *blkno);
+extern int	datapagemap_used_size(datapagemap_t *map);
 
 #endif							/* DATAPAGEMAP_H */
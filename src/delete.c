@@ -200,6 +200,8 @@ void do_retention(InstanceState *instanceState, bool no_validate, bool no_sync)
 	parray_free(backup_list);
 	parray_free(to_keep_list);
 	parray_free(to_purge_list);
+
+	progress_finish();
 }
 
 /* Evaluate every backup by retention policies and populate purge and keep lists.
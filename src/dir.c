@@ -19,8 +19,10 @@
 #include "catalog/pg_tablespace.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <time.h>
 
 #include "utils/configuration.h"
 
@@ -94,6 +96,55 @@ static char *pgdata_exclude_files_non_exclusive[] =
 	NULL
 };
 
+/*
+ * Names from the exclude lists above are looked up in a small hash table,
+ * which is built once before listing, instead of comparing every listed
+ * file with each item of every list.
+ */
+#define EXCLUDE_HASH_SIZE			64	/* power of 2, much more than needed */
+
+#define EXCLUDE_FILE				0x01
+#define EXCLUDE_FILE_NON_EXCLUSIVE	0x02
+#define EXCLUDE_DIR					0x04
+
+typedef struct
+{
+	const char *name;
+	uint8		flags;
+} ExcludeHashEntry;
+
+static ExcludeHashEntry exclude_hash[EXCLUDE_HASH_SIZE];
+static bool exclude_hash_initialized = false;
+
+/*
+ * Shared state of parallel directory listing. Workers take directories
+ * from "dirs" and put found subdirectories back, listing is over when
+ * the queue is empty and no worker is busy.
+ */
+typedef struct
+{
+	const char *root;
+	parray	   *dirs;
+	int			n_busy;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	bool		exclude;
+	bool		follow_symlink;
+	bool		backup_logs;
+	bool		skip_hidden;
+	int			external_dir_num;
+
+	dir_list_callback callback;
+	void	   *callback_arg;
+} dir_list_queue;
+
+typedef struct
+{
+	dir_list_queue *queue;
+	parray	   *files;		/* files found by this worker */
+} dir_list_arg;
+
 /* Tablespace mapping structures */
 
 typedef struct TablespaceListCell
@@ -124,9 +175,18 @@ typedef struct TablespaceCreatedList
 
 static char dir_check_file(pgFile *file, bool backup_logs);
 
+static void exclude_hash_init(void);
+static uint8 exclude_hash_lookup(const char *name);
+static pgFile *dir_list_root(const char *root, bool follow_symlink,
+							 int external_dir_num, fio_location location);
+static pgFile *dir_entry_new(DIR *dir, const char *d_name, const char *path,
+							 const char *rel_path, bool follow_symlink,
+							 int external_dir_num, fio_location location);
 static void dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 								   bool exclude, bool follow_symlink, bool backup_logs,
-								   bool skip_hidden, int external_dir_num, fio_location location);
+								   bool skip_hidden, int external_dir_num, fio_location location,
+								   parray *subdirs);
+static void *dir_list_worker(void *arg);
 static void opt_path_map(ConfigOption *opt, const char *arg,
 						 TablespaceList *list, const char *type);
 static void cleanup_tablespace(const char *path);
@@ -574,6 +634,129 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 			  fio_location location)
 {
 	pgFile	   *file;
+	uint64		start;
+
+	exclude_hash_init();
+
+	file = dir_list_root(root, follow_symlink, external_dir_num, location);
+	if (file == NULL)
+		return;
+
+	if (add_root)
+		parray_append(files, file);
+
+	TIMING_START(start);
+	dir_list_file_internal(files, file, root, exclude, follow_symlink,
+						   backup_logs, skip_hidden, external_dir_num, location, NULL);
+	TIMING_STOP(TIMING_LIST_FILES, start);
+
+	if (!add_root)
+		pgFileFree(file);
+}
+
+/*
+ * Same as dir_list_file(), but local directories are listed by "n_threads"
+ * workers at once, so that clusters with many databases and tablespaces
+ * are listed faster.
+ *
+ * Order of readdir() is not preserved anyway, so listed files are sorted
+ * by relative path, which keeps every directory before its content, as
+ * sequential listing does.
+ *
+ * If "callback" is set, it is called by the worker for content of every
+ * listed directory as soon as it is known, before its subdirectories are
+ * listed. Callback may remove regular files from the array and free them.
+ */
+void
+dir_list_file_parallel(parray *files, const char *root, bool exclude, bool follow_symlink,
+					   bool add_root, bool backup_logs, bool skip_hidden, int external_dir_num,
+					   int n_threads, dir_list_callback callback, void *callback_arg)
+{
+	pgFile	   *file;
+	parray	   *listed;
+	dir_list_queue queue;
+	dir_list_arg *threads_args;
+	pthread_t  *threads;
+	int			i;
+	uint64		start;
+
+	if (n_threads <= 1 && callback == NULL)
+	{
+		dir_list_file(files, root, exclude, follow_symlink, add_root, backup_logs,
+					  skip_hidden, external_dir_num, FIO_LOCAL_HOST);
+		return;
+	}
+
+	exclude_hash_init();
+
+	file = dir_list_root(root, follow_symlink, external_dir_num, FIO_LOCAL_HOST);
+	if (file == NULL)
+		return;
+
+	TIMING_START(start);
+
+	queue.root = root;
+	queue.dirs = parray_new();
+	queue.n_busy = 0;
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	queue.exclude = exclude;
+	queue.follow_symlink = follow_symlink;
+	queue.backup_logs = backup_logs;
+	queue.skip_hidden = skip_hidden;
+	queue.external_dir_num = external_dir_num;
+	queue.callback = callback;
+	queue.callback_arg = callback_arg;
+
+	/* listing starts with the root */
+	parray_append(queue.dirs, file);
+
+	n_threads = Max(n_threads, 1);
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * n_threads);
+	threads_args = (dir_list_arg *) palloc(sizeof(dir_list_arg) * n_threads);
+
+	for (i = 0; i < n_threads; i++)
+	{
+		threads_args[i].queue = &queue;
+		threads_args[i].files = parray_new();
+		pthread_create(&threads[i], NULL, dir_list_worker, &threads_args[i]);
+	}
+
+	listed = parray_new();
+	if (add_root)
+		parray_append(listed, file);
+
+	for (i = 0; i < n_threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+		parray_concat(listed, threads_args[i].files);
+		parray_free(threads_args[i].files);
+	}
+
+	if (interrupted || thread_interrupted)
+		elog(ERROR, "Failed to list directory \"%s\"", root);
+
+	parray_qsort(listed, pgFileCompareRelPathWithExternal);
+	parray_concat(files, listed);
+	TIMING_STOP(TIMING_LIST_FILES, start);
+
+	if (!add_root)
+		pgFileFree(file);
+
+	parray_free(listed);
+	parray_free(queue.dirs);
+	pthread_mutex_destroy(&queue.lock);
+	pthread_cond_destroy(&queue.cond);
+	pfree(threads);
+	pfree(threads_args);
+}
+
+/* Check that root of the listing exists and is a directory */
+static pgFile *
+dir_list_root(const char *root, bool follow_symlink, int external_dir_num,
+			  fio_location location)
+{
+	pgFile	   *file;
 
 	file = pgFileNew(root, "", follow_symlink, external_dir_num, location);
 	if (file == NULL)
@@ -582,7 +765,7 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 		if (external_dir_num > 0)
 			elog(ERROR, "External directory is not found: \"%s\"", root);
 		else
-			return;
+			return NULL;
 	}
 
 	if (!S_ISDIR(file->mode))
@@ -592,16 +775,160 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 					root);
 		else
 			elog(WARNING, "Skip \"%s\": unexpected file format", root);
-		return;
+		pgFileFree(file);
+		return NULL;
 	}
-	if (add_root)
-		parray_append(files, file);
 
-	dir_list_file_internal(files, file, root, exclude, follow_symlink,
-						   backup_logs, skip_hidden, external_dir_num, location);
+	return file;
+}
 
-	if (!add_root)
-		pgFileFree(file);
+/*
+ * Worker of parallel listing: list content of a directory taken from the
+ * queue, found subdirectories are returned to the queue.
+ */
+static void *
+dir_list_worker(void *arg)
+{
+	dir_list_arg *args = (dir_list_arg *) arg;
+	dir_list_queue *queue = args->queue;
+	parray	   *subdirs = parray_new();
+	parray	   *content = parray_new();	/* files of the current directory */
+
+	for (;;)
+	{
+		pgFile	   *dir;
+		char		dir_path[MAXPGPATH];
+
+		pthread_lock(&queue->lock);
+
+		while (parray_num(queue->dirs) == 0 && queue->n_busy > 0)
+		{
+			struct timespec	timeout;
+
+			/* other worker may die because of error, don't wait for it forever */
+			if (interrupted || thread_interrupted)
+			{
+				pthread_mutex_unlock(&queue->lock);
+				elog(ERROR, "Interrupted during directory listing");
+			}
+
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_sec += 1;
+			pthread_cond_timedwait(&queue->cond, &queue->lock, &timeout);
+		}
+
+		/* nothing to list and nobody can find more */
+		if (parray_num(queue->dirs) == 0)
+		{
+			pthread_cond_broadcast(&queue->cond);
+			pthread_mutex_unlock(&queue->lock);
+			break;
+		}
+
+		/* take the last one to go deep first and keep the queue short */
+		dir = (pgFile *) parray_remove(queue->dirs, parray_num(queue->dirs) - 1);
+		queue->n_busy++;
+		pthread_mutex_unlock(&queue->lock);
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during directory listing");
+
+		if (dir->rel_path[0] == '\0')
+			strncpy(dir_path, queue->root, MAXPGPATH);
+		else
+			join_path_components(dir_path, queue->root, dir->rel_path);
+
+		dir_list_file_internal(content, dir, dir_path, queue->exclude,
+							   queue->follow_symlink, queue->backup_logs,
+							   queue->skip_hidden, queue->external_dir_num,
+							   FIO_LOCAL_HOST, subdirs);
+
+		if (queue->callback)
+			queue->callback(dir, content, queue->callback_arg);
+
+		while (parray_num(content) > 0)
+			parray_append(args->files,
+						  parray_remove(content, parray_num(content) - 1));
+
+		pthread_lock(&queue->lock);
+		while (parray_num(subdirs) > 0)
+			parray_append(queue->dirs,
+						  parray_remove(subdirs, parray_num(subdirs) - 1));
+		queue->n_busy--;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->lock);
+	}
+
+	parray_free(subdirs);
+	parray_free(content);
+
+	return NULL;
+}
+
+/* FNV-1a hash of the name */
+static uint32
+exclude_hash_name(const char *name)
+{
+	uint32		hash = 2166136261u;
+
+	for (; *name; name++)
+	{
+		hash ^= (unsigned char) *name;
+		hash *= 16777619;
+	}
+
+	return hash;
+}
+
+static void
+exclude_hash_add(const char *name, uint8 flag)
+{
+	uint32		i = exclude_hash_name(name) & (EXCLUDE_HASH_SIZE - 1);
+
+	/* linear probing, table is never full */
+	while (exclude_hash[i].name != NULL && strcmp(exclude_hash[i].name, name) != 0)
+		i = (i + 1) & (EXCLUDE_HASH_SIZE - 1);
+
+	exclude_hash[i].name = name;
+	exclude_hash[i].flags |= flag;
+}
+
+/* Must be called before listing is started, not thread-safe */
+static void
+exclude_hash_init(void)
+{
+	int			i;
+
+	if (exclude_hash_initialized)
+		return;
+
+	for (i = 0; pgdata_exclude_dir[i]; i++)
+		exclude_hash_add(pgdata_exclude_dir[i], EXCLUDE_DIR);
+
+	for (i = 0; pgdata_exclude_files[i]; i++)
+		exclude_hash_add(pgdata_exclude_files[i], EXCLUDE_FILE);
+
+	for (i = 0; pgdata_exclude_files_non_exclusive[i]; i++)
+		exclude_hash_add(pgdata_exclude_files_non_exclusive[i],
+						 EXCLUDE_FILE_NON_EXCLUSIVE);
+
+	exclude_hash_initialized = true;
+}
+
+/* Return exclude flags of the name, 0 if it is not in exclude lists */
+static uint8
+exclude_hash_lookup(const char *name)
+{
+	uint32		i = exclude_hash_name(name) & (EXCLUDE_HASH_SIZE - 1);
+
+	while (exclude_hash[i].name != NULL)
+	{
+		if (strcmp(exclude_hash[i].name, name) == 0)
+			return exclude_hash[i].flags;
+		i = (i + 1) & (EXCLUDE_HASH_SIZE - 1);
+	}
+
+	return 0;
 }
 
 #define CHECK_FALSE				0
@@ -624,34 +951,27 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 static char
 dir_check_file(pgFile *file, bool backup_logs)
 {
-	int			i;
 	int			sscanf_res;
 	bool		in_tablespace = false;
+	uint8		exclude_flags;
 
 	in_tablespace = path_is_prefix_of_path(PG_TBLSPC_DIR, file->rel_path);
+	exclude_flags = exclude_hash_lookup(file->name);
 
-	/* Check if we need to exclude file by name */
+	/*
+	 * Check if we need to exclude file by name, files are excluded
+	 * only in the root of PGDATA.
+	 */
 	if (S_ISREG(file->mode))
 	{
-		if (!exclusive_backup)
+		if ((exclude_flags & EXCLUDE_FILE ||
+			 (exclude_flags & EXCLUDE_FILE_NON_EXCLUSIVE && !exclusive_backup)) &&
+			strcmp(file->rel_path, file->name) == 0)
 		{
-			for (i = 0; pgdata_exclude_files_non_exclusive[i]; i++)
-				if (strcmp(file->rel_path,
-						   pgdata_exclude_files_non_exclusive[i]) == 0)
-				{
-					/* Skip */
-					elog(VERBOSE, "Excluding file: %s", file->name);
-					return CHECK_FALSE;
-				}
+			/* Skip */
+			elog(VERBOSE, "Excluding file: %s", file->name);
+			return CHECK_FALSE;
 		}
-
-		for (i = 0; pgdata_exclude_files[i]; i++)
-			if (strcmp(file->rel_path, pgdata_exclude_files[i]) == 0)
-			{
-				/* Skip */
-				elog(VERBOSE, "Excluding file: %s", file->name);
-				return CHECK_FALSE;
-			}
 	}
 	/*
 	 * If the directory name is in the exclude list, do not list the
@@ -659,19 +979,11 @@ dir_check_file(pgFile *file, bool backup_logs)
 	 */
 	else if (S_ISDIR(file->mode) && !in_tablespace && file->external_dir_num == 0)
 	{
-		/*
-		 * If the item in the exclude list starts with '/', compare to
-		 * the absolute path of the directory. Otherwise compare to the
-		 * directory name portion.
-		 */
-		for (i = 0; pgdata_exclude_dir[i]; i++)
+		/* exclude by dirname */
+		if (exclude_flags & EXCLUDE_DIR)
 		{
-			/* exclude by dirname */
-			if (strcmp(file->name, pgdata_exclude_dir[i]) == 0)
-			{
-				elog(VERBOSE, "Excluding directory content: %s", file->rel_path);
-				return CHECK_EXCLUDE_FALSE;
-			}
+			elog(VERBOSE, "Excluding directory content: %s", file->rel_path);
+			return CHECK_EXCLUDE_FALSE;
 		}
 
 		if (!backup_logs)
@@ -817,17 +1129,58 @@ dir_check_file(pgFile *file, bool backup_logs)
 	return CHECK_TRUE;
 }
 
+/*
+ * Create pgFile for the directory entry.
+ *
+ * Local entry is stat'ed relative to the descriptor of the open directory,
+ * so the kernel doesn't have to resolve the full path for every file.
+ */
+static pgFile *
+dir_entry_new(DIR *dir, const char *d_name, const char *path, const char *rel_path,
+			  bool follow_symlink, int external_dir_num, fio_location location)
+{
+#ifndef WIN32
+	if (!fio_is_remote(location))
+	{
+		struct stat	st;
+		pgFile	   *file;
+
+		if (fstatat(dirfd(dir), d_name, &st,
+					follow_symlink ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+		{
+			/* file not found is not an error case */
+			if (errno == ENOENT)
+				return NULL;
+			elog(ERROR, "cannot stat file \"%s\": %s", path,
+				strerror(errno));
+		}
+
+		file = pgFileInit(rel_path);
+		file->size = st.st_size;
+		file->mode = st.st_mode;
+		file->mtime = st.st_mtime;
+		file->external_dir_num = external_dir_num;
+
+		return file;
+	}
+#endif
+
+	return pgFileNew(path, rel_path, follow_symlink, external_dir_num, location);
+}
+
 /*
  * List files in parent->path directory.  If "exclude" is true do not add into
  * "files" files from pgdata_exclude_files and directories from
  * pgdata_exclude_dir.
  *
- * TODO: should we check for interrupt here ?
+ * If "subdirs" is not NULL, subdirectories are not listed recursively,
+ * but appended to "subdirs" to be listed later.
  */
 static void
 dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 					   bool exclude, bool follow_symlink, bool backup_logs,
-					   bool skip_hidden, int external_dir_num, fio_location location)
+					   bool skip_hidden, int external_dir_num, fio_location location,
+					   parray *subdirs)
 {
 	DIR			  *dir;
 	struct dirent *dent;
@@ -856,29 +1209,43 @@ dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 		char		rel_child[MAXPGPATH];
 		char		check_res;
 
-		join_path_components(child, parent_dir, dent->d_name);
-		join_path_components(rel_child, parent->rel_path, dent->d_name);
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during directory listing");
 
-		file = pgFileNew(child, rel_child, follow_symlink, external_dir_num,
-						 location);
-		if (file == NULL)
+		/* Skip entries point current dir or parent dir */
+		if (strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
 			continue;
 
-		/* Skip entries point current dir or parent dir */
-		if (S_ISDIR(file->mode) &&
-			(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0))
+		join_path_components(child, parent_dir, dent->d_name);
+
+		/* skip hidden files and directories */
+		if (skip_hidden && dent->d_name[0] == '.')
 		{
-			pgFileFree(file);
+			elog(WARNING, "Skip hidden file: '%s'", child);
 			continue;
 		}
 
-		/* skip hidden files and directories */
-		if (skip_hidden && file->name[0] == '.')
+#ifdef _DIRENT_HAVE_D_TYPE
+		/*
+		 * Add only files, directories and links. Sockets and other unexpected
+		 * file formats can be skipped without stat, if file system reports
+		 * type of the entry.
+		 */
+		if (dent->d_type != DT_UNKNOWN && dent->d_type != DT_REG &&
+			dent->d_type != DT_DIR && dent->d_type != DT_LNK)
 		{
-			elog(WARNING, "Skip hidden file: '%s'", child);
-			pgFileFree(file);
+			elog(WARNING, "Skip '%s': unexpected file format", child);
 			continue;
 		}
+#endif
+
+		join_path_components(rel_child, parent->rel_path, dent->d_name);
+
+		file = dir_entry_new(dir, dent->d_name, child, rel_child, follow_symlink,
+							 external_dir_num, location);
+		if (file == NULL)
+			continue;
 
 		/*
 		 * Add only files, directories and links. Skip sockets and other
@@ -912,11 +1279,17 @@ dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 
 		/*
 		 * If the entry is a directory call dir_list_file_internal()
-		 * recursively.
+		 * recursively or leave it to the caller.
 		 */
 		if (S_ISDIR(file->mode))
-			dir_list_file_internal(files, file, child, exclude, follow_symlink,
-								   backup_logs, skip_hidden, external_dir_num, location);
+		{
+			if (subdirs)
+				parray_append(subdirs, file);
+			else
+				dir_list_file_internal(files, file, child, exclude, follow_symlink,
+									   backup_logs, skip_hidden, external_dir_num,
+									   location, NULL);
+		}
 	}
 
 	if (errno && errno != ENOENT)
@@ -0,0 +1,1185 @@
+/*-------------------------------------------------------------------------
+ *
+ * export.c: serialize backup into a single sequential stream and
+ *           restore it back without backup catalog
+ *
+ * Stream consists of a header, a sequence of entries and an index
+ * of entry offsets at the end:
+ *
+ *   ExportStreamHeader
+ *   ExportEntryHeader CONTROL, rel_path, content of backup.control
+ *   ExportEntryHeader DIR|FILE|DATAFILE, rel_path, link, payload
+ *   ...
+ *   ExportEntryHeader END, array of entry offsets
+ *   ExportStreamTrailer
+ *
+ * Data files are stored exactly as in the backup catalog: a sequence of
+ * BackupPageHeader followed by (possibly compressed) page, so the reader
+ * can decompress them in parallel and doesn't need page header map.
+ * Tablespace directories carry the target of the link, so the stream
+ * can be restored in one pass.
+ *
+ * Backup taken with --to-stdout writes the stream while files are being
+ * copied, so entries of files come in no particular order, but after the
+ * entry of their directory. Such stream has one more CONTROL entry at the
+ * end with the final metadata of the backup, which replaces the first one.
+ *
+ * Copyright (c) 2021, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef WIN32
+#include <io.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* Entries may be written by several threads, they are serialized by lock */
+struct ExportStream
+{
+	FILE	   *out;
+	char	   *buf;		/* buffer for copying of payloads */
+	uint64		offset;		/* current offset in the stream */
+	pg_crc32	crc;		/* CRC of everything written so far */
+
+	/* offsets of all entries */
+	uint64	   *index;
+	size_t		n_entries;
+	size_t		max_entries;
+
+	pthread_mutex_t lock;
+};
+
+static void export_write(ExportStream *stream, const void *data, size_t len);
+static void export_entry(ExportStream *stream, ExportEntryKind kind,
+						 pgFile *file, const char *rel_path, const char *link,
+						 const char *from_fullpath, uint64 size);
+static const char *export_tablespace_link(parray *links, pgFile *dir);
+
+/*
+ * Implementation of EXPORT command.
+ *
+ * Write FULL backup into stdout as a single stream in native format,
+ * so it can be piped to another host or stored on devices, which are
+ * unable to keep a directory tree with thousands of files.
+ */
+void
+do_export(InstanceState *instanceState, time_t backup_id, bool no_validate)
+{
+	int			i;
+	parray	   *backup_list = NULL;
+	parray	   *files = NULL;
+	parray	   *links = NULL;
+	pgBackup   *backup = NULL;
+	ExportStream *stream;
+	uint64		stream_size;
+	char		from_fullpath[MAXPGPATH];
+	char		external_prefix[MAXPGPATH];
+	struct stat	st;
+	time_t		start_time,
+				end_time;
+	char		pretty_time[20];
+	char		pretty_bytes[20];
+
+	if (backup_id == INVALID_BACKUP_ID)
+		elog(ERROR, "required parameter is not specified: --backup-id");
+
+	if (isatty(fileno(stdout)))
+		elog(ERROR, "Refuse to write backup stream to terminal, redirect stdout");
+
+	backup_list = catalog_get_backup_list(instanceState, backup_id);
+
+	if (parray_num(backup_list) == 0)
+		elog(ERROR, "Backup %s was not found", base36enc(backup_id));
+
+	backup = (pgBackup *) parray_get(backup_list, 0);
+
+	if (backup->status != BACKUP_STATUS_OK &&
+		backup->status != BACKUP_STATUS_DONE)
+		elog(ERROR, "Backup %s has status: %s",
+			 base36enc(backup->start_time), status2str(backup->status));
+
+	if (backup->backup_mode != BACKUP_MODE_FULL)
+		elog(ERROR, "Backup %s is not a full backup, only full backups can be exported, "
+			 "merge it with its parent chain first", base36enc(backup->start_time));
+
+	if (parse_program_version(backup->program_version) < 20400)
+		elog(ERROR, "Backup %s has been produced by pg_probackup version %s, "
+			 "export of backups older than 2.4.0 is not supported",
+			 base36enc(backup->start_time), backup->program_version);
+
+	if (parse_program_version(backup->program_version) > parse_program_version(PROGRAM_VERSION))
+		elog(ERROR, "Backup %s has been produced by pg_probackup version %s, "
+			 "but current program version is %s. Forward compatibility "
+			 "is not supported.",
+			 base36enc(backup->start_time), backup->program_version,
+			 PROGRAM_VERSION);
+
+	if (!lock_backup(backup, true, false))
+		elog(ERROR, "Cannot lock backup %s directory",
+			 base36enc(backup->start_time));
+
+	if (!no_validate)
+	{
+		pgBackupValidate(backup, NULL);
+
+		if (backup->status != BACKUP_STATUS_OK)
+			elog(ERROR, "Backup %s has status %s, export is aborted",
+				 base36enc(backup->start_time), status2str(backup->status));
+	}
+
+	files = get_backup_filelist(backup, true);
+	/* parent directories must precede their content */
+	parray_qsort(files, pgFileCompareRelPathWithExternal);
+
+	join_path_components(external_prefix, backup->root_dir, EXTERNAL_DIR);
+
+	/* tablespace links are not kept in file list, take them from tablespace map */
+	links = parray_new();
+	join_path_components(from_fullpath, backup->database_dir, PG_TABLESPACE_MAP_FILE);
+	if (stat(from_fullpath, &st) == 0)
+	{
+		read_tablespace_map(links, backup->root_dir);
+		parray_qsort(links, pgFileCompareName);
+	}
+
+	elog(INFO, "Exporting backup %s", base36enc(backup->start_time));
+	time(&start_time);
+
+	stream = export_stream_open(stdout);
+
+	/* meta information goes first, restore cannot start without it */
+	export_stream_control(stream, backup->root_dir);
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during export");
+
+		if (progress)
+			elog(INFO, "Progress: (%d/%lu). Exporting file \"%s\"",
+				 i + 1, (unsigned long) parray_num(files), file->rel_path);
+
+		if (S_ISDIR(file->mode))
+		{
+			export_stream_dir(stream, file, export_tablespace_link(links, file));
+			continue;
+		}
+
+		if (file->external_dir_num)
+		{
+			char		temp[MAXPGPATH];
+
+			makeExternalDirPathByNum(temp, external_prefix, file->external_dir_num);
+			join_path_components(from_fullpath, temp, file->rel_path);
+		}
+		else
+			join_path_components(from_fullpath, backup->database_dir, file->rel_path);
+
+		export_stream_file(stream, file, from_fullpath);
+	}
+
+	stream_size = export_stream_close(stream);
+
+	time(&end_time);
+	pretty_time_interval(difftime(end_time, start_time),
+						 pretty_time, lengthof(pretty_time));
+	pretty_size(stream_size, pretty_bytes, lengthof(pretty_bytes));
+
+	elog(INFO, "Backup %s is exported, stream size: %s, time elapsed: %s",
+		 base36enc(backup->start_time), pretty_bytes, pretty_time);
+
+	/* cleanup */
+	parray_walk(files, pgFileFree);
+	parray_free(files);
+
+	parray_walk(links, pgFileFree);
+	parray_free(links);
+
+	parray_walk(backup_list, pgBackupFree);
+	parray_free(backup_list);
+}
+
+/*
+ * Start the stream in "out", which must not be a terminal, and write its
+ * header.
+ */
+ExportStream *
+export_stream_open(FILE *out)
+{
+	ExportStream *stream = pgut_new(ExportStream);
+	ExportStreamHeader header;
+
+#ifdef WIN32
+	_setmode(fileno(out), _O_BINARY);
+#endif
+
+	stream->out = out;
+	stream->buf = pgut_malloc(STDIO_BUFSIZE);
+	stream->offset = 0;
+	stream->n_entries = 0;
+	stream->max_entries = 1024;
+	stream->index = pgut_malloc(stream->max_entries * sizeof(uint64));
+	INIT_FILE_CRC32(true, stream->crc);
+	pthread_mutex_init(&stream->lock, NULL);
+
+	setvbuf(stream->out, NULL, _IOFBF, LARGE_CHUNK_SIZE);
+
+	MemSet(&header, 0, sizeof(header));
+	memcpy(header.magic, EXPORT_STREAM_MAGIC, sizeof(header.magic));
+	header.version = EXPORT_STREAM_VERSION;
+	header.block_size = BLCKSZ;
+	export_write(stream, &header, sizeof(header));
+
+	return stream;
+}
+
+/* Write backup.control of the backup located in "root_dir" */
+void
+export_stream_control(ExportStream *stream, const char *root_dir)
+{
+	char		from_fullpath[MAXPGPATH];
+	struct stat	st;
+
+	join_path_components(from_fullpath, root_dir, BACKUP_CONTROL_FILE);
+	if (stat(from_fullpath, &st) != 0)
+		elog(ERROR, "Cannot stat file \"%s\": %s", from_fullpath, strerror(errno));
+
+	pthread_lock(&stream->lock);
+	export_entry(stream, EXPORT_ENTRY_CONTROL, NULL, BACKUP_CONTROL_FILE,
+				 NULL, from_fullpath, st.st_size);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+/* Write directory, "link" is the target of tablespace link or NULL */
+void
+export_stream_dir(ExportStream *stream, pgFile *dir, const char *link)
+{
+	pthread_lock(&stream->lock);
+	export_entry(stream, EXPORT_ENTRY_DIR, dir, dir->rel_path, link, NULL, 0);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+/*
+ * Write file copied to "from_fullpath" by backup. Files, which were
+ * concurrently deleted during backup, are skipped.
+ */
+void
+export_stream_file(ExportStream *stream, pgFile *file, const char *from_fullpath)
+{
+	if (file->write_size < 0)
+		return;
+
+	pthread_lock(&stream->lock);
+	export_entry(stream,
+				 (file->is_datafile && !file->is_cfs) ?
+					EXPORT_ENTRY_DATAFILE : EXPORT_ENTRY_FILE,
+				 file, file->rel_path, NULL, from_fullpath, file->write_size);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+/*
+ * Finish the stream with index of entries and trailer and free it.
+ * Returns the size of the stream.
+ */
+uint64
+export_stream_close(ExportStream *stream)
+{
+	ExportStreamTrailer trailer;
+	uint64		size;
+
+	MemSet(&trailer, 0, sizeof(trailer));
+	trailer.n_entries = stream->n_entries;
+	export_entry(stream, EXPORT_ENTRY_END, NULL, "", NULL, NULL,
+				 stream->n_entries * sizeof(uint64));
+
+	trailer.index_offset = stream->offset;
+	export_write(stream, stream->index, trailer.n_entries * sizeof(uint64));
+
+	FIN_FILE_CRC32(true, stream->crc);
+	trailer.crc = stream->crc;
+	memcpy(trailer.magic, EXPORT_STREAM_MAGIC, sizeof(trailer.magic));
+
+	if (fwrite(&trailer, 1, sizeof(trailer), stream->out) != sizeof(trailer) ||
+		fflush(stream->out) != 0)
+		elog(ERROR, "Cannot write backup stream: %s", strerror(errno));
+
+	size = stream->offset + sizeof(trailer);
+
+	pthread_mutex_destroy(&stream->lock);
+	pg_free(stream->buf);
+	pg_free(stream->index);
+	pg_free(stream);
+
+	return size;
+}
+
+/* Write data into stream, keeping track of offset and CRC */
+static void
+export_write(ExportStream *stream, const void *data, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (fwrite(data, 1, len, stream->out) != len)
+		elog(ERROR, "Cannot write backup stream: %s", strerror(errno));
+
+	COMP_FILE_CRC32(true, stream->crc, data, len);
+	stream->offset += len;
+}
+
+/*
+ * Write single entry into stream, must be called with the lock held.
+ * If from_fullpath is not NULL, then "size" bytes of this file are
+ * written as entry payload. Empty files are not created by backup,
+ * so they are not opened.
+ */
+static void
+export_entry(ExportStream *stream, ExportEntryKind kind, pgFile *file,
+			 const char *rel_path, const char *link,
+			 const char *from_fullpath, uint64 size)
+{
+	ExportEntryHeader hdr;
+	uint64		copied = 0;
+
+	MemSet(&hdr, 0, sizeof(hdr));
+	hdr.kind = kind;
+	hdr.path_len = strlen(rel_path);
+	hdr.link_len = link ? strlen(link) : 0;
+	hdr.size = size;
+
+	if (file)
+	{
+		hdr.mode = file->mode;
+		hdr.external_dir_num = file->external_dir_num;
+		hdr.n_blocks = file->n_blocks;
+		hdr.compress_alg = file->compress_alg;
+		hdr.crc = file->crc;
+	}
+
+	/* END entry is not included in the index */
+	if (kind != EXPORT_ENTRY_END)
+	{
+		if (stream->n_entries >= stream->max_entries)
+		{
+			stream->max_entries *= 2;
+			stream->index = pgut_realloc(stream->index,
+										 stream->max_entries * sizeof(uint64));
+		}
+		stream->index[stream->n_entries++] = stream->offset;
+	}
+
+	export_write(stream, &hdr, sizeof(hdr));
+	export_write(stream, rel_path, hdr.path_len);
+	if (hdr.link_len > 0)
+		export_write(stream, link, hdr.link_len);
+
+	if (from_fullpath && size > 0)
+	{
+		FILE	   *in = fopen(from_fullpath, PG_BINARY_R);
+
+		if (in == NULL)
+			elog(ERROR, "Cannot open backup file \"%s\": %s",
+				 from_fullpath, strerror(errno));
+
+		while (copied < size)
+		{
+			size_t		read_len = Min(size - copied, STDIO_BUFSIZE);
+
+			if (fread(stream->buf, 1, read_len, in) != read_len)
+				elog(ERROR, "Cannot read backup file \"%s\": %s",
+					 from_fullpath, ferror(in) ? strerror(errno) : "unexpected end of file");
+
+			export_write(stream, stream->buf, read_len);
+			copied += read_len;
+		}
+
+		fclose(in);
+	}
+}
+
+/*
+ * Return target of tablespace link, if directory is located in pg_tblspc
+ * and listed in tablespace map. Otherwise return NULL.
+ */
+static const char *
+export_tablespace_link(parray *links, pgFile *dir)
+{
+	char		parent_dir[MAXPGPATH];
+	pgFile	  **link;
+
+	if (dir->external_dir_num != 0 || parray_num(links) == 0)
+		return NULL;
+
+	strncpy(parent_dir, dir->rel_path, MAXPGPATH);
+	get_parent_directory(parent_dir);
+
+	if (strcmp(parent_dir, PG_TBLSPC_DIR) != 0)
+		return NULL;
+
+	link = (pgFile **) parray_bsearch(links, dir, pgFileCompareName);
+
+	return link ? (*link)->linked : NULL;
+}
+
+/*
+ * Restore from stream.
+ *
+ * Stream is read by the main thread only once from start to end.
+ * Directories and non-data files are written by the main thread as they
+ * come. Content of data files is cut into chunks, which are passed via
+ * bounded queue to worker threads for decompression, so memory usage
+ * doesn't depend on the size of backup.
+ */
+
+/* Data file records are passed to workers in chunks of this size */
+#define IMPORT_CHUNK_SIZE	(128 * (sizeof(BackupPageHeader) + BLCKSZ))
+
+typedef struct
+{
+	FILE	   *in;
+	uint64		offset;		/* current offset in the stream */
+	pg_crc32	crc;		/* CRC of everything read so far */
+} import_stream;
+
+/* Data file being restored, shared by all its chunks */
+typedef struct
+{
+	char		path[MAXPGPATH];
+	int			fd;
+	CompressAlg	compress_alg;
+	int			refcount;	/* chunks in the queue plus reader */
+} import_file;
+
+typedef struct
+{
+	import_file *file;
+	char	   *data;		/* sequence of BackupPageHeader and page */
+	size_t		len;
+} import_chunk;
+
+/* Queue of chunks shared by reader and workers */
+typedef struct
+{
+	pthread_mutex_t	lock;
+	pthread_cond_t	not_empty;
+	pthread_cond_t	not_full;
+	import_chunk  **chunks;
+	int			capacity;
+	int			head;
+	int			count;
+	bool		finished;	/* no more chunks will be added */
+	bool		no_sync;
+} import_queue;
+
+static void import_read(import_stream *stream, void *data, size_t len);
+static void import_skip(import_stream *stream, char *buf, uint64 size);
+static pgBackup *import_control(import_stream *stream, ExportEntryHeader *hdr,
+								char *buf);
+static void import_plain_file(import_stream *stream, ExportEntryHeader *hdr,
+							  const char *to_fullpath, char *buf, bool no_sync);
+#ifdef HAVE_LIBZ
+static void import_compressed_wal_file(import_stream *stream, ExportEntryHeader *hdr,
+									   const char *to_fullpath, char *buf, bool no_sync);
+#endif
+static void import_data_file(import_stream *stream, import_queue *queue,
+							 ExportEntryHeader *hdr, const char *to_fullpath);
+static void import_queue_put(import_queue *queue, import_chunk *chunk);
+static import_chunk *import_queue_get(import_queue *queue);
+static void import_file_release(import_queue *queue, import_file *file);
+static void *import_worker(void *arg);
+
+/*
+ * Implementation of RESTORE command with --from-stdin option.
+ *
+ * Read backup stream, produced by EXPORT command, from stdin and restore
+ * it into PGDATA in a single pass. Backup catalog is not required.
+ */
+int
+do_restore_from_stream(InstanceState *instanceState, pgRecoveryTarget *rt,
+					   pgRestoreParams *params, bool no_sync)
+{
+	int			i;
+	import_stream stream;
+	import_queue queue;
+	ExportStreamHeader header;
+	ExportStreamTrailer trailer;
+	ExportEntryHeader hdr;
+	pgBackup   *backup = NULL;
+	parray	   *external_dirs = NULL;
+	pthread_t  *threads;
+	char	   *buf;
+	char		rel_path[MAXPGPATH];
+	char		linked[MAXPGPATH];
+	char		to_fullpath[MAXPGPATH];
+	char	   *pg_control = NULL;
+	size_t		pg_control_size = 0;
+	mode_t		pg_control_mode = FILE_PERMISSION;
+	uint64		n_entries = 0;
+	time_t		start_time,
+				end_time;
+	char		pretty_time[20];
+	char		pretty_bytes[20];
+
+	if (instance_config.pgdata == NULL)
+		elog(ERROR, "required parameter not specified: PGDATA (-D, --pgdata)");
+
+	if (current.backup_id != INVALID_BACKUP_ID)
+		elog(ERROR, "You cannot specify (-i, --backup-id) option together with --from-stdin");
+
+	if (params->incremental_mode != INCR_NONE)
+		elog(ERROR, "Incremental restore is not supported with --from-stdin");
+
+	if (params->partial_restore_type != NONE)
+		elog(ERROR, "Partial restore is not supported with --from-stdin");
+
+	if (fio_is_remote(FIO_DB_HOST))
+		elog(ERROR, "Restore from stdin to remote host is not supported");
+
+	if (isatty(fileno(stdin)))
+		elog(ERROR, "Refuse to read backup stream from terminal, redirect stdin");
+
+	if (!dir_is_empty(instance_config.pgdata, FIO_DB_HOST))
+		elog(ERROR, "Restore destination is not empty: \"%s\"",
+			 instance_config.pgdata);
+
+	fio_mkdir(instance_config.pgdata, DIR_PERMISSION, FIO_DB_HOST);
+
+#ifdef WIN32
+	_setmode(fileno(stdin), _O_BINARY);
+#endif
+
+	stream.in = stdin;
+	stream.offset = 0;
+	INIT_FILE_CRC32(true, stream.crc);
+	setvbuf(stream.in, NULL, _IOFBF, LARGE_CHUNK_SIZE);
+
+	buf = pgut_malloc(STDIO_BUFSIZE);
+
+	time(&start_time);
+
+	import_read(&stream, &header, sizeof(header));
+
+	if (memcmp(header.magic, EXPORT_STREAM_MAGIC, sizeof(header.magic)) != 0)
+		elog(ERROR, "Input is not a backup stream");
+
+	/* version 1 differs only in the absence of the final CONTROL entry */
+	if (header.version < 1 || header.version > EXPORT_STREAM_VERSION)
+		elog(ERROR, "Unsupported version of backup stream: %u", header.version);
+
+	if (header.block_size != BLCKSZ)
+		elog(ERROR, "Backup stream has block size %u, but pg_probackup is compiled "
+			 "with block size %u", header.block_size, BLCKSZ);
+
+	/* meta information goes first */
+	import_read(&stream, &hdr, sizeof(hdr));
+	if (hdr.kind != EXPORT_ENTRY_CONTROL)
+		elog(ERROR, "Backup stream doesn't start with backup metadata");
+
+	if (hdr.path_len >= MAXPGPATH)
+		elog(ERROR, "Invalid entry in backup stream at offset " UINT64_FORMAT,
+			 stream.offset);
+	import_read(&stream, rel_path, hdr.path_len);
+
+	backup = import_control(&stream, &hdr, buf);
+
+	/*
+	 * Without backup catalog restore_command cannot be constructed,
+	 * so it must be provided if recovery needs WAL archive.
+	 */
+	if (instanceState == NULL &&
+		(!instance_config.restore_command ||
+		 pg_strcasecmp(instance_config.restore_command, "none") == 0) &&
+		(!backup->stream || rt->time_string || rt->xid_string ||
+		 rt->lsn_string || rt->target_name || rt->target_stop))
+		elog(ERROR, "Recovery of backup %s requires WAL archive, "
+			 "specify --restore-command or backup catalog (-B, --instance)",
+			 base36enc(backup->start_time));
+
+	elog(INFO, "Restoring the database from backup %s in stream",
+		 base36enc(backup->start_time));
+
+	if (backup->external_dir_str && !params->skip_external_dirs)
+	{
+		external_dirs = make_external_directory_list(backup->external_dir_str, true);
+
+		for (i = 0; i < parray_num(external_dirs); i++)
+		{
+			char	   *external_path = parray_get(external_dirs, i);
+
+			if (!dir_is_empty(external_path, FIO_DB_HOST))
+				elog(ERROR, "External directory is not empty: \"%s\"", external_path);
+
+			fio_mkdir(external_path, DIR_PERMISSION, FIO_DB_HOST);
+		}
+	}
+
+	/* start decompression workers */
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.not_empty, NULL);
+	pthread_cond_init(&queue.not_full, NULL);
+	queue.capacity = 2 * num_threads;
+	queue.chunks = pgut_malloc(queue.capacity * sizeof(import_chunk *));
+	queue.head = 0;
+	queue.count = 0;
+	queue.finished = false;
+	queue.no_sync = no_sync;
+
+	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&threads[i], NULL, import_worker, &queue);
+
+	for (;;)
+	{
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during restore from stream");
+
+		import_read(&stream, &hdr, sizeof(hdr));
+
+		if (hdr.kind == EXPORT_ENTRY_END)
+			break;
+
+		if (hdr.path_len >= MAXPGPATH || hdr.link_len >= MAXPGPATH)
+			elog(ERROR, "Invalid entry in backup stream at offset " UINT64_FORMAT,
+				 stream.offset);
+
+		import_read(&stream, rel_path, hdr.path_len);
+		rel_path[hdr.path_len] = '\0';
+		import_read(&stream, linked, hdr.link_len);
+		linked[hdr.link_len] = '\0';
+		n_entries++;
+
+		if (hdr.external_dir_num > 0)
+		{
+			char	   *external_path;
+
+			if (params->skip_external_dirs)
+			{
+				import_skip(&stream, buf, hdr.size);
+				continue;
+			}
+
+			if (external_dirs == NULL || hdr.external_dir_num > parray_num(external_dirs))
+				elog(ERROR, "Inconsistent external directory backup metadata");
+
+			external_path = parray_get(external_dirs, hdr.external_dir_num - 1);
+			join_path_components(to_fullpath, external_path, rel_path);
+		}
+		else
+			join_path_components(to_fullpath, instance_config.pgdata, rel_path);
+
+		/* final metadata of backup, written to stdout during backup */
+		if (hdr.kind == EXPORT_ENTRY_CONTROL)
+		{
+			pgBackupFree(backup);
+			backup = import_control(&stream, &hdr, buf);
+			continue;
+		}
+
+		elog(VERBOSE, "Restoring \"%s\"", rel_path);
+
+		switch (hdr.kind)
+		{
+			case EXPORT_ENTRY_DIR:
+				if (hdr.link_len > 0)
+				{
+					const char *linked_path = get_tablespace_mapping(linked);
+
+					if (!is_absolute_path(linked_path))
+						elog(ERROR, "Tablespace directory path must be an absolute path: %s",
+							 linked_path);
+
+					if (!dir_is_empty(linked_path, FIO_DB_HOST))
+						elog(ERROR, "Tablespace directory is not empty: \"%s\"",
+							 linked_path);
+
+					fio_mkdir(linked_path, hdr.mode, FIO_DB_HOST);
+					if (fio_symlink(linked_path, to_fullpath, false, FIO_DB_HOST) < 0)
+						elog(ERROR, "Could not create symbolic link \"%s\": %s",
+							 to_fullpath, strerror(errno));
+				}
+				else
+					fio_mkdir(to_fullpath, hdr.mode, FIO_DB_HOST);
+				break;
+
+			case EXPORT_ENTRY_FILE:
+				/*
+				 * Skip tablespace_map and database_map, same as restore does:
+				 * tablespace links are already created with -T applied.
+				 */
+				if (hdr.external_dir_num == 0 &&
+					(strcmp(rel_path, PG_TABLESPACE_MAP_FILE) == 0 ||
+					 strcmp(rel_path, DATABASE_MAP) == 0))
+				{
+					elog(VERBOSE, "Skip \"%s\"", rel_path);
+					import_skip(&stream, buf, hdr.size);
+				}
+				/* pg_control is written last, so cluster is not usable until restore is done */
+				else if (hdr.external_dir_num == 0 &&
+					strcmp(rel_path, XLOG_CONTROL_FILE) == 0)
+				{
+					pg_control_size = hdr.size;
+					pg_control_mode = hdr.mode;
+					pg_control = pgut_malloc(pg_control_size);
+					import_read(&stream, pg_control, pg_control_size);
+				}
+				else
+					import_plain_file(&stream, &hdr, to_fullpath, buf, no_sync);
+				break;
+
+			case EXPORT_ENTRY_DATAFILE:
+				import_data_file(&stream, &queue, &hdr, to_fullpath);
+				break;
+
+			default:
+				elog(ERROR, "Invalid entry kind %u in backup stream at offset " UINT64_FORMAT,
+					 hdr.kind, stream.offset);
+		}
+	}
+
+	/* wait for workers to write all data files */
+	pthread_lock(&queue.lock);
+	queue.finished = true;
+	pthread_cond_broadcast(&queue.not_empty);
+	pthread_mutex_unlock(&queue.lock);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (thread_interrupted)
+		elog(ERROR, "Restore from stream failed");
+
+	/* skip index of entries and check integrity of the stream */
+	import_skip(&stream, buf, hdr.size);
+	FIN_FILE_CRC32(true, stream.crc);
+
+	if (fread(&trailer, 1, sizeof(trailer), stream.in) != sizeof(trailer))
+		elog(ERROR, "Cannot read backup stream: unexpected end of stream");
+
+	if (memcmp(trailer.magic, EXPORT_STREAM_MAGIC, sizeof(trailer.magic)) != 0 ||
+		trailer.n_entries != n_entries + 1)
+		elog(ERROR, "Backup stream is corrupted: invalid trailer");
+
+	if (trailer.crc != stream.crc)
+		elog(ERROR, "Backup stream is corrupted: CRC mismatch, expected %X, got %X",
+			 trailer.crc, stream.crc);
+
+	if (pg_control == NULL)
+		elog(ERROR, "Backup stream doesn't contain \"%s\"", XLOG_CONTROL_FILE);
+
+	/* now cluster can be started */
+	join_path_components(to_fullpath, instance_config.pgdata, XLOG_CONTROL_FILE);
+	{
+		FILE	   *out = fopen(to_fullpath, PG_BINARY_W);
+
+		if (out == NULL)
+			elog(ERROR, "Cannot open file \"%s\": %s", to_fullpath, strerror(errno));
+
+		if (fwrite(pg_control, 1, pg_control_size, out) != pg_control_size ||
+			fflush(out) != 0 ||
+			(!no_sync && fsync(fileno(out)) != 0) ||
+			fclose(out) != 0)
+			elog(ERROR, "Cannot write file \"%s\": %s", to_fullpath, strerror(errno));
+
+		if (chmod(to_fullpath, pg_control_mode) != 0)
+			elog(ERROR, "Cannot change mode of \"%s\": %s", to_fullpath, strerror(errno));
+	}
+
+	create_recovery_conf(instanceState, backup->start_time, rt, backup, params);
+
+	time(&end_time);
+	pretty_time_interval(difftime(end_time, start_time),
+						 pretty_time, lengthof(pretty_time));
+	pretty_size(stream.offset + sizeof(trailer), pretty_bytes, lengthof(pretty_bytes));
+
+	elog(INFO, "Backup %s restored from stream, stream size: %s, time elapsed: %s",
+		 base36enc(backup->start_time), pretty_bytes, pretty_time);
+
+	/* cleanup */
+	pg_free(buf);
+	pg_free(pg_control);
+	pg_free(queue.chunks);
+	pfree(threads);
+	pthread_mutex_destroy(&queue.lock);
+	pthread_cond_destroy(&queue.not_empty);
+	pthread_cond_destroy(&queue.not_full);
+
+	if (external_dirs)
+		free_dir_list(external_dirs);
+
+	pgBackupFree(backup);
+
+	return 0;
+}
+
+/* Read exactly "len" bytes from stream, keeping track of offset and CRC */
+static void
+import_read(import_stream *stream, void *data, size_t len)
+{
+	if (len == 0)
+		return;
+
+	if (fread(data, 1, len, stream->in) != len)
+		elog(ERROR, "Cannot read backup stream: %s",
+			 ferror(stream->in) ? strerror(errno) : "unexpected end of stream");
+
+	COMP_FILE_CRC32(true, stream->crc, data, len);
+	stream->offset += len;
+}
+
+/*
+ * Read metadata of backup from CONTROL entry, whose header and path
+ * are already read.
+ */
+static pgBackup *
+import_control(import_stream *stream, ExportEntryHeader *hdr, char *buf)
+{
+	char		to_fullpath[MAXPGPATH];
+	pgBackup   *backup;
+
+	/* use temporary copy of control file to parse it */
+	join_path_components(to_fullpath, instance_config.pgdata, BACKUP_CONTROL_FILE);
+	import_plain_file(stream, hdr, to_fullpath, buf, true);
+	backup = read_backup(instance_config.pgdata);
+	if (unlink(to_fullpath) != 0)
+		elog(ERROR, "Cannot remove file \"%s\": %s", to_fullpath, strerror(errno));
+
+	if (backup == NULL)
+		elog(ERROR, "Cannot parse metadata of backup from stream");
+
+	return backup;
+}
+
+/* Read and throw away "size" bytes of stream */
+static void
+import_skip(import_stream *stream, char *buf, uint64 size)
+{
+	while (size > 0)
+	{
+		size_t		read_len = Min(size, STDIO_BUFSIZE);
+
+		import_read(stream, buf, read_len);
+		size -= read_len;
+	}
+}
+
+/* Copy entry payload into file as is */
+static void
+import_plain_file(import_stream *stream, ExportEntryHeader *hdr,
+				  const char *to_fullpath, char *buf, bool no_sync)
+{
+	uint64		copied = 0;
+	FILE	   *out;
+
+#ifdef HAVE_LIBZ
+	/* streamed WAL segment compressed during backup */
+	if (hdr->compress_alg == ZLIB_COMPRESS)
+	{
+		import_compressed_wal_file(stream, hdr, to_fullpath, buf, no_sync);
+		return;
+	}
+#endif
+
+	out = fopen(to_fullpath, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", to_fullpath, strerror(errno));
+
+	while (copied < hdr->size)
+	{
+		size_t		read_len = Min(hdr->size - copied, STDIO_BUFSIZE);
+
+		import_read(stream, buf, read_len);
+
+		if (fwrite(buf, 1, read_len, out) != read_len)
+			elog(ERROR, "Cannot write file \"%s\": %s", to_fullpath, strerror(errno));
+
+		copied += read_len;
+	}
+
+	if (fflush(out) != 0 ||
+		(!no_sync && fsync(fileno(out)) != 0) ||
+		fclose(out) != 0)
+		elog(ERROR, "Cannot write file \"%s\": %s", to_fullpath, strerror(errno));
+
+	if (hdr->mode != 0 && chmod(to_fullpath, hdr->mode) != 0)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", to_fullpath, strerror(errno));
+}
+
+#ifdef HAVE_LIBZ
+/*
+ * Decompress "<segment>.gz" entry into "<segment>".
+ */
+static void
+import_compressed_wal_file(import_stream *stream, ExportEntryHeader *hdr,
+						   const char *to_fullpath, char *buf, bool no_sync)
+{
+	char		path[MAXPGPATH];
+	char	   *in_buf = pgut_malloc(STDIO_BUFSIZE);
+	uint64		remaining = hdr->size;
+	FILE	   *out;
+	z_stream	z;
+	int			rc = Z_OK;
+
+	strncpy(path, to_fullpath, MAXPGPATH);
+	if (strlen(path) > strlen(".gz") &&
+		strcmp(path + strlen(path) - strlen(".gz"), ".gz") == 0)
+		path[strlen(path) - strlen(".gz")] = '\0';
+
+	out = fopen(path, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", path, strerror(errno));
+
+	MemSet(&z, 0, sizeof(z));
+	if (inflateInit2(&z, MAX_WBITS + 16) != Z_OK)
+		elog(ERROR, "Cannot initialize decompression of \"%s\"", path);
+
+	while (rc != Z_STREAM_END)
+	{
+		if (z.avail_in == 0)
+		{
+			size_t		read_len = Min(remaining, STDIO_BUFSIZE);
+
+			if (read_len == 0)
+				elog(ERROR, "Cannot decompress file \"%s\" in backup stream: unexpected end of data",
+					 path);
+
+			import_read(stream, in_buf, read_len);
+			remaining -= read_len;
+			z.next_in = (Bytef *) in_buf;
+			z.avail_in = read_len;
+		}
+
+		z.next_out = (Bytef *) buf;
+		z.avail_out = STDIO_BUFSIZE;
+
+		rc = inflate(&z, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END)
+			elog(ERROR, "Cannot decompress file \"%s\" in backup stream: %s",
+				 path, z.msg ? z.msg : "unknown error");
+
+		if (fwrite(buf, 1, STDIO_BUFSIZE - z.avail_out, out) != STDIO_BUFSIZE - z.avail_out)
+			elog(ERROR, "Cannot write file \"%s\": %s", path, strerror(errno));
+	}
+
+	inflateEnd(&z);
+	pg_free(in_buf);
+
+	/* keep the stream in sync, if there is some trailing garbage */
+	import_skip(stream, buf, remaining);
+
+	if (fflush(out) != 0 ||
+		(!no_sync && fsync(fileno(out)) != 0) ||
+		fclose(out) != 0)
+		elog(ERROR, "Cannot write file \"%s\": %s", path, strerror(errno));
+
+	if (hdr->mode != 0 && chmod(path, hdr->mode) != 0)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", path, strerror(errno));
+}
+#endif
+
+/*
+ * Cut content of data file into chunks and pass them to workers.
+ * Pages are written by workers, file is closed by whoever releases
+ * it the last.
+ */
+static void
+import_data_file(import_stream *stream, import_queue *queue,
+				 ExportEntryHeader *hdr, const char *to_fullpath)
+{
+	import_file *file = pgut_new(import_file);
+	uint64		remaining = hdr->size;
+
+	strncpy(file->path, to_fullpath, MAXPGPATH);
+	file->compress_alg = hdr->compress_alg;
+	file->refcount = 1;
+	file->fd = open(to_fullpath, O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY,
+					hdr->mode ? hdr->mode : FILE_PERMISSION);
+
+	if (file->fd < 0)
+		elog(ERROR, "Cannot open file \"%s\": %s", to_fullpath, strerror(errno));
+
+	/* file may have holes, set its final size right away */
+	if (hdr->n_blocks > 0 &&
+		ftruncate(file->fd, (off_t) hdr->n_blocks * BLCKSZ) != 0)
+		elog(ERROR, "Cannot truncate file \"%s\": %s", to_fullpath, strerror(errno));
+
+	while (remaining > 0)
+	{
+		import_chunk *chunk = pgut_new(import_chunk);
+
+		chunk->file = file;
+		chunk->data = pgut_malloc(IMPORT_CHUNK_SIZE);
+		chunk->len = 0;
+
+		while (remaining > 0 &&
+			   chunk->len + sizeof(BackupPageHeader) + BLCKSZ <= IMPORT_CHUNK_SIZE)
+		{
+			BackupPageHeader bph;
+
+			if (remaining < sizeof(BackupPageHeader))
+				elog(ERROR, "Invalid page header in file \"%s\" in backup stream", to_fullpath);
+
+			import_read(stream, &bph, sizeof(bph));
+
+			if (bph.compressed_size <= 0 || bph.compressed_size > BLCKSZ ||
+				remaining < sizeof(BackupPageHeader) + bph.compressed_size)
+				elog(ERROR, "Invalid page header of block %u in file \"%s\" in backup stream",
+					 bph.block, to_fullpath);
+
+			/* records are not aligned, so copy header instead of referencing it */
+			memcpy(chunk->data + chunk->len, &bph, sizeof(bph));
+			import_read(stream, chunk->data + chunk->len + sizeof(bph),
+						bph.compressed_size);
+
+			chunk->len += sizeof(bph) + bph.compressed_size;
+			remaining -= sizeof(bph) + bph.compressed_size;
+		}
+
+		pthread_lock(&queue->lock);
+		file->refcount++;
+		pthread_mutex_unlock(&queue->lock);
+
+		import_queue_put(queue, chunk);
+	}
+
+	/* drop reference of reader */
+	import_file_release(queue, file);
+}
+
+/* Add chunk to the queue, waiting for workers if it is full */
+static void
+import_queue_put(import_queue *queue, import_chunk *chunk)
+{
+	pthread_lock(&queue->lock);
+
+	while (queue->count == queue->capacity)
+	{
+		struct timespec	timeout;
+
+		/* worker may die because of error, don't wait for it forever */
+		if (interrupted || thread_interrupted)
+		{
+			pthread_mutex_unlock(&queue->lock);
+			elog(ERROR, "Interrupted during restore from stream");
+		}
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += 1;
+		pthread_cond_timedwait(&queue->not_full, &queue->lock, &timeout);
+	}
+
+	queue->chunks[(queue->head + queue->count) % queue->capacity] = chunk;
+	queue->count++;
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/* Take chunk from the queue. Returns NULL when there is no more work */
+static import_chunk *
+import_queue_get(import_queue *queue)
+{
+	import_chunk *chunk = NULL;
+
+	pthread_lock(&queue->lock);
+
+	while (queue->count == 0 && !queue->finished)
+		pthread_cond_wait(&queue->not_empty, &queue->lock);
+
+	if (queue->count > 0)
+	{
+		chunk = queue->chunks[queue->head];
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->count--;
+
+		pthread_cond_signal(&queue->not_full);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return chunk;
+}
+
+/* Drop reference to the file, the last one syncs and closes it */
+static void
+import_file_release(import_queue *queue, import_file *file)
+{
+	bool		last;
+
+	pthread_lock(&queue->lock);
+	last = (--file->refcount == 0);
+	pthread_mutex_unlock(&queue->lock);
+
+	if (!last)
+		return;
+
+	if (!queue->no_sync && fsync(file->fd) != 0)
+		elog(ERROR, "Cannot sync file \"%s\": %s", file->path, strerror(errno));
+
+	if (close(file->fd) != 0)
+		elog(ERROR, "Cannot close file \"%s\": %s", file->path, strerror(errno));
+
+	pg_free(file);
+}
+
+/* Decompress pages of chunks and write them into their files */
+static void *
+import_worker(void *arg)
+{
+	import_queue *queue = (import_queue *) arg;
+	import_chunk *chunk;
+	char		page[BLCKSZ];
+
+	while ((chunk = import_queue_get(queue)) != NULL)
+	{
+		size_t		pos = 0;
+
+		while (pos < chunk->len)
+		{
+			BackupPageHeader bph;
+			char	   *data;
+
+			if (interrupted || thread_interrupted)
+				elog(ERROR, "Interrupted during restore from stream");
+
+			memcpy(&bph, chunk->data + pos, sizeof(bph));
+			data = chunk->data + pos + sizeof(bph);
+			pos += sizeof(bph) + bph.compressed_size;
+
+			if (bph.compressed_size != BLCKSZ)
+			{
+				const char *errormsg = NULL;
+				int32		size = do_decompress(page, BLCKSZ, data, bph.compressed_size,
+												 chunk->file->compress_alg, &errormsg);
+
+				if (size != BLCKSZ)
+					elog(ERROR, "Cannot decompress block %u of file \"%s\": %s",
+						 bph.block, chunk->file->path,
+						 errormsg ? errormsg : "invalid page size");
+				data = page;
+			}
+
+			if (pwrite(chunk->file->fd, data, BLCKSZ, (off_t) bph.block * BLCKSZ) != BLCKSZ)
+				elog(ERROR, "Cannot write block %u of file \"%s\": %s",
+					 bph.block, chunk->file->path, strerror(errno));
+		}
+
+		import_file_release(queue, chunk->file);
+		pg_free(chunk->data);
+		pg_free(chunk);
+	}
+
+	return NULL;
+}
@@ -30,6 +30,8 @@ static void help_checkdb(void);
 static void help_help(void);
 static void help_version(void);
 static void help_catchup(void);
+static void help_export(void);
+static void help_index_wal(void);
 
 void
 help_print_version(void)
@@ -72,6 +74,8 @@ help_command(ProbackupSubcmd const subcmd)
 		&help_help,
 		&help_version,
 		&help_catchup,
+		&help_export,
+		&help_index_wal,
 	};
 
 	Assert((int)subcmd < sizeof(help_functions) / sizeof(help_functions[0]));
@@ -128,7 +132,7 @@ help_pg_probackup(void)
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [--external-dirs=external-directories-paths]\n"));
-	printf(_("                 [--no-sync]\n"));
+	printf(_("                 [--no-sync] [--dedup] [--to-stdout]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-filename=log-filename]\n"));
@@ -169,6 +173,7 @@ help_pg_probackup(void)
 	printf(_("                 [-T OLDDIR=NEWDIR] [--progress]\n"));
 	printf(_("                 [--external-mapping=OLDDIR=NEWDIR]\n"));
 	printf(_("                 [--skip-external-dirs] [--no-sync]\n"));
+	printf(_("                 [--from-stdin]\n"));
 	printf(_("                 [-I | --incremental-mode=none|checksum|lsn]\n"));
 	printf(_("                 [--db-include | --db-exclude]\n"));
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
@@ -210,7 +215,11 @@ help_pg_probackup(void)
 
 	printf(_("\n  %s merge -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 -i backup-id [--progress] [-j num-threads]\n"));
-	printf(_("                 [--no-validate] [--no-sync]\n"));
+	printf(_("                 [--no-validate] [--no-sync] [--reflink]\n"));
+	printf(_("                 [--help]\n"));
+
+	printf(_("\n  %s export -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
+	printf(_("                 -i backup-id [--progress] [--no-validate]\n"));
 	printf(_("                 [--help]\n"));
 
 	printf(_("\n  %s add-instance -B backup-path -D pgdata-path\n"), PROGRAM_NAME);
@@ -249,6 +258,10 @@ help_pg_probackup(void)
 	printf(_("                 [--ssh-options]\n"));
 	printf(_("                 [--help]\n"));
 
+	printf(_("\n  %s index-wal -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
+	printf(_("                 [-j num-threads]\n"));
+	printf(_("                 [--help]\n"));
+
 	printf(_("\n  %s catchup  -b catchup-mode\n"), PROGRAM_NAME);
 	printf(_("                 --source-pgdata=path_to_pgdata_on_remote_server\n"));
 	printf(_("                 --destination-pgdata=path_to_local_dir\n"));
@@ -302,7 +315,7 @@ help_backup(void)
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [-E external-directories-paths]\n"));
-	printf(_("                 [--no-sync]\n"));
+	printf(_("                 [--no-sync] [--dedup] [--to-stdout]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-filename=log-filename]\n"));
@@ -336,12 +349,25 @@ help_backup(void)
 	printf(_("      --backup-pg-log              backup of '%s' directory\n"), PG_LOG_DIR);
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
+	printf(_("      --max-read-rate=size         limit read rate from PGDATA, per second\n"));
+	printf(_("      --max-write-rate=size        limit write rate, per second\n"));
+	printf(_("      --max-page-rate=pages        limit number of data pages read per second\n"));
+	printf(_("      --throttle-file=path         reread rate limits from file at runtime\n"));
 	printf(_("      --no-validate                disable validation after backup\n"));
 	printf(_("      --skip-block-validation      set to validate only file-level checksum\n"));
 	printf(_("  -E  --external-dirs=external-directories-paths\n"));
 	printf(_("                                   backup some directories not from pgdata \n"));
 	printf(_("                                   (example: --external-dirs=/tmp/dir1:/tmp/dir2)\n"));
 	printf(_("      --no-sync                    do not sync backed up files to disk\n"));
+	printf(_("      --dedup                      hardlink files of FULL backup, which are identical\n"));
+	printf(_("                                   to files of previous backup, instead of storing new copies\n"));
+	printf(_("      --to-stdout                  write FULL backup to stdout as a stream, which can be\n"));
+	printf(_("                                   restored with --from-stdin, instead of keeping it in catalog\n"));
+	printf(_("      --wal-poll-interval=interval\n"));
+	printf(_("                                   how often to check for WAL segment while waiting for it\n"));
+	printf(_("                                   (default: 200ms)\n"));
 	printf(_("      --note=text                  add note to backup\n"));
 	printf(_("                                   (example: --note='backup before app update to v13.1')\n"));
 
@@ -394,6 +420,7 @@ help_backup(void)
 	printf(_("                                   available options: 'zlib', 'pglz', 'none' (default: none)\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
+	printf(_("      --compress-adaptive          adjust zlib level to the throughput of every thread\n"));
 
 	printf(_("\n  Archive options:\n"));
 	printf(_("      --archive-timeout=timeout    wait timeout for WAL segment archiving (default: 5min)\n"));
@@ -434,7 +461,7 @@ help_restore(void)
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [-T OLDDIR=NEWDIR]\n"));
 	printf(_("                 [--external-mapping=OLDDIR=NEWDIR]\n"));
-	printf(_("                 [--skip-external-dirs]\n"));
+	printf(_("                 [--skip-external-dirs] [--from-stdin]\n"));
 	printf(_("                 [-I | --incremental-mode=none|checksum|lsn]\n"));
 	printf(_("                 [--db-include dbname | --db-exclude dbname]\n"));
 	printf(_("                 [--recovery-target-time=time|--recovery-target-xid=xid\n"));
@@ -461,6 +488,10 @@ help_restore(void)
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
+	printf(_("      --max-write-rate=size        limit write rate, per second\n"));
+	printf(_("      --throttle-file=path         reread rate limits from file at runtime\n"));
 	printf(_("      --force                      ignore invalid status of the restored backup\n"));
 	printf(_("      --no-sync                    do not sync restored files to disk\n"));
 	printf(_("      --no-validate                disable backup validation during restore\n"));
@@ -471,6 +502,8 @@ help_restore(void)
 	printf(_("      --external-mapping=OLDDIR=NEWDIR\n"));
 	printf(_("                                   relocate the external directory from OLDDIR to NEWDIR\n"));
 	printf(_("      --skip-external-dirs         do not restore all external directories\n"));
+	printf(_("      --from-stdin                 restore backup stream, produced by export command\n"));
+	printf(_("                                   or backup with --to-stdout, from stdin\n"));
 
 	printf(_("\n  Incremental restore options:\n"));
 	printf(_("  -I, --incremental-mode=none|checksum|lsn\n"));
@@ -561,6 +594,8 @@ help_validate(void)
 	printf(_("  -i, --backup-id=backup-id        backup to validate\n"));
 
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --recovery-target-time=time  time stamp up to which recovery will proceed\n"));
 	printf(_("      --recovery-target-xid=xid    transaction ID up to which recovery will proceed\n"));
@@ -602,7 +637,8 @@ help_checkdb(void)
 	printf(_("\n%s checkdb [-B backup-path] [--instance=instance_name]\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--amcheck] [--skip-block-validation]\n"));
-	printf(_("                 [--heapallindexed] [--checkunique]\n\n"));
+	printf(_("                 [--heapallindexed] [--checkunique]\n"));
+	printf(_("                 [--shard=N/M]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
 	printf(_("      --instance=instance_name     name of the instance\n"));
@@ -619,6 +655,7 @@ help_checkdb(void)
 	printf(_("                                   can be used only with '--amcheck' option\n"));
 	printf(_("      --checkunique                also check unique constraints\n"));
 	printf(_("                                   can be used only with '--amcheck' option\n"));
+	printf(_("      --shard=N/M                  check only N-th of M parts of data files\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -728,7 +765,7 @@ help_merge(void)
 {
 	printf(_("\n%s merge -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
 	printf(_("                 -i backup-id [-j num-threads] [--progress]\n"));
-	printf(_("                 [--no-validate] [--no-sync]\n"));
+	printf(_("                 [--no-validate] [--no-sync] [--reflink]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-filename=log-filename]\n"));
@@ -743,8 +780,54 @@ help_merge(void)
 
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
 	printf(_("      --progress                   show progress\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
 	printf(_("      --no-validate                disable validation during retention merge\n"));
 	printf(_("      --no-sync                    do not sync merged files to disk\n"));
+	printf(_("      --reflink                    clone unchanged blocks of FULL backup instead of\n"));
+	printf(_("                                   copying them, if supported by filesystem\n"));
+
+	printf(_("\n  Logging options:\n"));
+	printf(_("      --log-level-console=log-level-console\n"));
+	printf(_("                                   level for console logging (default: info)\n"));
+	printf(_("                                   available options: 'off', 'error', 'warning', 'info', 'log', 'verbose'\n"));
+	printf(_("      --log-level-file=log-level-file\n"));
+	printf(_("                                   level for file logging (default: off)\n"));
+	printf(_("                                   available options: 'off', 'error', 'warning', 'info', 'log', 'verbose'\n"));
+	printf(_("      --log-filename=log-filename\n"));
+	printf(_("                                   filename for file logging (default: 'pg_probackup.log')\n"));
+	printf(_("                                   support strftime format (example: pg_probackup-%%Y-%%m-%%d_%%H%%M%%S.log)\n"));
+	printf(_("      --error-log-filename=error-log-filename\n"));
+	printf(_("                                   filename for error logging (default: none)\n"));
+	printf(_("      --log-directory=log-directory\n"));
+	printf(_("                                   directory for file logging (default: BACKUP_PATH/log)\n"));
+	printf(_("      --log-rotation-size=log-rotation-size\n"));
+	printf(_("                                   rotate logfile if its size exceeds this value; 0 disables; (default: 0)\n"));
+	printf(_("                                   available units: 'kB', 'MB', 'GB', 'TB' (default: kB)\n"));
+	printf(_("      --log-rotation-age=log-rotation-age\n"));
+	printf(_("                                   rotate logfile if its age exceeds this value; 0 disables; (default: 0)\n"));
+	printf(_("                                   available units: 'ms', 's', 'min', 'h', 'd' (default: min)\n"));
+	printf(_("      --no-color                   disable the coloring of error and warning console messages\n\n"));
+}
+
+static void
+help_export(void)
+{
+	printf(_("\n%s export -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
+	printf(_("                 -i backup-id [--progress] [--no-validate]\n"));
+	printf(_("                 [--log-level-console=log-level-console]\n"));
+	printf(_("                 [--log-level-file=log-level-file]\n"));
+	printf(_("                 [--log-filename=log-filename]\n"));
+	printf(_("                 [--error-log-filename=error-log-filename]\n"));
+	printf(_("                 [--log-directory=log-directory]\n"));
+	printf(_("                 [--log-rotation-size=log-rotation-size]\n"));
+	printf(_("                 [--log-rotation-age=log-rotation-age]\n\n"));
+
+	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
+	printf(_("      --instance=instance_name     name of the instance\n"));
+	printf(_("  -i, --backup-id=backup-id        full backup to write into stdout as a single stream\n"));
+	printf(_("      --progress                   show progress\n"));
+	printf(_("      --no-validate                disable backup validation before export\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -959,6 +1042,8 @@ help_archive_push(void)
 	printf(_("      --wal-file-path=wal-file-path\n"));
 	printf(_("                                   relative destination path of the WAL archive\n"));
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
 	printf(_("      --batch-size=NUM             number of files to be copied\n"));
 	printf(_("      --archive-timeout=timeout    wait timeout before discarding stale temp file(default: 5min)\n"));
 	printf(_("      --no-ready-rename            do not rename '.ready' files in 'archive_status' directory\n"));
@@ -1019,6 +1104,46 @@ help_archive_get(void)
 	printf(_("                                   (example: --ssh-options='-c cipher_spec -F configfile')\n\n"));
 }
 
+static void
+help_index_wal(void)
+{
+	printf(_("\n%s index-wal -B backup-path --instance=instance_name\n"), PROGRAM_NAME);
+	printf(_("                 [-j num-threads]\n"));
+	printf(_("                 [--log-level-console=log-level-console]\n"));
+	printf(_("                 [--log-level-file=log-level-file]\n"));
+	printf(_("                 [--log-filename=log-filename]\n"));
+	printf(_("                 [--error-log-filename=error-log-filename]\n"));
+	printf(_("                 [--log-directory=log-directory]\n"));
+	printf(_("                 [--log-rotation-size=log-rotation-size]\n"));
+	printf(_("                 [--log-rotation-age=log-rotation-age]\n\n"));
+
+	printf(_("  -B, --backup-path=backup-path    location of the backup storage area\n"));
+	printf(_("      --instance=instance_name     name of the instance\n"));
+	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+
+	printf(_("\n  Logging options:\n"));
+	printf(_("      --log-level-console=log-level-console\n"));
+	printf(_("                                   level for console logging (default: info)\n"));
+	printf(_("                                   available options: 'off', 'error', 'warning', 'info', 'log', 'verbose'\n"));
+	printf(_("      --log-level-file=log-level-file\n"));
+	printf(_("                                   level for file logging (default: off)\n"));
+	printf(_("                                   available options: 'off', 'error', 'warning', 'info', 'log', 'verbose'\n"));
+	printf(_("      --log-filename=log-filename\n"));
+	printf(_("                                   filename for file logging (default: 'pg_probackup.log')\n"));
+	printf(_("                                   support strftime format (example: pg_probackup-%%Y-%%m-%%d_%%H%%M%%S.log)\n"));
+	printf(_("      --error-log-filename=error-log-filename\n"));
+	printf(_("                                   filename for error logging (default: none)\n"));
+	printf(_("      --log-directory=log-directory\n"));
+	printf(_("                                   directory for file logging (default: BACKUP_PATH/log)\n"));
+	printf(_("      --log-rotation-size=log-rotation-size\n"));
+	printf(_("                                   rotate logfile if its size exceeds this value; 0 disables; (default: 0)\n"));
+	printf(_("                                   available units: 'kB', 'MB', 'GB', 'TB' (default: kB)\n"));
+	printf(_("      --log-rotation-age=log-rotation-age\n"));
+	printf(_("                                   rotate logfile if its age exceeds this value; 0 disables; (default: 0)\n"));
+	printf(_("                                   available units: 'ms', 's', 'min', 'h', 'd' (default: min)\n"));
+	printf(_("      --no-color                   disable the coloring of error and warning console messages\n\n"));
+}
+
 static void
 help_help(void)
 {
@@ -1058,6 +1183,12 @@ help_catchup(void)
 	printf(_("  -P  --perm-slot                  create permanent replication slot\n"));
 
 	printf(_("  -j, --threads=NUM                number of parallel threads\n"));
+	printf(_("      --status-file=path           write progress metrics in JSON into file\n"));
+	printf(_("      --timing                     measure time spent in I/O and CPU hot paths\n"));
+	printf(_("      --max-read-rate=size         limit read rate from PGDATA, per second\n"));
+	printf(_("      --max-write-rate=size        limit write rate, per second\n"));
+	printf(_("      --max-page-rate=pages        limit number of data pages read per second\n"));
+	printf(_("      --throttle-file=path         reread rate limits from file at runtime\n"));
 
 	printf(_("  -T, --tablespace-mapping=OLDDIR=NEWDIR\n"));
 	printf(_("                                   relocate the tablespace from directory OLDDIR to NEWDIR\n"));
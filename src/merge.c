@@ -11,9 +11,16 @@
 
 #include <sys/stat.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
 
 #include "utils/thread.h"
 
+/* Size of block record in uncompressed backup of data file */
+#define MERGE_RECORD_SIZE	(sizeof(BackupPageHeader) + BLCKSZ)
+
 typedef struct
 {
 	parray		*merge_filelist;
@@ -31,6 +38,7 @@ typedef struct
 	bool        use_bitmap;
 	bool        is_retry;
 	bool        no_sync;
+	bool        reflink;
 
 	/*
 	 * Return value from the thread.
@@ -53,6 +61,11 @@ merge_data_file(parray *parent_chain, pgBackup *full_backup,
 				pgFile *tmp_file, const char *to_root, bool use_bitmap,
 				bool is_retry, bool no_sync);
 
+static bool
+merge_data_file_reflink(parray *parent_chain, pgBackup *full_backup,
+				pgFile *dest_file, pgFile *tmp_file,
+				const char *full_database_dir, bool no_sync);
+
 static void
 merge_non_data_file(parray *parent_chain, pgBackup *full_backup,
 				pgBackup *dest_backup, pgFile *dest_file,
@@ -418,6 +431,8 @@ do_merge(InstanceState *instanceState, time_t backup_id, bool no_validate, bool
 	parray_free(backups);
 	parray_free(merge_list);
 
+	progress_finish();
+
 	elog(INFO, "Merge of backup %s completed", base36enc(backup_id));
 }
 
@@ -462,6 +477,8 @@ merge_chain(InstanceState *instanceState,
 	/* in-place merge flags */
 	bool		compression_match = false;
 	bool		program_version_match = false;
+	/* build merged data files by cloning unchanged blocks */
+	bool		reflink = false;
 	/* It's redundant to check block checksumms during merge */
 	skip_block_validation = true;
 
@@ -632,6 +649,28 @@ merge_chain(InstanceState *instanceState,
 	if (parse_program_version(dest_backup->program_version) < 20300)
 		use_bitmap = false;
 
+	/*
+	 * Reflink merge relies on fixed block positions in backup files,
+	 * so it is possible only for uncompressed chains with page header maps.
+	 */
+	if (merge_reflink)
+	{
+		reflink = compression_match && program_version_match && !is_retry;
+
+		for (i = parray_num(parent_chain) - 1; i >= 0 && reflink; i--)
+		{
+			pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+
+			if (backup->compress_alg != NONE_COMPRESS ||
+				parse_program_version(backup->program_version) < 20400)
+				reflink = false;
+		}
+
+		if (!reflink)
+			elog(WARNING, "Reflink merge is disabled, it requires uncompressed "
+						"backups taken by pg_probackup 2.4.0 or newer");
+	}
+
 	/* Setup threads */
 	for (i = 0; i < parray_num(dest_backup->files); i++)
 	{
@@ -658,6 +697,7 @@ merge_chain(InstanceState *instanceState,
 	thread_interrupted = false;
 	merge_time = time(NULL);
 	elog(INFO, "Start merging backup files");
+	progress_begin_files("merge files", dest_backup->files);
 	for (i = 0; i < num_threads; i++)
 	{
 		merge_files_arg *arg = &(threads_args[i]);
@@ -673,6 +713,7 @@ merge_chain(InstanceState *instanceState,
 		arg->use_bitmap = use_bitmap;
 		arg->is_retry = is_retry;
 		arg->no_sync = no_sync;
+		arg->reflink = reflink;
 		/* By default there are some error */
 		arg->ret = 1;
 
@@ -770,6 +811,10 @@ merge_chain(InstanceState *instanceState,
 	if (dest_backup->note)
 		full_backup->note = pgut_strdup(dest_backup->note);
 
+	/* timings of the backup run are meaningless for merged backup */
+	pg_free(full_backup->timing);
+	full_backup->timing = NULL;
+
 	/* FULL backup must inherit wal mode. */
 	full_backup->stream = dest_backup->stream;
 
@@ -1068,11 +1113,13 @@ merge_files(void *arg)
 
 				tmp_file->crc = file->crc;
 				tmp_file->write_size = file->write_size;
+				/* streamed WAL segments may be compressed too */
+				tmp_file->compress_alg = file->compress_alg;
+				tmp_file->compress_level = file->compress_level;
 
 				if (dest_file->is_datafile && !dest_file->is_cfs)
 				{
 					tmp_file->n_blocks = file->n_blocks;
-					tmp_file->compress_alg = file->compress_alg;
 					tmp_file->uncompressed_size = file->n_blocks * BLCKSZ;
 
 					tmp_file->n_headers = file->n_headers;
@@ -1100,6 +1147,15 @@ merge_files(void *arg)
 		}
 
 		if (dest_file->is_datafile && !dest_file->is_cfs)
+		{
+			if (arguments->reflink &&
+				merge_data_file_reflink(arguments->parent_chain,
+										arguments->full_backup,
+										dest_file, tmp_file,
+										arguments->full_database_dir,
+										arguments->no_sync))
+				goto done;
+
 			merge_data_file(arguments->parent_chain,
 							arguments->full_backup,
 							arguments->dest_backup,
@@ -1108,6 +1164,7 @@ merge_files(void *arg)
 							arguments->use_bitmap,
 							arguments->is_retry,
 							arguments->no_sync);
+		}
 		else
 			merge_non_data_file(arguments->parent_chain,
 								arguments->full_backup,
@@ -1118,6 +1175,9 @@ merge_files(void *arg)
 								arguments->no_sync);
 
 done:
+		if (S_ISREG(dest_file->mode))
+			progress_file_done(tmp_file);
+
 		parray_append(arguments->merge_filelist, tmp_file);
 	}
 
@@ -1293,6 +1353,340 @@ merge_data_file(parray *parent_chain, pgBackup *full_backup,
 	unlink(to_fullpath_tmp1);
 }
 
+/* Source of block for merged data file */
+typedef struct
+{
+	int			backup_seq;		/* index of backup in parent chain, -1 if none */
+	int			hdr_seq;		/* index of block header in this backup */
+} merge_block_source;
+
+/*
+ * Copy the range of FULL backup file into merged file at the same offset
+ * and update CRC of merged file. Part of the range aligned to filesystem
+ * block size is cloned if filesystem supports it, the rest is copied.
+ */
+static void
+merge_clone_range(int in, const char *from_fullpath,
+				  int out, const char *to_fullpath,
+				  off_t off, off_t len, off_t align,
+				  char *buf, pg_crc32 *crc)
+{
+	off_t	end = off + len;
+	off_t	clone_start = off;
+	off_t	clone_end = off;
+	off_t	pos = off;
+
+#ifdef FICLONERANGE
+	if (align > 0)
+	{
+		clone_start = ((off + align - 1) / align) * align;
+		clone_end = (end / align) * align;
+	}
+
+	if (clone_end > clone_start)
+	{
+		struct file_clone_range range;
+
+		range.src_fd = in;
+		range.src_offset = clone_start;
+		range.src_length = clone_end - clone_start;
+		range.dest_offset = clone_start;
+
+		if (ioctl(out, FICLONERANGE, &range) != 0)
+		{
+			elog(VERBOSE, "Cannot clone range of file \"%s\" into \"%s\", copy it instead: %s",
+				 from_fullpath, to_fullpath, strerror(errno));
+			clone_start = clone_end = off;
+		}
+	}
+	else
+		clone_start = clone_end = off;
+#endif
+
+	/*
+	 * Cloned data must be read anyway to calculate CRC of merged file,
+	 * but it doesn't have to be written.
+	 */
+	while (pos < end)
+	{
+		size_t	n = Min(end - pos, CHUNK_SIZE);
+		bool	cloned = pos >= clone_start && pos < clone_end;
+
+		/* chunk should not cross the bounds of cloned area */
+		if (pos < clone_start && pos + n > clone_start)
+			n = clone_start - pos;
+		else if (cloned && pos + n > clone_end)
+			n = clone_end - pos;
+
+		if (pread(in, buf, n, pos) != n)
+			elog(ERROR, "Cannot read file \"%s\" at offset %lld: %s",
+				 from_fullpath, (long long) pos, strerror(errno));
+
+		COMP_FILE_CRC32(true, *crc, buf, n);
+
+		if (!cloned && pwrite(out, buf, n, pos) != n)
+			elog(ERROR, "Cannot write file \"%s\" at offset %lld: %s",
+				 to_fullpath, (long long) pos, strerror(errno));
+
+		pos += n;
+	}
+}
+
+/*
+ * Merge uncompressed data file without restoring it into temp file.
+ *
+ * Every block of uncompressed data file in FULL backup is stored at
+ * the offset blknum * MERGE_RECORD_SIZE, so merged file can be assembled
+ * from ranges of unchanged blocks of FULL file and the newest copies of
+ * changed blocks taken from incremental backups. On copy-on-write
+ * filesystems (XFS, btrfs, etc.) unchanged ranges are cloned with
+ * FICLONERANGE, so only changed blocks are actually written.
+ *
+ * Return false if the file cannot be merged this way, e.g. some block of
+ * destination file is missing in the chain, in this case caller should
+ * fall back to merge_data_file().
+ */
+static bool
+merge_data_file_reflink(parray *parent_chain, pgBackup *full_backup,
+				pgFile *dest_file, pgFile *tmp_file,
+				const char *full_database_dir, bool no_sync)
+{
+	int			i;
+	int			n_backups = parray_num(parent_chain);
+	int			n_blocks = dest_file->n_blocks;
+	int			blknum;
+	bool		success = false;
+	pgFile	  **chain_files = NULL;
+	BackupPageHeader2 **chain_headers = NULL;
+	int		   *chain_fds = NULL;
+	merge_block_source *blocks = NULL;
+	BackupPageHeader2 *headers = NULL;
+	char		from_fullpath[MAXPGPATH];
+	char		to_fullpath[MAXPGPATH];
+	char		to_fullpath_tmp[MAXPGPATH];
+	char	   *buf = NULL;
+	int			out = -1;
+	struct stat	st;
+	pg_crc32	crc;
+
+	if (n_blocks <= 0)
+		return false;
+
+	chain_files = pgut_malloc0(n_backups * sizeof(pgFile *));
+	chain_headers = pgut_malloc0(n_backups * sizeof(BackupPageHeader2 *));
+	chain_fds = pgut_malloc(n_backups * sizeof(int));
+	blocks = pgut_malloc(n_blocks * sizeof(merge_block_source));
+
+	for (i = 0; i < n_backups; i++)
+		chain_fds[i] = -1;
+
+	for (blknum = 0; blknum < n_blocks; blknum++)
+		blocks[blknum].backup_seq = -1;
+
+	/*
+	 * Iterate over parent chain starting from destination backup and
+	 * pick up the newest copy of every block.
+	 */
+	for (i = 0; i < n_backups; i++)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+		pgFile	  **res_file = NULL;
+		pgFile	   *file = NULL;
+		int			n_hdr;
+
+		res_file = parray_bsearch(backup->files, dest_file, pgFileCompareRelPathWithExternal);
+		file = (res_file) ? *res_file : NULL;
+
+		/* file is missing in this backup or didn`t changed since previous one */
+		if (file == NULL ||
+			file->write_size == BYTES_INVALID ||
+			file->write_size == 0)
+			continue;
+
+		if (file->n_headers <= 0)
+			goto cleanup;
+
+		chain_files[i] = file;
+		chain_headers[i] = get_data_file_headers(&(backup->hdr_map), file,
+									parse_program_version(backup->program_version),
+									true);
+		if (!chain_headers[i])
+			goto cleanup;
+
+		for (n_hdr = 0; n_hdr < file->n_headers; n_hdr++)
+		{
+			BackupPageHeader2 *hdr = &(chain_headers[i][n_hdr]);
+
+			/* every block must be stored as is */
+			if (chain_headers[i][n_hdr + 1].pos - hdr->pos != MERGE_RECORD_SIZE)
+				goto cleanup;
+
+			/* blocks of FULL file are expected to be stored without gaps */
+			if (backup->backup_mode == BACKUP_MODE_FULL &&
+				(hdr->block != n_hdr || hdr->pos != (off_t) n_hdr * MERGE_RECORD_SIZE))
+				goto cleanup;
+
+			/* relation was truncated later */
+			if (hdr->block >= n_blocks)
+				continue;
+
+			if (blocks[hdr->block].backup_seq < 0)
+			{
+				blocks[hdr->block].backup_seq = i;
+				blocks[hdr->block].hdr_seq = n_hdr;
+			}
+		}
+	}
+
+	/* some blocks are not backed up at all, leave them to restore */
+	for (blknum = 0; blknum < n_blocks; blknum++)
+	{
+		if (blocks[blknum].backup_seq < 0)
+			goto cleanup;
+	}
+
+	/* Here we are sure that merged file can be assembled */
+	join_path_components(to_fullpath, full_database_dir, tmp_file->rel_path);
+	snprintf(to_fullpath_tmp, MAXPGPATH, "%s_tmp2", to_fullpath);
+
+	out = open(to_fullpath_tmp, O_CREAT | O_TRUNC | O_WRONLY | PG_BINARY, FILE_PERMISSION);
+	if (out < 0)
+		elog(ERROR, "Cannot open merge target file \"%s\": %s",
+			 to_fullpath_tmp, strerror(errno));
+
+	if (fstat(out, &st) != 0)
+		elog(ERROR, "Cannot stat file \"%s\": %s", to_fullpath_tmp, strerror(errno));
+
+	for (i = 0; i < n_backups; i++)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+		char		from_root[MAXPGPATH];
+
+		if (!chain_files[i])
+			continue;
+
+		join_path_components(from_root, backup->root_dir, DATABASE_DIR);
+		join_path_components(from_fullpath, from_root, chain_files[i]->rel_path);
+
+		chain_fds[i] = open(from_fullpath, O_RDONLY | PG_BINARY, 0);
+		if (chain_fds[i] < 0)
+			elog(ERROR, "Cannot open backup file \"%s\": %s",
+				 from_fullpath, strerror(errno));
+	}
+
+	buf = pgut_malloc(CHUNK_SIZE);
+	headers = pgut_malloc0((n_blocks + 1) * sizeof(BackupPageHeader2));
+	INIT_FILE_CRC32(true, crc);
+
+	blknum = 0;
+	while (blknum < n_blocks)
+	{
+		int			seq = blocks[blknum].backup_seq;
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, seq);
+		int			start = blknum;
+		char		from_root[MAXPGPATH];
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during merge");
+
+		/* collect the run of blocks, unchanged since FULL backup */
+		do
+		{
+			BackupPageHeader2 *hdr = &(chain_headers[seq][blocks[blknum].hdr_seq]);
+
+			headers[blknum] = (BackupPageHeader2){
+				.block = blknum,
+				.pos = blknum * MERGE_RECORD_SIZE,
+				.lsn = hdr->lsn,
+				.checksum = hdr->checksum,
+			};
+			blknum++;
+		} while (backup->backup_mode == BACKUP_MODE_FULL &&
+				 blknum < n_blocks && blocks[blknum].backup_seq == seq);
+
+		join_path_components(from_root, backup->root_dir, DATABASE_DIR);
+		join_path_components(from_fullpath, from_root, chain_files[seq]->rel_path);
+
+		if (backup->backup_mode == BACKUP_MODE_FULL)
+			merge_clone_range(chain_fds[seq], from_fullpath, out, to_fullpath_tmp,
+							  (off_t) start * MERGE_RECORD_SIZE,
+							  (off_t) (blknum - start) * MERGE_RECORD_SIZE,
+							  st.st_blksize, buf, &crc);
+		else
+		{
+			/* changed block is copied from incremental backup as it is */
+			BackupPageHeader2 *hdr = &(chain_headers[seq][blocks[start].hdr_seq]);
+			BackupPageHeader  *bph = (BackupPageHeader *) buf;
+
+			if (pread(chain_fds[seq], buf, MERGE_RECORD_SIZE, hdr->pos) != MERGE_RECORD_SIZE)
+				elog(ERROR, "Cannot read block %d of file \"%s\": %s",
+					 start, from_fullpath, strerror(errno));
+
+			if (bph->block != (BlockNumber) start || bph->compressed_size != BLCKSZ)
+				elog(ERROR, "Invalid header of block %d in file \"%s\"",
+					 start, from_fullpath);
+
+			COMP_FILE_CRC32(true, crc, buf, MERGE_RECORD_SIZE);
+
+			if (pwrite(out, buf, MERGE_RECORD_SIZE,
+					   (off_t) start * MERGE_RECORD_SIZE) != MERGE_RECORD_SIZE)
+				elog(ERROR, "Cannot write block %d of file \"%s\": %s",
+					 start, to_fullpath_tmp, strerror(errno));
+		}
+	}
+	FIN_FILE_CRC32(true, crc);
+
+	/* dummy header to calculate the length of the last block */
+	headers[n_blocks] = (BackupPageHeader2){.pos = n_blocks * MERGE_RECORD_SIZE};
+
+	if (close(out) != 0)
+		elog(ERROR, "Cannot close file \"%s\": %s", to_fullpath_tmp, strerror(errno));
+	out = -1;
+
+	tmp_file->n_blocks = n_blocks;
+	tmp_file->n_headers = n_blocks;
+	tmp_file->compress_alg = NONE_COMPRESS;
+	tmp_file->size = (size_t) n_blocks * BLCKSZ;
+	tmp_file->read_size = tmp_file->size;
+	tmp_file->uncompressed_size = tmp_file->size;
+	tmp_file->write_size = (int64) n_blocks * MERGE_RECORD_SIZE;
+	tmp_file->crc = crc;
+
+	write_page_headers(headers, tmp_file, &(full_backup->hdr_map), true);
+
+	/* sync temp file to disk */
+	if (!no_sync && fio_sync(to_fullpath_tmp, FIO_BACKUP_HOST) != 0)
+		elog(ERROR, "Cannot sync merge temp file \"%s\": %s",
+			to_fullpath_tmp, strerror(errno));
+
+	/* Do atomic rename from temp file to destination file */
+	if (rename(to_fullpath_tmp, to_fullpath) == -1)
+		elog(ERROR, "Could not rename file \"%s\" to \"%s\": %s",
+			 to_fullpath_tmp, to_fullpath, strerror(errno));
+
+	success = true;
+
+cleanup:
+	for (i = 0; i < n_backups; i++)
+	{
+		if (chain_fds[i] >= 0)
+			close(chain_fds[i]);
+		pg_free(chain_headers[i]);
+	}
+
+	pg_free(chain_files);
+	pg_free(chain_headers);
+	pg_free(chain_fds);
+	pg_free(blocks);
+	pg_free(headers);
+	pg_free(buf);
+
+	if (!success)
+		elog(VERBOSE, "Cannot use reflink merge for file \"%s\"", dest_file->rel_path);
+
+	return success;
+}
+
 /*
  * For every destionation file lookup the newest file in chain and
  * copy it.
@@ -1385,6 +1779,9 @@ merge_non_data_file(parray *parent_chain, pgBackup *full_backup,
 	backup_non_data_file(tmp_file, NULL, from_fullpath,
 						 to_fullpath_tmp, BACKUP_MODE_FULL, 0, false);
 
+	/* file is copied as is, so keep compression of streamed WAL segment */
+	tmp_file->compress_alg = from_file->compress_alg;
+
 	/* sync temp file to disk */
 	if (!no_sync && fio_sync(to_fullpath_tmp, FIO_BACKUP_HOST) != 0)
 		elog(ERROR, "Cannot sync merge temp file \"%s\": %s",
@@ -22,6 +22,7 @@
 #endif
 
 #include "utils/thread.h"
+#include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -108,6 +109,16 @@ typedef struct XLogReaderData
 
 	bool		need_switch;
 
+	/*
+	 * Summary of the segment being read, summary_segno is 0 if the segment
+	 * isn't read from its beginning and cannot be summarized.
+	 */
+	XLogSegNo	summary_segno;
+	XLogRecTarget summary_last_rec;
+	TimestampTz	summary_max_time;
+	TransactionId summary_min_xid;
+	TransactionId summary_max_xid;
+
 	int			xlogfile;
 	char		xlogpath[MAXPGPATH];
 
@@ -148,6 +159,31 @@ typedef struct
 	int			ret;
 } xlog_thread_arg;
 
+/*
+ * Summary of a WAL segment all records of which were successfully read
+ * during validation to a recovery target.
+ *
+ * Summaries of a timeline are appended to the "<tli>.walsummary" file in
+ * the WAL archive, one line per segment. Next validation to a recovery
+ * target doesn't read a segment again if the segment file has the same
+ * size and modification time, and the summary shows that the target cannot
+ * be found within the segment.
+ */
+typedef struct WalSegmentSummary
+{
+	XLogSegNo	segno;
+	char		fname[MAXFNAMELEN];	/* segment file name, maybe with .gz */
+	int64		size;
+	int64		mtime;
+	/* last record, and last timestamp and xid found within the segment */
+	XLogRecTarget last_rec;
+	TimestampTz	max_time;
+	TransactionId min_xid;
+	TransactionId max_xid;
+	/* line number, later lines override earlier ones */
+	uint32		line;
+} WalSegmentSummary;
+
 static XLogRecord* WalReadRecord(XLogReaderState *xlogreader, XLogRecPtr startpoint, char **errormsg);
 static XLogReaderState* WalReaderAllocate(uint32 wal_seg_size, XLogReaderData *reader_data);
 
@@ -187,6 +223,14 @@ static void validateXLogRecord(XLogReaderState *record,
 							   XLogReaderData *reader_data, bool *stop_reading);
 static bool getRecordTimestamp(XLogReaderState *record, TimestampTz *recordXtime);
 
+static void wal_summary_load(const char *archivedir, TimeLineID tli);
+static void wal_summary_free(void);
+static void wal_summary_start(XLogReaderData *reader_data, XLogRecPtr startpoint);
+static void wal_summary_add_record(XLogReaderState *record,
+								   XLogReaderData *reader_data, bool has_time);
+static void wal_summary_finish(XLogReaderData *reader_data);
+static bool wal_summary_skip(XLogReaderData *reader_data);
+
 static XLogSegNo segno_start = 0;
 /* Segment number where target record is located */
 static XLogSegNo segno_target = 0;
@@ -198,6 +242,18 @@ static uint32 segnum_read = 0;
 static uint32 segnum_corrupted = 0;
 static pthread_mutex_t wal_segment_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* Summaries of WAL segments, used only during validation to a target */
+static bool wal_use_summaries = false;
+static parray *wal_summaries = NULL;
+static char wal_summary_path[MAXPGPATH];
+static FILE *wal_summary_out = NULL;
+static bool wal_summary_failed = false;
+/* Number of segments skipped according to their summaries */
+static uint32 segnum_skipped = 0;
+/* Number of segments summarized */
+static uint32 segnum_summarized = 0;
+static pthread_mutex_t wal_summary_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 /* copied from timestamp.c */
 static pg_time_t
 timestamptz_to_time_t(TimestampTz t)
@@ -524,6 +580,42 @@ validate_wal(pgBackup *backup, const char *archivedir,
 	}
 }
 
+/*
+ * Summarize WAL segments of the timeline from begin_segno up to end_segno,
+ * so that validation to a recovery target doesn't need to read them later.
+ * This is validation without a target, segments with up to date summaries
+ * are not read. The last segment is not summarized: its last record may
+ * continue in the next segment, which isn't archived yet.
+ *
+ * Returns false if WAL cannot be read, numbers of summarized segments and
+ * segments with up to date summaries are added to the counters.
+ */
+bool
+summarize_wal(const char *archivedir, TimeLineID tli, XLogSegNo begin_segno,
+			  XLogSegNo end_segno, uint32 wal_seg_size,
+			  uint32 *n_summarized, uint32 *n_skipped)
+{
+	XLogRecPtr	startpoint;
+	XLogRecPtr	endpoint;
+	bool		res;
+
+	if (end_segno <= begin_segno)
+		return true;
+
+	GetXLogRecPtr(begin_segno, 0, wal_seg_size, startpoint);
+	GetXLogRecPtr(end_segno, 0, wal_seg_size, endpoint);
+
+	res = RunXLogThreads(archivedir, 0, InvalidTransactionId,
+						 InvalidXLogRecPtr, tli, wal_seg_size,
+						 startpoint, endpoint, false, validateXLogRecord,
+						 NULL, true);
+
+	*n_summarized += segnum_summarized;
+	*n_skipped += segnum_skipped;
+
+	return res;
+}
+
 /*
  * Read from archived WAL segments latest recovery time and xid. All necessary
  * segments present at archive folder. We waited **stop_lsn** in
@@ -1237,6 +1329,8 @@ RunXLogThreads(const char *archivedir, time_t target_time,
 	GetXLogSegNo(startpoint, segno_next, segment_size);
 	segnum_read = 0;
 	segnum_corrupted = 0;
+	segnum_skipped = 0;
+	segnum_summarized = 0;
 
 	threads = (pthread_t *) pgut_malloc(sizeof(pthread_t) * num_threads);
 	thread_args = (xlog_thread_arg *) pgut_malloc(sizeof(xlog_thread_arg) * num_threads);
@@ -1275,6 +1369,11 @@ RunXLogThreads(const char *archivedir, time_t target_time,
 		GetXLogRecPtr(segno_next, 0, segment_size, startpoint);
 	}
 
+	/* Segments are summarized only while looking for a recovery target */
+	wal_use_summaries = (process_record == validateXLogRecord);
+	if (wal_use_summaries)
+		wal_summary_load(archivedir, tli);
+
 	/* Run threads */
 	thread_interrupted = false;
 	for (i = 0; i < threads_need; i++)
@@ -1300,6 +1399,15 @@ RunXLogThreads(const char *archivedir, time_t target_time,
 	pfree(threads);
 	threads = NULL;
 
+	if (wal_use_summaries)
+	{
+		if (segnum_skipped > 0)
+			elog(INFO, "%u WAL segments are not read again, they were validated earlier according to \"%s\"",
+				 segnum_skipped, wal_summary_path);
+		wal_summary_free();
+		wal_use_summaries = false;
+	}
+
 	if (last_rec)
 	{
 		/*
@@ -1377,45 +1485,56 @@ XLogThreadWorker(void *arg)
 	XLogBeginRead(xlogreader, thread_arg->startpoint);
 #endif
 
-	found = XLogFindNextRecord(xlogreader, thread_arg->startpoint);
-
 	/*
-	 * We get invalid WAL record pointer usually when WAL segment is absent or
-	 * is corrupted.
+	 * If the first segment was validated earlier, its records are not read,
+	 * the thread switches to the next segment right away.
 	 */
-	if (XLogRecPtrIsInvalid(found))
+	if (wal_use_summaries && wal_summary_skip(reader_data))
+		reader_data->need_switch = true;
+	else
 	{
-		if (wal_consistent_read && XLogWaitForConsistency(xlogreader))
-			need_read = false;
-		else
+		found = XLogFindNextRecord(xlogreader, thread_arg->startpoint);
+
+		/*
+		 * We get invalid WAL record pointer usually when WAL segment is absent or
+		 * is corrupted.
+		 */
+		if (XLogRecPtrIsInvalid(found))
 		{
-			if (xlogreader->errormsg_buf[0] != '\0')
-				elog(WARNING, "Thread [%d]: Could not read WAL record at %X/%X: %s",
-					reader_data->thread_num,
-					(uint32) (thread_arg->startpoint >> 32),
-					(uint32) (thread_arg->startpoint),
-					xlogreader->errormsg_buf);
+			if (wal_consistent_read && XLogWaitForConsistency(xlogreader))
+				need_read = false;
 			else
-				elog(WARNING, "Thread [%d]: Could not read WAL record at %X/%X",
-					reader_data->thread_num,
-					(uint32) (thread_arg->startpoint >> 32),
-					(uint32) (thread_arg->startpoint));
-			PrintXLogCorruptionMsg(reader_data, ERROR);
+			{
+				if (xlogreader->errormsg_buf[0] != '\0')
+					elog(WARNING, "Thread [%d]: Could not read WAL record at %X/%X: %s",
+						reader_data->thread_num,
+						(uint32) (thread_arg->startpoint >> 32),
+						(uint32) (thread_arg->startpoint),
+						xlogreader->errormsg_buf);
+				else
+					elog(WARNING, "Thread [%d]: Could not read WAL record at %X/%X",
+						reader_data->thread_num,
+						(uint32) (thread_arg->startpoint >> 32),
+						(uint32) (thread_arg->startpoint));
+				PrintXLogCorruptionMsg(reader_data, ERROR);
+			}
 		}
-	}
 
-	thread_arg->startpoint = found;
+		wal_summary_start(reader_data, thread_arg->startpoint);
+		thread_arg->startpoint = found;
 
-	elog(VERBOSE, "Thread [%d]: Starting LSN: %X/%X",
-		 reader_data->thread_num,
-		 (uint32) (thread_arg->startpoint >> 32),
-		 (uint32) (thread_arg->startpoint));
+		elog(VERBOSE, "Thread [%d]: Starting LSN: %X/%X",
+			 reader_data->thread_num,
+			 (uint32) (thread_arg->startpoint >> 32),
+			 (uint32) (thread_arg->startpoint));
+	}
 
 	while (need_read)
 	{
 		XLogRecord *record;
 		char	   *errormsg;
 		bool		stop_reading = false;
+		bool		has_time;
 
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Thread [%d]: Interrupted during WAL reading",
@@ -1502,11 +1621,14 @@ XLogThreadWorker(void *arg)
 			PrintXLogCorruptionMsg(reader_data, ERROR);
 		}
 
-		getRecordTimestamp(xlogreader, &reader_data->cur_rec.rec_time);
+		has_time = getRecordTimestamp(xlogreader, &reader_data->cur_rec.rec_time);
 		if (TransactionIdIsValid(XLogRecGetXid(xlogreader)))
 			reader_data->cur_rec.rec_xid = XLogRecGetXid(xlogreader);
 		reader_data->cur_rec.rec_lsn = xlogreader->ReadRecPtr;
 
+		if (reader_data->summary_segno != 0)
+			wal_summary_add_record(xlogreader, reader_data, has_time);
+
 		if (thread_arg->process_record)
 			thread_arg->process_record(xlogreader, reader_data, &stop_reading);
 		if (stop_reading)
@@ -1578,17 +1700,32 @@ SwitchThreadToNextWal(XLogReaderState *xlogreader, xlog_thread_arg *arg)
 	reader_data = (XLogReaderData *) xlogreader->private_data;
 	reader_data->need_switch = false;
 
-	/* Critical section */
-	pthread_lock(&wal_segment_mutex);
-	Assert(segno_next);
-	reader_data->xlogsegno = segno_next;
-	segnum_read++;
-	segno_next++;
-	pthread_mutex_unlock(&wal_segment_mutex);
+	/* All records of the previous segment are read */
+	if (reader_data->summary_segno != 0)
+		wal_summary_finish(reader_data);
 
-	/* We've reached the end */
-	if (arg->endSegNo != 0 && reader_data->xlogsegno > arg->endSegNo)
-		return false;
+	/* Take segments until the one which isn't validated earlier */
+	do
+	{
+		XLogSegNo	segno;
+
+		/* Critical section */
+		pthread_lock(&wal_segment_mutex);
+		Assert(segno_next);
+		reader_data->xlogsegno = segno_next;
+		segnum_read++;
+		segno_next++;
+		segno = segno_target;
+		pthread_mutex_unlock(&wal_segment_mutex);
+
+		/* We've reached the end */
+		if (arg->endSegNo != 0 && reader_data->xlogsegno > arg->endSegNo)
+			return false;
+
+		/* Other thread already got the target in a previous segment */
+		if (segno != 0 && segno < reader_data->xlogsegno)
+			return false;
+	} while (wal_use_summaries && wal_summary_skip(reader_data));
 
 	/* Adjust next record position */
 	GetXLogRecPtr(reader_data->xlogsegno, 0, wal_seg_size, arg->startpoint);
@@ -1629,6 +1766,7 @@ SwitchThreadToNextWal(XLogReaderState *xlogreader, xlog_thread_arg *arg)
 			 (uint32) (arg->startpoint >> 32), (uint32) (arg->startpoint));
 		PrintXLogCorruptionMsg(reader_data, ERROR);
 	}
+	wal_summary_start(reader_data, arg->startpoint);
 	arg->startpoint = found;
 
 	elog(VERBOSE, "Thread [%d]: Switched to LSN %X/%X",
@@ -1897,6 +2035,360 @@ getRecordTimestamp(XLogReaderState *record, TimestampTz *recordXtime)
 	return false;
 }
 
+/*
+ * Comparison functions to sort and search WAL segment summaries.
+ */
+static int
+wal_summary_compare(const void *a1, const void *a2)
+{
+	WalSegmentSummary *s1 = *(WalSegmentSummary **) a1;
+	WalSegmentSummary *s2 = *(WalSegmentSummary **) a2;
+
+	if (s1->segno != s2->segno)
+		return s1->segno < s2->segno ? -1 : 1;
+	if (s1->line != s2->line)
+		return s1->line < s2->line ? -1 : 1;
+	return 0;
+}
+
+static int
+wal_summary_compare_segno(const void *a1, const void *a2)
+{
+	WalSegmentSummary *s1 = *(WalSegmentSummary **) a1;
+	WalSegmentSummary *s2 = *(WalSegmentSummary **) a2;
+
+	if (s1->segno != s2->segno)
+		return s1->segno < s2->segno ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Find the file of the segment in the archive in the same way as
+ * SimpleXLogPageRead() does, .partial segments are not summarized.
+ */
+static bool
+wal_summary_stat_segment(TimeLineID tli, XLogSegNo segno, char *fname,
+						 struct stat *st)
+{
+	char		xlogfname[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+
+	GetXLogFileName(xlogfname, tli, segno, wal_seg_size);
+
+	join_path_components(path, wal_archivedir, xlogfname);
+	if (stat(path, st) == 0)
+	{
+		strlcpy(fname, xlogfname, MAXFNAMELEN);
+		return true;
+	}
+
+#ifdef HAVE_LIBZ
+	snprintf(fname, MAXFNAMELEN, "%s.gz", xlogfname);
+	join_path_components(path, wal_archivedir, fname);
+	if (stat(path, st) == 0)
+		return true;
+#endif
+
+	return false;
+}
+
+/*
+ * Return the summary of the segment if the segment file is not changed
+ * since the summary was made.
+ */
+static WalSegmentSummary *
+wal_summary_find(TimeLineID tli, XLogSegNo segno, char *fname)
+{
+	WalSegmentSummary key;
+	WalSegmentSummary *summary;
+	void	  **found;
+	struct stat st;
+
+	if (wal_summaries == NULL || parray_num(wal_summaries) == 0)
+		return NULL;
+
+	key.segno = segno;
+	found = parray_bsearch(wal_summaries, &key, wal_summary_compare_segno);
+	if (found == NULL)
+		return NULL;
+	summary = (WalSegmentSummary *) *found;
+
+	if (!wal_summary_stat_segment(tli, segno, fname, &st) ||
+		strcmp(fname, summary->fname) != 0 ||
+		(int64) st.st_size != summary->size ||
+		(int64) st.st_mtime != summary->mtime)
+		return NULL;
+
+	return summary;
+}
+
+/*
+ * Read summaries of WAL segments of the timeline. If there are several
+ * summaries of a segment, the latest one is used.
+ */
+static void
+wal_summary_load(const char *archivedir, TimeLineID tli)
+{
+	char		fname[MAXFNAMELEN];
+	char		buf[1024];
+	FILE	   *fp;
+	uint32		line = 0;
+	parray	   *summaries;
+	size_t		i;
+
+	snprintf(fname, lengthof(fname), "%08X" WAL_SUMMARY_SUFFIX, tli);
+	join_path_components(wal_summary_path, archivedir, fname);
+
+	wal_summaries = parray_new();
+	wal_summary_out = NULL;
+	wal_summary_failed = false;
+
+	fp = fopen(wal_summary_path, PG_BINARY_R);
+	if (fp == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open WAL summary file \"%s\": %s",
+				 wal_summary_path, strerror(errno));
+		return;
+	}
+
+	summaries = parray_new();
+
+	while (fgets(buf, lengthof(buf), fp))
+	{
+		WalSegmentSummary *summary = pgut_new0(WalSegmentSummary);
+		uint32		lsn_hi;
+		uint32		lsn_lo;
+		TimeLineID	seg_tli;
+
+		line++;
+
+		/* the last line may be torn by a crash */
+		if (sscanf(buf, "%63s " INT64_FORMAT " " INT64_FORMAT " %X/%X "
+				   INT64_FORMAT " %u " INT64_FORMAT " %u %u",
+				   summary->fname, &summary->size, &summary->mtime,
+				   &lsn_hi, &lsn_lo, &summary->last_rec.rec_time,
+				   &summary->last_rec.rec_xid, &summary->max_time,
+				   &summary->min_xid, &summary->max_xid) != 10 ||
+			strspn(summary->fname, "0123456789ABCDEF") != XLOG_FNAME_LEN)
+		{
+			elog(WARNING, "Invalid line %u in WAL summary file \"%s\" is ignored",
+				 line, wal_summary_path);
+			pfree(summary);
+			continue;
+		}
+
+		summary->last_rec.rec_lsn = ((uint64) lsn_hi) << 32 | lsn_lo;
+		summary->line = line;
+		GetXLogFromFileName(summary->fname, &seg_tli, &summary->segno,
+							wal_seg_size);
+
+		parray_append(summaries, summary);
+	}
+
+	if (ferror(fp))
+		elog(WARNING, "Cannot read WAL summary file \"%s\": %s",
+			 wal_summary_path, strerror(errno));
+	fclose(fp);
+
+	/* Leave only the latest summary of each segment */
+	parray_qsort(summaries, wal_summary_compare);
+	for (i = 0; i < parray_num(summaries); i++)
+	{
+		WalSegmentSummary *summary = (WalSegmentSummary *) parray_get(summaries, i);
+
+		if (i + 1 < parray_num(summaries) &&
+			((WalSegmentSummary *) parray_get(summaries, i + 1))->segno == summary->segno)
+			pfree(summary);
+		else
+			parray_append(wal_summaries, summary);
+	}
+	parray_free(summaries);
+
+	elog(LOG, "Loaded %lu WAL segment summaries from \"%s\"",
+		 (unsigned long) parray_num(wal_summaries), wal_summary_path);
+}
+
+static void
+wal_summary_free(void)
+{
+	if (wal_summary_out)
+	{
+		if (fclose(wal_summary_out) != 0)
+			elog(WARNING, "Cannot write WAL summary file \"%s\": %s",
+				 wal_summary_path, strerror(errno));
+		wal_summary_out = NULL;
+	}
+
+	if (wal_summaries)
+	{
+		parray_walk(wal_summaries, pfree);
+		parray_free(wal_summaries);
+		wal_summaries = NULL;
+	}
+}
+
+/*
+ * Start summary of the segment, if the thread reads it from the beginning.
+ */
+static void
+wal_summary_start(XLogReaderData *reader_data, XLogRecPtr startpoint)
+{
+	reader_data->summary_segno = 0;
+
+	if (!wal_use_summaries || WalSegmentOffset(startpoint, wal_seg_size) != 0)
+		return;
+
+	GetXLogSegNo(startpoint, reader_data->summary_segno, wal_seg_size);
+	reader_data->summary_last_rec.rec_time = 0;
+	reader_data->summary_last_rec.rec_xid = InvalidTransactionId;
+	reader_data->summary_last_rec.rec_lsn = InvalidXLogRecPtr;
+	reader_data->summary_max_time = 0;
+	reader_data->summary_min_xid = InvalidTransactionId;
+	reader_data->summary_max_xid = InvalidTransactionId;
+}
+
+/*
+ * Account the record just read in the summary of the segment.
+ */
+static void
+wal_summary_add_record(XLogReaderState *record, XLogReaderData *reader_data,
+					   bool has_time)
+{
+	TransactionId xid = XLogRecGetXid(record);
+	XLogSegNo	segno;
+
+	GetXLogSegNo(record->ReadRecPtr, segno, wal_seg_size);
+
+	/* Shouldn't happen with manual switch, but don't summarize then */
+	if (segno != reader_data->summary_segno)
+	{
+		reader_data->summary_segno = 0;
+		return;
+	}
+
+	reader_data->summary_last_rec.rec_lsn = record->ReadRecPtr;
+
+	if (has_time)
+	{
+		reader_data->summary_last_rec.rec_time = reader_data->cur_rec.rec_time;
+		reader_data->summary_max_time = Max(reader_data->summary_max_time,
+											reader_data->cur_rec.rec_time);
+	}
+
+	if (TransactionIdIsValid(xid))
+	{
+		reader_data->summary_last_rec.rec_xid = xid;
+		if (!TransactionIdIsValid(reader_data->summary_min_xid) ||
+			xid < reader_data->summary_min_xid)
+			reader_data->summary_min_xid = xid;
+		if (xid > reader_data->summary_max_xid)
+			reader_data->summary_max_xid = xid;
+	}
+}
+
+/*
+ * All records of the segment are read successfully, append its summary to
+ * the summary file.
+ */
+static void
+wal_summary_finish(XLogReaderData *reader_data)
+{
+	XLogSegNo	segno = reader_data->summary_segno;
+	XLogRecTarget *last_rec = &reader_data->summary_last_rec;
+	char		fname[MAXFNAMELEN];
+	struct stat st;
+
+	reader_data->summary_segno = 0;
+
+	if (!wal_use_summaries || XLogRecPtrIsInvalid(last_rec->rec_lsn))
+		return;
+
+	/* The segment is read again, but its summary is up to date */
+	if (wal_summary_find(reader_data->tli, segno, fname) != NULL)
+		return;
+
+	if (!wal_summary_stat_segment(reader_data->tli, segno, fname, &st))
+		return;
+
+	pthread_lock(&wal_summary_mutex);
+
+	if (wal_summary_out == NULL && !wal_summary_failed)
+	{
+		wal_summary_out = fopen(wal_summary_path, PG_BINARY_A);
+		if (wal_summary_out == NULL)
+		{
+			/* the archive may be read-only, complain once */
+			elog(WARNING, "Cannot open WAL summary file \"%s\": %s",
+				 wal_summary_path, strerror(errno));
+			wal_summary_failed = true;
+		}
+	}
+
+	if (wal_summary_out)
+	{
+		fprintf(wal_summary_out, "%s " INT64_FORMAT " " INT64_FORMAT " %X/%X "
+				INT64_FORMAT " %u " INT64_FORMAT " %u %u\n",
+				fname, (int64) st.st_size, (int64) st.st_mtime,
+				(uint32) (last_rec->rec_lsn >> 32), (uint32) last_rec->rec_lsn,
+				(int64) last_rec->rec_time, last_rec->rec_xid,
+				(int64) reader_data->summary_max_time,
+				reader_data->summary_min_xid, reader_data->summary_max_xid);
+		/* a line at once, so concurrent validations don't mix lines */
+		fflush(wal_summary_out);
+		segnum_summarized++;
+	}
+
+	pthread_mutex_unlock(&wal_summary_mutex);
+}
+
+/*
+ * Check if the segment the thread has switched to can be skipped: it was
+ * validated earlier, isn't changed since then and cannot contain the
+ * recovery target. In this case the thread gets the last record of
+ * the segment as if all records of the segment were read.
+ */
+static bool
+wal_summary_skip(XLogReaderData *reader_data)
+{
+	WalSegmentSummary *summary;
+	char		fname[MAXFNAMELEN];
+
+	summary = wal_summary_find(reader_data->tli, reader_data->xlogsegno,
+							   fname);
+	if (summary == NULL)
+		return false;
+
+	/* The target may be within the segment, read it */
+	if (TransactionIdIsValid(wal_target_xid) &&
+		TransactionIdIsValid(summary->min_xid) &&
+		wal_target_xid >= summary->min_xid &&
+		wal_target_xid <= summary->max_xid)
+		return false;
+	if (wal_target_time != 0 && summary->max_time != 0 &&
+		timestamptz_to_time_t(summary->max_time) >= wal_target_time)
+		return false;
+	if (XRecOffIsValid(wal_target_lsn) &&
+		summary->last_rec.rec_lsn >= wal_target_lsn)
+		return false;
+
+	if (summary->last_rec.rec_time != 0)
+		reader_data->cur_rec.rec_time = summary->last_rec.rec_time;
+	if (TransactionIdIsValid(summary->last_rec.rec_xid))
+		reader_data->cur_rec.rec_xid = summary->last_rec.rec_xid;
+	reader_data->cur_rec.rec_lsn = summary->last_rec.rec_lsn;
+	reader_data->summary_segno = 0;
+
+	pthread_lock(&wal_summary_mutex);
+	segnum_skipped++;
+	pthread_mutex_unlock(&wal_summary_mutex);
+
+	elog(VERBOSE, "Thread [%d]: WAL segment \"%s\" was validated earlier, skip it",
+		 reader_data->thread_num, fname);
+
+	return true;
+}
+
 bool validate_wal_segment(TimeLineID tli, XLogSegNo segno, const char *prefetch_dir, uint32 wal_seg_size)
 {
 	XLogRecPtr startpoint;
@@ -74,9 +74,16 @@ bool		stream_wal = false;
 bool		no_color = false;
 bool 		show_color = true;
 bool        is_archive_cmd = false;
+bool        is_validate_cmd = false;
 pid_t       my_pid = 0;
 __thread int  my_thread_num = 1;
 bool		progress = false;
+char	   *status_file = NULL;
+bool		timing = false;
+uint64		max_read_rate = 0;
+uint64		max_write_rate = 0;
+uint64		max_page_rate = 0;
+char	   *throttle_file = NULL;
 bool		no_sync = false;
 #if PG_VERSION_NUM >= 100000
 char	   *replication_slot = NULL;
@@ -87,6 +94,9 @@ bool perm_slot = false;
 /* backup options */
 bool         backup_logs = false;
 bool         smooth_checkpoint;
+bool         backup_dedup = false;
+bool         backup_to_stdout = false;
+uint32       wal_poll_interval = 200;
 char        *remote_agent;
 static char *backup_note = NULL;
 /* catchup options */
@@ -115,6 +125,7 @@ IncrRestoreMode incremental_mode = INCR_NONE;
 
 bool skip_block_validation = false;
 bool skip_external_dirs = false;
+static bool restore_from_stdin = false;
 
 /* array for datnames, provided via db-include and db-exclude */
 static parray *datname_exclude_list = NULL;
@@ -128,6 +139,9 @@ bool need_amcheck = false;
 bool heapallindexed = false;
 bool checkunique = false;
 bool amcheck_parent = false;
+static char *checkdb_shard_string = NULL;
+uint32 checkdb_shard_num = 0;
+uint32 checkdb_shard_count = 0;
 
 /* delete options */
 bool		delete_wal = false;
@@ -136,8 +150,11 @@ bool		merge_expired = false;
 bool		force = false;
 bool		dry_run = false;
 static char *delete_status = NULL;
+/* merge options */
+bool		merge_reflink = false;
 /* compression options */
 static bool 		compress_shortcut = false;
+bool		compress_adaptive = false;
 
 /* ================ instanceState =========== */
 static char	   *instance_name;
@@ -200,6 +217,12 @@ static ConfigOption cmd_options[] =
 	{ 's', 'i', "backup-id",		&backup_id_string,	SOURCE_CMD_STRICT },
 	{ 'b', 133, "no-sync",			&no_sync,			SOURCE_CMD_STRICT },
 	{ 'b', 134, "no-color",			&no_color,			SOURCE_CMD_STRICT },
+	{ 's', 167, "status-file",		&status_file,		SOURCE_CMD_STRICT },
+	{ 'b', 168, "timing",			&timing,			SOURCE_CMD_STRICT },
+	{ 'U', 169, "max-read-rate", &max_read_rate, SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_KB, option_get_value },
+	{ 'U', 173, "max-write-rate", &max_write_rate, SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_KB, option_get_value },
+	{ 'U', 174, "max-page-rate",	&max_page_rate,		SOURCE_CMD_STRICT },
+	{ 's', 175, "throttle-file",	&throttle_file,		SOURCE_CMD_STRICT },
 	/* backup options */
 	{ 'b', 180, "backup-pg-log",	&backup_logs,		SOURCE_CMD_STRICT },
 	{ 'f', 'b', "backup-mode",		opt_backup_mode,	SOURCE_CMD_STRICT },
@@ -209,10 +232,14 @@ static ConfigOption cmd_options[] =
 	{ 'b', 181, "temp-slot",		&temp_slot,			SOURCE_CMD_STRICT },
 #endif
 	{ 'b', 'P', "perm-slot",	&perm_slot,	SOURCE_CMD_STRICT },
+	{ 'b', 187, "dedup",			&backup_dedup,		SOURCE_CMD_STRICT },
+	{ 'b', 189, "to-stdout",		&backup_to_stdout,	SOURCE_CMD_STRICT },
+	{ 'u', 178, "wal-poll-interval", &wal_poll_interval, SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_MS, option_get_value },
 	{ 'b', 182, "delete-wal",		&delete_wal,		SOURCE_CMD_STRICT },
 	{ 'b', 183, "delete-expired",	&delete_expired,	SOURCE_CMD_STRICT },
 	{ 'b', 184, "merge-expired",	&merge_expired,		SOURCE_CMD_STRICT },
 	{ 'b', 185, "dry-run",			&dry_run,			SOURCE_CMD_STRICT },
+	{ 'b', 186, "reflink",			&merge_reflink,		SOURCE_CMD_STRICT },
 	{ 's', 238, "note",				&backup_note,		SOURCE_CMD_STRICT },
 	/* catchup options */
 	{ 's', 239, "source-pgdata",		&catchup_source_pgdata,	SOURCE_CMD_STRICT },
@@ -238,11 +265,13 @@ static ConfigOption cmd_options[] =
 	{ 's', 160, "primary-conninfo",	&primary_conninfo,	SOURCE_CMD_STRICT },
 	{ 's', 'S', "primary-slot-name",&replication_slot,	SOURCE_CMD_STRICT },
 	{ 'f', 'I', "incremental-mode", opt_incr_restore_mode,	SOURCE_CMD_STRICT },
+	{ 'b', 188, "from-stdin",		&restore_from_stdin,	SOURCE_CMD_STRICT },
 	/* checkdb options */
 	{ 'b', 195, "amcheck",			&need_amcheck,		SOURCE_CMD_STRICT },
 	{ 'b', 196, "heapallindexed",	&heapallindexed,	SOURCE_CMD_STRICT },
 	{ 'b', 198, "checkunique",		&checkunique,		SOURCE_CMD_STRICT },
 	{ 'b', 197, "parent",			&amcheck_parent,	SOURCE_CMD_STRICT },
+	{ 's', 177, "shard",			&checkdb_shard_string,	SOURCE_CMD_STRICT },
 	/* delete options */
 	{ 'b', 145, "wal",				&delete_wal,		SOURCE_CMD_STRICT },
 	{ 'b', 146, "expired",			&delete_expired,	SOURCE_CMD_STRICT },
@@ -252,6 +281,7 @@ static ConfigOption cmd_options[] =
 	{ 'b', 147, "force",			&force,				SOURCE_CMD_STRICT },
 	/* compression options */
 	{ 'b', 148, "compress",			&compress_shortcut,	SOURCE_CMD_STRICT },
+	{ 'b', 176, "compress-adaptive",	&compress_adaptive,	SOURCE_CMD_STRICT },
 	/* connection options */
 	{ 'B', 'w', "no-password",		&prompt_password,	SOURCE_CMD_STRICT },
 	{ 'b', 'W', "password",			&force_password,	SOURCE_CMD_STRICT },
@@ -464,12 +494,28 @@ main(int argc, char *argv[])
 							catalogState->catalog_path, WAL_SUBDIR);
 	}
 
-	/* backup_path is required for all pg_probackup commands except help, version, checkdb and catchup */
+	if (restore_from_stdin && backup_subcmd != RESTORE_CMD)
+		elog(ERROR, "You cannot specify \"--from-stdin\" option with the \"%s\" command",
+			 get_subcmd_name(backup_subcmd));
+
+	if (backup_to_stdout && backup_subcmd != BACKUP_CMD)
+		elog(ERROR, "You cannot specify \"--to-stdout\" option with the \"%s\" command",
+			 get_subcmd_name(backup_subcmd));
+
+	/*
+	 * backup_path is required for all pg_probackup commands except help, version,
+	 * checkdb, catchup and restore from stdin
+	 */
 	if (backup_path == NULL &&
 		backup_subcmd != CHECKDB_CMD &&
 		backup_subcmd != HELP_CMD &&
 		backup_subcmd != VERSION_CMD &&
-		backup_subcmd != CATCHUP_CMD)
+		backup_subcmd != CATCHUP_CMD &&
+		!restore_from_stdin)
+		elog(ERROR, "required parameter not specified: BACKUP_PATH (-B, --backup-path)");
+
+	/* instance without catalog makes no sense */
+	if (backup_path == NULL && instance_name != NULL && restore_from_stdin)
 		elog(ERROR, "required parameter not specified: BACKUP_PATH (-B, --backup-path)");
 
 	/* ===== catalogState (END) ======*/
@@ -478,12 +524,13 @@ main(int argc, char *argv[])
 
 	/*
 	 * Option --instance is required for all commands except
-	 * init, show, checkdb, validate and catchup
+	 * init, show, checkdb, validate, catchup and restore from stdin
 	 */
 	if (instance_name == NULL)
 	{
 		if (backup_subcmd != INIT_CMD && backup_subcmd != SHOW_CMD &&
-			backup_subcmd != VALIDATE_CMD && backup_subcmd != CHECKDB_CMD && backup_subcmd != CATCHUP_CMD)
+			backup_subcmd != VALIDATE_CMD && backup_subcmd != CHECKDB_CMD && backup_subcmd != CATCHUP_CMD &&
+			!restore_from_stdin)
 			elog(ERROR, "required parameter not specified: --instance");
 	}
 	else
@@ -587,9 +634,12 @@ main(int argc, char *argv[])
 		is_archive_cmd = true;
 	}
 
+	is_validate_cmd = (backup_subcmd == VALIDATE_CMD);
+
 
 	/* Just read environment variables */
-	if (backup_path == NULL && backup_subcmd == CHECKDB_CMD)
+	if ((backup_path == NULL && backup_subcmd == CHECKDB_CMD) ||
+		(instance_name == NULL && restore_from_stdin))
 		config_get_opt_env(instance_options);
 
 	/* Sanity for checkdb, if backup_dir is provided but pgdata and instance are not */
@@ -609,6 +659,20 @@ main(int argc, char *argv[])
 			elog(ERROR, "--checkunique can only be used with --amcheck option");
 	}
 
+	if (backup_subcmd == CHECKDB_CMD && checkdb_shard_string)
+	{
+		char		junk;
+
+		if (sscanf(checkdb_shard_string, "%u/%u%c", &checkdb_shard_num,
+				   &checkdb_shard_count, &junk) != 2 ||
+			checkdb_shard_num < 1 || checkdb_shard_num > checkdb_shard_count)
+			elog(ERROR, "Invalid value of --shard option \"%s\", "
+				 "expected N/M where 1 <= N <= M", checkdb_shard_string);
+
+		if (skip_block_validation)
+			elog(ERROR, "Option '--shard' cannot be used with '--skip-block-validation' option");
+	}
+
 	/* Usually checkdb for file logging requires log_directory
 	 * to be specified explicitly, but if backup_dir and instance name are provided,
 	 * checkdb can use the usual default values or values from config
@@ -683,6 +747,7 @@ main(int argc, char *argv[])
 			backup_subcmd != VALIDATE_CMD &&
 			backup_subcmd != DELETE_CMD &&
 			backup_subcmd != MERGE_CMD &&
+			backup_subcmd != EXPORT_CMD &&
 			backup_subcmd != SET_BACKUP_CMD &&
 			backup_subcmd != SHOW_CMD)
 			elog(ERROR, "Cannot use -i (--backup-id) option together with the \"%s\" command",
@@ -739,6 +804,7 @@ main(int argc, char *argv[])
 		restore_params->partial_restore_type = NONE;
 		restore_params->primary_conninfo = primary_conninfo;
 		restore_params->incremental_mode = incremental_mode;
+		restore_params->resume = false;
 
 		/* handle partial restore parameters */
 		if (datname_exclude_list && datname_include_list)
@@ -915,11 +981,19 @@ main(int argc, char *argv[])
 	if (num_threads < 1)
 		num_threads = 1;
 
+	if (wal_poll_interval < 1)
+		wal_poll_interval = 1;
+
 	if (batch_size < 1)
 		batch_size = 1;
 
 	compress_init(backup_subcmd);
 
+	if (timing)
+		timing_init();
+
+	throttle_init();
+
 	/* do actual operation */
 	switch (backup_subcmd)
 	{
@@ -953,6 +1027,9 @@ main(int argc, char *argv[])
 			return do_catchup(catchup_source_pgdata, catchup_destination_pgdata, num_threads, !no_sync,
 				exclude_absolute_paths_list, exclude_relative_paths_list);
 		case RESTORE_CMD:
+			if (restore_from_stdin)
+				return do_restore_from_stream(instanceState, recovery_target_options,
+											  restore_params, no_sync);
 			return do_restore_or_validate(instanceState, current.backup_id,
 							recovery_target_options,
 							restore_params, no_sync);
@@ -997,6 +1074,12 @@ main(int argc, char *argv[])
 		case MERGE_CMD:
 			do_merge(instanceState, current.backup_id, no_validate, no_sync);
 			break;
+		case EXPORT_CMD:
+			do_export(instanceState, current.backup_id, no_validate);
+			break;
+		case INDEX_WAL_CMD:
+			do_index_wal(instanceState);
+			break;
 		case SHOW_CONFIG_CMD:
 			do_show_config();
 			break;
@@ -1104,6 +1187,9 @@ compress_init(ProbackupSubcmd const subcmd)
 	if (instance_config.compress_alg == ZLIB_COMPRESS && instance_config.compress_level == 0)
 		elog(WARNING, "Compression level 0 will lead to data bloat!");
 
+	if (compress_adaptive && instance_config.compress_alg != ZLIB_COMPRESS)
+		elog(ERROR, "Option --compress-adaptive requires zlib compression");
+
 	if (subcmd == BACKUP_CMD || subcmd == ARCHIVE_PUSH_CMD)
 	{
 #ifndef HAVE_LIBZ
@@ -78,6 +78,8 @@ extern const char  *PROGRAM_EMAIL;
 #define BACKUP_LOCK_FILE		"backup.pid"
 #define BACKUP_RO_LOCK_FILE		"backup_ro.pid"
 #define DATABASE_FILE_LIST		"backup_content.control"
+#define VALIDATE_JOURNAL_FILE	"validate_journal"
+#define RESTORE_JOURNAL_FILE	"pg_probackup_restore_journal"
 #define PG_BACKUP_LABEL_FILE	"backup_label"
 #define PG_TABLESPACE_MAP_FILE	"tablespace_map"
 #define RELMAPPER_FILENAME		"pg_filenode.map"
@@ -117,6 +119,10 @@ extern const char  *PROGRAM_EMAIL;
 #define ERRMSG_MAX_LEN 2048
 #define CHUNK_SIZE (128 * 1024)
 #define LARGE_CHUNK_SIZE (4 * 1024 * 1024)
+/* number of pages read at once by checkdb */
+#define CHECKDB_READ_CHUNK_PAGES (LARGE_CHUNK_SIZE / BLCKSZ)
+/* max number of pages written at once by restore */
+#define RESTORE_STAGE_PAGES (LARGE_CHUNK_SIZE / BLCKSZ)
 #define OUT_BUF_SIZE (512 * 1024)
 
 /* retry attempts */
@@ -272,6 +278,7 @@ typedef struct pgFile
 	int		external_dir_num;	/* Number of external directory. 0 if not external */
 	bool	exists_in_prev;		/* Mark files, both data and regular, that exists in previous backup */
 	CompressAlg		compress_alg;		/* compression algorithm applied to the file */
+	int				compress_level;		/* zlib level applied to the file, 0 if unknown */
 	volatile 		pg_atomic_flag lock;/* lock for synchronization of parallel threads  */
 	datapagemap_t	pagemap;			/* bitmap of pages updated since previous backup
 										   may take up to 16kB per file */
@@ -341,8 +348,8 @@ typedef enum ShowFormat
 #define PROGRAM_VERSION	"2.5.6"
 
 /* update when remote agent API or behaviour changes */
-#define AGENT_PROTOCOL_VERSION 20501
-#define AGENT_PROTOCOL_VERSION_STR "2.5.1"
+#define AGENT_PROTOCOL_VERSION 20506
+#define AGENT_PROTOCOL_VERSION_STR "2.5.6"
 
 /* update only when changing storage format */
 #define STORAGE_FORMAT_VERSION "2.4.4"
@@ -439,6 +446,9 @@ typedef struct HeaderMap
 	FILE    *fp;                  /* used only for writing */
 	char    *buf;                 /* buffer */
 	pg_off_t offset;              /* current position in fp */
+	char    *rmap;                /* map mapped into memory for reading */
+	size_t   rmap_size;
+	bool     rmap_tried;          /* rmap is NULL if mapping failed */
 	pthread_mutex_t mutex;
 
 } HeaderMap;
@@ -517,6 +527,8 @@ struct pgBackup
 	parray			*files;			/* list of files belonging to this backup
 									 * must be populated explicitly */
 	char			*note;
+	char			*timing;		/* JSON with timings of hot paths,
+									 * filled if --timing is specified */
 
 	pg_crc32         content_crc;
 
@@ -566,6 +578,9 @@ typedef struct pgRestoreParams
 	/* options for partial restore */
 	PartialRestoreType partial_restore_type;
 	parray *partial_db_list;
+
+	/* destination contains journal of interrupted restore */
+	bool	resume;
 } pgRestoreParams;
 
 /* Options needed for set-backup command */
@@ -594,6 +609,13 @@ typedef struct
 	parray	   *external_dirs;
 	XLogRecPtr	prev_start_lsn;
 
+	/* files of backup to share identical files with, used by --dedup */
+	parray	   *dedup_filelist;
+	const char *dedup_root;
+
+	/* files to back up are taken from here, if they are still being listed */
+	struct backup_files_queue *files_queue;
+
 	int			thread_num;
 	HeaderMap   *hdr_map;
 
@@ -682,6 +704,78 @@ typedef struct BackupPageHeader2
 	uint16      checksum;
 } BackupPageHeader2;
 
+/*
+ * Events measured by --timing instrumentation, see timing.c.
+ */
+typedef enum TimingEvent
+{
+	TIMING_LIST_FILES,
+	TIMING_PAGEMAP,
+	TIMING_READ,
+	TIMING_VALIDATE_PAGE,
+	TIMING_COMPRESS,
+	TIMING_WRITE,
+	TIMING_HEADER_MAP,
+	TIMING_FSYNC,
+	TIMING_WAIT_WAL,
+	TIMING_NUM_EVENTS
+} TimingEvent;
+
+#define TIMING_START(start) ((start) = timing ? timing_now() : 0)
+#define TIMING_STOP(event, start) \
+do { \
+	if (timing) \
+		timing_add((event), (start)); \
+} while (0)
+
+/*
+ * Native stream format of exported backup, see export.c for details.
+ * All integers are stored in native byte order.
+ */
+#define EXPORT_STREAM_MAGIC		"PGPBSTRM"
+#define EXPORT_STREAM_VERSION	2
+
+typedef enum ExportEntryKind
+{
+	EXPORT_ENTRY_CONTROL = 1,	/* content of backup.control */
+	EXPORT_ENTRY_DIR,			/* directory or tablespace link */
+	EXPORT_ENTRY_FILE,			/* non-data file, stored as is */
+	EXPORT_ENTRY_DATAFILE,		/* data file, stored as in backup catalog */
+	EXPORT_ENTRY_END			/* index of entry offsets */
+} ExportEntryKind;
+
+typedef struct ExportStreamHeader
+{
+	char		magic[8];
+	uint32		version;
+	uint32		block_size;
+} ExportStreamHeader;
+
+/* entry header is followed by rel_path, link target and payload */
+typedef struct ExportEntryHeader
+{
+	uint32		kind;
+	uint32		mode;
+	int32		external_dir_num;
+	int32		n_blocks;
+	int32		compress_alg;
+	pg_crc32	crc;			/* CRC of payload as calculated by backup */
+	uint32		path_len;		/* without trailing zero */
+	uint32		link_len;		/* target of tablespace link, if any */
+	uint64		size;			/* size of payload */
+} ExportEntryHeader;
+
+typedef struct ExportStreamTrailer
+{
+	uint64		n_entries;
+	uint64		index_offset;	/* offset of array of entry offsets */
+	pg_crc32	crc;			/* CRC of the stream preceding trailer */
+	uint32		reserved;
+	char		magic[8];
+} ExportStreamTrailer;
+
+typedef struct ExportStream ExportStream;
+
 typedef struct StopBackupCallbackParams
 {
 	PGconn	*conn;
@@ -766,6 +860,14 @@ typedef struct StopBackupCallbackParams
 	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&		\
 	 strcmp((fname) + XLOG_FNAME_LEN, ".gz.part") == 0)
 
+/* summaries of WAL segments of a timeline, see parsexlog.c */
+#define WAL_SUMMARY_SUFFIX		".walsummary"
+
+#define IsWalSummaryFileName(fname)	\
+	(strlen(fname) == 8 + strlen(WAL_SUMMARY_SUFFIX) &&	\
+	 strspn(fname, "0123456789ABCDEF") == 8 &&		\
+	 strcmp((fname) + 8, WAL_SUMMARY_SUFFIX) == 0)
+
 #define IsSshProtocol() (instance_config.remote.host && strcmp(instance_config.remote.proto, "ssh") == 0)
 
 /* common options */
@@ -775,7 +877,15 @@ extern int		num_threads;
 extern bool		stream_wal;
 extern bool		show_color;
 extern bool		progress;
+extern char	   *status_file;
+extern bool		timing;
+extern uint64	max_read_rate;
+extern uint64	max_write_rate;
+extern uint64	max_page_rate;
+extern char	   *throttle_file;
+extern bool		compress_adaptive;
 extern bool     is_archive_cmd; /* true for archive-{get,push} */
+extern bool     is_validate_cmd; /* true for validate */
 /* In pre-10 'replication_slot' is defined in receivelog.h */
 extern char	   *replication_slot;
 #if PG_VERSION_NUM >= 100000
@@ -785,6 +895,9 @@ extern bool perm_slot;
 
 /* backup options */
 extern bool		smooth_checkpoint;
+extern bool		backup_dedup;
+extern bool		backup_to_stdout;
+extern uint32	wal_poll_interval;
 
 /* remote probackup options */
 extern char* remote_agent;
@@ -797,6 +910,9 @@ extern bool		delete_expired;
 extern bool		merge_expired;
 extern bool		dry_run;
 
+/* merge options */
+extern bool		merge_reflink;
+
 /* ===== instanceState ===== */
 
 typedef struct InstanceState
@@ -831,6 +947,8 @@ extern ShowFormat show_format;
 extern bool heapallindexed;
 extern bool checkunique;
 extern bool skip_block_validation;
+extern uint32 checkdb_shard_num;
+extern uint32 checkdb_shard_count;
 
 /* current settings */
 extern pgBackup current;
@@ -869,6 +987,10 @@ extern pgRecoveryTarget *parseRecoveryTargetOptions(
 
 extern parray *get_dbOid_exclude_list(pgBackup *backup, parray *datname_list,
 										PartialRestoreType partial_restore_type);
+extern void create_recovery_conf(InstanceState *instanceState, time_t backup_id,
+								 pgRecoveryTarget *rt,
+								 pgBackup *backup,
+								 pgRestoreParams *params);
 
 extern parray *get_backup_filelist(pgBackup *backup, bool strict);
 extern parray *read_timeline_history(const char *arclog_path, TimeLineID targetTLI, bool strict);
@@ -895,6 +1017,7 @@ extern void do_archive_push(InstanceState *instanceState, InstanceConfig *instan
 						   bool no_sync, bool no_ready_rename);
 extern void do_archive_get(InstanceState *instanceState, InstanceConfig *instance, const char *prefetch_dir_arg, char *wal_file_path,
 						   char *wal_file_name, int batch_size, bool validate_wal);
+extern void do_index_wal(InstanceState *instanceState);
 
 /* in configure.c */
 extern void do_show_config(void);
@@ -906,6 +1029,39 @@ extern InstanceConfig *readInstanceConfigFile(InstanceState *instanceState);
 extern int do_show(CatalogState *catalogState, InstanceState *instanceState,
 				   time_t requested_backup_id, bool show_archive);
 
+/* in export.c */
+extern void do_export(InstanceState *instanceState, time_t backup_id, bool no_validate);
+extern ExportStream *export_stream_open(FILE *out);
+extern void export_stream_control(ExportStream *stream, const char *root_dir);
+extern void export_stream_dir(ExportStream *stream, pgFile *dir, const char *link);
+extern void export_stream_file(ExportStream *stream, pgFile *file,
+							   const char *from_fullpath);
+extern uint64 export_stream_close(ExportStream *stream);
+extern int do_restore_from_stream(InstanceState *instanceState, pgRecoveryTarget *rt,
+								  pgRestoreParams *params, bool no_sync);
+
+/* in progress.c */
+extern void progress_begin(const char *phase, size_t files_total, int64 bytes_total);
+extern void progress_begin_files(const char *phase, parray *files);
+extern void progress_add_total(size_t files, int64 bytes);
+extern void progress_file_done(pgFile *file);
+extern void progress_add_file(int64 bytes_read, int64 bytes_written);
+extern void progress_set_queue_depth(size_t depth);
+extern void progress_report_rtt(uint64 usec);
+extern void progress_finish(void);
+
+/* in timing.c */
+extern void timing_init(void);
+extern uint64 timing_now(void);
+extern void timing_add(TimingEvent event, uint64 start);
+extern char *timing_to_json(void);
+
+/* in throttle.c */
+extern void throttle_init(void);
+extern void throttle_read(size_t bytes);
+extern void throttle_read_pages(int n_pages);
+extern void throttle_write(size_t bytes);
+
 /* in delete.c */
 extern void do_delete(InstanceState *instanceState, time_t backup_id);
 extern void delete_backup_files(pgBackup *backup);
@@ -1016,6 +1172,11 @@ extern bool get_control_value_str(const char *str, const char *name,
 extern void dir_list_file(parray *files, const char *root, bool exclude,
 						  bool follow_symlink, bool add_root, bool backup_logs,
 						  bool skip_hidden, int external_dir_num, fio_location location);
+typedef void (*dir_list_callback) (pgFile *dir, parray *files, void *arg);
+extern void dir_list_file_parallel(parray *files, const char *root, bool exclude,
+								   bool follow_symlink, bool add_root, bool backup_logs,
+								   bool skip_hidden, int external_dir_num, int n_threads,
+								   dir_list_callback callback, void *callback_arg);
 
 extern const char *get_tablespace_mapping(const char *dir);
 extern void create_data_directories(parray *dest_files,
@@ -1106,6 +1267,7 @@ extern size_t restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint
 										 const char *from_fullpath, const char *to_fullpath, int nblocks,
 										 datapagemap_t *map, PageState *checksum_map, int checksum_version,
 										 datapagemap_t *lsn_map, BackupPageHeader2 *headers);
+extern void restore_plan_report(void);
 extern size_t restore_non_data_file(parray *parent_chain, pgBackup *dest_backup,
 									pgFile *dest_file, FILE *out, const char *to_fullpath,
 									bool already_exists);
@@ -1118,8 +1280,9 @@ extern PageState *get_checksum_map(const char *fullpath, uint32 checksum_version
 								int n_blocks, XLogRecPtr dest_stop_lsn, BlockNumber segmentno);
 extern datapagemap_t *get_lsn_map(const char *fullpath, uint32 checksum_version,
 								  int n_blocks, XLogRecPtr shift_lsn, BlockNumber segmentno);
-extern bool validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
+extern bool validate_file_pages(pgFile *file, FILE *in, const char *fullpath, XLogRecPtr stop_lsn,
 							    uint32 checksum_version, uint32 backup_version, HeaderMap *hdr_map);
+extern void prefetch_file_range(int fd, off_t offset, off_t len);
 
 extern BackupPageHeader2* get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, bool strict);
 extern void write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map, bool is_merge);
@@ -1136,6 +1299,10 @@ extern void validate_wal(pgBackup *backup, const char *archivedir,
 						 uint32 seg_size);
 extern bool validate_wal_segment(TimeLineID tli, XLogSegNo segno,
 								 const char *prefetch_dir, uint32 wal_seg_size);
+extern bool summarize_wal(const char *archivedir, TimeLineID tli,
+						  XLogSegNo begin_segno, XLogSegNo end_segno,
+						  uint32 wal_seg_size, uint32 *n_summarized,
+						  uint32 *n_skipped);
 extern bool read_recovery_info(const char *archivedir, TimeLineID tli,
 							   uint32 seg_size,
 							   XLogRecPtr start_lsn, XLogRecPtr stop_lsn,
@@ -1200,6 +1367,9 @@ extern bool pg_is_ptrack_enabled(PGconn *backup_conn, int ptrack_version_num);
 extern XLogRecPtr get_last_ptrack_lsn(PGconn *backup_conn, PGNodeInfo *nodeInfo);
 extern parray * pg_ptrack_get_pagemapset(PGconn *backup_conn, const char *ptrack_schema,
 										 int ptrack_version_num, XLogRecPtr lsn);
+extern void pg_ptrack_start_pagemapset_fetch(ConnectionOptions *conn_opt,
+											 const char *ptrack_schema,
+											 int ptrack_version_num, XLogRecPtr lsn);
 
 /* open local file to writing */
 extern FILE* open_local_file_rw(const char *to_fullpath, char **out_buf, uint32 buf_size);
@@ -1277,6 +1447,7 @@ extern void start_WAL_streaming(PGconn *backup_conn, char *stream_dst_path,
 							   XLogRecPtr startpos, TimeLineID starttli,
 							   bool is_backup);
 extern int wait_WAL_streaming_end(parray *backup_files_list);
+extern void wait_WAL_streamed(XLogRecPtr lsn, uint32 timeout_ms);
 extern parray* parse_tli_history_buffer(char *history, TimeLineID tli);
 
 /* external variables and functions, implemented in backup.c */
@@ -0,0 +1,484 @@
+/*-------------------------------------------------------------------------
+ *
+ * progress.c: live progress counters and machine-readable status file
+ *
+ * Worker threads of backup, restore, merge, validate, catchup and
+ * archive-push account processed files in per-thread counter slots with
+ * atomic additions, without taking any lock. If --status-file is specified,
+ * a background thread sums up the slots every second and atomically rewrites
+ * the file with a JSON document, so monitoring can compute throughput and ETA
+ * and detect stalls without parsing the log:
+ *
+ *   {
+ *       "command": "backup",
+ *       "pid": 12345,
+ *       "status": "running",
+ *       "phase": "backup files",
+ *       "start-time": "...", "update-time": "...", "phase-start-time": "...",
+ *       "files-total": 1000, "files-done": 500,
+ *       "bytes-total": ..., "bytes-read": ..., "bytes-written": ...,
+ *       "pages-skipped": ..., "pages-compressed": ..., "compression-ratio": ...,
+ *       "queue-depth": ..., "remote-rtt-avg": ..., "remote-rtt-last": ...,
+ *       "threads": [ {"files-done": ..., "bytes-read": ..., "bytes-written": ...}, ... ]
+ *   }
+ *
+ * Counters are reset at the beginning of every phase. Status is "done" after
+ * progress_finish() and "failed" if the process exits without calling it.
+ *
+ * Copyright (c) 2021, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils/json.h"
+#include "utils/thread.h"
+
+/* How often the status file is rewritten, in seconds */
+#define PROGRESS_WRITE_INTERVAL	1
+/* Threads beyond this number share counter slots */
+#define PROGRESS_MAX_SLOTS		64
+
+/*
+ * Counters of one thread. Slots are padded to the cache line size, so
+ * threads updating their own counters don't slow down each other.
+ */
+typedef union ProgressSlot
+{
+	struct
+	{
+		pg_atomic_uint64 files_done;
+		pg_atomic_uint64 bytes_read;
+		pg_atomic_uint64 bytes_written;
+		pg_atomic_uint64 bytes_uncompressed;
+		pg_atomic_uint64 pages_skipped;
+		pg_atomic_uint64 pages_compressed;
+	}			c;
+	char		pad[PG_CACHE_LINE_SIZE];
+} ProgressSlot;
+
+static ProgressSlot progress_slots[PROGRESS_MAX_SLOTS];
+static pg_atomic_uint32 progress_slots_used;
+/* Slot of the current thread, -1 if it didn't report anything yet */
+static __thread int my_progress_slot = -1;
+
+static pg_atomic_uint64 progress_files_total;
+static pg_atomic_uint64 progress_bytes_total;
+static pg_atomic_uint32 progress_queue_depth;
+static pg_atomic_uint64 progress_rtt_total;
+static pg_atomic_uint64 progress_rtt_count;
+static pg_atomic_uint64 progress_rtt_last;
+
+static const char *progress_phase = NULL;
+static time_t progress_start_time = 0;
+static time_t progress_phase_start_time = 0;
+static bool progress_done = false;
+
+static bool progress_started = false;
+static bool progress_stop_requested = false;
+static pthread_t progress_thread;
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t progress_cond;
+
+static ProgressSlot *progress_get_slot(void);
+static void *progress_writer(void *arg);
+static void progress_stop(void);
+static void progress_atexit(bool fatal, void *userdata);
+static void progress_write_status_file(void);
+
+/*
+ * Begin a new phase of the command: reset the counters and remember the
+ * amount of work, if known. The first call starts the writer of the status
+ * file.
+ */
+void
+progress_begin(const char *phase, size_t files_total, int64 bytes_total)
+{
+	int			i;
+
+	if (status_file == NULL)
+		return;
+
+	pthread_lock(&progress_lock);
+
+	for (i = 0; i < PROGRESS_MAX_SLOTS; i++)
+	{
+		pg_atomic_init_u64(&progress_slots[i].c.files_done, 0);
+		pg_atomic_init_u64(&progress_slots[i].c.bytes_read, 0);
+		pg_atomic_init_u64(&progress_slots[i].c.bytes_written, 0);
+		pg_atomic_init_u64(&progress_slots[i].c.bytes_uncompressed, 0);
+		pg_atomic_init_u64(&progress_slots[i].c.pages_skipped, 0);
+		pg_atomic_init_u64(&progress_slots[i].c.pages_compressed, 0);
+	}
+	pg_atomic_init_u32(&progress_slots_used, 0);
+	pg_atomic_init_u64(&progress_files_total, files_total);
+	pg_atomic_init_u64(&progress_bytes_total, bytes_total);
+	pg_atomic_init_u32(&progress_queue_depth, 0);
+
+	progress_phase = phase;
+	progress_phase_start_time = time(NULL);
+
+	if (!progress_started)
+	{
+		pg_atomic_init_u64(&progress_rtt_total, 0);
+		pg_atomic_init_u64(&progress_rtt_count, 0);
+		pg_atomic_init_u64(&progress_rtt_last, 0);
+		progress_start_time = progress_phase_start_time;
+		pthread_cond_init(&progress_cond, NULL);
+
+		if (pthread_create(&progress_thread, NULL, progress_writer, NULL) != 0)
+		{
+			pthread_mutex_unlock(&progress_lock);
+			elog(ERROR, "Cannot start the writer of status file \"%s\"", status_file);
+		}
+		progress_started = true;
+		pgut_atexit_push(progress_atexit, NULL);
+	}
+
+	/* write the new phase out immediately */
+	pthread_cond_signal(&progress_cond);
+	pthread_mutex_unlock(&progress_lock);
+}
+
+/*
+ * Begin a new phase processing the list of files.
+ */
+void
+progress_begin_files(const char *phase, parray *files)
+{
+	size_t		files_total = 0;
+	int64		bytes_total = 0;
+	size_t		i;
+
+	if (status_file == NULL)
+		return;
+
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		if (!S_ISREG(file->mode))
+			continue;
+
+		files_total++;
+		bytes_total += file->size;
+	}
+
+	progress_begin(phase, files_total, bytes_total);
+}
+
+/*
+ * Add to the amount of work of the current phase, if it becomes known
+ * gradually, e.g. during concurrent listing of PGDATA.
+ */
+void
+progress_add_total(size_t files, int64 bytes)
+{
+	if (status_file == NULL)
+		return;
+
+	pg_atomic_fetch_add_u64(&progress_files_total, files);
+	pg_atomic_fetch_add_u64(&progress_bytes_total, bytes);
+}
+
+/*
+ * Account the file processed by backup, catchup or merge.
+ */
+void
+progress_file_done(pgFile *file)
+{
+	ProgressSlot *slot;
+
+	if (status_file == NULL)
+		return;
+
+	slot = progress_get_slot();
+
+	pg_atomic_fetch_add_u64(&slot->c.files_done, 1);
+	if (file->read_size > 0)
+		pg_atomic_fetch_add_u64(&slot->c.bytes_read, file->read_size);
+	if (file->write_size > 0)
+	{
+		pg_atomic_fetch_add_u64(&slot->c.bytes_written, file->write_size);
+		pg_atomic_fetch_add_u64(&slot->c.bytes_uncompressed,
+								file->uncompressed_size > 0 ?
+								file->uncompressed_size : file->write_size);
+	}
+
+	if (!file->is_datafile || file->is_cfs || file->n_blocks <= 0)
+		return;
+
+	/* Unchanged file is skipped as a whole */
+	if (file->write_size == BYTES_INVALID)
+		pg_atomic_fetch_add_u64(&slot->c.pages_skipped, file->n_blocks);
+	else if (file->n_headers >= 0 && file->n_headers < file->n_blocks)
+		pg_atomic_fetch_add_u64(&slot->c.pages_skipped,
+								file->n_blocks - file->n_headers);
+
+	if (file->n_headers > 0 &&
+		(file->compress_alg == ZLIB_COMPRESS || file->compress_alg == PGLZ_COMPRESS))
+		pg_atomic_fetch_add_u64(&slot->c.pages_compressed, file->n_headers);
+}
+
+/*
+ * Account the file processed by restore, validate or archive-push.
+ */
+void
+progress_add_file(int64 bytes_read, int64 bytes_written)
+{
+	ProgressSlot *slot;
+
+	if (status_file == NULL)
+		return;
+
+	slot = progress_get_slot();
+
+	pg_atomic_fetch_add_u64(&slot->c.files_done, 1);
+	if (bytes_read > 0)
+		pg_atomic_fetch_add_u64(&slot->c.bytes_read, bytes_read);
+	if (bytes_written > 0)
+	{
+		pg_atomic_fetch_add_u64(&slot->c.bytes_written, bytes_written);
+		pg_atomic_fetch_add_u64(&slot->c.bytes_uncompressed, bytes_written);
+	}
+}
+
+/*
+ * Remember the number of files waiting in the queue of worker threads.
+ */
+void
+progress_set_queue_depth(size_t depth)
+{
+	if (status_file == NULL)
+		return;
+
+	pg_atomic_write_u32(&progress_queue_depth, (uint32) depth);
+}
+
+/*
+ * Account round-trip time of a request to the remote agent, in microseconds.
+ */
+void
+progress_report_rtt(uint64 usec)
+{
+	if (status_file == NULL)
+		return;
+
+	pg_atomic_fetch_add_u64(&progress_rtt_total, usec);
+	pg_atomic_fetch_add_u64(&progress_rtt_count, 1);
+	pg_atomic_write_u64(&progress_rtt_last, usec);
+}
+
+/*
+ * Command is completed successfully: write the final status file.
+ */
+void
+progress_finish(void)
+{
+	if (status_file == NULL || !progress_started)
+		return;
+
+	progress_done = true;
+	progress_stop();
+}
+
+static ProgressSlot *
+progress_get_slot(void)
+{
+	if (my_progress_slot < 0)
+		my_progress_slot = pg_atomic_fetch_add_u32(&progress_slots_used, 1) %
+			PROGRESS_MAX_SLOTS;
+
+	return &progress_slots[my_progress_slot];
+}
+
+/*
+ * Status file writer thread.
+ */
+static void *
+progress_writer(void *arg)
+{
+	pthread_lock(&progress_lock);
+
+	while (!progress_stop_requested)
+	{
+		struct timespec timeout;
+
+		pthread_mutex_unlock(&progress_lock);
+		progress_write_status_file();
+		pthread_lock(&progress_lock);
+
+		if (progress_stop_requested)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_sec += PROGRESS_WRITE_INTERVAL;
+		pthread_cond_timedwait(&progress_cond, &progress_lock, &timeout);
+	}
+
+	pthread_mutex_unlock(&progress_lock);
+
+	return NULL;
+}
+
+/*
+ * Stop the writer and write the final status.
+ */
+static void
+progress_stop(void)
+{
+	pthread_lock(&progress_lock);
+	if (progress_stop_requested)
+	{
+		pthread_mutex_unlock(&progress_lock);
+		return;
+	}
+	progress_stop_requested = true;
+	pthread_cond_signal(&progress_cond);
+	pthread_mutex_unlock(&progress_lock);
+
+	pthread_join(progress_thread, NULL);
+
+	progress_write_status_file();
+}
+
+static void
+progress_atexit(bool fatal, void *userdata)
+{
+	progress_stop();
+}
+
+/*
+ * Sum up the counters and rewrite the status file.
+ * Errors are reported as warnings, status file must not break the command.
+ */
+static void
+progress_write_status_file(void)
+{
+	PQExpBufferData buf;
+	int32		json_level = 0;
+	char		path_temp[MAXPGPATH];
+	char		timestamp[100];
+	uint64		files_done = 0,
+				bytes_read = 0,
+				bytes_written = 0,
+				bytes_uncompressed = 0,
+				pages_skipped = 0,
+				pages_compressed = 0;
+	uint64		rtt_count;
+	uint32		n_slots;
+	uint32		i;
+	FILE	   *fp;
+
+	n_slots = Min(pg_atomic_read_u32(&progress_slots_used), PROGRESS_MAX_SLOTS);
+
+	for (i = 0; i < n_slots; i++)
+	{
+		files_done += pg_atomic_read_u64(&progress_slots[i].c.files_done);
+		bytes_read += pg_atomic_read_u64(&progress_slots[i].c.bytes_read);
+		bytes_written += pg_atomic_read_u64(&progress_slots[i].c.bytes_written);
+		bytes_uncompressed += pg_atomic_read_u64(&progress_slots[i].c.bytes_uncompressed);
+		pages_skipped += pg_atomic_read_u64(&progress_slots[i].c.pages_skipped);
+		pages_compressed += pg_atomic_read_u64(&progress_slots[i].c.pages_compressed);
+	}
+
+	initPQExpBuffer(&buf);
+
+	json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+
+	json_add_value(&buf, "command", get_subcmd_name(backup_subcmd), json_level, true);
+	json_add_key(&buf, "pid", json_level);
+	appendPQExpBuffer(&buf, "%d", my_pid);
+	json_add_value(&buf, "status",
+				   !progress_stop_requested ? "running" :
+				   progress_done ? "done" : "failed",
+				   json_level, true);
+	json_add_value(&buf, "phase", progress_phase ? progress_phase : "",
+				   json_level, true);
+
+	time2iso(timestamp, lengthof(timestamp), progress_start_time, false);
+	json_add_value(&buf, "start-time", timestamp, json_level, true);
+	time2iso(timestamp, lengthof(timestamp), progress_phase_start_time, false);
+	json_add_value(&buf, "phase-start-time", timestamp, json_level, true);
+	time2iso(timestamp, lengthof(timestamp), time(NULL), false);
+	json_add_value(&buf, "update-time", timestamp, json_level, true);
+
+	json_add_key(&buf, "files-total", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, pg_atomic_read_u64(&progress_files_total));
+	json_add_key(&buf, "files-done", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, files_done);
+	json_add_key(&buf, "bytes-total", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, pg_atomic_read_u64(&progress_bytes_total));
+	json_add_key(&buf, "bytes-read", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, bytes_read);
+	json_add_key(&buf, "bytes-written", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, bytes_written);
+	json_add_key(&buf, "pages-skipped", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, pages_skipped);
+	json_add_key(&buf, "pages-compressed", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, pages_compressed);
+	json_add_key(&buf, "compression-ratio", json_level);
+	appendPQExpBuffer(&buf, "%.2f", bytes_written > 0 ?
+					  (double) bytes_uncompressed / bytes_written : 1.0);
+	json_add_key(&buf, "queue-depth", json_level);
+	appendPQExpBuffer(&buf, "%u", pg_atomic_read_u32(&progress_queue_depth));
+
+	/* round-trip time to remote agent in microseconds */
+	rtt_count = pg_atomic_read_u64(&progress_rtt_count);
+	json_add_key(&buf, "remote-rtt-avg", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, rtt_count > 0 ?
+					  pg_atomic_read_u64(&progress_rtt_total) / rtt_count : 0);
+	json_add_key(&buf, "remote-rtt-last", json_level);
+	appendPQExpBuffer(&buf, UINT64_FORMAT, pg_atomic_read_u64(&progress_rtt_last));
+
+	json_add_key(&buf, "threads", json_level);
+	json_add(&buf, JT_BEGIN_ARRAY, &json_level);
+	for (i = 0; i < n_slots; i++)
+	{
+		json_add(&buf, JT_BEGIN_OBJECT, &json_level);
+		json_add_key(&buf, "files-done", json_level);
+		appendPQExpBuffer(&buf, UINT64_FORMAT,
+						  pg_atomic_read_u64(&progress_slots[i].c.files_done));
+		json_add_key(&buf, "bytes-read", json_level);
+		appendPQExpBuffer(&buf, UINT64_FORMAT,
+						  pg_atomic_read_u64(&progress_slots[i].c.bytes_read));
+		json_add_key(&buf, "bytes-written", json_level);
+		appendPQExpBuffer(&buf, UINT64_FORMAT,
+						  pg_atomic_read_u64(&progress_slots[i].c.bytes_written));
+		json_add(&buf, JT_END_OBJECT, &json_level);
+	}
+	json_add(&buf, JT_END_ARRAY, &json_level);
+
+	json_add(&buf, JT_END_OBJECT, &json_level);
+
+	/* write to the temp file and rename, so readers never see partial file */
+	snprintf(path_temp, sizeof(path_temp), "%s.tmp", status_file);
+
+	fp = fopen(path_temp, PG_BINARY_W);
+	if (fp == NULL)
+	{
+		elog(WARNING, "Cannot open status file \"%s\": %s",
+			 path_temp, strerror(errno));
+		termPQExpBuffer(&buf);
+		return;
+	}
+
+	if (fwrite(buf.data, 1, buf.len, fp) != buf.len || fclose(fp) != 0)
+	{
+		elog(WARNING, "Cannot write status file \"%s\": %s",
+			 path_temp, strerror(errno));
+		termPQExpBuffer(&buf);
+		return;
+	}
+
+	if (rename(path_temp, status_file) < 0)
+		elog(WARNING, "Cannot rename file \"%s\" to \"%s\": %s",
+			 path_temp, status_file, strerror(errno));
+
+	termPQExpBuffer(&buf);
+}
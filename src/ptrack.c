@@ -14,6 +14,8 @@
 #endif
 #include "catalog/pg_tablespace.h"
 
+#include "utils/thread.h"
+
 /*
  * Macro needed to parse ptrack.
  * NOTE Keep those values synchronized with definitions in ptrack.h
@@ -21,6 +23,21 @@
 #define PTRACK_BITS_PER_HEAPBLOCK 1
 #define HEAPBLOCKS_PER_BYTE (BITS_PER_BYTE / PTRACK_BITS_PER_HEAPBLOCK)
 
+/* Arguments and result of the thread fetching ptrack pagemapset */
+typedef struct
+{
+	ConnectionOptions conn_opt;
+	const char *ptrack_schema;
+	int			ptrack_version_num;
+	XLogRecPtr	lsn;
+
+	parray	   *pagemapset;
+	bool		is_ok;
+} ptrack_fetch_arg;
+
+static pthread_t ptrack_fetch_thread;
+static ptrack_fetch_arg *ptrack_fetch = NULL;
+
 /*
  * Parse a string like "2.1" into int
  * result: int by formula major_number * 100 + minor_number
@@ -185,6 +202,11 @@ get_last_ptrack_lsn(PGconn *backup_conn, PGNodeInfo *nodeInfo)
 
 /*
  * Fetch a list of changed files with their ptrack maps.
+ *
+ * The result can be huge for a big cluster, so it is requested in binary
+ * format and received in single-row mode: each bitmap is copied as is
+ * right after its row arrives, and neither the whole result nor its escaped
+ * text representation is kept in memory.
  */
 parray *
 pg_ptrack_get_pagemapset(PGconn *backup_conn, const char *ptrack_schema,
@@ -210,37 +232,104 @@ pg_ptrack_get_pagemapset(PGconn *backup_conn, const char *ptrack_schema,
 		sprintf(query, "SELECT path, pagemap FROM %s.ptrack_get_pagemapset($1) ORDER BY 1",
 				ptrack_schema);
 
-	res = pgut_execute(backup_conn, query, 1, (const char **) params);
-	pfree(params[0]);
+	elog(VERBOSE, "Fetching ptrack pagemapset: %s", query);
 
-	if (PQnfields(res) != 2)
-		elog(ERROR, "cannot get ptrack pagemapset");
+	/* parameter is sent as text, result is received in binary format */
+	if (!PQsendQueryParams(backup_conn, query, 1, NULL, (const char **) params,
+						   NULL, NULL, 1))
+		elog(ERROR, "Cannot get ptrack pagemapset: %s",
+			 PQerrorMessage(backup_conn));
+	pfree(params[0]);
 
-	/* sanity ? */
+	/* if single-row mode is not available, the whole result comes at once */
+	if (!PQsetSingleRowMode(backup_conn))
+		elog(VERBOSE, "Cannot switch to single-row mode, receive ptrack pagemapset at once");
 
-	/* Construct database map */
-	for (i = 0; i < PQntuples(res); i++)
+	while ((res = PQgetResult(backup_conn)) != NULL)
 	{
-		page_map_entry *pm_entry = (page_map_entry *) pgut_malloc(sizeof(page_map_entry));
+		ExecStatusType status = PQresultStatus(res);
+
+		if (status != PGRES_SINGLE_TUPLE && status != PGRES_TUPLES_OK)
+		{
+			char	   *errmsg = pgut_strdup(PQresultErrorMessage(res));
 
-		/* get path */
-		pm_entry->path = pgut_strdup(PQgetvalue(res, i, 0));
+			PQclear(res);
+			elog(ERROR, "Cannot get ptrack pagemapset: %s", errmsg);
+		}
 
-		/* get bytea */
-		pm_entry->pagemap = (char *) PQunescapeBytea((unsigned char *) PQgetvalue(res, i, 1),
-													&pm_entry->pagemapsize);
+		if (PQnfields(res) != 2)
+			elog(ERROR, "cannot get ptrack pagemapset");
 
-		if (pagemapset == NULL)
-			pagemapset = parray_new();
+		for (i = 0; i < PQntuples(res); i++)
+		{
+			page_map_entry *pm_entry = (page_map_entry *) pgut_malloc(sizeof(page_map_entry));
 
-		parray_append(pagemapset, pm_entry);
-	}
+			/* get path, text value is the same in binary format */
+			pm_entry->path = pgut_strdup(PQgetvalue(res, i, 0));
 
-	PQclear(res);
+			/* get bytea, raw bytes in binary format */
+			pm_entry->pagemapsize = PQgetlength(res, i, 1);
+			pm_entry->pagemap = pgut_malloc(Max(pm_entry->pagemapsize, 1));
+			memcpy(pm_entry->pagemap, PQgetvalue(res, i, 1), pm_entry->pagemapsize);
+
+			if (pagemapset == NULL)
+				pagemapset = parray_new();
+
+			parray_append(pagemapset, pm_entry);
+		}
+
+		PQclear(res);
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during ptrack pagemapset fetching");
+	}
 
 	return pagemapset;
 }
 
+static void *
+ptrack_fetch_pagemapset(void *arg)
+{
+	ptrack_fetch_arg *fetch_arg = (ptrack_fetch_arg *) arg;
+	PGconn	   *conn;
+
+	conn = pgut_connect(fetch_arg->conn_opt.pghost, fetch_arg->conn_opt.pgport,
+						fetch_arg->conn_opt.pgdatabase, fetch_arg->conn_opt.pguser);
+
+	fetch_arg->pagemapset = pg_ptrack_get_pagemapset(conn,
+													 fetch_arg->ptrack_schema,
+													 fetch_arg->ptrack_version_num,
+													 fetch_arg->lsn);
+	pgut_disconnect(conn);
+
+	fetch_arg->is_ok = true;
+	return NULL;
+}
+
+/*
+ * Start fetching ptrack maps in a separate thread and connection, so that
+ * the fetch overlaps with listing of PGDATA. The result is picked up by
+ * the next call of make_pagemap_from_ptrack_2().
+ */
+void
+pg_ptrack_start_pagemapset_fetch(ConnectionOptions *conn_opt,
+								 const char *ptrack_schema,
+								 int ptrack_version_num, XLogRecPtr lsn)
+{
+	Assert(ptrack_fetch == NULL);
+
+	if (!ptrack_schema)
+		elog(ERROR, "Schema name of ptrack extension is missing");
+
+	ptrack_fetch = pgut_new0(ptrack_fetch_arg);
+	ptrack_fetch->conn_opt = *conn_opt;
+	ptrack_fetch->ptrack_schema = ptrack_schema;
+	ptrack_fetch->ptrack_version_num = ptrack_version_num;
+	ptrack_fetch->lsn = lsn;
+
+	pthread_create(&ptrack_fetch_thread, NULL, ptrack_fetch_pagemapset, ptrack_fetch);
+}
+
 /*
  * Given a list of files in the instance to backup, build a pagemap for each
  * data file that has ptrack. Result is saved in the pagemap field of pgFile.
@@ -259,9 +348,22 @@ make_pagemap_from_ptrack_2(parray *files,
 	int		file_i = 0;
 	page_map_entry *dummy_map = NULL;
 
-	/* Receive all available ptrack bitmaps at once */
-	filemaps = pg_ptrack_get_pagemapset(backup_conn, ptrack_schema,
-										ptrack_version_num, lsn);
+	if (ptrack_fetch)
+	{
+		/* Bitmaps are fetched concurrently with listing, wait for them */
+		pthread_join(ptrack_fetch_thread, NULL);
+
+		if (!ptrack_fetch->is_ok)
+			elog(ERROR, "Cannot get ptrack pagemapset");
+
+		filemaps = ptrack_fetch->pagemapset;
+		pg_free(ptrack_fetch);
+		ptrack_fetch = NULL;
+	}
+	else
+		/* Receive all available ptrack bitmaps at once */
+		filemaps = pg_ptrack_get_pagemapset(backup_conn, ptrack_schema,
+											ptrack_version_num, lsn);
 
 	if (filemaps != NULL)
 		parray_qsort(filemaps, pgFileMapComparePath);
@@ -17,6 +17,9 @@
 
 #include "utils/thread.h"
 
+/* Restore threads flush their journals at most once in this many seconds */
+#define RESTORE_JOURNAL_FLUSH_INTERVAL	1
+
 typedef struct
 {
 	parray	   *pgdata_files;
@@ -31,6 +34,7 @@ typedef struct
 	bool        use_bitmap;
 	IncrRestoreMode        incremental_mode;
 	XLogRecPtr  shift_lsn;    /* used only in LSN incremental_mode */
+	int			thread_num;
 
 	/*
 	 * Return value from the thread.
@@ -56,12 +60,14 @@ update_recovery_options_before_v12(InstanceState *instanceState, pgBackup *backu
 								   pgRestoreParams *params, pgRecoveryTarget *rt);
 #endif
 
-static void create_recovery_conf(InstanceState *instanceState, time_t backup_id,
-								 pgRecoveryTarget *rt,
-								 pgBackup *backup,
-								 pgRestoreParams *params);
 static void *restore_files(void *arg);
 static void set_orphan_status(parray *backups, pgBackup *parent_backup);
+static void get_restore_path(char *to_fullpath, pgFile *dest_file,
+							 const char *to_root, parray *external_dirs);
+static bool restore_journal_scan(const char *pgdata_path, bool remove);
+static void restore_journal_load(pgBackup *dest_backup, parray *dest_files,
+								 const char *pgdata_path, parray *external_dirs,
+								 bool skip_external_dirs);
 
 static void restore_chain(pgBackup *dest_backup, parray *parent_chain,
 						  parray *dbOid_exclude_list, pgRestoreParams *params,
@@ -205,6 +211,12 @@ do_restore_or_validate(InstanceState *instanceState, time_t target_backup_id, pg
 				if (!ok_to_go)
 					elog(ERROR, "Incremental restore is not allowed");
 			}
+			else if (restore_journal_scan(instance_config.pgdata, false))
+			{
+				elog(INFO, "Destination directory contains journal of interrupted restore, "
+					 "resuming restore into \"%s\"", instance_config.pgdata);
+				params->resume = true;
+			}
 			else
 				elog(ERROR, "Restore destination is not empty: \"%s\"",
 					 instance_config.pgdata);
@@ -407,9 +419,10 @@ do_restore_or_validate(InstanceState *instanceState, time_t target_backup_id, pg
 	 */
 	if (params->is_restore)
 	{
+		/* directories partially filled by interrupted restore are allowed */
 		int rc = check_tablespace_mapping(dest_backup,
-										  params->incremental_mode != INCR_NONE, params->force,
-										  pgdata_is_empty, params->no_validate);
+										  params->incremental_mode != INCR_NONE || params->resume,
+										  params->force, pgdata_is_empty, params->no_validate);
 
 		/* backup contain no tablespaces */
 		if (rc == NoTblspc)
@@ -427,7 +440,8 @@ do_restore_or_validate(InstanceState *instanceState, time_t target_backup_id, pg
 		//		- make check_external_dir_mapping more like check_tablespace_mapping
 		//		- honor force flag in case of incremental restore just like check_tablespace_mapping
 		if (!params->skip_external_dirs)
-			check_external_dir_mapping(dest_backup, params->incremental_mode != INCR_NONE);
+			check_external_dir_mapping(dest_backup,
+									   params->incremental_mode != INCR_NONE || params->resume);
 	}
 
 	/* At this point we are sure that parent chain is whole
@@ -677,11 +691,16 @@ do_restore_or_validate(InstanceState *instanceState, time_t target_backup_id, pg
 		//TODO rename and update comment
 		/* Create recovery.conf with given recovery target parameters */
 		create_recovery_conf(instanceState, target_backup_id, rt, dest_backup, params);
+
+		/* restore is complete, nothing to resume */
+		restore_journal_scan(instance_config.pgdata, true);
 	}
 
 	/* ssh connection to longer needed */
 	fio_disconnect();
 
+	progress_finish();
+
 	elog(INFO, "%s of backup %s completed.",
 		 action, base36enc(dest_backup->start_time));
 
@@ -800,7 +819,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 	 */
 	create_data_directories(dest_files, instance_config.pgdata,
 							dest_backup->root_dir, backup_has_tblspc,
-							params->incremental_mode != INCR_NONE,
+							params->incremental_mode != INCR_NONE || params->resume,
 							FIO_DB_HOST);
 
 	/*
@@ -964,6 +983,15 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 
 	pretty_size(dest_bytes, pretty_dest_bytes, lengthof(pretty_dest_bytes));
 	elog(INFO, "Start restoring backup files. PGDATA size: %s", pretty_dest_bytes);
+	progress_begin_files("restore files", dest_files);
+
+	if (params->resume)
+	{
+		restore_journal_load(dest_backup, dest_files, pgdata_path, external_dirs,
+							 params->skip_external_dirs);
+		fio_disconnect();
+	}
+
 	time(&start_time);
 	thread_interrupted = false;
 
@@ -983,6 +1011,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 		arg->use_bitmap = use_bitmap;
 		arg->incremental_mode = params->incremental_mode;
 		arg->shift_lsn = params->shift_lsn;
+		arg->thread_num = i + 1;
 		threads_args[i].restored_bytes = 0;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
@@ -1016,6 +1045,8 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 		elog(INFO, "Restore incremental ratio (less is better): %.f%% (%s/%s)",
 			((float) total_bytes / dest_bytes) * 100,
 			pretty_total_bytes, pretty_dest_bytes);
+
+		restore_plan_report();
 	}
 	else
 		elog(ERROR, "Backup files restoring failed. Transfered bytes: %s, time elapsed: %s",
@@ -1048,20 +1079,13 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 				params->skip_external_dirs)
 				continue;
 
-			/* construct fullpath */
-			if (dest_file->external_dir_num == 0)
-			{
-				if (strcmp(PG_TABLESPACE_MAP_FILE, dest_file->rel_path) == 0)
-					continue;
-				if (strcmp(DATABASE_MAP, dest_file->rel_path) == 0)
-					continue;
-				join_path_components(to_fullpath, pgdata_path, dest_file->rel_path);
-			}
-			else
-			{
-				char *external_path = parray_get(external_dirs, dest_file->external_dir_num - 1);
-				join_path_components(to_fullpath, external_path, dest_file->rel_path);
-			}
+			if (dest_file->external_dir_num == 0 &&
+				(strcmp(PG_TABLESPACE_MAP_FILE, dest_file->rel_path) == 0 ||
+				 strcmp(DATABASE_MAP, dest_file->rel_path) == 0))
+				continue;
+
+			/* construct fullpath the same way as restore_files() does */
+			get_restore_path(to_fullpath, dest_file, pgdata_path, external_dirs);
 
 			/* TODO: write test for case: file to be synced is missing */
 			if (fio_sync(to_fullpath, FIO_DB_HOST) != 0)
@@ -1107,6 +1131,9 @@ restore_files(void *arg)
 	char        to_fullpath[MAXPGPATH];
 	FILE       *out = NULL;
 	char       *out_buf = pgut_malloc(STDIO_BUFSIZE);
+	FILE       *journal = NULL;
+	char        journal_path[MAXPGPATH];
+	time_t      journal_flush_time = 0;
 
 	restore_files_arg *arguments = (restore_files_arg *) arg;
 
@@ -1119,6 +1146,8 @@ restore_files(void *arg)
 		datapagemap_t  *lsn_map = NULL;      /* it should take 16kB at most */
 		char           *errmsg = NULL;       /* remote agent error message */
 		pgFile	*dest_file = (pgFile *) parray_get(arguments->dest_files, i);
+		size_t	restored_bytes = arguments->restored_bytes;
+		int64	restored_size = 0;	/* size of restored file, -1 if unknown */
 
 		/* Directories were created before */
 		if (S_ISDIR(dest_file->mode))
@@ -1151,6 +1180,7 @@ restore_files(void *arg)
 
 				elog(VERBOSE, "Skip file due to partial restore: \"%s\"",
 						dest_file->rel_path);
+				progress_add_file(0, 0);
 				continue;
 			}
 		}
@@ -1176,14 +1206,8 @@ restore_files(void *arg)
 			continue;
 
 		/* set fullpath of destination file */
-		if (dest_file->external_dir_num == 0)
-			join_path_components(to_fullpath, arguments->to_root, dest_file->rel_path);
-		else
-		{
-			char	*external_path = parray_get(arguments->dest_external_dirs,
-												dest_file->external_dir_num - 1);
-			join_path_components(to_fullpath, external_path, dest_file->rel_path);
-		}
+		get_restore_path(to_fullpath, dest_file, arguments->to_root,
+						 arguments->dest_external_dirs);
 
 		if (arguments->incremental_mode != INCR_NONE &&
 			parray_bsearch(arguments->pgdata_files, dest_file, pgFileCompareRelPathWithExternalDesc))
@@ -1258,6 +1282,8 @@ restore_files(void *arg)
 														   dest_file, out, to_fullpath,
 														   arguments->use_bitmap, checksum_map,
 														   arguments->shift_lsn, lsn_map, true);
+			restored_size = dest_file->n_blocks != BLOCKNUM_INVALID ?
+				(int64) dest_file->n_blocks * BLCKSZ : -1;
 		}
 		else
 		{
@@ -1265,9 +1291,13 @@ restore_files(void *arg)
 			if (!fio_is_remote_file(out))
 				setvbuf(out, NULL, _IONBF, BUFSIZ);
 			/* Destination file is nonedata file */
-			arguments->restored_bytes += restore_non_data_file(arguments->parent_chain,
+			restored_size = restore_non_data_file(arguments->parent_chain,
 										arguments->dest_backup, dest_file, out, to_fullpath,
 										already_exists);
+			arguments->restored_bytes += restored_size;
+			/* nothing is written if already existing file is the same */
+			if (restored_size == 0)
+				restored_size = -1;
 		}
 
 done:
@@ -1280,6 +1310,36 @@ done:
 			elog(ERROR, "Cannot close file \"%s\": %s", to_fullpath,
 				 strerror(errno));
 
+		/* record the restored file, so that interrupted restore can be resumed */
+		if (journal == NULL)
+		{
+			snprintf(journal_path, MAXPGPATH, "%s/%s.%d.%d", arguments->to_root,
+					 RESTORE_JOURNAL_FILE, (int) getpid(), arguments->thread_num);
+			journal = fio_fopen(journal_path, PG_BINARY_W, FIO_DB_HOST);
+			if (journal == NULL)
+				elog(ERROR, "Cannot open file \"%s\": %s", journal_path, strerror(errno));
+			fio_fprintf(journal, "restore %s %u\n",
+						base36enc(arguments->dest_backup->start_time),
+						arguments->dest_backup->content_crc);
+		}
+
+		if (restored_size >= 0)
+			fio_fprintf(journal, "%d %u " INT64_FORMAT "\n",
+						i, dest_file->crc, restored_size);
+
+		/*
+		 * Losing the tail of the journal only makes resumed restore copy
+		 * some files again, so don't flush it after every file.
+		 */
+		if (time(NULL) - journal_flush_time >= RESTORE_JOURNAL_FLUSH_INTERVAL)
+		{
+			fio_fflush(journal);
+			journal_flush_time = time(NULL);
+		}
+
+		progress_add_file(dest_file->write_size,
+						  arguments->restored_bytes - restored_bytes);
+
 		/* free pagemap used for restore optimization */
 		pg_free(dest_file->pagemap.bitmap);
 
@@ -1292,6 +1352,9 @@ done:
 
 	free(out_buf);
 
+	if (journal && fio_fclose(journal) != 0)
+		elog(ERROR, "Cannot close file \"%s\": %s", journal_path, strerror(errno));
+
 	/* ssh connection to longer needed */
 	fio_disconnect();
 
@@ -1301,11 +1364,176 @@ done:
 	return NULL;
 }
 
+/*
+ * Construct full path of the file in the destination directory.
+ */
+static void
+get_restore_path(char *to_fullpath, pgFile *dest_file, const char *to_root,
+				 parray *external_dirs)
+{
+	if (dest_file->external_dir_num == 0)
+		join_path_components(to_fullpath, to_root, dest_file->rel_path);
+	else
+	{
+		char	*external_path = parray_get(external_dirs,
+											dest_file->external_dir_num - 1);
+		join_path_components(to_fullpath, external_path, dest_file->rel_path);
+	}
+
+	/* Streamed WAL segment may be stored compressed, restore it decompressed */
+	if (dest_file->external_dir_num == 0 && !dest_file->is_datafile &&
+		dest_file->compress_alg == ZLIB_COMPRESS &&
+		IsCompressedXLogFileName(dest_file->name))
+		to_fullpath[strlen(to_fullpath) - strlen(".gz")] = '\0';
+}
+
+/*
+ * Restore journal.
+ *
+ * Every restore thread appends files it has restored to its own journal
+ * file in the destination directory: index of the file in the sorted file
+ * list of the destination backup, its CRC in the backup and size of the
+ * restored file, as known from restoring it. The journal is flushed
+ * periodically rather than after every file, and the journal files are
+ * removed when restore is complete.
+ *
+ * If restore is interrupted, rerunning it into the same directory resumes
+ * the restore: files from the journal, whose size is still the same,
+ * are not restored again. Journal files of all runs are kept until restore
+ * is complete.
+ */
+
+/*
+ * Look for journal files of interrupted restore in the destination
+ * directory, remove them if asked to.
+ */
+static bool
+restore_journal_scan(const char *pgdata_path, bool remove)
+{
+	DIR		   *dir;
+	struct dirent *dent;
+	bool		found = false;
+
+	dir = fio_opendir(pgdata_path, FIO_DB_HOST);
+	if (dir == NULL)
+		return false;
+
+	while ((dent = fio_readdir(dir)) != NULL)
+	{
+		char		path[MAXPGPATH];
+
+		if (strncmp(dent->d_name, RESTORE_JOURNAL_FILE,
+					strlen(RESTORE_JOURNAL_FILE)) != 0)
+			continue;
+
+		found = true;
+		if (!remove)
+			break;
+
+		join_path_components(path, pgdata_path, dent->d_name);
+		if (fio_unlink(path, FIO_DB_HOST) != 0)
+			elog(WARNING, "Cannot remove file \"%s\": %s", path, strerror(errno));
+	}
+
+	fio_closedir(dir);
+
+	return found;
+}
+
+/*
+ * Mark files restored by interrupted restore, so that restore threads
+ * skip them.
+ */
+static void
+restore_journal_load(pgBackup *dest_backup, parray *dest_files,
+					 const char *pgdata_path, parray *external_dirs,
+					 bool skip_external_dirs)
+{
+	DIR		   *dir;
+	struct dirent *dent;
+	char		header[64];
+	int			n_resumed = 0;
+
+	snprintf(header, lengthof(header), "restore %s %u\n",
+			 base36enc(dest_backup->start_time), dest_backup->content_crc);
+
+	dir = fio_opendir(pgdata_path, FIO_DB_HOST);
+	if (dir == NULL)
+		elog(ERROR, "Cannot open directory \"%s\": %s", pgdata_path, strerror(errno));
+
+	while ((dent = fio_readdir(dir)) != NULL)
+	{
+		char		path[MAXPGPATH];
+		char		line[128];
+		FILE	   *fp;
+
+		if (strncmp(dent->d_name, RESTORE_JOURNAL_FILE,
+					strlen(RESTORE_JOURNAL_FILE)) != 0)
+			continue;
+
+		join_path_components(path, pgdata_path, dent->d_name);
+
+		fp = fio_open_stream(path, FIO_DB_HOST);
+		if (fp == NULL)
+			elog(ERROR, "Cannot open file \"%s\": %s", path, strerror(errno));
+
+		/* journal of a thread that had nothing to restore may be empty */
+		if (fgets(line, lengthof(line), fp) && strcmp(line, header) != 0)
+			elog(ERROR, "Destination directory \"%s\" contains interrupted restore "
+				 "of another backup, journal \"%s\" does not match backup %s",
+				 pgdata_path, path, base36enc(dest_backup->start_time));
+
+		while (fgets(line, lengthof(line), fp))
+		{
+			int			idx;
+			uint32		crc;
+			int64		size;
+			pgFile	   *dest_file;
+			char		to_fullpath[MAXPGPATH];
+			struct stat st;
+
+			/* skip incomplete line written at the moment of interruption */
+			if (sscanf(line, "%d %u " INT64_FORMAT "\n",
+					   &idx, &crc, &size) != 3 ||
+				line[strlen(line) - 1] != '\n')
+				continue;
+
+			if (idx < 0 || idx >= parray_num(dest_files))
+				continue;
+
+			dest_file = (pgFile *) parray_get(dest_files, idx);
+			if (dest_file->crc != crc || S_ISDIR(dest_file->mode))
+				continue;
+
+			if (skip_external_dirs && dest_file->external_dir_num > 0)
+				continue;
+
+			/* cheap check that the file is left as it was restored */
+			get_restore_path(to_fullpath, dest_file, pgdata_path, external_dirs);
+			if (fio_stat(to_fullpath, &st, true, FIO_DB_HOST) != 0 ||
+				st.st_size != size)
+				continue;
+
+			if (!pg_atomic_test_set_flag(&dest_file->lock))
+				continue;
+
+			progress_add_file(dest_file->write_size, 0);
+			n_resumed++;
+		}
+
+		fio_close_stream(fp);
+	}
+
+	fio_closedir(dir);
+
+	elog(INFO, "Resuming interrupted restore, %d files are already restored", n_resumed);
+}
+
 /*
  * Create recovery.conf (postgresql.auto.conf in case of PG12)
  * with given recovery target parameters
  */
-static void
+void
 create_recovery_conf(InstanceState *instanceState, time_t backup_id,
 					 pgRecoveryTarget *rt,
 					 pgBackup *backup,
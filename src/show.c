@@ -435,6 +435,11 @@ print_backup_json_object(PQExpBuffer buf, pgBackup *backup)
 		json_add_value(buf, "note", backup->note,
 					json_level, true);
 
+	/* already formatted as JSON object */
+	if (backup->timing)
+		json_add_value(buf, "timing", backup->timing,
+					json_level, false);
+
 	if (backup->content_crc != 0)
 	{
 		json_add_key(buf, "content-crc", json_level);
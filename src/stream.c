@@ -15,6 +15,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 /*
  * global variable needed by ReceiveXlogStream()
  *
@@ -58,8 +62,29 @@ typedef struct
 static pthread_t stream_thread;
 static StreamThreadArg stream_thread_arg = {"", NULL, 1};
 
+/*
+ * Position received by streaming thread, used to wake up wait_wal_lsn()
+ * as soon as the LSN it waits for is streamed.
+ */
+static pthread_mutex_t stream_progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_progress_cond = PTHREAD_COND_INITIALIZER;
+static XLogRecPtr stream_progress_lsn = InvalidXLogRecPtr;
+static XLogRecPtr stream_wait_lsn = InvalidXLogRecPtr;
+
 static parray *xlog_files_list = NULL;
 static bool do_crc = true;
+static bool compress_stream_wal = false;
+
+/*
+ * Finished WAL segments are handed over to the separate thread, which
+ * calculates their CRC and compresses them, so that receiving of WAL
+ * is never stalled by reading segments back or by compression.
+ */
+static pthread_t wal_worker_thread;
+static pthread_mutex_t wal_worker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_worker_cond = PTHREAD_COND_INITIALIZER;
+static parray *wal_worker_queue = NULL;
+static bool wal_worker_finished = false;
 
 static void IdentifySystem(StreamThreadArg *stream_thread_arg);
 static int checkpoint_timeout(PGconn *backup_conn);
@@ -71,6 +96,11 @@ static void add_walsegment_to_filelist(parray *filelist, uint32 timeline,
                                        uint32 xlog_seg_size);
 static void add_history_file_to_filelist(parray *filelist, uint32 timeline,
 										 char *basedir);
+static void *process_wal_segments(void *arg);
+static void process_wal_segment(pgFile *file, char *basedir, char *prev_fullpath);
+#ifdef HAVE_LIBZ
+static void compress_wal_segment(pgFile *file, const char *from_fullpath);
+#endif
 
 /*
  * Run IDENTIFY_SYSTEM through a given connection and
@@ -228,6 +258,11 @@ StreamLog(void *arg)
 	/* Initialize timeout */
 	stream_stop_begin = 0;
 
+	/* Start processing of finished segments */
+	wal_worker_queue = parray_new();
+	wal_worker_finished = false;
+	pthread_create(&wal_worker_thread, NULL, process_wal_segments, stream_arg->basedir);
+
 	/* Create repslot */
 #if PG_VERSION_NUM >= 100000
 	if (temp_slot || perm_slot)
@@ -329,6 +364,45 @@ StreamLog(void *arg)
                                stop_stream_lsn, (char *) stream_arg->basedir,
                                instance_config.xlog_seg_size);
 
+	/* Wait for all segments to be processed */
+	pthread_lock(&wal_worker_lock);
+	wal_worker_finished = true;
+	pthread_cond_signal(&wal_worker_cond);
+	pthread_mutex_unlock(&wal_worker_lock);
+
+	pthread_join(wal_worker_thread, NULL);
+	parray_free(wal_worker_queue);
+	wal_worker_queue = NULL;
+
+	if (thread_interrupted)
+	{
+		interrupted = true;
+		elog(ERROR, "Failed to process streamed WAL segments");
+	}
+
+	/*
+	 * Compressed segments were renamed by worker, rel_path is
+	 * fixed only now, because it is used to detect duplicates.
+	 */
+	if (compress_stream_wal)
+	{
+		int			i;
+
+		for (i = 0; i < parray_num(xlog_files_list); i++)
+		{
+			pgFile	   *file = (pgFile *) parray_get(xlog_files_list, i);
+			char	   *rel_path;
+
+			if (file->compress_alg != ZLIB_COMPRESS)
+				continue;
+
+			rel_path = psprintf("%s.gz", file->rel_path);
+			pg_free(file->rel_path);
+			file->rel_path = rel_path;
+			file->name = last_dir_separator(file->rel_path) + 1;
+		}
+	}
+
 	/* append history file to walsegment filelist */
 	add_history_file_to_filelist(xlog_files_list, stream_arg->starttli, (char *) stream_arg->basedir);
 
@@ -370,6 +444,12 @@ stop_streaming(XLogRecPtr xlogpos, uint32 timeline, bool segment_finished)
 	if (interrupted || thread_interrupted)
 		elog(ERROR, "Interrupted during WAL streaming");
 
+	pthread_lock(&stream_progress_lock);
+	stream_progress_lsn = xlogpos;
+	if (!XLogRecPtrIsInvalid(stream_wait_lsn) && xlogpos >= stream_wait_lsn)
+		pthread_cond_signal(&stream_progress_cond);
+	pthread_mutex_unlock(&stream_progress_lock);
+
 	/* we assume that we get called once at the end of each segment */
 	if (segment_finished)
 	{
@@ -425,6 +505,46 @@ stop_streaming(XLogRecPtr xlogpos, uint32 timeline, bool segment_finished)
 
 /* --- External API --- */
 
+/*
+ * Wait at most 'timeout_ms' milliseconds until WAL up to 'lsn' is received
+ * by the streaming thread. If it is already received, just sleep, so that
+ * the caller waiting for something else doesn't spin.
+ */
+void
+wait_WAL_streamed(XLogRecPtr lsn, uint32 timeout_ms)
+{
+	struct timespec deadline;
+
+	pthread_lock(&stream_progress_lock);
+
+	if (stream_progress_lsn >= lsn)
+	{
+		pthread_mutex_unlock(&stream_progress_lock);
+		pg_usleep(timeout_ms * 1000L);
+		return;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	stream_wait_lsn = lsn;
+	while (stream_progress_lsn < lsn)
+	{
+		if (pthread_cond_timedwait(&stream_progress_cond, &stream_progress_lock,
+								   &deadline) != 0)
+			break;
+	}
+	stream_wait_lsn = InvalidXLogRecPtr;
+
+	pthread_mutex_unlock(&stream_progress_lock);
+}
+
 /*
  * Maybe add a StreamOptions struct ?
  * Backup conn only needed to calculate stream_stop_timeout. Think about refactoring it.
@@ -635,6 +755,10 @@ start_WAL_streaming(PGconn *backup_conn, char *stream_dst_path, ConnectionOption
 {
 	/* calculate crc only when running backup, catchup has no need for it */
 	do_crc = is_backup;
+	/* compress WAL the same way as archive-push does, only zlib is supported */
+#ifdef HAVE_LIBZ
+	compress_stream_wal = is_backup && current.compress_alg == ZLIB_COMPRESS;
+#endif
 	/* How long we should wait for streaming end after pg_stop_backup */
 	stream_stop_timeout = checkpoint_timeout(backup_conn);
 	//TODO Add a comment about this calculation
@@ -706,28 +830,22 @@ add_walsegment_to_filelist(parray *filelist, uint32 timeline, XLogRecPtr xlogpos
     join_path_components(wal_segment_fullpath, basedir, wal_segment_name);
     join_path_components(wal_segment_relpath, PG_XLOG_DIR, wal_segment_name);
 
-    file = pgFileNew(wal_segment_fullpath, wal_segment_relpath, false, 0, FIO_BACKUP_HOST);
-
     /*
      * Check if file is already in the list
      * stop_lsn segment can be added to this list twice, so
-     * try not to add duplicates
+     * try not to add duplicates. Segment is already passed to
+     * the worker and may be compressed by now, so don't touch it.
      */
-
+    file = pgFileInit(wal_segment_relpath);
     existing_file = (pgFile **) parray_bsearch(filelist, file, pgFileCompareRelPathWithExternal);
+    pgFileFree(file);
 
     if (existing_file)
-    {
-        if (do_crc)
-            (*existing_file)->crc = pgFileGetCRC(wal_segment_fullpath, true, false);
-        (*existing_file)->write_size = xlog_seg_size;
-        (*existing_file)->uncompressed_size = xlog_seg_size;
-
         return;
-    }
 
-    if (do_crc)
-        file->crc = pgFileGetCRC(wal_segment_fullpath, true, false);
+    file = pgFileNew(wal_segment_fullpath, wal_segment_relpath, false, 0, FIO_BACKUP_HOST);
+    if (file == NULL)
+        elog(ERROR, "Cannot find streamed WAL segment \"%s\"", wal_segment_fullpath);
 
     /* Should we recheck it using stat? */
     file->write_size = xlog_seg_size;
@@ -735,6 +853,12 @@ add_walsegment_to_filelist(parray *filelist, uint32 timeline, XLogRecPtr xlogpos
 
     /* append file to filelist */
     parray_append(filelist, file);
+
+    /* crc and compression are done by the worker */
+    pthread_lock(&wal_worker_lock);
+    parray_append(wal_worker_queue, file);
+    pthread_cond_signal(&wal_worker_cond);
+    pthread_mutex_unlock(&wal_worker_lock);
 }
 
 /* Append history file to filelist  */
@@ -765,3 +889,175 @@ add_history_file_to_filelist(parray *filelist, uint32 timeline, char *basedir)
     /* append file to filelist */
     parray_append(filelist, file);
 }
+
+/*
+ * Worker thread: take finished segments from the queue one by one,
+ * until streaming is finished and queue is empty.
+ */
+static void *
+process_wal_segments(void *arg)
+{
+	char	   *basedir = (char *) arg;
+	char		prev_fullpath[MAXPGPATH] = "";
+
+	for (;;)
+	{
+		pgFile	   *file = NULL;
+
+		pthread_lock(&wal_worker_lock);
+		while (parray_num(wal_worker_queue) == 0 && !wal_worker_finished)
+			pthread_cond_wait(&wal_worker_cond, &wal_worker_lock);
+
+		if (parray_num(wal_worker_queue) > 0)
+			file = (pgFile *) parray_remove(wal_worker_queue, 0);
+		pthread_mutex_unlock(&wal_worker_lock);
+
+		if (file == NULL)
+			break;
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during WAL streaming");
+
+		process_wal_segment(file, basedir, prev_fullpath);
+	}
+
+	/* streaming is over, nobody will read uncompressed segment anymore */
+	if (prev_fullpath[0] != '\0' && unlink(prev_fullpath) != 0)
+		elog(ERROR, "Cannot remove file \"%s\": %s", prev_fullpath, strerror(errno));
+
+	return NULL;
+}
+
+/*
+ * Calculate CRC of finished segment, compress it if requested.
+ *
+ * Uncompressed copy of the segment is removed only when the next segment
+ * is processed: pg_stop_backup() may still read the latest finished segment
+ * while looking for stop_lsn, so its path is returned in prev_fullpath.
+ */
+static void
+process_wal_segment(pgFile *file, char *basedir, char *prev_fullpath)
+{
+	char		from_fullpath[MAXPGPATH];
+
+	join_path_components(from_fullpath, basedir, file->name);
+
+	if (!compress_stream_wal)
+	{
+		if (do_crc)
+			file->crc = pgFileGetCRC(from_fullpath, true, false);
+		return;
+	}
+
+#ifdef HAVE_LIBZ
+	compress_wal_segment(file, from_fullpath);
+
+	if (prev_fullpath[0] != '\0' && unlink(prev_fullpath) != 0)
+		elog(ERROR, "Cannot remove file \"%s\": %s", prev_fullpath, strerror(errno));
+
+	strncpy(prev_fullpath, from_fullpath, MAXPGPATH);
+#endif
+}
+
+#ifdef HAVE_LIBZ
+/*
+ * Compress WAL segment into "<segment>.gz" file, readable by gzip and by
+ * archive-get. CRC is calculated over compressed data, since that is
+ * what is stored in backup and checked by validate.
+ */
+static void
+compress_wal_segment(pgFile *file, const char *from_fullpath)
+{
+	char		to_fullpath[MAXPGPATH];
+	char		to_fullpath_part[MAXPGPATH];
+	char	   *in_buf = pgut_malloc(STDIO_BUFSIZE);
+	char	   *out_buf = pgut_malloc(STDIO_BUFSIZE);
+	FILE	   *in;
+	FILE	   *out;
+	z_stream	z;
+	int			flush = Z_NO_FLUSH;
+	int			rc;
+	pg_crc32	crc;
+	size_t		read_len = 0;
+	size_t		write_size = 0;
+
+	snprintf(to_fullpath, MAXPGPATH, "%s.gz", from_fullpath);
+	snprintf(to_fullpath_part, MAXPGPATH, "%s.gz.part", from_fullpath);
+
+	in = fopen(from_fullpath, PG_BINARY_R);
+	if (in == NULL)
+		elog(ERROR, "Cannot open WAL segment \"%s\": %s", from_fullpath, strerror(errno));
+
+	out = fopen(to_fullpath_part, PG_BINARY_W);
+	if (out == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s", to_fullpath_part, strerror(errno));
+
+	MemSet(&z, 0, sizeof(z));
+	/* add 16 to window bits to get gzip header and trailer */
+	if (deflateInit2(&z, current.compress_level, Z_DEFLATED, MAX_WBITS + 16,
+					 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		elog(ERROR, "Cannot initialize compression of \"%s\": %s",
+			 from_fullpath, z.msg ? z.msg : "unknown error");
+
+	INIT_FILE_CRC32(true, crc);
+
+	do
+	{
+		if (z.avail_in == 0 && flush != Z_FINISH)
+		{
+			z.avail_in = fread(in_buf, 1, STDIO_BUFSIZE, in);
+			z.next_in = (Bytef *) in_buf;
+			read_len += z.avail_in;
+
+			if (ferror(in))
+				elog(ERROR, "Cannot read WAL segment \"%s\": %s",
+					 from_fullpath, strerror(errno));
+
+			if (feof(in))
+				flush = Z_FINISH;
+		}
+
+		z.next_out = (Bytef *) out_buf;
+		z.avail_out = STDIO_BUFSIZE;
+
+		rc = deflate(&z, flush);
+		if (rc == Z_STREAM_ERROR)
+			elog(ERROR, "Cannot compress WAL segment \"%s\": %s",
+				 from_fullpath, z.msg ? z.msg : "unknown error");
+
+		if (z.avail_out < STDIO_BUFSIZE)
+		{
+			size_t		len = STDIO_BUFSIZE - z.avail_out;
+
+			if (fwrite(out_buf, 1, len, out) != len)
+				elog(ERROR, "Cannot write to file \"%s\": %s",
+					 to_fullpath_part, strerror(errno));
+
+			COMP_FILE_CRC32(true, crc, out_buf, len);
+			write_size += len;
+		}
+	} while (rc != Z_STREAM_END);
+
+	FIN_FILE_CRC32(true, crc);
+	deflateEnd(&z);
+
+	fclose(in);
+	if (fclose(out) != 0)
+		elog(ERROR, "Cannot close file \"%s\": %s", to_fullpath_part, strerror(errno));
+
+	/* file is synced at the end of backup, together with other files */
+	if (rename(to_fullpath_part, to_fullpath) != 0)
+		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+			 to_fullpath_part, to_fullpath, strerror(errno));
+
+	file->crc = crc;
+	file->write_size = write_size;
+	file->uncompressed_size = read_len;
+	file->compress_alg = ZLIB_COMPRESS;
+
+	pg_free(in_buf);
+	pg_free(out_buf);
+
+	elog(VERBOSE, "Compressed WAL segment \"%s\": %lu bytes", from_fullpath, write_size);
+}
+#endif
@@ -0,0 +1,324 @@
+/*-------------------------------------------------------------------------
+ *
+ * throttle.c: I/O rate limits shared by all threads
+ *
+ * Every limit is a token bucket shared by worker threads: bytes read from
+ * PGDATA (--max-read-rate), bytes written to the backup catalog or restored
+ * data directory (--max-write-rate) and data file pages read
+ * (--max-page-rate). A thread takes tokens for the data it has just
+ * processed; if the bucket goes into debt, the thread sleeps until the debt
+ * is paid off, so the total rate of all threads stays within the limit.
+ * Bucket capacity is THROTTLE_BURST_MS worth of tokens, so an idle period
+ * doesn't allow a long burst afterwards.
+ *
+ * Limits may be changed while the command is running by writing them into
+ * the file specified by --throttle-file, in the same format as in the
+ * configuration file:
+ *
+ *   max-read-rate = 50MB
+ *   max-write-rate = '0'
+ *
+ * The file is checked at most once a second. Limits specified in the file
+ * override command line options, removal of a limit from the file or of the
+ * whole file restores the value given on the command line, zero means no
+ * limit.
+ *
+ * With remote backup, pages are read by the agent, which is not throttled
+ * itself but is slowed down by the backpressure of the throttled reader
+ * of its output.
+ *
+ * Copyright (c) 2021, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <sys/stat.h>
+
+#include "utils/thread.h"
+
+/* capacity of buckets */
+#define THROTTLE_BURST_MS		100
+/* how often the throttle file is checked for modification */
+#define THROTTLE_RELOAD_MS		1000
+/* longest sleep between checks for interrupt */
+#define THROTTLE_MAX_SLEEP_MS	100
+
+typedef struct TokenBucket
+{
+	const char *name;
+	uint64		cmd_rate;		/* tokens per second given on command line */
+	uint64		rate;			/* current tokens per second, 0 if unlimited */
+	double		tokens;			/* available tokens, negative is debt */
+	uint64		last_fill;		/* time of last refill, in usec */
+	pthread_mutex_t lock;
+} TokenBucket;
+
+static TokenBucket read_bucket = {"max-read-rate"};
+static TokenBucket write_bucket = {"max-write-rate"};
+static TokenBucket page_bucket = {"max-page-rate"};
+
+/* true if any limit or the throttle file is set */
+static bool throttle_active = false;
+
+static pthread_mutex_t throttle_reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64 throttle_last_check = 0;
+static time_t throttle_file_mtime = 0;
+static off_t throttle_file_size = -1;
+
+static void throttle_bucket_init(TokenBucket *bucket, uint64 rate);
+static void throttle_set_rate(TokenBucket *bucket, uint64 rate);
+static void throttle_consume(TokenBucket *bucket, uint64 amount);
+static void throttle_reload(bool force);
+
+static uint64
+throttle_now(void)
+{
+	return timing_now() / 1000;
+}
+
+/*
+ * Set up buckets according to --max-read-rate, --max-write-rate and
+ * --max-page-rate options, called once before the command starts.
+ */
+void
+throttle_init(void)
+{
+	/* sizes are given in kilobytes */
+	throttle_bucket_init(&read_bucket, max_read_rate * 1024);
+	throttle_bucket_init(&write_bucket, max_write_rate * 1024);
+	throttle_bucket_init(&page_bucket, max_page_rate);
+
+	throttle_active = max_read_rate > 0 || max_write_rate > 0 ||
+					  max_page_rate > 0 || throttle_file != NULL;
+
+	if (throttle_file)
+		throttle_reload(true);
+}
+
+static void
+throttle_bucket_init(TokenBucket *bucket, uint64 rate)
+{
+	pthread_mutex_init(&bucket->lock, NULL);
+	bucket->cmd_rate = rate;
+	bucket->rate = rate;
+	bucket->tokens = 0;
+	bucket->last_fill = throttle_now();
+}
+
+/* Account data read from PGDATA */
+void
+throttle_read(size_t bytes)
+{
+	if (!throttle_active)
+		return;
+
+	throttle_reload(false);
+	throttle_consume(&read_bucket, bytes);
+}
+
+/* Account data file pages read from PGDATA */
+void
+throttle_read_pages(int n_pages)
+{
+	if (!throttle_active)
+		return;
+
+	throttle_reload(false);
+	throttle_consume(&read_bucket, (uint64) n_pages * BLCKSZ);
+	throttle_consume(&page_bucket, n_pages);
+}
+
+/* Account data written to the backup catalog or the data directory */
+void
+throttle_write(size_t bytes)
+{
+	if (!throttle_active)
+		return;
+
+	throttle_reload(false);
+	throttle_consume(&write_bucket, bytes);
+}
+
+/*
+ * Take tokens from the bucket, sleep if it is in debt.
+ */
+static void
+throttle_consume(TokenBucket *bucket, uint64 amount)
+{
+	uint64		now;
+	int64		sleep_usec = 0;
+
+	pthread_lock(&bucket->lock);
+
+	if (bucket->rate == 0)
+	{
+		pthread_mutex_unlock(&bucket->lock);
+		return;
+	}
+
+	now = throttle_now();
+	bucket->tokens += (double) (now - bucket->last_fill) * bucket->rate / 1000000;
+	bucket->tokens = Min(bucket->tokens,
+						 (double) bucket->rate * THROTTLE_BURST_MS / 1000);
+	bucket->last_fill = now;
+
+	bucket->tokens -= amount;
+	if (bucket->tokens < 0)
+		sleep_usec = (int64) (-bucket->tokens * 1000000 / bucket->rate);
+
+	pthread_mutex_unlock(&bucket->lock);
+
+	/* sleep in short steps to respond to interrupt */
+	while (sleep_usec > 0)
+	{
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during throttling");
+
+		pg_usleep(Min(sleep_usec, THROTTLE_MAX_SLEEP_MS * 1000));
+		sleep_usec -= THROTTLE_MAX_SLEEP_MS * 1000;
+	}
+}
+
+static void
+throttle_set_rate(TokenBucket *bucket, uint64 rate)
+{
+	pthread_lock(&bucket->lock);
+
+	if (bucket->rate != rate)
+	{
+		elog(INFO, "Throttling: %s is changed from " UINT64_FORMAT " to " UINT64_FORMAT,
+			 bucket->name, bucket->rate, rate);
+
+		/* forget debt and savings made at the old rate */
+		bucket->rate = rate;
+		bucket->tokens = 0;
+		bucket->last_fill = throttle_now();
+	}
+
+	pthread_mutex_unlock(&bucket->lock);
+}
+
+/*
+ * Reread limits from the throttle file if it is modified. Only one thread
+ * checks the file, others go on at old limits in the meantime.
+ */
+static void
+throttle_reload(bool force)
+{
+	struct stat st;
+	FILE	   *fp;
+	char		buf[1024];
+	uint64		read_rate = read_bucket.cmd_rate;
+	uint64		write_rate = write_bucket.cmd_rate;
+	uint64		page_rate = page_bucket.cmd_rate;
+	bool		is_valid = true;
+
+	if (throttle_file == NULL)
+		return;
+
+	if (!force && throttle_now() - throttle_last_check < THROTTLE_RELOAD_MS * 1000)
+		return;
+
+	if (pthread_mutex_trylock(&throttle_reload_lock) != 0)
+		return;
+
+	throttle_last_check = throttle_now();
+
+	if (stat(throttle_file, &st) != 0)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot stat throttle file \"%s\": %s",
+				 throttle_file, strerror(errno));
+		else
+		{
+			/* file is removed, return to limits of the command line */
+			throttle_set_rate(&read_bucket, read_rate);
+			throttle_set_rate(&write_bucket, write_rate);
+			throttle_set_rate(&page_bucket, page_rate);
+
+			/* reread the file once it is created again */
+			throttle_file_mtime = 0;
+			throttle_file_size = -1;
+		}
+		goto cleanup;
+	}
+
+	if (!force && st.st_mtime == throttle_file_mtime &&
+		st.st_size == throttle_file_size)
+		goto cleanup;
+
+	throttle_file_mtime = st.st_mtime;
+	throttle_file_size = st.st_size;
+
+	fp = fopen(throttle_file, "rt");
+	if (fp == NULL)
+	{
+		elog(WARNING, "Cannot open throttle file \"%s\": %s",
+			 throttle_file, strerror(errno));
+		goto cleanup;
+	}
+
+	while (fgets(buf, lengthof(buf), fp))
+	{
+		char		key[64];
+		char		value[64];
+		uint64		rate;
+		size_t		i;
+		size_t		len;
+
+		for (i = strlen(buf); i > 0 && IsSpace(buf[i - 1]); i--)
+			buf[i - 1] = '\0';
+
+		/* skip empty lines and comments */
+		if (sscanf(buf, " %63[a-z_-] = %63[^ \t#]", key, value) != 2)
+			continue;
+
+		for (i = 0; key[i]; i++)
+			if (key[i] == '_')
+				key[i] = '-';
+
+		/* value may be quoted as in the configuration file */
+		len = strlen(value);
+		if (len >= 2 && value[0] == '\'' && value[len - 1] == '\'')
+		{
+			memmove(value, value + 1, len - 2);
+			value[len - 2] = '\0';
+		}
+
+		if (strcmp(key, "max-page-rate") == 0)
+			is_valid = parse_uint64(value, &page_rate, 0);
+		else if (strcmp(key, "max-read-rate") == 0)
+		{
+			is_valid = parse_uint64(value, &rate, OPTION_UNIT_KB);
+			read_rate = rate * 1024;
+		}
+		else if (strcmp(key, "max-write-rate") == 0)
+		{
+			is_valid = parse_uint64(value, &rate, OPTION_UNIT_KB);
+			write_rate = rate * 1024;
+		}
+		else
+			is_valid = false;
+
+		if (!is_valid)
+		{
+			elog(WARNING, "Invalid line in throttle file \"%s\": %s, limits are not changed",
+				 throttle_file, buf);
+			break;
+		}
+	}
+
+	fclose(fp);
+
+	if (is_valid)
+	{
+		throttle_set_rate(&read_bucket, read_rate);
+		throttle_set_rate(&write_bucket, write_rate);
+		throttle_set_rate(&page_bucket, page_rate);
+	}
+
+cleanup:
+	pthread_mutex_unlock(&throttle_reload_lock);
+}
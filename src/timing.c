@@ -0,0 +1,206 @@
+/*-------------------------------------------------------------------------
+ *
+ * timing.c: optional instrumentation of hot paths
+ *
+ * If --timing is specified, time spent in listing, pagemap extraction, page
+ * reads and validation, compression, writes, header map I/O, fsync and WAL
+ * waiting is measured with a monotonic clock and accumulated in per-thread
+ * slots without any locking. Totals are written into backup.control of the
+ * backup, shown by "show --format=json", and reported at exit.
+ *
+ * When disabled, TIMING_START()/TIMING_STOP() cost a check of a global flag.
+ *
+ * Copyright (c) 2021, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <time.h>
+
+#include "utils/thread.h"
+
+/* Accumulated time of one thread, in nanoseconds */
+typedef struct TimingSlot
+{
+	uint64		time[TIMING_NUM_EVENTS];
+	uint64		count[TIMING_NUM_EVENTS];
+} TimingSlot;
+
+/* Keep in sync with TimingEvent */
+static const char *timing_event_names[TIMING_NUM_EVENTS] = {
+	"list-files",
+	"pagemap",
+	"read-pages",
+	"validate-pages",
+	"compress",
+	"write",
+	"header-map",
+	"fsync",
+	"wait-wal"
+};
+
+static parray *timing_slots = NULL;
+static pthread_mutex_t timing_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TimingSlot *my_timing_slot = NULL;
+
+static void timing_report(bool fatal, void *userdata);
+
+/*
+ * Prepare instrumentation, called once if --timing is specified.
+ */
+void
+timing_init(void)
+{
+	timing_slots = parray_new();
+	pgut_atexit_push(timing_report, NULL);
+}
+
+/*
+ * Current value of the monotonic clock in nanoseconds.
+ */
+uint64
+timing_now(void)
+{
+#ifndef WIN32
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	static double ns_per_tick = 0;
+	LARGE_INTEGER counter;
+
+	if (ns_per_tick == 0)
+	{
+		LARGE_INTEGER frequency;
+
+		QueryPerformanceFrequency(&frequency);
+		ns_per_tick = 1000000000.0 / frequency.QuadPart;
+	}
+
+	QueryPerformanceCounter(&counter);
+	return (uint64) (counter.QuadPart * ns_per_tick);
+#endif
+}
+
+/*
+ * Account time elapsed since "start" to the event in the slot of
+ * the current thread.
+ */
+void
+timing_add(TimingEvent event, uint64 start)
+{
+	uint64		elapsed = timing_now() - start;
+
+	if (my_timing_slot == NULL)
+	{
+		my_timing_slot = pgut_new0(TimingSlot);
+
+		pthread_lock(&timing_lock);
+		parray_append(timing_slots, my_timing_slot);
+		pthread_mutex_unlock(&timing_lock);
+	}
+
+	my_timing_slot->time[event] += elapsed;
+	my_timing_slot->count[event]++;
+}
+
+/*
+ * Sum up time of the event over all threads. Also return the number of
+ * threads which had the event and the biggest time of a single thread,
+ * which shows imbalance between threads.
+ */
+static uint64
+timing_sum(TimingEvent event, uint64 *count, int *n_threads, uint64 *max_time)
+{
+	uint64		total = 0;
+	size_t		i;
+
+	*count = 0;
+	*n_threads = 0;
+	*max_time = 0;
+
+	pthread_lock(&timing_lock);
+	for (i = 0; i < parray_num(timing_slots); i++)
+	{
+		TimingSlot *slot = (TimingSlot *) parray_get(timing_slots, i);
+
+		if (slot->count[event] == 0)
+			continue;
+
+		total += slot->time[event];
+		*count += slot->count[event];
+		(*n_threads)++;
+		*max_time = Max(*max_time, slot->time[event]);
+	}
+	pthread_mutex_unlock(&timing_lock);
+
+	return total;
+}
+
+/*
+ * Return accumulated timings as a single-line JSON object in allocated
+ * buffer, NULL if instrumentation is disabled.
+ */
+char *
+timing_to_json(void)
+{
+	PQExpBufferData buf;
+	bool		first = true;
+	int			event;
+
+	if (!timing)
+		return NULL;
+
+	initPQExpBuffer(&buf);
+	appendPQExpBufferChar(&buf, '{');
+
+	for (event = 0; event < TIMING_NUM_EVENTS; event++)
+	{
+		uint64		count;
+		uint64		max_time;
+		int			n_threads;
+		uint64		total = timing_sum(event, &count, &n_threads, &max_time);
+
+		if (count == 0)
+			continue;
+
+		appendPQExpBuffer(&buf, "%s\"%s\": {\"seconds\": %.3f, \"calls\": " UINT64_FORMAT
+						  ", \"threads\": %d, \"max-thread-seconds\": %.3f}",
+						  first ? "" : ", ", timing_event_names[event],
+						  total / 1000000000.0, count, n_threads,
+						  max_time / 1000000000.0);
+		first = false;
+	}
+
+	appendPQExpBufferChar(&buf, '}');
+
+	return buf.data;
+}
+
+/*
+ * Report accumulated timings at exit.
+ */
+static void
+timing_report(bool fatal, void *userdata)
+{
+	int			event;
+
+	for (event = 0; event < TIMING_NUM_EVENTS; event++)
+	{
+		uint64		count;
+		uint64		max_time;
+		int			n_threads;
+		uint64		total = timing_sum(event, &count, &n_threads, &max_time);
+
+		if (count == 0)
+			continue;
+
+		elog(INFO, "Timing of %s: %.3f sec, calls: " UINT64_FORMAT
+			 ", threads: %d, max per thread: %.3f sec",
+			 timing_event_names[event], total / 1000000000.0, count,
+			 n_threads, max_time / 1000000000.0);
+	}
+}
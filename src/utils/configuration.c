@@ -111,6 +111,8 @@ static char const * const subcmd_names[] =
 	"help",
 	"version",
 	"catchup",
+	"export",
+	"index-wal",
 };
 
 ProbackupSubcmd
@@ -40,6 +40,8 @@ typedef enum ProbackupSubcmd
 	HELP_CMD,
 	VERSION_CMD,
 	CATCHUP_CMD,
+	EXPORT_CMD,
+	INDEX_WAL_CMD,
 } ProbackupSubcmd;
 
 typedef enum OptionSource
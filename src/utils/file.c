@@ -7,6 +7,7 @@
 
 #include "file.h"
 #include "storage/checksum.h"
+#include "instr_time.h"
 
 #define PRINTF_BUF_SIZE  1024
 #define FILE_PERMISSIONS 0600
@@ -42,6 +43,7 @@ typedef struct
 	bool exclusive_backup;
 	bool skip_hidden;
 	int  external_dir_num;
+	int  n_threads;
 } fio_list_dir_request;
 
 typedef struct
@@ -56,6 +58,7 @@ typedef struct
 	ForkName   forkName;
 	int     segno;
 	int     external_dir_num;
+	int     path_len;
 	int     linked_len;
 } fio_pgFile;
 
@@ -437,6 +440,8 @@ fio_open(char const* path, int mode, fio_location location)
 		int i;
 		fio_header hdr;
 		unsigned long mask;
+		instr_time	start_time,
+					rtt;
 
 		mask = fio_fdset;
 		for (i = 0; (mask & 1) != 0; i++, mask >>= 1);
@@ -453,12 +458,18 @@ fio_open(char const* path, int mode, fio_location location)
 //		elog(INFO, "MODE: %i", hdr.arg);
 		fio_fdset |= 1 << i;
 
+		INSTR_TIME_SET_CURRENT(start_time);
+
 		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
 		IO_CHECK(fio_write_all(fio_stdout, path, hdr.size), hdr.size);
 
 		/* check results */
 		IO_CHECK(fio_read_all(fio_stdin, &hdr, sizeof(hdr)), sizeof(hdr));
 
+		INSTR_TIME_SET_CURRENT(rtt);
+		INSTR_TIME_SUBTRACT(rtt, start_time);
+		progress_report_rtt(INSTR_TIME_GET_MICROSEC(rtt));
+
 		if (hdr.arg != 0)
 		{
 			errno = hdr.arg;
@@ -1117,12 +1128,16 @@ fio_stat(char const* path, struct stat* st, bool follow_symlink, fio_location lo
 	{
 		fio_header hdr;
 		size_t path_len = strlen(path) + 1;
+		instr_time	start_time,
+					rtt;
 
 		hdr.cop = FIO_STAT;
 		hdr.handle = -1;
 		hdr.arg = follow_symlink;
 		hdr.size = path_len;
 
+		INSTR_TIME_SET_CURRENT(start_time);
+
 		IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
 		IO_CHECK(fio_write_all(fio_stdout, path, path_len), path_len);
 
@@ -1130,6 +1145,11 @@ fio_stat(char const* path, struct stat* st, bool follow_symlink, fio_location lo
 		Assert(hdr.cop == FIO_STAT);
 		IO_CHECK(fio_read_all(fio_stdin, st, sizeof(*st)), sizeof(*st));
 
+		/* round-trip time to the agent, for the status file */
+		INSTR_TIME_SET_CURRENT(rtt);
+		INSTR_TIME_SUBTRACT(rtt, start_time);
+		progress_report_rtt(INSTR_TIME_GET_MICROSEC(rtt));
+
 		if (hdr.arg != 0)
 		{
 			errno = hdr.arg;
@@ -1312,9 +1332,8 @@ fio_rename(char const* old_path, char const* new_path, fio_location location)
 	}
 }
 
-/* Sync file to disk */
-int
-fio_sync(char const* path, fio_location location)
+static int
+fio_sync_internal(char const* path, fio_location location)
 {
 	if (fio_is_remote(location))
 	{
@@ -1355,6 +1374,20 @@ fio_sync(char const* path, fio_location location)
 	}
 }
 
+/* Sync file to disk */
+int
+fio_sync(char const* path, fio_location location)
+{
+	uint64		start;
+	int			rc;
+
+	TIMING_START(start);
+	rc = fio_sync_internal(path, location);
+	TIMING_STOP(TIMING_FSYNC, start);
+
+	return rc;
+}
+
 /* Get crc32 of file */
 pg_crc32
 fio_get_crc32(const char *file_path, fio_location location, bool decompress)
@@ -1850,8 +1883,9 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 
 	if (use_pagemap)
 	{
-		req.hdr.size = sizeof(fio_send_request) + (*file).pagemap.bitmapsize + strlen(from_fullpath) + 1;
-		req.arg.bitmapsize = (*file).pagemap.bitmapsize;
+		/* trailing zeroes of pagemap are not sent */
+		req.arg.bitmapsize = datapagemap_used_size(&file->pagemap);
+		req.hdr.size = sizeof(fio_send_request) + req.arg.bitmapsize + strlen(from_fullpath) + 1;
 
 		/* TODO: add optimization for the case of pagemap
 		 * containing small number of blocks with big serial numbers:
@@ -1891,7 +1925,7 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 
 	/* send pagemap if any */
 	if (use_pagemap)
-		IO_CHECK(fio_write_all(fio_stdout, (*file).pagemap.bitmap, (*file).pagemap.bitmapsize), (*file).pagemap.bitmapsize);
+		IO_CHECK(fio_write_all(fio_stdout, (*file).pagemap.bitmap, req.arg.bitmapsize), req.arg.bitmapsize);
 
 	while (true)
 	{
@@ -1962,6 +1996,10 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			}
 			file->write_size += hdr.size;
 			file->uncompressed_size += BLCKSZ;
+
+			/* agent is throttled by backpressure */
+			throttle_read_pages(1);
+			throttle_write(hdr.size);
 		}
 		else
 			elog(ERROR, "Remote agent returned message of unexpected type: %i", hdr.cop);
@@ -2017,8 +2055,9 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 
 	if (use_pagemap)
 	{
-		req.hdr.size = sizeof(fio_send_request) + (*file).pagemap.bitmapsize + strlen(from_fullpath) + 1;
-		req.arg.bitmapsize = (*file).pagemap.bitmapsize;
+		/* trailing zeroes of pagemap are not sent */
+		req.arg.bitmapsize = datapagemap_used_size(&file->pagemap);
+		req.hdr.size = sizeof(fio_send_request) + req.arg.bitmapsize + strlen(from_fullpath) + 1;
 
 		/* TODO: add optimization for the case of pagemap
 		 * containing small number of blocks with big serial numbers:
@@ -2058,7 +2097,7 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 
 	/* send pagemap if any */
 	if (use_pagemap)
-		IO_CHECK(fio_write_all(fio_stdout, (*file).pagemap.bitmap, (*file).pagemap.bitmapsize), (*file).pagemap.bitmapsize);
+		IO_CHECK(fio_write_all(fio_stdout, (*file).pagemap.bitmap, req.arg.bitmapsize), req.arg.bitmapsize);
 
 	out = fio_fopen(to_fullpath, PG_BINARY_R "+", FIO_BACKUP_HOST);
 	if (out == NULL)
@@ -2153,6 +2192,10 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			}
 			file->write_size += BLCKSZ;
 			file->uncompressed_size += BLCKSZ;
+
+			/* agent is throttled by backpressure */
+			throttle_read_pages(1);
+			throttle_write(BLCKSZ);
 		}
 		else
 			elog(ERROR, "Remote agent returned message of unexpected type: %i", hdr.cop);
@@ -2658,6 +2701,9 @@ fio_send_file(const char *from_fullpath, const char *to_fullpath, FILE* out,
 				break;
 			}
 
+			throttle_read(hdr.size);
+			throttle_write(hdr.size);
+
 			if (file)
 			{
 				file->read_size += hdr.size;
@@ -2799,6 +2845,7 @@ fio_list_dir_internal(parray *files, const char *root, bool exclude,
 	req.exclusive_backup = exclusive_backup;
 	req.skip_hidden = skip_hidden;
 	req.external_dir_num = external_dir_num;
+	req.n_threads = num_threads;
 
 	hdr.cop = FIO_LIST_DIR;
 	hdr.size = sizeof(req);
@@ -2818,39 +2865,49 @@ fio_list_dir_internal(parray *files, const char *root, bool exclude,
 		}
 		else if (hdr.cop == FIO_SEND_FILE)
 		{
-			pgFile *file = NULL;
-			fio_pgFile  fio_file;
+			char   *ptr = buf;
+			int		i;
 
-			/* receive rel_path */
+			if (hdr.size > CHUNK_SIZE)
+				elog(ERROR, "Remote agent sent too large batch of files: %u", hdr.size);
+
+			/* receive the batch of "hdr.arg" files */
 			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
-			file = pgFileInit(buf);
-
-			/* receive metainformation */
-			IO_CHECK(fio_read_all(fio_stdin, &fio_file, sizeof(fio_file)), sizeof(fio_file));
-
-			file->mode = fio_file.mode;
-			file->size = fio_file.size;
-			file->mtime = fio_file.mtime;
-			file->is_datafile = fio_file.is_datafile;
-			file->tblspcOid = fio_file.tblspcOid;
-			file->dbOid = fio_file.dbOid;
-			file->relOid = fio_file.relOid;
-			file->forkName = fio_file.forkName;
-			file->segno = fio_file.segno;
-			file->external_dir_num = fio_file.external_dir_num;
-
-			if (fio_file.linked_len > 0)
+
+			for (i = 0; i < hdr.arg; i++)
 			{
-				IO_CHECK(fio_read_all(fio_stdin, buf, fio_file.linked_len), fio_file.linked_len);
+				pgFile *file = NULL;
+				fio_pgFile  fio_file;
+
+				/* metainformation goes first */
+				memcpy(&fio_file, ptr, sizeof(fio_file));
+				ptr += sizeof(fio_file);
+
+				/* then rel_path */
+				file = pgFileInit(ptr);
+				ptr += fio_file.path_len;
+
+				file->mode = fio_file.mode;
+				file->size = fio_file.size;
+				file->mtime = fio_file.mtime;
+				file->is_datafile = fio_file.is_datafile;
+				file->tblspcOid = fio_file.tblspcOid;
+				file->dbOid = fio_file.dbOid;
+				file->relOid = fio_file.relOid;
+				file->forkName = fio_file.forkName;
+				file->segno = fio_file.segno;
+				file->external_dir_num = fio_file.external_dir_num;
+
+				/* and link path, if any */
+				if (fio_file.linked_len > 0)
+				{
+					file->linked = pgut_malloc(fio_file.linked_len);
+					snprintf(file->linked, fio_file.linked_len, "%s", ptr);
+					ptr += fio_file.linked_len;
+				}
 
-				file->linked = pgut_malloc(fio_file.linked_len);
-				snprintf(file->linked, fio_file.linked_len, "%s", buf);
+				parray_append(files, file);
 			}
-
-//			elog(INFO, "Received file: %s, mode: %u, size: %lu, mtime: %lu",
-//				file->rel_path, file->mode, file->size, file->mtime);
-
-			parray_append(files, file);
 		}
 		else
 		{
@@ -2862,14 +2919,27 @@ fio_list_dir_internal(parray *files, const char *root, bool exclude,
 	pg_free(buf);
 }
 
+/* Send accumulated batch of files to the main process */
+static void
+fio_list_dir_send_batch(int out, char *batch, size_t batch_len, int n_files)
+{
+	fio_header hdr;
+
+	hdr.cop = FIO_SEND_FILE;
+	hdr.size = batch_len;
+	hdr.arg = n_files;
+
+	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(out, batch, batch_len), batch_len);
+}
 
 /*
  * To get the arrays of files we use the same function dir_list_file(),
  * that is used for local backup.
- * After that we iterate over arrays and for every file send at least
- * two messages to main process:
- * 1. rel_path
- * 2. metainformation (size, mtime, etc)
+ * After that we iterate over arrays and send files to main process
+ * in batches of up to CHUNK_SIZE bytes, every file in the batch is:
+ * 1. metainformation (size, mtime, etc)
+ * 2. rel_path
  * 3. link path (optional)
  *
  * TODO: replace FIO_SEND_FILE and FIO_SEND_FILE_EOF with dedicated messages
@@ -2881,6 +2951,9 @@ fio_list_dir_impl(int out, char* buf)
 	fio_header hdr;
 	fio_list_dir_request *req = (fio_list_dir_request*) buf;
 	parray *file_files = parray_new();
+	char   *batch = pgut_malloc(CHUNK_SIZE);
+	size_t	batch_len = 0;
+	int		batch_files = 0;
 
 	/*
 	 * Disable logging into console any messages with exception of ERROR messages,
@@ -2891,15 +2964,16 @@ fio_list_dir_impl(int out, char* buf)
 	instance_config.logger.log_level_console = ERROR;
 	exclusive_backup = req->exclusive_backup;
 
-	dir_list_file(file_files, req->path, req->exclude, req->follow_symlink,
-				  req->add_root, req->backup_logs, req->skip_hidden,
-				  req->external_dir_num, FIO_LOCAL_HOST);
+	dir_list_file_parallel(file_files, req->path, req->exclude, req->follow_symlink,
+						   req->add_root, req->backup_logs, req->skip_hidden,
+						   req->external_dir_num, req->n_threads, NULL, NULL);
 
 	/* send information about files to the main process */
 	for (i = 0; i < parray_num(file_files); i++)
 	{
 		fio_pgFile  fio_file;
 		pgFile	   *file = (pgFile *) parray_get(file_files, i);
+		size_t		file_len;
 
 		fio_file.mode = file->mode;
 		fio_file.size = file->size;
@@ -2911,29 +2985,43 @@ fio_list_dir_impl(int out, char* buf)
 		fio_file.forkName = file->forkName;
 		fio_file.segno = file->segno;
 		fio_file.external_dir_num = file->external_dir_num;
+		fio_file.path_len = strlen(file->rel_path) + 1;
 
 		if (file->linked)
 			fio_file.linked_len = strlen(file->linked) + 1;
 		else
 			fio_file.linked_len = 0;
 
-		hdr.cop = FIO_SEND_FILE;
-		hdr.size = strlen(file->rel_path) + 1;
+		file_len = sizeof(fio_file) + fio_file.path_len + fio_file.linked_len;
 
-		/* send rel_path first */
-		IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
-		IO_CHECK(fio_write_all(out, file->rel_path, hdr.size), hdr.size);
+		/* no room for this file, send what we have */
+		if (batch_len + file_len > CHUNK_SIZE)
+		{
+			fio_list_dir_send_batch(out, batch, batch_len, batch_files);
+			batch_len = 0;
+			batch_files = 0;
+		}
 
-		/* now send file metainformation */
-		IO_CHECK(fio_write_all(out, &fio_file, sizeof(fio_file)), sizeof(fio_file));
+		memcpy(batch + batch_len, &fio_file, sizeof(fio_file));
+		batch_len += sizeof(fio_file);
+		memcpy(batch + batch_len, file->rel_path, fio_file.path_len);
+		batch_len += fio_file.path_len;
 
-		/* If file is a symlink, then send link path */
+		/* If file is a symlink, then add link path */
 		if (file->linked)
-			IO_CHECK(fio_write_all(out, file->linked, fio_file.linked_len), fio_file.linked_len);
+		{
+			memcpy(batch + batch_len, file->linked, fio_file.linked_len);
+			batch_len += fio_file.linked_len;
+		}
 
+		batch_files++;
 		pgFileFree(file);
 	}
 
+	if (batch_files > 0)
+		fio_list_dir_send_batch(out, batch, batch_len, batch_files);
+
+	pg_free(batch);
 	parray_free(file_files);
 	hdr.cop = FIO_SEND_FILE_EOF;
 	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
@@ -2946,11 +3034,18 @@ fio_list_dir(parray *files, const char *root, bool exclude,
 				  bool skip_hidden, int external_dir_num)
 {
 	if (fio_is_remote(FIO_DB_HOST))
+	{
+		uint64		start;
+
+		TIMING_START(start);
 		fio_list_dir_internal(files, root, exclude, follow_symlink, add_root,
 							  backup_logs, skip_hidden, external_dir_num);
+		TIMING_STOP(TIMING_LIST_FILES, start);
+	}
 	else
-		dir_list_file(files, root, exclude, follow_symlink, add_root,
-					  backup_logs, skip_hidden, external_dir_num, FIO_LOCAL_HOST);
+		dir_list_file_parallel(files, root, exclude, follow_symlink, add_root,
+							   backup_logs, skip_hidden, external_dir_num, num_threads,
+							   NULL, NULL);
 }
 
 PageState *
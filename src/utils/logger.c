@@ -16,6 +16,9 @@
 #include "pgut.h"
 #include "thread.h"
 #include <time.h>
+#ifndef WIN32
+#include <sys/time.h>
+#endif
 
 #include "utils/configuration.h"
 
@@ -67,6 +70,79 @@ static bool loggin_in_progress = false;
 
 static pthread_mutex_t log_file_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Asynchronous writing to the log file.
+ *
+ * Messages below ERROR that go to the log file are not written by the calling
+ * thread. It puts them into one of the log rings without taking any lock and
+ * the log writer thread takes them out, timestamps and writes them in batches
+ * with a single flush. Every thread always uses the same ring, so its messages
+ * keep their order, and messages of different threads are ordered by the time
+ * they were logged. ERROR messages are written synchronously, after everything
+ * queued before them.
+ *
+ * A ring is a bounded queue: a producer reserves a slot by advancing "head"
+ * and publishes it by setting its "seq" to position + 1; the writer releases
+ * the slot by setting "seq" to position + LOG_RING_SIZE.
+ */
+#define LOG_RING_COUNT		32
+#define LOG_RING_SIZE		512
+/* How often the log writer flushes the rings, in milliseconds */
+#define LOG_WRITER_DELAY	100
+
+typedef struct LogRecord
+{
+	pg_atomic_uint32 seq;
+	int			elevel;
+	struct timeval time;
+	char	   *message;
+} LogRecord;
+
+typedef struct LogRing
+{
+	pg_atomic_uint32 head;		/* next position to be reserved */
+	uint32		tail;			/* next position to be taken by the writer */
+	LogRecord	records[LOG_RING_SIZE];
+} LogRing;
+
+/* Record taken out of a ring by log_flush_rings() */
+typedef struct LogBatchItem
+{
+	int			elevel;
+	struct timeval time;
+	char	   *message;
+	uint32		order;
+} LogBatchItem;
+
+typedef enum LogWriterState
+{
+	LOG_WRITER_NONE,
+	LOG_WRITER_RUNNING,
+	LOG_WRITER_STOPPED
+} LogWriterState;
+
+static LogRing *log_rings = NULL;
+static pg_atomic_uint32 log_rings_used;
+static LogBatchItem *log_batch = NULL;
+
+static volatile LogWriterState log_writer_state = LOG_WRITER_NONE;
+static pthread_t log_writer_thread;
+static pthread_mutex_t log_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_writer_cond;
+static bool log_writer_wakeup = false;
+
+/* Ring of the current thread, -1 if it didn't log to the ring yet */
+static __thread int my_log_ring = -1;
+
+static void log_writer_start(void);
+static void log_writer_stop(void);
+static void *log_writer_main(void *arg);
+static bool log_ring_put(int elevel, const char *message);
+static void log_flush_rings(void);
+static int	log_batch_compare(const void *a, const void *b);
+static void write_log_record(FILE *stream, const char *strfbuf, int elevel,
+							 const char *message);
+
 /*
  * Initialize logger.
  *
@@ -289,9 +365,24 @@ elog_internal(int elevel, bool file_only, const char *message)
 		write_to_stderr |= write_to_error_log | write_to_file;
 		write_to_error_log = write_to_file = false;
 	}
+
+	/* Pass the message to the log writer if it is running */
+	if (write_to_file && elevel < ERROR &&
+		log_writer_state == LOG_WRITER_RUNNING &&
+		log_ring_put(elevel, message))
+	{
+		write_to_file = false;
+		if (!write_to_stderr)
+			return;
+	}
+
 	pthread_lock(&log_file_mutex);
 	loggin_in_progress = true;
 
+	/* Messages queued before this one must be written first */
+	if (write_to_file || write_to_error_log)
+		log_flush_rings();
+
 	if (write_to_file || write_to_error_log || is_archive_cmd)
 		strftime(strfbuf, sizeof(strfbuf), "%Y-%m-%d %H:%M:%S %Z",
 				 localtime(&log_time));
@@ -308,12 +399,12 @@ elog_internal(int elevel, bool file_only, const char *message)
 		if (log_file == NULL)
 			open_logfile(&log_file, logger_config.log_filename ? logger_config.log_filename : LOG_FILENAME_DEFAULT);
 
-		fprintf(log_file, "%s ", strfbuf);
-		fprintf(log_file, "%s ", str_pid);
-		write_elevel(log_file, elevel);
-
-		fprintf(log_file, "%s\n", message);
+		write_log_record(log_file, strfbuf, elevel, message);
 		fflush(log_file);
+
+		/* Following messages will be written by the log writer */
+		if (log_writer_state == LOG_WRITER_NONE && !in_cleanup)
+			log_writer_start();
 	}
 
 	/*
@@ -326,11 +417,7 @@ elog_internal(int elevel, bool file_only, const char *message)
 		if (error_log_file == NULL)
 			open_logfile(&error_log_file, logger_config.error_log_filename);
 
-		fprintf(error_log_file, "%s ", strfbuf);
-		fprintf(error_log_file, "%s ", str_pid);
-		write_elevel(error_log_file, elevel);
-
-		fprintf(error_log_file, "%s\n", message);
+		write_log_record(error_log_file, strfbuf, elevel, message);
 		fflush(error_log_file);
 	}
 
@@ -379,6 +466,307 @@ elog_internal(int elevel, bool file_only, const char *message)
 	pthread_mutex_unlock(&log_file_mutex);
 }
 
+/*
+ * Write a single log line: timestamp, pid, level and the message.
+ */
+static void
+write_log_record(FILE *stream, const char *strfbuf, int elevel,
+				 const char *message)
+{
+	fprintf(stream, "%s [%d]: ", strfbuf, my_pid);
+	write_elevel(stream, elevel);
+	fprintf(stream, "%s\n", message);
+}
+
+/*
+ * Start the log writer thread. Called with log_file_mutex held, after the
+ * log file was opened. If the thread cannot be started, messages are written
+ * synchronously as before.
+ */
+static void
+log_writer_start(void)
+{
+	int			i,
+				j;
+
+	log_writer_state = LOG_WRITER_STOPPED;
+
+	log_rings = malloc(sizeof(LogRing) * LOG_RING_COUNT);
+	log_batch = malloc(sizeof(LogBatchItem) * LOG_RING_COUNT * LOG_RING_SIZE);
+	if (log_rings == NULL || log_batch == NULL)
+	{
+		free(log_rings);
+		free(log_batch);
+		log_rings = NULL;
+		log_batch = NULL;
+		return;
+	}
+
+	for (i = 0; i < LOG_RING_COUNT; i++)
+	{
+		pg_atomic_init_u32(&log_rings[i].head, 0);
+		log_rings[i].tail = 0;
+		for (j = 0; j < LOG_RING_SIZE; j++)
+			pg_atomic_init_u32(&log_rings[i].records[j].seq, j);
+	}
+	pg_atomic_init_u32(&log_rings_used, 0);
+	pthread_cond_init(&log_writer_cond, NULL);
+
+	log_writer_state = LOG_WRITER_RUNNING;
+	if (pthread_create(&log_writer_thread, NULL, log_writer_main, NULL) != 0)
+		log_writer_state = LOG_WRITER_STOPPED;
+}
+
+/*
+ * Stop the log writer thread and write out everything it has not written.
+ * Producers, which publish a record after that, see that the writer is
+ * stopped and flush the rings themselves, see log_ring_put().
+ */
+static void
+log_writer_stop(void)
+{
+	if (log_writer_state != LOG_WRITER_RUNNING)
+		return;
+
+	pthread_lock(&log_writer_lock);
+	log_writer_state = LOG_WRITER_STOPPED;
+	pthread_cond_signal(&log_writer_cond);
+	pthread_mutex_unlock(&log_writer_lock);
+
+	pthread_join(log_writer_thread, NULL);
+
+	pthread_lock(&log_file_mutex);
+	log_flush_rings();
+	pthread_mutex_unlock(&log_file_mutex);
+}
+
+/*
+ * Log writer thread: flush the rings every LOG_WRITER_DELAY milliseconds or
+ * when a ring is getting full.
+ */
+static void *
+log_writer_main(void *arg)
+{
+	bool		stop = false;
+
+	while (!stop)
+	{
+		pthread_lock(&log_writer_lock);
+		if (!log_writer_wakeup && log_writer_state == LOG_WRITER_RUNNING)
+		{
+			struct timespec timeout;
+
+			clock_gettime(CLOCK_REALTIME, &timeout);
+			timeout.tv_nsec += LOG_WRITER_DELAY * 1000000L;
+			if (timeout.tv_nsec >= 1000000000L)
+			{
+				timeout.tv_sec++;
+				timeout.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&log_writer_cond, &log_writer_lock, &timeout);
+		}
+		log_writer_wakeup = false;
+		stop = log_writer_state != LOG_WRITER_RUNNING;
+		pthread_mutex_unlock(&log_writer_lock);
+
+		pthread_lock(&log_file_mutex);
+		log_flush_rings();
+		pthread_mutex_unlock(&log_file_mutex);
+	}
+
+	return NULL;
+}
+
+/*
+ * Put the message into the ring of the current thread.
+ * Returns false if the message must be written synchronously.
+ */
+static bool
+log_ring_put(int elevel, const char *message)
+{
+	LogRing    *ring;
+	LogRecord  *rec;
+	char	   *copy;
+	uint32		pos;
+
+	if (my_log_ring < 0)
+		my_log_ring = pg_atomic_fetch_add_u32(&log_rings_used, 1) % LOG_RING_COUNT;
+	ring = &log_rings[my_log_ring];
+
+	copy = strdup(message);
+	if (copy == NULL)
+		return false;
+
+	pos = pg_atomic_read_u32(&ring->head);
+	for (;;)
+	{
+		int32		diff;
+
+		if (log_writer_state != LOG_WRITER_RUNNING)
+		{
+			free(copy);
+			return false;
+		}
+
+		rec = &ring->records[pos % LOG_RING_SIZE];
+		diff = (int32) (pg_atomic_read_u32(&rec->seq) - pos);
+
+		if (diff == 0)
+		{
+			/* Slot is free, reserve it. On failure pos is reread */
+			if (pg_atomic_compare_exchange_u32(&ring->head, &pos, pos + 1))
+				break;
+		}
+		else if (diff < 0)
+		{
+			/* Ring is full and the writer lags behind, help it */
+			pthread_lock(&log_file_mutex);
+			log_flush_rings();
+			pthread_mutex_unlock(&log_file_mutex);
+			pos = pg_atomic_read_u32(&ring->head);
+		}
+		else
+			/* Slot was reserved by another thread */
+			pos = pg_atomic_read_u32(&ring->head);
+	}
+
+	rec->elevel = elevel;
+	gettimeofday(&rec->time, NULL);
+	rec->message = copy;
+
+	/* Publish the record */
+	pg_write_barrier();
+	pg_atomic_write_u32(&rec->seq, pos + 1);
+
+	/*
+	 * The writer may have been stopped after the check above, and its final
+	 * flush may have missed the record. Write it out synchronously then.
+	 */
+	pg_memory_barrier();
+	if (log_writer_state != LOG_WRITER_RUNNING)
+	{
+		pthread_lock(&log_file_mutex);
+		log_flush_rings();
+		pthread_mutex_unlock(&log_file_mutex);
+		return true;
+	}
+
+	/* Wake up the writer when the ring is half full */
+	if ((pos + 1) % (LOG_RING_SIZE / 2) == 0)
+	{
+		pthread_lock(&log_writer_lock);
+		log_writer_wakeup = true;
+		pthread_cond_signal(&log_writer_cond);
+		pthread_mutex_unlock(&log_writer_lock);
+	}
+
+	return true;
+}
+
+/*
+ * Take all published records out of the rings and write them to the log file
+ * ordered by time. Must be called with log_file_mutex held.
+ */
+static void
+log_flush_rings(void)
+{
+	uint32		n = 0;
+	uint32		i;
+	int			r;
+	time_t		last_sec = (time_t) -1;
+	char		strfbuf[128];
+
+	if (log_rings == NULL)
+		return;
+
+	for (r = 0; r < LOG_RING_COUNT; r++)
+	{
+		LogRing    *ring = &log_rings[r];
+
+		for (;;)
+		{
+			LogRecord  *rec = &ring->records[ring->tail % LOG_RING_SIZE];
+
+			if (pg_atomic_read_u32(&rec->seq) != ring->tail + 1)
+				break;
+			pg_read_barrier();
+
+			log_batch[n].elevel = rec->elevel;
+			log_batch[n].time = rec->time;
+			log_batch[n].message = rec->message;
+			log_batch[n].order = n;
+			n++;
+
+			/* Release the slot */
+			pg_memory_barrier();
+			pg_atomic_write_u32(&rec->seq, ring->tail + LOG_RING_SIZE);
+			ring->tail++;
+		}
+	}
+
+	if (n == 0)
+		return;
+
+	qsort(log_batch, n, sizeof(LogBatchItem), log_batch_compare);
+
+	/*
+	 * Don't open the log file here: open_logfile() may raise an ERROR, which
+	 * would exit the thread with log_file_mutex held. The writer is started
+	 * after the file is opened and the file is closed after the writer is
+	 * stopped, so only a record published during exit may find it closed.
+	 * Don't lose it, write it to stderr.
+	 */
+	if (log_file == NULL)
+	{
+		for (i = 0; i < n; i++)
+		{
+			write_elevel(stderr, log_batch[i].elevel);
+			fprintf(stderr, "%s\n", log_batch[i].message);
+			free(log_batch[i].message);
+		}
+		fflush(stderr);
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		time_t		sec = (time_t) log_batch[i].time.tv_sec;
+
+		/* Timestamp has a precision of one second, format it once per second */
+		if (sec != last_sec)
+		{
+			strftime(strfbuf, sizeof(strfbuf), "%Y-%m-%d %H:%M:%S %Z",
+					 localtime(&sec));
+			last_sec = sec;
+		}
+
+		write_log_record(log_file, strfbuf, log_batch[i].elevel,
+						 log_batch[i].message);
+		free(log_batch[i].message);
+	}
+
+	fflush(log_file);
+}
+
+/*
+ * Compare log batch items by time, keeping the order of a ring for records
+ * with the same time.
+ */
+static int
+log_batch_compare(const void *a, const void *b)
+{
+	const LogBatchItem *item1 = (const LogBatchItem *) a;
+	const LogBatchItem *item2 = (const LogBatchItem *) b;
+
+	if (item1->time.tv_sec != item2->time.tv_sec)
+		return item1->time.tv_sec < item2->time.tv_sec ? -1 : 1;
+	if (item1->time.tv_usec != item2->time.tv_usec)
+		return item1->time.tv_usec < item2->time.tv_usec ? -1 : 1;
+	if (item1->order != item2->order)
+		return item1->order < item2->order ? -1 : 1;
+	return 0;
+}
+
 /*
  * Log only to stderr. It is called only within elog_internal() when another
  * logging already was started.
@@ -803,6 +1191,8 @@ logfile_open:
 static void
 release_logfile(bool fatal, void *userdata)
 {
+	log_writer_stop();
+
 	if (log_file)
 	{
 		fclose(log_file);
@@ -12,11 +12,16 @@
 
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
 
 #include "utils/thread.h"
 
 static void *pgBackupValidateFiles(void *arg);
 static void do_validate_instance(InstanceState *instanceState);
+static FILE *validate_journal_open(pgBackup *backup, parray *files);
+static void validate_journal_remove(pgBackup *backup);
+static pg_crc32 validate_file_crc(FILE *in, const char *path, bool use_crc32c,
+								  char *buf);
 
 static bool corrupted_backup_found = false;
 static bool skipped_due_to_lock = false;
@@ -33,6 +38,9 @@ typedef struct
 	parray		*dbOid_exclude_list;
 	const char	*external_prefix;
 	HeaderMap   *hdr_map;
+	/* validated files are recorded here, see validate_journal_open() */
+	FILE		*journal;
+	pthread_mutex_t *journal_lock;
 
 	/*
 	 * Return value from the thread.
@@ -56,6 +64,8 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	pthread_t  *threads;
 	validate_files_arg *threads_args;
 	int			i;
+	FILE	   *journal;
+	pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
 //	parray		*dbOid_exclude_list = NULL;
 
 	/* Check backup program version */
@@ -138,6 +148,11 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 		palloc(sizeof(validate_files_arg) * num_threads);
 
 	/* Validate files */
+	progress_begin_files("validate files", files);
+
+	/* The journal is kept only by the validate command */
+	journal = is_validate_cmd ? validate_journal_open(backup, files) : NULL;
+
 	thread_interrupted = false;
 	for (i = 0; i < num_threads; i++)
 	{
@@ -152,6 +167,8 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 		arg->backup_version = parse_program_version(backup->program_version);
 		arg->external_prefix = external_prefix;
 		arg->hdr_map = &(backup->hdr_map);
+		arg->journal = journal;
+		arg->journal_lock = &journal_lock;
 //		arg->dbOid_exclude_list = dbOid_exclude_list;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
@@ -173,6 +190,15 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	if (!validation_isok)
 		elog(ERROR, "Data files validation failed");
 
+	/* validation is complete, nothing to resume */
+	if (journal)
+	{
+		if (fclose(journal) != 0)
+			elog(ERROR, "Cannot close validate journal of backup %s: %s",
+				 base36enc(backup->start_time), strerror(errno));
+		validate_journal_remove(backup);
+	}
+
 	pfree(threads);
 	pfree(threads_args);
 
@@ -228,12 +254,15 @@ pgBackupValidateFiles(void *arg)
 	validate_files_arg *arguments = (validate_files_arg *)arg;
 	int			num_files = parray_num(arguments->files);
 	pg_crc32	crc;
+	char	   *buf = pgut_malloc(LARGE_CHUNK_SIZE);
 
 	for (i = 0; i < num_files; i++)
 	{
 		struct stat st;
 		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
 		char        file_fullpath[MAXPGPATH];
+		FILE	   *in;
+		bool		file_valid = true;
 
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during validate");
@@ -278,12 +307,18 @@ pgBackupValidateFiles(void *arg)
 				break;
 			}
 			else
+			{
+				progress_add_file(0, 0);
 				continue;
+			}
 		}
 
 		/* no point in trying to open empty file */
 		if (file->write_size == 0)
+		{
+			progress_add_file(0, 0);
 			continue;
+		}
 
 		if (file->external_dir_num)
 		{
@@ -295,14 +330,17 @@ pgBackupValidateFiles(void *arg)
 		else
 			join_path_components(file_fullpath, arguments->base_path, file->rel_path);
 
-		/* TODO: it is redundant to check file existence using stat */
-		if (stat(file_fullpath, &st) == -1)
+		/* the file is opened anyway, so check its existence and size at once */
+		in = fopen(file_fullpath, PG_BINARY_R);
+		if (in == NULL || fstat(fileno(in), &st) == -1)
 		{
 			if (errno == ENOENT)
 				elog(WARNING, "Backup file \"%s\" is not found", file_fullpath);
 			else
 				elog(WARNING, "Cannot stat backup file \"%s\": %s",
 					file_fullpath, strerror(errno));
+			if (in)
+				fclose(in);
 			arguments->corrupted = true;
 			break;
 		}
@@ -311,6 +349,7 @@ pgBackupValidateFiles(void *arg)
 		{
 			elog(WARNING, "Invalid size of backup file \"%s\" : " INT64_FORMAT ". Expected %lu",
 				 file_fullpath, (unsigned long) st.st_size, file->write_size);
+			fclose(in);
 			arguments->corrupted = true;
 			break;
 		}
@@ -323,6 +362,9 @@ pgBackupValidateFiles(void *arg)
 		 */
 		if (!file->is_datafile || skip_block_validation || file->is_cfs)
 		{
+			/* file is read directly into large buffer */
+			setvbuf(in, NULL, _IONBF, 0);
+
 			/*
 			 * Pre 2.0.22 we use CRC-32C, but in newer version of pg_probackup we
 			 * use CRC-32.
@@ -341,15 +383,15 @@ pgBackupValidateFiles(void *arg)
 				!file->external_dir_num)
 				crc = get_pgcontrol_checksum(arguments->base_path);
 			else
-				crc = pgFileGetCRC(file_fullpath,
-								   arguments->backup_version <= 20021 ||
-								   arguments->backup_version >= 20025,
-								   false);
+				crc = validate_file_crc(in, file_fullpath,
+										arguments->backup_version <= 20021 ||
+										arguments->backup_version >= 20025,
+										buf);
 			if (crc != file->crc)
 			{
 				elog(WARNING, "Invalid CRC of backup file \"%s\" : %X. Expected %X",
 						file_fullpath, crc, file->crc);
-				arguments->corrupted = true;
+				file_valid = false;
 			}
 		}
 		else
@@ -359,20 +401,198 @@ pgBackupValidateFiles(void *arg)
 			 * check page headers, checksums (if enabled)
 			 * and compute checksum of the file
 			 */
-			if (!validate_file_pages(file, file_fullpath, arguments->stop_lsn,
+			setvbuf(in, buf, _IOFBF, LARGE_CHUNK_SIZE);
+			if (!validate_file_pages(file, in, file_fullpath, arguments->stop_lsn,
 								  arguments->checksum_version,
 								  arguments->backup_version,
 								  arguments->hdr_map))
-				arguments->corrupted = true;
+				file_valid = false;
+		}
+
+		fclose(in);
+
+		if (!file_valid)
+			arguments->corrupted = true;
+		else if (arguments->journal)
+		{
+			/* remember the file, so that interrupted validation can be resumed */
+			pthread_lock(arguments->journal_lock);
+			fprintf(arguments->journal, "%d %s\n", file->external_dir_num, file->rel_path);
+			fflush(arguments->journal);
+			pthread_mutex_unlock(arguments->journal_lock);
 		}
+
+		progress_add_file(file->write_size, 0);
 	}
 
+	pg_free(buf);
+
 	/* Data files validation is successful */
 	arguments->ret = 0;
 
 	return NULL;
 }
 
+/*
+ * Compute CRC of the whole file, reading it in large chunks and asking the
+ * kernel to read the next chunk while the current one is processed.
+ */
+static pg_crc32
+validate_file_crc(FILE *in, const char *path, bool use_crc32c, char *buf)
+{
+	pg_crc32	crc;
+	off_t		pos = 0;
+	size_t		len;
+
+	INIT_FILE_CRC32(use_crc32c, crc);
+
+	for (;;)
+	{
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "interrupted during CRC calculation");
+
+		prefetch_file_range(fileno(in), pos + LARGE_CHUNK_SIZE, LARGE_CHUNK_SIZE);
+
+		len = fread(buf, 1, LARGE_CHUNK_SIZE, in);
+		if (ferror(in))
+			elog(ERROR, "Cannot read \"%s\": %s", path, strerror(errno));
+
+		COMP_FILE_CRC32(use_crc32c, crc, buf, len);
+		pos += len;
+
+		if (len < LARGE_CHUNK_SIZE)
+			break;
+	}
+
+	FIN_FILE_CRC32(use_crc32c, crc);
+
+	return crc;
+}
+
+/*
+ * Open the journal of validated files of the backup.
+ *
+ * Validation only takes a shared lock on the backup, so every process
+ * appends files it has successfully validated to its own journal file
+ * in the backup directory, named after its pid. If validation is
+ * interrupted, the next one skips files listed in the journals of all
+ * previous runs, provided that the file list of the backup has not
+ * changed since then. Journals are removed when validation of the backup
+ * is complete.
+ * Return NULL if the journal cannot be written, e.g. the catalog is
+ * read-only, validation then silently goes on without it.
+ */
+static FILE *
+validate_journal_open(pgBackup *backup, parray *files)
+{
+	char		path[MAXPGPATH];
+	char		header[64];
+	char		line[MAXPGPATH + 32];
+	FILE	   *fp;
+	DIR		   *dir;
+	struct dirent *dent;
+	parray	   *done = parray_new();
+	int			n_done = 0;
+	int			i;
+
+	snprintf(header, lengthof(header), "backup %s content-crc %u\n",
+			 base36enc(backup->start_time), backup->content_crc);
+
+	/* load journals left by interrupted validations */
+	dir = opendir(backup->root_dir);
+	while (dir && (dent = readdir(dir)) != NULL)
+	{
+		if (strncmp(dent->d_name, VALIDATE_JOURNAL_FILE,
+					strlen(VALIDATE_JOURNAL_FILE)) != 0)
+			continue;
+
+		join_path_components(path, backup->root_dir, dent->d_name);
+		fp = fopen(path, PG_BINARY_R);
+		if (fp == NULL)
+			continue;
+
+		if (fgets(line, lengthof(line), fp) && strcmp(line, header) == 0)
+		{
+			while (fgets(line, lengthof(line), fp))
+			{
+				/* skip incomplete line written at the moment of interruption */
+				if (line[strlen(line) - 1] != '\n')
+					break;
+				line[strlen(line) - 1] = '\0';
+				parray_append(done, pgut_strdup(line));
+			}
+		}
+		fclose(fp);
+	}
+	if (dir)
+		closedir(dir);
+
+	if (parray_num(done) > 0)
+	{
+		parray_qsort(done, pgCompareString);
+
+		for (i = 0; i < parray_num(files); i++)
+		{
+			pgFile	   *file = (pgFile *) parray_get(files, i);
+
+			snprintf(line, lengthof(line), "%d %s", file->external_dir_num, file->rel_path);
+			if (parray_bsearch(done, line, pgCompareString) == NULL)
+				continue;
+
+			/* make threads skip the file */
+			pg_atomic_test_set_flag(&file->lock);
+			progress_add_file(file->write_size, 0);
+			n_done++;
+		}
+
+		if (n_done > 0)
+			elog(INFO, "Resuming interrupted validation of backup %s, %d files are already validated",
+				 base36enc(backup->start_time), n_done);
+	}
+
+	parray_walk(done, pfree);
+	parray_free(done);
+
+	snprintf(path, lengthof(path), "%s/%s.%d", backup->root_dir,
+			 VALIDATE_JOURNAL_FILE, (int) getpid());
+	fp = fopen(path, PG_BINARY_W);
+	if (fp == NULL)
+		return NULL;
+
+	fputs(header, fp);
+	fflush(fp);
+
+	return fp;
+}
+
+/*
+ * Remove journals of all validations of the backup.
+ */
+static void
+validate_journal_remove(pgBackup *backup)
+{
+	char		path[MAXPGPATH];
+	DIR		   *dir;
+	struct dirent *dent;
+
+	dir = opendir(backup->root_dir);
+	if (dir == NULL)
+		return;
+
+	while ((dent = readdir(dir)) != NULL)
+	{
+		if (strncmp(dent->d_name, VALIDATE_JOURNAL_FILE,
+					strlen(VALIDATE_JOURNAL_FILE)) != 0)
+			continue;
+
+		join_path_components(path, backup->root_dir, dent->d_name);
+		if (unlink(path) != 0 && errno != ENOENT)
+			elog(WARNING, "Cannot remove file \"%s\": %s", path, strerror(errno));
+	}
+
+	closedir(dir);
+}
+
 /*
  * Validate all backups in the backup catalog.
  * If --instance option was provided, validate only backups of this instance.
@@ -463,6 +683,8 @@ do_validate_all(CatalogState *catalogState, InstanceState *instanceState)
 		return 1;
 	}
 
+	progress_finish();
+
 	if (!skipped_due_to_lock && !corrupted_backup_found)
 		elog(INFO, "All backups are valid");
 
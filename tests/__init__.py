@@ -7,7 +7,7 @@ from . import init, merge, option, show, compatibility, \
     compression, page, ptrack, archive, exclude, cfs_backup, cfs_restore, \
     cfs_validate_backup, auth_test, time_stamp, logging, \
     locking, remote, external, config, checkdb, set_backup, incr_restore, \
-    catchup, CVE_2018_1058, time_consuming
+    catchup, export, CVE_2018_1058, time_consuming
 
 
 def load_tests(loader, tests, pattern):
@@ -42,6 +42,7 @@ def load_tests(loader, tests, pattern):
     suite.addTests(loader.loadTestsFromModule(delete))
     suite.addTests(loader.loadTestsFromModule(delta))
     suite.addTests(loader.loadTestsFromModule(exclude))
+    suite.addTests(loader.loadTestsFromModule(export))
     suite.addTests(loader.loadTestsFromModule(external))
     suite.addTests(loader.loadTestsFromModule(false_positive))
     suite.addTests(loader.loadTestsFromModule(init))
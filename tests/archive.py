@@ -2791,6 +2791,68 @@ class ArchiveTest(ProbackupTest, unittest.TestCase):
 
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_index_wal(self):
+        """
+        index-wal summarizes archived WAL segments, so validation
+        to a recovery target doesn't read them
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        backup_id = self.backup_node(backup_dir, 'node', node)
+
+        for i in range(3):
+            node.pgbench_init(scale=1)
+            self.switch_wal_segment(node)
+
+        output = self.run_pb([
+            'index-wal', '-B', backup_dir, '--instance=node', '-j', '2'])
+
+        self.assertIn('WAL segments are summarized', output)
+        self.assertTrue(
+            os.path.exists(os.path.join(
+                backup_dir, 'wal', 'node', '00000001.walsummary')))
+
+        # summaries are not made again
+        output = self.run_pb([
+            'index-wal', '-B', backup_dir, '--instance=node'])
+
+        self.assertIn('0 WAL segments are summarized', output)
+
+        # summary file doesn't confuse archive listing
+        self.assertNotIn(
+            'unexpected WAL file name',
+            self.run_pb(['show', '-B', backup_dir, '--instance=node', '--archive']))
+
+        target_time = datetime.now().replace(microsecond=0) + timedelta(days=2)
+
+        try:
+            self.validate_pb(
+                backup_dir, 'node', backup_id,
+                options=['--recovery-target-time={0}'.format(target_time)])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of validation to unreal time.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: Not enough WAL records to time', e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+            self.assertIn('WAL segments are not read again', e.message)
+
+        self.del_test_dir(module_name, fname)
+
 # TODO test with multiple not archived segments.
 # TODO corrupted file in archive.
 
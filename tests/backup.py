@@ -1,8 +1,10 @@
 import unittest
 import os
 from time import sleep
+import time
 from .helpers.ptrack_helpers import ProbackupTest, ProbackupException
 import shutil
+import json
 from distutils.dir_util import copy_tree
 from testgres import ProcessType, QueryException
 import subprocess
@@ -3400,3 +3402,210 @@ class BackupTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_dedup(self):
+        """
+        FULL backup with --dedup shares unchanged files with previous FULL backup
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as select i as id, '
+            'md5(i::text) as text from generate_series(0,1000) i')
+
+        relation_path = node.safe_psql(
+            'postgres',
+            "select pg_relation_filepath('pgbench_accounts')").decode('utf-8').rstrip()
+
+        full_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        node.safe_psql(
+            'postgres',
+            'insert into t_heap select i as id, '
+            'md5(i::text) as text from generate_series(0,1000) i')
+
+        dedup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--dedup'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        full_file = os.path.join(
+            backup_dir, 'backups', 'node', full_id, 'database', relation_path)
+        dedup_file = os.path.join(
+            backup_dir, 'backups', 'node', dedup_id, 'database', relation_path)
+
+        self.assertEqual(
+            os.stat(full_file).st_ino, os.stat(dedup_file).st_ino)
+
+        # deleting of original backup must not affect deduplicated one
+        self.delete_pb(backup_dir, 'node', backup_id=full_id)
+
+        self.validate_pb(backup_dir, 'node')
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_status_file(self):
+        """
+        Status file reports progress of backup and restore
+        and is marked as done when command completes
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        status_file = os.path.join(
+            self.tmp_path, module_name, fname, 'status.json')
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '-j2', '--compress',
+                '--status-file={0}'.format(status_file)])
+
+        with open(status_file) as f:
+            status = json.load(f)
+
+        self.assertEqual(status['command'], 'backup')
+        self.assertEqual(status['status'], 'done')
+        self.assertEqual(status['files-done'], status['files-total'])
+        self.assertGreater(status['files-total'], 0)
+        self.assertGreater(status['bytes-read'], 0)
+
+        node.cleanup()
+        self.restore_node(
+            backup_dir, 'node', node,
+            options=['-j2', '--status-file={0}'.format(status_file)])
+
+        with open(status_file) as f:
+            status = json.load(f)
+
+        self.assertEqual(status['command'], 'restore')
+        self.assertEqual(status['status'], 'done')
+        self.assertGreater(status['bytes-written'], 0)
+        self.assertFalse(os.path.exists(status_file + '.tmp'))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_timing(self):
+        """
+        Timings of hot paths are saved into backup metadata
+        and reported at exit if --timing is specified
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        self.assertNotIn(
+            'timing', self.show_pb(backup_dir, 'node', backup_id))
+
+        output = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j2', '--compress', '--timing'],
+            return_id=False)
+
+        self.assertIn('INFO: Timing of read-pages', output)
+
+        backup_id = self.show_pb(backup_dir, 'node')[-1]['id']
+        timing = self.show_pb(backup_dir, 'node', backup_id)['timing']
+
+        for event in ['list-files', 'read-pages', 'compress', 'write']:
+            self.assertIn(event, timing)
+            self.assertGreater(timing[event]['calls'], 0)
+
+        self.assertLessEqual(
+            timing['read-pages']['max-thread-seconds'],
+            timing['read-pages']['seconds'])
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_throttle_file(self):
+        """
+        Read rate limit from throttle file slows down backup
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        throttle_file = os.path.join(
+            self.tmp_path, module_name, fname, 'throttle.conf')
+
+        with open(throttle_file, 'w') as f:
+            f.write('# limits for business hours\n')
+            f.write("max-read-rate = '4MB'\n")
+
+        pgdata_size = int(node.safe_psql(
+            'postgres',
+            'select pg_database_size(\'postgres\')').decode('utf-8').rstrip())
+
+        start = time.time()
+        output = self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '-j4',
+                '--throttle-file={0}'.format(throttle_file)],
+            return_id=False)
+        elapsed = time.time() - start
+
+        self.assertIn('max-read-rate is changed from 0 to 4194304', output)
+        self.assertGreaterEqual(elapsed, pgdata_size / (4 * 1024 * 1024) * 0.8)
+
+        self.validate_pb(backup_dir, 'node')
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
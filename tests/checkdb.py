@@ -353,6 +353,54 @@ class CheckdbTest(ProbackupTest, unittest.TestCase):
         node.stop()
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_checkdb_amcheck_parallel_databases(self):
+        """
+        Indexes of several databases are checked by one pool of threads,
+        results are reported per database
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir="{0}/{1}/node".format(module_name, fname),
+            initdb_params=['--data-checksums'])
+
+        node.slow_start()
+
+        for dbname in ['postgres', 'db1', 'db2']:
+            if dbname != 'postgres':
+                node.safe_psql("postgres", "create database " + dbname)
+            try:
+                node.safe_psql(dbname, "create extension amcheck")
+            except QueryException as e:
+                node.safe_psql(dbname, "create extension amcheck_next")
+
+        node.pgbench_init(scale=2, dbname='db1')
+        node.pgbench_init(scale=1, dbname='db2')
+
+        output = self.checkdb_node(
+            options=[
+                '--amcheck',
+                '--skip-block-validation', '-j', '4',
+                '-d', 'postgres', '-p', str(node.port)])
+
+        for dbname in ['postgres', 'db1', 'db2']:
+            self.assertIn(
+                "INFO: Amcheck succeeded for database '{0}'".format(dbname),
+                output)
+
+        self.assertIn(
+            "INFO: Slowest index 1:", output)
+        self.assertIn(
+            'INFO: checkdb --amcheck finished successfully',
+            output)
+        self.assertIn(
+            'All databases were amchecked',
+            output)
+
+        # Clean after yourself
+        node.stop()
+        self.del_test_dir(module_name, fname)
+
     # @unittest.skip("skip")
     def test_checkdb_block_validation_sanity(self):
         """make node, corrupt some pages, check that checkdb failed"""
@@ -450,6 +498,77 @@ class CheckdbTest(ProbackupTest, unittest.TestCase):
         node.stop()
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_checkdb_shard(self):
+        """
+        corrupt a page, check that exactly one of two shards
+        detects corruption
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        node.slow_start()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i as id, md5(i::text) as text "
+            "from generate_series(0,10000) i")
+        node.safe_psql(
+            "postgres",
+            "CHECKPOINT;")
+
+        heap_path = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").decode('utf-8').rstrip()
+        heap_full_path = os.path.join(node.data_dir, heap_path)
+
+        try:
+            self.checkdb_node(
+                data_dir=node.data_dir,
+                options=['--shard=3/2', '-d', 'postgres', '-p', str(node.port)])
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of invalid shard\n"
+                " Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: Invalid value of --shard option "3/2"',
+                e.message,
+                "\n Unexpected Error Message: {0}\n CMD: {1}".format(
+                    repr(e.message), self.cmd))
+
+        with open(heap_full_path, "rb+", 0) as f:
+                f.seek(42000)
+                f.write(b"bla")
+                f.flush()
+                f.close
+
+        n_failed = 0
+        for shard in ['1/2', '2/2']:
+            try:
+                output = self.checkdb_node(
+                    data_dir=node.data_dir,
+                    options=[
+                        '-j', '2', '--shard={0}'.format(shard),
+                        '-d', 'postgres', '-p', str(node.port)])
+                self.assertIn('INFO: Data files are valid', output)
+            except ProbackupException as e:
+                self.assertIn(
+                    'WARNING: Corruption detected in file "{0}", block 5'.format(
+                        os.path.normpath(heap_full_path)),
+                    e.message)
+                n_failed += 1
+
+        self.assertEqual(n_failed, 1)
+
+        # Clean after yourself
+        node.stop()
+        self.del_test_dir(module_name, fname)
+
     def test_checkdb_checkunique(self):
         """Test checkunique parameter of amcheck.bt_index_check function"""
         fname = self.id().split('.')[3]
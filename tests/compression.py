@@ -520,3 +520,130 @@ class CompressionTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_streamed_wal_zlib(self):
+        """
+        make stream backup with zlib compression, check that streamed
+        WAL segments are compressed, validate and restore backup
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        # generate a few WAL segments while backup is running
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--compress-algorithm=zlib'])
+
+        pgbench.wait()
+        pgbench.stdout.close()
+
+        wal_dir = os.path.join(
+            backup_dir, 'backups', 'node', backup_id, 'database', 'pg_wal')
+
+        wal_files = [f for f in os.listdir(wal_dir) if len(f) >= 24]
+        self.assertTrue(wal_files)
+        for wal_file in wal_files:
+            if wal_file.endswith('.history'):
+                continue
+            self.assertTrue(
+                wal_file.endswith('.gz'),
+                'Streamed WAL segment is not compressed: {0}'.format(wal_file))
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
+        node.cleanup()
+
+        # restore without --no-sync, decompressed segments must be synced
+        self.run_pb([
+            'restore', '-B', backup_dir, '-D', node.data_dir,
+            '--instance=node', '-j', '4'])
+
+        restored_wal = os.listdir(os.path.join(node.data_dir, 'pg_wal'))
+        self.assertFalse(
+            [f for f in restored_wal if f.endswith('.gz')],
+            'Restored WAL segments must be decompressed')
+
+        node.slow_start()
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_compression_adaptive(self):
+        """
+        Backup with adaptive compression records zlib level of every
+        data file and is restored correctly
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        # incompressible data
+        node.safe_psql(
+            "postgres",
+            "create table t_random as select i as id, "
+            "decode(md5(random()::text) || md5(random()::text), 'hex') as data "
+            "from generate_series(0,100000) i")
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=[
+                '--stream', '-j2', '--compress-algorithm=zlib',
+                '--compress-level=3', '--compress-adaptive'])
+
+        filelist = self.get_backup_filelist(backup_dir, 'node', backup_id)
+        levels = [
+            int(f['compress_level']) for f in filelist.values()
+            if f['is_datafile'] == '1' and 'compress_level' in f]
+
+        self.assertTrue(levels)
+        for level in levels:
+            self.assertTrue(1 <= level <= 9)
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node, options=['-j', '4'])
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # adaptive mode works with zlib only
+        try:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=['--stream', '--compress-adaptive'])
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of missing zlib compression.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: Option --compress-adaptive requires zlib compression',
+                e.message)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -0,0 +1,343 @@
+import os
+import struct
+import subprocess
+import unittest
+from .helpers.ptrack_helpers import ProbackupTest, ProbackupException
+
+
+module_name = 'export'
+
+STREAM_MAGIC = b'PGPBSTRM'
+
+
+class ExportTest(ProbackupTest, unittest.TestCase):
+
+    def export_backup(self, backup_dir, instance, backup_id, path, options=[]):
+        """Write exported backup stream into file"""
+        cmd = [
+            self.probackup_path, 'export',
+            '-B', backup_dir,
+            '--instance={0}'.format(instance),
+            '-i', backup_id] + options
+
+        with open(path, 'wb') as f:
+            proc = subprocess.Popen(
+                cmd, stdout=f, stderr=subprocess.PIPE, env=self.test_env)
+            _, stderr = proc.communicate()
+
+        if proc.returncode != 0:
+            raise ProbackupException(stderr.decode('utf-8'), ' '.join(cmd))
+
+        return stderr.decode('utf-8')
+
+    def restore_from_stream(self, path, pgdata, options=[]):
+        """Restore backup stream from file via stdin"""
+        cmd = [
+            self.probackup_path, 'restore',
+            '-D', pgdata, '--from-stdin'] + options
+
+        with open(path, 'rb') as f:
+            proc = subprocess.Popen(
+                cmd, stdin=f, stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT, env=self.test_env)
+            output, _ = proc.communicate()
+
+        if proc.returncode != 0:
+            raise ProbackupException(output.decode('utf-8'), ' '.join(cmd))
+
+        return output.decode('utf-8')
+
+    # @unittest.skip("skip")
+    def test_export_full_backup(self):
+        """Export FULL backup and check stream header and trailer"""
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=2)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--compress'])
+
+        stream_path = os.path.join(
+            self.tmp_path, module_name, fname, 'backup.stream')
+
+        output = self.export_backup(backup_dir, 'node', backup_id, stream_path)
+        self.assertIn(
+            'INFO: Backup {0} is exported'.format(backup_id), output)
+
+        with open(stream_path, 'rb') as f:
+            data = f.read()
+
+        self.assertEqual(data[:8], STREAM_MAGIC)
+        self.assertEqual(data[-8:], STREAM_MAGIC)
+
+        # trailer: n_entries, index_offset, crc, magic
+        n_entries, index_offset = struct.unpack_from(
+            '=QQ', data, len(data) - 32)
+
+        self.assertEqual(
+            len(self.get_backup_filelist(backup_dir, 'node', backup_id)) + 1,
+            n_entries)
+        self.assertEqual(index_offset + n_entries * 8, len(data) - 32)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_export_incremental_backup(self):
+        """Export of incremental backup is not allowed"""
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.backup_node(backup_dir, 'node', node, options=['--stream'])
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            backup_type='delta', options=['--stream'])
+
+        stream_path = os.path.join(
+            self.tmp_path, module_name, fname, 'backup.stream')
+
+        try:
+            self.export_backup(backup_dir, 'node', backup_id, stream_path)
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of export of incremental backup.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'ERROR: Backup {0} is not a full backup'.format(backup_id),
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_from_stream(self):
+        """Restore exported FULL backup from stdin without catalog"""
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '--compress'])
+
+        if self.paranoia:
+            pgdata = self.pgdata_content(node.data_dir)
+
+        result = node.safe_psql("postgres", "SELECT * FROM pgbench_accounts")
+
+        stream_path = os.path.join(
+            self.tmp_path, module_name, fname, 'backup.stream')
+        self.export_backup(backup_dir, 'node', backup_id, stream_path)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        output = self.restore_from_stream(
+            stream_path, node_restored.data_dir, options=['-j', '4'])
+        self.assertIn(
+            'INFO: Backup {0} restored from stream'.format(backup_id), output)
+
+        if self.paranoia:
+            pgdata_restored = self.pgdata_content(node_restored.data_dir)
+            self.compare_pgdata(pgdata, pgdata_restored)
+
+        self.set_auto_conf(node_restored, {'port': node_restored.port})
+        node_restored.slow_start()
+
+        self.assertEqual(
+            result,
+            node_restored.safe_psql(
+                "postgres", "SELECT * FROM pgbench_accounts"))
+
+        # truncated stream must be rejected
+        with open(stream_path, 'rb') as f:
+            data = f.read()
+        with open(stream_path, 'wb') as f:
+            f.write(data[:len(data) // 2])
+
+        node_restored.cleanup()
+        try:
+            self.restore_from_stream(stream_path, node_restored.data_dir)
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of truncated stream.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'unexpected end of stream',
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_from_stream_tablespace_mapping(self):
+        """
+        Restore exported backup with tablespace from stdin with -T,
+        tablespace_map must not be restored
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.create_tblspace_in_node(node, 'tblspace')
+        node.safe_psql(
+            "postgres",
+            "create table t_heap tablespace tblspace as select i "
+            "from generate_series(0,1000) i")
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        stream_path = os.path.join(
+            self.tmp_path, module_name, fname, 'backup.stream')
+        self.export_backup(backup_dir, 'node', backup_id, stream_path)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        tblspace_old = self.get_tblspace_path(node, 'tblspace')
+        tblspace_new = self.get_tblspace_path(node_restored, 'tblspace')
+
+        self.restore_from_stream(
+            stream_path, node_restored.data_dir,
+            options=['-T', '{0}={1}'.format(tblspace_old, tblspace_new)])
+
+        self.assertFalse(
+            os.path.exists(
+                os.path.join(node_restored.data_dir, 'tablespace_map')))
+
+        self.set_auto_conf(node_restored, {'port': node_restored.port})
+        node_restored.slow_start()
+
+        tblspace_oid = node_restored.safe_psql(
+            "postgres",
+            "select oid from pg_tablespace "
+            "where spcname = 'tblspace'").decode('utf-8').rstrip()
+        self.assertEqual(
+            os.path.realpath(os.path.join(
+                node_restored.data_dir, 'pg_tblspc', tblspace_oid)),
+            os.path.realpath(tblspace_new))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_backup_to_stdout(self):
+        """
+        Pipe FULL backup with tablespace from stdout of backup to stdin
+        of restore, backup must not be left in catalog
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        self.create_tblspace_in_node(node, 'tblspace')
+        node.pgbench_init(scale=5, options=['--tablespace=tblspace'])
+
+        result = node.safe_psql("postgres", "SELECT * FROM pgbench_accounts")
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        tblspace_old = self.get_tblspace_path(node, 'tblspace')
+        tblspace_new = self.get_tblspace_path(node_restored, 'tblspace')
+
+        backup_cmd = [
+            self.probackup_path, 'backup',
+            '-B', backup_dir, '--instance=node', '-b', 'full',
+            '-D', node.data_dir, '-d', 'postgres', '-p', str(node.port),
+            '--stream', '--compress', '-j', '4', '--to-stdout']
+        restore_cmd = [
+            self.probackup_path, 'restore',
+            '-D', node_restored.data_dir, '--from-stdin', '-j', '4',
+            '-T', '{0}={1}'.format(tblspace_old, tblspace_new)]
+
+        backup_proc = subprocess.Popen(
+            backup_cmd, stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE, env=self.test_env)
+        restore_proc = subprocess.Popen(
+            restore_cmd, stdin=backup_proc.stdout, stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT, env=self.test_env)
+        backup_proc.stdout.close()
+
+        restore_output, _ = restore_proc.communicate()
+        _, backup_output = backup_proc.communicate()
+
+        if backup_proc.returncode != 0:
+            raise ProbackupException(
+                backup_output.decode('utf-8'), ' '.join(backup_cmd))
+        if restore_proc.returncode != 0:
+            raise ProbackupException(
+                restore_output.decode('utf-8'), ' '.join(restore_cmd))
+
+        self.assertIn(
+            'is written to stdout', backup_output.decode('utf-8'))
+        self.assertIn(
+            'restored from stream', restore_output.decode('utf-8'))
+
+        # nothing is kept in catalog
+        self.assertEqual(self.show_pb(backup_dir, 'node'), [])
+
+        self.set_auto_conf(node_restored, {'port': node_restored.port})
+        node_restored.slow_start()
+
+        self.assertEqual(
+            result,
+            node_restored.safe_psql(
+                "postgres", "SELECT * FROM pgbench_accounts"))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
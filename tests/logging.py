@@ -369,3 +369,63 @@ class LogTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_log_file_parallel_threads(self):
+        """
+        Messages of parallel threads are written to the log file
+        in time order and ERROR is written after them
+        """
+        fname = self.id().split('.')[3]
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j4', '--log-level-file=verbose'])
+
+        log_file_path = os.path.join(
+            backup_dir, 'log', 'pg_probackup.log')
+
+        with open(log_file_path, "r") as f:
+            log_lines = f.read().splitlines()
+
+        timestamps = [line[:19] for line in log_lines]
+        self.assertEqual(timestamps, sorted(timestamps))
+
+        self.assertIn(
+            'INFO: Backup {0} completed'.format(backup_id),
+            '\n'.join(log_lines))
+
+        try:
+            self.backup_node(
+                backup_dir, 'node', node, backup_type='page',
+                options=['-j4', '--log-level-file=verbose'])
+            # we should die here because exception is what we expect to happen
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because of disabled archiving"
+                "\n Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            pass
+
+        with open(log_file_path, "r") as f:
+            log_lines = f.read().splitlines()
+
+        timestamps = [line[:19] for line in log_lines]
+        self.assertEqual(timestamps, sorted(timestamps))
+
+        self.assertIn('ERROR: ', '\n'.join(log_lines))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
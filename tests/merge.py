@@ -236,6 +236,70 @@ class MergeTest(ProbackupTest, unittest.TestCase):
         node.cleanup()
         self.del_test_dir(module_name, fname)
 
+    def test_merge_reflink(self):
+        """
+        Test MERGE command with --reflink option for uncompressed backups
+        """
+        fname = self.id().split(".")[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, "backup")
+
+        # Initialize instance and backup directory
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True, initdb_params=["--data-checksums"])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, "node", node)
+        self.set_archiving(backup_dir, "node", node)
+        node.slow_start()
+
+        # Fill with data
+        node.pgbench_init(scale=10)
+
+        # Do FULL backup
+        self.backup_node(backup_dir, "node", node, options=['--stream'])
+
+        # Change data
+        pgbench = node.pgbench(options=['-T', '10', '-c', '1', '--no-vacuum'])
+        pgbench.wait()
+
+        # Do DELTA backup
+        self.backup_node(
+            backup_dir, "node", node,
+            backup_type="delta", options=['--stream'])
+
+        # Change data
+        pgbench = node.pgbench(options=['-T', '10', '-c', '1', '--no-vacuum'])
+        pgbench.wait()
+
+        # Do PAGE backup
+        page_id = self.backup_node(
+            backup_dir, "node", node, backup_type="page")
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        # Merge all backups
+        self.merge_backup(
+            backup_dir, "node", page_id, options=['-j2', '--reflink'])
+        show_backups = self.show_pb(backup_dir, "node")
+
+        self.assertEqual(len(show_backups), 1)
+        self.assertEqual(show_backups[0]["status"], "OK")
+        self.assertEqual(show_backups[0]["backup-mode"], "FULL")
+
+        self.validate_pb(backup_dir, 'node')
+
+        # Drop node and restore it
+        node.cleanup()
+        self.restore_node(backup_dir, 'node', node)
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        node.cleanup()
+        self.del_test_dir(module_name, fname)
+
     def test_merge_compressed_and_uncompressed_backups(self):
         """
         Test MERGE command with compressed and uncompressed backups
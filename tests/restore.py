@@ -6,6 +6,7 @@ import sys
 from time import sleep
 from datetime import datetime, timedelta, timezone
 import hashlib
+import re
 import shutil
 import json
 from shutil import copyfile
@@ -3916,3 +3917,118 @@ class RestoreTest(ProbackupTest, unittest.TestCase):
 
         # Clean after yourself
         self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_chain_collapsed(self):
+        """
+        Restore of incremental chain reads every block from
+        the newest backup containing it only
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=5)
+
+        # FULL backup
+        self.backup_node(backup_dir, 'node', node, options=['--stream'])
+
+        # the same pages are changed by every incremental backup
+        for i in range(3):
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+            pgbench.wait()
+            self.backup_node(
+                backup_dir, 'node', node,
+                backup_type='delta', options=['--stream'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        output = self.restore_node(backup_dir, 'node', node_restored)
+
+        self.assertIn(
+            'superseded by newer backups are neither read nor written', output)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_restore_resume_from_journal(self):
+        """
+        Restore into directory with journal of interrupted restore
+        skips files restored before
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node_restored'))
+        node_restored.cleanup()
+
+        self.restore_node(backup_dir, 'node', node_restored)
+
+        # emulate interrupted restore: every other file is restored
+        # and recorded in the journal, the rest are missing
+        with open(os.path.join(
+                backup_dir, 'backups', 'node', backup_id,
+                'backup.control'), 'r') as f:
+            content_crc = re.search(
+                r'content-crc = (\d+)', f.read()).group(1)
+
+        filelist = self.get_backup_filelist(backup_dir, 'node', backup_id)
+        paths = sorted(filelist, key=lambda p: (
+            p.encode('utf-8'), filelist[p]['external_dir_num']))
+
+        journal = os.path.join(
+            node_restored.data_dir, 'pg_probackup_restore_journal.1.1')
+        with open(journal, 'w') as f:
+            f.write('restore {0} {1}\n'.format(backup_id, content_crc))
+            for idx, path in enumerate(paths):
+                fullpath = os.path.join(node_restored.data_dir, path)
+                if not os.path.isfile(fullpath):
+                    continue
+                if idx % 2:
+                    os.remove(fullpath)
+                    continue
+                f.write('{0} {1} {2}\n'.format(
+                    idx, filelist[path]['crc'], os.path.getsize(fullpath)))
+
+        output = self.restore_node(backup_dir, 'node', node_restored)
+
+        self.assertIn('Resuming interrupted restore', output)
+        self.assertFalse(os.path.exists(journal))
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
@@ -7,6 +7,7 @@ import subprocess
 from sys import exit
 import time
 import hashlib
+import re
 
 
 module_name = 'validate'
@@ -4237,6 +4238,134 @@ class ValidateTest(ProbackupTest, unittest.TestCase):
         # Clean after yourself
         self.del_test_dir(module_name, fname)
 
+    # @unittest.skip("skip")
+    def test_validate_resume_from_journal(self):
+        """
+        Validation skips files recorded in the journal
+        left by interrupted validation
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        node.pgbench_init(scale=1)
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        self.assertEqual(
+            'OK', self.show_pb(backup_dir, 'node', backup_id)['status'])
+
+        backup_path = os.path.join(backup_dir, 'backups', 'node', backup_id)
+
+        with open(os.path.join(backup_path, 'backup.control'), 'r') as f:
+            content_crc = re.search(
+                r'content-crc = (\d+)', f.read()).group(1)
+
+        file_path = node.safe_psql(
+            'postgres',
+            "select pg_relation_filepath('pgbench_accounts')").decode('utf-8').rstrip()
+
+        # pretend that all files were validated before interruption
+        filelist = self.get_backup_filelist(backup_dir, 'node', backup_id)
+        # journal of validation interrupted in a process with pid 1
+        with open(os.path.join(backup_path, 'validate_journal.1'), 'w') as f:
+            f.write('backup {0} content-crc {1}\n'.format(backup_id, content_crc))
+            for path in filelist:
+                f.write('{0} {1}\n'.format(
+                    filelist[path]['external_dir_num'], path))
+
+        # corrupt already validated file
+        with open(os.path.join(backup_path, 'database', file_path), 'r+b') as f:
+            f.seek(8192)
+            f.write(b'blahblahblah')
+            f.flush()
+
+        output = self.validate_pb(
+            backup_dir, 'node', backup_id, options=['--log-level-console=INFO'])
+
+        self.assertIn('Resuming interrupted validation', output)
+        self.assertFalse(
+            [f for f in os.listdir(backup_path)
+                if f.startswith('validate_journal')])
+
+        # without journal corruption is detected
+        try:
+            self.validate_pb(backup_dir, 'node', backup_id)
+            self.assertEqual(
+                1, 0,
+                "Expecting Error because backup is corrupted.\n "
+                "Output: {0} \n CMD: {1}".format(
+                    repr(self.output), self.cmd))
+        except ProbackupException as e:
+            self.assertIn(
+                'Backup {0} data files are corrupted'.format(backup_id),
+                e.message,
+                '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                    repr(e.message), self.cmd))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
+    # @unittest.skip("skip")
+    def test_validate_wal_summary(self):
+        """
+        Validation to a recovery target doesn't read again
+        WAL segments validated earlier
+        """
+        fname = self.id().split('.')[3]
+        backup_dir = os.path.join(self.tmp_path, module_name, fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(module_name, fname, 'node'),
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        self.set_archiving(backup_dir, 'node', node)
+        node.slow_start()
+
+        backup_id = self.backup_node(backup_dir, 'node', node)
+
+        for i in range(3):
+            node.pgbench_init(scale=1)
+            self.switch_wal_segment(node)
+
+        target_time = datetime.now().replace(microsecond=0) + timedelta(days=2)
+
+        for i in range(2):
+            try:
+                self.validate_pb(
+                    backup_dir, 'node', backup_id,
+                    options=[
+                        '--recovery-target-time={0}'.format(target_time),
+                        '--log-level-console=INFO', '-j', '4'])
+                self.assertEqual(
+                    1, 0,
+                    "Expecting Error because of validation to unreal time.\n "
+                    "Output: {0} \n CMD: {1}".format(
+                        repr(self.output), self.cmd))
+            except ProbackupException as e:
+                self.assertIn(
+                    'ERROR: Not enough WAL records to time', e.message,
+                    '\n Unexpected Error Message: {0}\n CMD: {1}'.format(
+                        repr(e.message), self.cmd))
+                output = e.message
+
+        self.assertIn('WAL segments are not read again', output)
+        self.assertTrue(
+            os.path.exists(os.path.join(
+                backup_dir, 'wal', 'node', '00000001.walsummary')))
+
+        # Clean after yourself
+        self.del_test_dir(module_name, fname)
+
 # validate empty backup list
 # page from future during validate
 # page from future during backup